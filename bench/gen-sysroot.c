@@ -0,0 +1,551 @@
+// Generates a reproducible synthetic sysroot to benchmark on: mostly
+// LoongArch ELF64 libraries and programs, varying in .dynsym size, version
+// definitions and requirements, and .text size, with syscall sites like in
+// real code; mixed with files to be skipped, i.e. non-ELF, ELF32, big-endian
+// and other architectures' ones.
+//
+// usage: gen-sysroot <dir> [nr_files [seed]]
+//
+// What's generated is summed up on stdout as "key value" lines.
+#include <endian.h>
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <sys/stat.h>
+
+#include <elf.h>
+
+#include "elfcompat.h"
+#include "utils.h"
+
+#define DEFAULT_NR_FILES 2000
+#define DEFAULT_SEED 0x5eed
+
+// files are spread over directories of this many
+#define FILES_PER_DIR 100
+
+static uint64_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+// true with a chance of pct percent
+static bool chance(unsigned int pct)
+{
+    return rng() % 100 < pct;
+}
+
+// log-uniformly distributed in [2^lo, 2^hi), like sizes of real files
+static size_t log_uniform(unsigned int lo, unsigned int hi)
+{
+    unsigned int shift = lo + rng() % (hi - lo);
+    return ((size_t)1 << shift) + rng() % ((size_t)1 << shift);
+}
+
+static struct {
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t loongarch;
+    uint64_t skipped;
+    uint64_t syscall_sites;
+    uint64_t removed_syscall_sites;
+    uint64_t to_patch;
+} summary;
+
+/////////////////////////////////////////////////////////////////////////////
+
+struct buf {
+    uint8_t *p;
+    size_t len;
+    size_t cap;
+};
+
+// appends len zero bytes after padding to align, returning where they are
+static size_t buf_grow(struct buf *b, size_t len, size_t align)
+{
+    size_t off = (b->len + align - 1) & ~(align - 1);
+    size_t need = off + len;
+    if (need > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < need) {
+            cap *= 2;
+        }
+        uint8_t *p = realloc(b->p, cap);
+        if (!p) {
+            err(EX_OSERR, "cannot allocate file buffer");
+        }
+        b->p = p;
+        b->cap = cap;
+    }
+
+    memset(b->p + b->len, 0, need - b->len);
+    b->len = need;
+    return off;
+}
+
+static void put16(struct buf *b, size_t off, uint16_t v)
+{
+    v = htole16(v);
+    memcpy(b->p + off, &v, sizeof(v));
+}
+
+static void put32(struct buf *b, size_t off, uint32_t v)
+{
+    v = htole32(v);
+    memcpy(b->p + off, &v, sizeof(v));
+}
+
+static void put64(struct buf *b, size_t off, uint64_t v)
+{
+    v = htole64(v);
+    memcpy(b->p + off, &v, sizeof(v));
+}
+
+static uint32_t str_add(struct buf *strtab, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    size_t off = buf_grow(strtab, len, 1);
+    memcpy(strtab->p + off, s, len);
+    return (uint32_t)off;
+}
+
+static void put_ehdr(struct buf *b, unsigned char data, Elf64_Half machine, Elf64_Word flags)
+{
+    size_t off = buf_grow(b, sizeof(Elf64_Ehdr), 1);
+    memcpy(b->p + off, ELFMAG, SELFMAG);
+    b->p[off + EI_CLASS] = ELFCLASS64;
+    b->p[off + EI_DATA] = data;
+    b->p[off + EI_VERSION] = EV_CURRENT;
+
+    // only little-endian ones are written out in full
+    Elf64_Half type = ET_DYN;
+    Elf64_Word version = EV_CURRENT;
+    if (data == ELFDATA2LSB) {
+        type = htole16(type);
+        machine = htole16(machine);
+        version = htole32(version);
+        flags = htole32(flags);
+    } else {
+        type = htobe16(type);
+        machine = htobe16(machine);
+        version = htobe32(version);
+        flags = htobe32(flags);
+    }
+
+    memcpy(b->p + off + offsetof(Elf64_Ehdr, e_type), &type, sizeof(type));
+    memcpy(b->p + off + offsetof(Elf64_Ehdr, e_machine), &machine, sizeof(machine));
+    memcpy(b->p + off + offsetof(Elf64_Ehdr, e_version), &version, sizeof(version));
+    memcpy(b->p + off + offsetof(Elf64_Ehdr, e_flags), &flags, sizeof(flags));
+    if (data == ELFDATA2LSB) {
+        put16(b, offsetof(Elf64_Ehdr, e_ehsize), sizeof(Elf64_Ehdr));
+    }
+}
+
+static void put_garbage(struct buf *b, size_t len)
+{
+    size_t off = buf_grow(b, len, 1);
+    size_t i;
+    for (i = 0; i < len; i++) {
+        b->p[off + i] = (uint8_t)rng();
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// versions referred to, the first one of which is to be migrated from
+static const char *const glibc_versions[] = {
+    "GLIBC_2.35",
+    "GLIBC_2.36",
+    "GLIBC_2.27",
+};
+
+#define SYSCALL_INSN 0x002b0000
+#define A7 11
+
+static uint32_t addi_d_a7(uint32_t imm)
+{
+    return 0x02c00000 | ((imm & 0xfff) << 10) | A7;
+}
+
+// a few common encodings with random operands, never writing to $a7, so the
+// syscall sites are left alone; calls and jumps only if asked for, as
+// nothing in $a7 survives them
+static uint32_t filler_insn(bool jumps)
+{
+    static const uint32_t ops[][2] = {
+        // opcode, operand bits
+        { 0x00108000, 0x00007fff },  // add.d
+        { 0x00150000, 0x00007fff },  // or
+        { 0x02c00000, 0x003fffff },  // addi.d
+        { 0x28c00000, 0x003fffff },  // ld.d
+        { 0x29c00000, 0x003fffff },  // st.d
+        { 0x4c000000, 0x03ffffff },  // jirl
+        { 0x54000000, 0x03ffffff },  // bl
+    };
+
+    size_t nr_ops = sizeof(ops) / sizeof(ops[0]) - (jumps ? 0 : 2);
+    const uint32_t *op = ops[rng() % nr_ops];
+    uint32_t insn = op[0] | (rng() & op[1]);
+    if ((insn & 0x1f) == A7) {
+        insn ^= 1;
+    }
+    return insn;
+}
+
+static uint32_t syscall_nr(void)
+{
+    // read, write, openat, close, mmap, exit_group, and the removed ones
+    static const uint32_t common[] = { 63, 64, 56, 57, 222, 94 };
+    static const uint32_t removed[] = { 79, 80, 163, 164 };
+
+    if (chance(5)) {
+        summary.removed_syscall_sites++;
+        return removed[rng() % (sizeof(removed) / sizeof(removed[0]))];
+    }
+    return common[rng() % (sizeof(common) / sizeof(common[0]))];
+}
+
+static void gen_text(struct buf *b, size_t off, size_t nr_insns)
+{
+    size_t i = 0;
+    while (i < nr_insns) {
+        // a syscall site every 2048 insns on average: the number loaded
+        // into $a7, a few unrelated insns, then the syscall
+        if (nr_insns - i >= 8 && rng() % 2048 == 0) {
+            put32(b, off + i * 4, addi_d_a7(syscall_nr()));
+            i++;
+            unsigned int gap = rng() % 6;
+            while (gap--) {
+                put32(b, off + i * 4, filler_insn(false));
+                i++;
+            }
+            put32(b, off + i * 4, SYSCALL_INSN);
+            i++;
+            summary.syscall_sites++;
+            continue;
+        }
+
+        put32(b, off + i * 4, filler_insn(true));
+        i++;
+    }
+}
+
+enum scn_idx {
+    SCN_NULL,
+    SCN_DYNSTR,
+    SCN_DYNSYM,
+    SCN_VERDEF,
+    SCN_VERNEED,
+    SCN_TEXT,
+    SCN_SHSTRTAB,
+    NR_SCNS,
+};
+
+struct scn {
+    const char *name;
+    Elf64_Word type;
+    Elf64_Xword flags;
+    size_t off;
+    size_t size;
+    Elf64_Word link;
+    Elf64_Word info;
+    Elf64_Xword align;
+    Elf64_Xword entsize;
+};
+
+static void gen_loongarch(struct buf *b, unsigned int idx)
+{
+    struct scn scns[NR_SCNS] = {
+        [SCN_DYNSTR] = { ".dynstr", SHT_STRTAB, SHF_ALLOC, 0, 0, 0, 0, 1, 0 },
+        [SCN_DYNSYM] = { ".dynsym", SHT_DYNSYM, SHF_ALLOC, 0, 0, SCN_DYNSTR, 1, 8, sizeof(Elf64_Sym) },
+        [SCN_VERDEF] = { ".gnu.version_d", SHT_GNU_verdef, SHF_ALLOC, 0, 0, SCN_DYNSTR, 0, 8, 0 },
+        [SCN_VERNEED] = { ".gnu.version_r", SHT_GNU_verneed, SHF_ALLOC, 0, 0, SCN_DYNSTR, 0, 8, 0 },
+        [SCN_TEXT] = { ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0, 0, 0, 0, 16, 0 },
+        [SCN_SHSTRTAB] = { ".shstrtab", SHT_STRTAB, 0, 0, 0, 0, 0, 1, 0 },
+    };
+
+    // mostly objabi v1, some v0
+    Elf64_Word flags = chance(10) ? 0x03 : EF_LARCH_OBJABI_V1 | 0x03;
+    put_ehdr(b, ELFDATA2LSB, EM_LOONGARCH, flags);
+
+    // libraries define versions, and everything requires some
+    size_t nr_verdefs = chance(20) ? 1 + rng() % 8 : 0;
+    size_t nr_verneeds = rng() % 4;
+    size_t nr_syms = log_uniform(2, 12);
+    size_t nr_insns = chance(1) ? log_uniform(20, 21) : log_uniform(6, 17);
+
+    struct buf dynstr = { 0 };
+    (void) str_add(&dynstr, "");
+
+    // .dynsym, with an absolute STT_OBJECT symbol for each version defined,
+    // like glibc has
+    scns[SCN_DYNSYM].size = (1 + nr_syms + nr_verdefs) * sizeof(Elf64_Sym);
+    scns[SCN_DYNSYM].off = buf_grow(b, scns[SCN_DYNSYM].size, 8);
+    uint32_t verdef_names[8];
+    // whether any version is the one to migrate from
+    bool old = false;
+    size_t i;
+    for (i = 0; i < nr_verdefs; i++) {
+        char name[32];
+        if (i < sizeof(glibc_versions) / sizeof(glibc_versions[0]) && chance(50)) {
+            snprintf(name, sizeof(name), "%s", glibc_versions[i]);
+            old = old || i == 0;
+        } else {
+            snprintf(name, sizeof(name), "GEN_%u.%zu", idx, i);
+        }
+        verdef_names[i] = str_add(&dynstr, name);
+
+        size_t sym = scns[SCN_DYNSYM].off + (1 + i) * sizeof(Elf64_Sym);
+        put32(b, sym + offsetof(Elf64_Sym, st_name), verdef_names[i]);
+        b->p[sym + offsetof(Elf64_Sym, st_info)] = ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT);
+        put16(b, sym + offsetof(Elf64_Sym, st_shndx), SHN_ABS);
+    }
+    for (i = 0; i < nr_syms; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "gen_%u_%zu", idx, i);
+
+        size_t sym = scns[SCN_DYNSYM].off + (1 + nr_verdefs + i) * sizeof(Elf64_Sym);
+        put32(b, sym + offsetof(Elf64_Sym, st_name), str_add(&dynstr, name));
+        b->p[sym + offsetof(Elf64_Sym, st_info)] = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+        put16(b, sym + offsetof(Elf64_Sym, st_shndx), SCN_TEXT);
+    }
+
+    if (nr_verdefs) {
+        size_t len = nr_verdefs * (sizeof(Elf64_Verdef) + sizeof(Elf64_Verdaux));
+        size_t off = buf_grow(b, len, 8);
+        scns[SCN_VERDEF].off = off;
+        scns[SCN_VERDEF].size = len;
+        scns[SCN_VERDEF].info = (Elf64_Word)nr_verdefs;
+        for (i = 0; i < nr_verdefs; i++) {
+            const char *name = (const char *)dynstr.p + verdef_names[i];
+            put16(b, off + offsetof(Elf64_Verdef, vd_version), VER_DEF_CURRENT);
+            put16(b, off + offsetof(Elf64_Verdef, vd_ndx), (uint16_t)(i + 1));
+            put16(b, off + offsetof(Elf64_Verdef, vd_cnt), 1);
+            put32(b, off + offsetof(Elf64_Verdef, vd_hash), (uint32_t)bfd_elf_hash(name));
+            put32(b, off + offsetof(Elf64_Verdef, vd_aux), sizeof(Elf64_Verdef));
+            if (i + 1 < nr_verdefs) {
+                put32(b, off + offsetof(Elf64_Verdef, vd_next), sizeof(Elf64_Verdef) + sizeof(Elf64_Verdaux));
+            }
+            off += sizeof(Elf64_Verdef);
+            put32(b, off + offsetof(Elf64_Verdaux, vda_name), verdef_names[i]);
+            off += sizeof(Elf64_Verdaux);
+        }
+    }
+
+    if (nr_verneeds) {
+        size_t nr_auxes[4];
+        size_t len = 0;
+        for (i = 0; i < nr_verneeds; i++) {
+            nr_auxes[i] = 1 + rng() % 6;
+            len += sizeof(Elf64_Verneed) + nr_auxes[i] * sizeof(Elf64_Vernaux);
+        }
+
+        size_t off = buf_grow(b, len, 8);
+        scns[SCN_VERNEED].off = off;
+        scns[SCN_VERNEED].size = len;
+        scns[SCN_VERNEED].info = (Elf64_Word)nr_verneeds;
+        for (i = 0; i < nr_verneeds; i++) {
+            char file[32];
+            snprintf(file, sizeof(file), "libgen%zu.so.1", i);
+            put16(b, off + offsetof(Elf64_Verneed, vn_version), VER_NEED_CURRENT);
+            put16(b, off + offsetof(Elf64_Verneed, vn_cnt), (uint16_t)nr_auxes[i]);
+            put32(b, off + offsetof(Elf64_Verneed, vn_file), str_add(&dynstr, file));
+            put32(b, off + offsetof(Elf64_Verneed, vn_aux), sizeof(Elf64_Verneed));
+            if (i + 1 < nr_verneeds) {
+                put32(b, off + offsetof(Elf64_Verneed, vn_next), sizeof(Elf64_Verneed) + nr_auxes[i] * sizeof(Elf64_Vernaux));
+            }
+            off += sizeof(Elf64_Verneed);
+
+            size_t j;
+            for (j = 0; j < nr_auxes[i]; j++) {
+                char name[32];
+                if (j < sizeof(glibc_versions) / sizeof(glibc_versions[0]) && chance(40)) {
+                    snprintf(name, sizeof(name), "%s", glibc_versions[j]);
+                    old = old || j == 0;
+                } else {
+                    snprintf(name, sizeof(name), "GEN_%zu.%zu", i, j);
+                }
+                put32(b, off + offsetof(Elf64_Vernaux, vna_hash), (uint32_t)bfd_elf_hash(name));
+                put16(b, off + offsetof(Elf64_Vernaux, vna_other), (uint16_t)(nr_verdefs + 2 + j));
+                put32(b, off + offsetof(Elf64_Vernaux, vna_name), str_add(&dynstr, name));
+                if (j + 1 < nr_auxes[i]) {
+                    put32(b, off + offsetof(Elf64_Vernaux, vna_next), sizeof(Elf64_Vernaux));
+                }
+                off += sizeof(Elf64_Vernaux);
+            }
+        }
+    }
+
+    if (old) {
+        summary.to_patch++;
+    }
+
+    scns[SCN_DYNSTR].off = buf_grow(b, dynstr.len, 1);
+    scns[SCN_DYNSTR].size = dynstr.len;
+    memcpy(b->p + scns[SCN_DYNSTR].off, dynstr.p, dynstr.len);
+    free(dynstr.p);
+
+    scns[SCN_TEXT].size = nr_insns * 4;
+    scns[SCN_TEXT].off = buf_grow(b, scns[SCN_TEXT].size, 16);
+    gen_text(b, scns[SCN_TEXT].off, nr_insns);
+
+    struct buf shstrtab = { 0 };
+    uint32_t sh_names[NR_SCNS] = { str_add(&shstrtab, "") };
+    for (i = 1; i < NR_SCNS; i++) {
+        sh_names[i] = str_add(&shstrtab, scns[i].name);
+    }
+    scns[SCN_SHSTRTAB].off = buf_grow(b, shstrtab.len, 1);
+    scns[SCN_SHSTRTAB].size = shstrtab.len;
+    memcpy(b->p + scns[SCN_SHSTRTAB].off, shstrtab.p, shstrtab.len);
+    free(shstrtab.p);
+
+    size_t shoff = buf_grow(b, NR_SCNS * sizeof(Elf64_Shdr), 8);
+    for (i = 1; i < NR_SCNS; i++) {
+        size_t sh = shoff + i * sizeof(Elf64_Shdr);
+        put32(b, sh + offsetof(Elf64_Shdr, sh_name), sh_names[i]);
+        put32(b, sh + offsetof(Elf64_Shdr, sh_type), scns[i].type);
+        put64(b, sh + offsetof(Elf64_Shdr, sh_flags), scns[i].flags);
+        put64(b, sh + offsetof(Elf64_Shdr, sh_offset), scns[i].off);
+        put64(b, sh + offsetof(Elf64_Shdr, sh_size), scns[i].size);
+        put32(b, sh + offsetof(Elf64_Shdr, sh_link), scns[i].link);
+        put32(b, sh + offsetof(Elf64_Shdr, sh_info), scns[i].info);
+        put64(b, sh + offsetof(Elf64_Shdr, sh_addralign), scns[i].align);
+        put64(b, sh + offsetof(Elf64_Shdr, sh_entsize), scns[i].entsize);
+    }
+
+    put64(b, offsetof(Elf64_Ehdr, e_shoff), shoff);
+    put16(b, offsetof(Elf64_Ehdr, e_shentsize), sizeof(Elf64_Shdr));
+    put16(b, offsetof(Elf64_Ehdr, e_shnum), NR_SCNS);
+    put16(b, offsetof(Elf64_Ehdr, e_shstrndx), SCN_SHSTRTAB);
+}
+
+// files that are only looked at up to their headers, if at all
+static void gen_other(struct buf *b)
+{
+    static const Elf64_Half machines[] = { EM_X86_64, EM_AARCH64, EM_RISCV };
+
+    switch (rng() % 5) {
+    case 0: {
+        static const char script[] = "#!/bin/sh\nexec /usr/bin/true \"$@\"\n";
+        size_t off = buf_grow(b, sizeof(script) - 1, 1);
+        memcpy(b->p + off, script, sizeof(script) - 1);
+        break;
+    }
+
+    case 1:
+        put_garbage(b, log_uniform(4, 16));
+        break;
+
+    case 2: {
+        // a LoongArch ELF32 header
+        size_t off = buf_grow(b, sizeof(Elf32_Ehdr), 1);
+        memcpy(b->p + off, ELFMAG, SELFMAG);
+        b->p[off + EI_CLASS] = ELFCLASS32;
+        b->p[off + EI_DATA] = ELFDATA2LSB;
+        put16(b, offsetof(Elf32_Ehdr, e_machine), EM_LOONGARCH);
+        put_garbage(b, log_uniform(10, 16));
+        break;
+    }
+
+    case 3:
+        put_ehdr(b, ELFDATA2MSB, EM_MIPS, 0);
+        put_garbage(b, log_uniform(10, 16));
+        break;
+
+    default:
+        put_ehdr(b, ELFDATA2LSB, machines[rng() % (sizeof(machines) / sizeof(machines[0]))], 0);
+        put_garbage(b, log_uniform(10, 16));
+        break;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void make_dir(const char *path)
+{
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        err(EX_CANTCREAT, "cannot create %s", path);
+    }
+}
+
+static void write_file(const char *path, const struct buf *b)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        err(EX_CANTCREAT, "cannot create %s", path);
+    }
+    if (fwrite(b->p, 1, b->len, fp) != b->len || fclose(fp) != 0) {
+        err(EX_IOERR, "cannot write %s", path);
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: %s <dir> [nr_files [seed]]\n", argv[0]);
+        return EX_USAGE;
+    }
+
+    const char *root = argv[1];
+    unsigned long nr_files = argc > 2 ? strtoul(argv[2], NULL, 0) : DEFAULT_NR_FILES;
+    rng_state = argc > 3 ? strtoull(argv[3], NULL, 0) : DEFAULT_SEED;
+    if (!rng_state) {
+        rng_state = DEFAULT_SEED;
+    }
+
+    char path[4096];
+    make_dir(root);
+    snprintf(path, sizeof(path), "%s/usr", root);
+    make_dir(path);
+    snprintf(path, sizeof(path), "%s/usr/lib64", root);
+    make_dir(path);
+    snprintf(path, sizeof(path), "%s/usr/share", root);
+    make_dir(path);
+
+    struct buf b = { 0 };
+    unsigned long i;
+    for (i = 0; i < nr_files; i++) {
+        b.len = 0;
+
+        bool loongarch = chance(80);
+        const char *parent = loongarch ? "lib64" : "share";
+        snprintf(path, sizeof(path), "%s/usr/%s/gen%03lu", root, parent, i / FILES_PER_DIR);
+        make_dir(path);
+
+        size_t len = strlen(path);
+        if (loongarch) {
+            snprintf(path + len, sizeof(path) - len, "/libgen%05lu.so.1", i);
+            gen_loongarch(&b, (unsigned int)i);
+            summary.loongarch++;
+        } else {
+            snprintf(path + len, sizeof(path) - len, "/gen%05lu.dat", i);
+            gen_other(&b);
+            summary.skipped++;
+        }
+
+        write_file(path, &b);
+        summary.files++;
+        summary.bytes += b.len;
+    }
+    free(b.p);
+
+    printf("files %llu\n", (unsigned long long)summary.files);
+    printf("bytes %llu\n", (unsigned long long)summary.bytes);
+    printf("loongarch %llu\n", (unsigned long long)summary.loongarch);
+    printf("skipped %llu\n", (unsigned long long)summary.skipped);
+    printf("syscall_sites %llu\n", (unsigned long long)summary.syscall_sites);
+    printf("removed_syscall_sites %llu\n", (unsigned long long)summary.removed_syscall_sites);
+    printf("to_patch %llu\n", (unsigned long long)summary.to_patch);
+
+    return 0;
+}
@@ -0,0 +1,499 @@
+// Times the scanning and hashing kernels in isolation, over synthetic buffers
+// of random code, densely placed matches, and patterns that make each kernel
+// do the most work per byte. Kernels built on sl_insn_find are run with every
+// variant supported by the running CPU, to compare them.
+//
+// usage: microbench [size_kib [rounds [kernel]]]
+//
+// Instructions per byte are counted with perf events if the kernel allows.
+#include <endian.h>
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buildconfig.gen.h"
+
+#if defined(HAVE_LINUX_PERF_EVENT_H) && HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "cfg.h"
+#include "ctx.h"
+#include "insnscan.h"
+#include "processing_ldso.h"
+#include "processing_syscall_abi.h"
+#include "utils.h"
+
+#define DEFAULT_SIZE_KIB 1024
+#define DEFAULT_ROUNDS 20
+
+static uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+// keeps results from being optimized away
+static volatile uint64_t sink;
+
+/////////////////////////////////////////////////////////////////////////////
+
+enum input_kind {
+    INPUT_TEXT,
+    INPUT_RODATA,
+    INPUT_DYNSTR,
+};
+
+struct input {
+    enum input_kind kind;
+    const char *name;
+    uint8_t *buf;
+    size_t size;
+};
+
+#define SYSCALL_INSN 0x002b0000
+#define A7 11
+
+static uint32_t addi_d_a7(uint32_t imm)
+{
+    return 0x02c00000 | ((imm & 0xfff) << 10) | A7;
+}
+
+static uint32_t lu12i_w(uint32_t rd, uint32_t imm)
+{
+    return 0x14000000 | ((imm & 0xfffff) << 5) | rd;
+}
+
+static uint32_t ori(uint32_t rd, uint32_t rj, uint32_t imm)
+{
+    return 0x03800000 | ((imm & 0xfff) << 10) | (rj << 5) | rd;
+}
+
+// common encodings with random operands, never writing to $a7; calls and
+// jumps only if asked for, as nothing in $a7 survives them
+static uint32_t filler_insn(bool jumps)
+{
+    static const uint32_t ops[][2] = {
+        // opcode, operand bits
+        { 0x00108000, 0x00007fff },  // add.d
+        { 0x00150000, 0x00007fff },  // or
+        { 0x02c00000, 0x003fffff },  // addi.d
+        { 0x28c00000, 0x003fffff },  // ld.d
+        { 0x29c00000, 0x003fffff },  // st.d
+        { 0x4c000000, 0x03ffffff },  // jirl
+        { 0x54000000, 0x03ffffff },  // bl
+    };
+
+    size_t nr_ops = sizeof(ops) / sizeof(ops[0]) - (jumps ? 0 : 2);
+    const uint32_t *op = ops[rng() % nr_ops];
+    uint32_t insn = op[0] | (rng() & op[1]);
+    if ((insn & 0x1f) == A7) {
+        insn ^= 1;
+    }
+    return insn;
+}
+
+static uint32_t syscall_nr(void)
+{
+    // newfstatat, removed, now and then; otherwise read
+    return rng() % 20 ? 63 : 79;
+}
+
+static Elf64_Word old_hash;
+
+static void put_insn(uint8_t *buf, size_t i, uint32_t insn)
+{
+    insn = htole32(insn);
+    memcpy(buf + i * 4, &insn, 4);
+}
+
+// a syscall site every 2048 insns and an old hash load every 4096 on average
+static void gen_text_random(uint8_t *buf, size_t n)
+{
+    size_t i = 0;
+    while (i < n) {
+        uint32_t r = rng() % 4096;
+        if (n - i >= 8 && r < 2) {
+            put_insn(buf, i++, addi_d_a7(syscall_nr()));
+            put_insn(buf, i++, filler_insn(false));
+            put_insn(buf, i++, SYSCALL_INSN);
+        } else if (n - i >= 8 && r == 2) {
+            put_insn(buf, i++, lu12i_w(12, old_hash >> 12));
+            put_insn(buf, i++, filler_insn(false));
+            put_insn(buf, i++, ori(12, 12, old_hash & 0xfff));
+        } else {
+            put_insn(buf, i++, filler_insn(true));
+        }
+    }
+}
+
+// a syscall site or an old hash load every 8 insns
+static void gen_text_dense(uint8_t *buf, size_t n)
+{
+    size_t i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        size_t j;
+        for (j = 0; j < 8; j++) {
+            put_insn(buf, i + j, filler_insn(false));
+        }
+        if (i % 16) {
+            put_insn(buf, i, addi_d_a7(syscall_nr()));
+            put_insn(buf, i + 7, SYSCALL_INSN);
+        } else {
+            put_insn(buf, i, lu12i_w(12, old_hash >> 12));
+            put_insn(buf, i + 7, ori(12, 12, old_hash & 0xfff));
+        }
+    }
+    for (; i < n; i++) {
+        put_insn(buf, i, filler_insn(true));
+    }
+}
+
+// syscalls every 21 insns, with nothing loaded into or clobbering $a7 in
+// between, so every insn is decoded in looking for what's in $a7; an old
+// hash is loaded into $a7 at the start, so the rest is looked at word by
+// word for the matching ori
+static void gen_text_worst(uint8_t *buf, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        put_insn(buf, i, i % 21 == 20 ? SYSCALL_INSN : filler_insn(false));
+    }
+    if (n) {
+        put_insn(buf, 0, lu12i_w(A7, old_hash >> 12));
+    }
+}
+
+static size_t put_str(uint8_t *buf, size_t size, size_t off, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    if (off + len > size) {
+        memset(buf + off, 0, size - off);
+        return size;
+    }
+    memcpy(buf + off, s, len);
+    return off + len;
+}
+
+// random strings, the old version now and then
+static void gen_rodata_random(uint8_t *buf, size_t size)
+{
+    size_t off = 0;
+    while (off < size) {
+        char s[48];
+        if (rng() % 4096 == 0) {
+            snprintf(s, sizeof(s), "GLIBC_2.35");
+        } else {
+            size_t len = 4 + rng() % 40;
+            size_t i;
+            for (i = 0; i < len; i++) {
+                s[i] = (char)(' ' + rng() % 95);
+            }
+            s[len] = '\0';
+        }
+        off = put_str(buf, size, off, s);
+    }
+}
+
+static void gen_rodata_dense(uint8_t *buf, size_t size)
+{
+    size_t off = 0;
+    while (off < size) {
+        off = put_str(buf, size, off, "GLIBC_2.35");
+    }
+}
+
+// the longest possible near misses
+static void gen_rodata_worst(uint8_t *buf, size_t size)
+{
+    size_t off = 0;
+    while (off < size) {
+        off = put_str(buf, size, off, "GLIBC_2.");
+    }
+}
+
+static void gen_dynstr(uint8_t *buf, size_t size)
+{
+    size_t off = 0;
+    unsigned int i = 0;
+    while (off < size) {
+        char s[48];
+        if (i % 16 == 0) {
+            snprintf(s, sizeof(s), "GLIBC_2.%u", 17 + i % 20);
+        } else {
+            snprintf(s, sizeof(s), "gen_symbol_%x_%u", rng(), i);
+        }
+        off = put_str(buf, size, off, s);
+        i++;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static struct sl_cfg bench_cfg;
+
+static void with_ctx(const struct input *in, void (*fn)(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s))
+{
+    struct sl_file file = { 0 };
+    struct sl_elf_ctx ctx = {
+        .cfg = &bench_cfg,
+        .file = &file,
+    };
+    struct sl_elf64_scn s = {
+        .data = in->buf,
+        .size = in->size,
+    };
+
+    fn(&ctx, &s);
+    sink += file.res.nr_findings;
+    sl_result_free(&file.res);
+}
+
+static void do_syscall_scan(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s)
+{
+    (void) scan_for_removed_syscalls(ctx, s);
+}
+
+static void do_ldso_text(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s)
+{
+    (void) patch_ldso_text_hashes(ctx, s);
+}
+
+static void do_ldso_rodata(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s)
+{
+    (void) patch_ldso_rodata(ctx, s);
+}
+
+static void run_insn_find(const struct input *in)
+{
+    const uint32_t *insns = (const uint32_t *)in->buf;
+    size_t n = in->size / 4;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        i += sl_insn_find(insns + i, n - i, 0xffff7000, SYSCALL_INSN);
+        sink += i;
+    }
+}
+
+static void run_syscall_scan(const struct input *in)
+{
+    with_ctx(in, do_syscall_scan);
+}
+
+static void run_ldso_text(const struct input *in)
+{
+    with_ctx(in, do_ldso_text);
+}
+
+static void run_ldso_rodata(const struct input *in)
+{
+    with_ctx(in, do_ldso_rodata);
+}
+
+static void run_bfd_elf_hash(const struct input *in)
+{
+    const char *p = (const char *)in->buf;
+    const char *end = p + in->size;
+    while (p < end) {
+        sink += bfd_elf_hash(p);
+        p += strlen(p) + 1;
+    }
+}
+
+struct kernel {
+    const char *name;
+    enum input_kind kind;
+    void (*run)(const struct input *in);
+    // run with each variant of sl_insn_find
+    bool insnscan;
+};
+
+static const struct kernel kernels[] = {
+    { "insn_find", INPUT_TEXT, run_insn_find, true },
+    { "syscall_scan", INPUT_TEXT, run_syscall_scan, true },
+    { "ldso_text_hashes", INPUT_TEXT, run_ldso_text, true },
+    { "ldso_rodata", INPUT_RODATA, run_ldso_rodata, false },
+    { "bfd_elf_hash", INPUT_DYNSTR, run_bfd_elf_hash, false },
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int perf_fd = -1;
+
+static void perf_open(void)
+{
+#if defined(HAVE_LINUX_PERF_EVENT_H) && HAVE_LINUX_PERF_EVENT_H
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void perf_start(void)
+{
+#if defined(HAVE_LINUX_PERF_EVENT_H) && HAVE_LINUX_PERF_EVENT_H
+    if (perf_fd >= 0) {
+        (void) ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+        (void) ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+// returns the number of instructions since perf_start, or 0 if unknown
+static uint64_t perf_stop(void)
+{
+    uint64_t count = 0;
+#if defined(HAVE_LINUX_PERF_EVENT_H) && HAVE_LINUX_PERF_EVENT_H
+    if (perf_fd >= 0) {
+        (void) ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(perf_fd, &count, sizeof(count)) != sizeof(count)) {
+            count = 0;
+        }
+    }
+#endif
+    return count;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void measure(const struct kernel *k, const struct input *in, const char *impl, unsigned long rounds)
+{
+    // once to warm up the caches
+    k->run(in);
+
+    perf_start();
+    uint64_t start = now_ns();
+    unsigned long i;
+    for (i = 0; i < rounds; i++) {
+        k->run(in);
+    }
+    uint64_t ns = now_ns() - start;
+    uint64_t insns = perf_stop();
+
+    double bytes = (double)in->size * (double)rounds;
+    printf("%-18s %-8s %-8s %10.3f", k->name, in->name, impl, (double)ns / bytes);
+    if (insns) {
+        printf(" %12.3f\n", (double)insns / bytes);
+    } else {
+        printf(" %12s\n", "n/a");
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc > 4) {
+        fprintf(stderr, "usage: %s [size_kib [rounds [kernel]]]\n", argv[0]);
+        return EX_USAGE;
+    }
+
+    size_t size = (argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_SIZE_KIB) * 1024;
+    unsigned long rounds = argc > 2 ? strtoul(argv[2], NULL, 0) : DEFAULT_ROUNDS;
+    const char *only = argc > 3 ? argv[3] : NULL;
+    if (!size || !rounds) {
+        fprintf(stderr, "%s: size and rounds must not be zero\n", argv[0]);
+        return EX_USAGE;
+    }
+
+    // findings are kept, like they would be, but never shown
+    bench_cfg.dry_run = 1;
+    bench_cfg.check_objabi = 1;
+    bench_cfg.removed_syscalls = &sl_removed_syscalls_default;
+    bench_cfg.from_ver = "GLIBC_2.35";
+    bench_cfg.to_ver = "GLIBC_2.36";
+    bench_cfg.from_elfhash = bfd_elf_hash(bench_cfg.from_ver);
+    bench_cfg.to_elfhash = bfd_elf_hash(bench_cfg.to_ver);
+    old_hash = bench_cfg.from_elfhash;
+
+    struct input inputs[] = {
+        { INPUT_TEXT, "random", NULL, size },
+        { INPUT_TEXT, "dense", NULL, size },
+        { INPUT_TEXT, "worst", NULL, size },
+        { INPUT_RODATA, "random", NULL, size },
+        { INPUT_RODATA, "dense", NULL, size },
+        { INPUT_RODATA, "worst", NULL, size },
+        { INPUT_DYNSTR, "dynstr", NULL, size },
+    };
+    void (*gens[])(uint8_t *, size_t) = {
+        gen_text_random,
+        gen_text_dense,
+        gen_text_worst,
+        gen_rodata_random,
+        gen_rodata_dense,
+        gen_rodata_worst,
+        gen_dynstr,
+    };
+    size_t nr_inputs = sizeof(inputs) / sizeof(inputs[0]);
+
+    size_t i;
+    for (i = 0; i < nr_inputs; i++) {
+        // as aligned as sections in a mapping would be
+        if (posix_memalign((void **)&inputs[i].buf, 64, size)) {
+            err(EX_OSERR, "cannot allocate buffers");
+        }
+        if (inputs[i].kind == INPUT_TEXT) {
+            gens[i](inputs[i].buf, size / 4);
+        } else {
+            gens[i](inputs[i].buf, size);
+        }
+    }
+
+    perf_open();
+
+    printf("%-18s %-8s %-8s %10s %12s\n", "kernel", "input", "variant", "ns/byte", "insns/byte");
+
+    size_t k;
+    for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        const struct kernel *kernel = &kernels[k];
+        if (only && strcmp(only, kernel->name)) {
+            continue;
+        }
+
+        for (i = 0; i < nr_inputs; i++) {
+            if (inputs[i].kind != kernel->kind) {
+                continue;
+            }
+
+            if (!kernel->insnscan) {
+                measure(kernel, &inputs[i], "-", rounds);
+                continue;
+            }
+
+            const struct sl_insnscan_impl *impl;
+            for (impl = sl_insnscan_impls; impl->name; impl++) {
+                if (impl->supported()) {
+                    sl_insnscan_use(impl);
+                    measure(kernel, &inputs[i], impl->name, rounds);
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < nr_inputs; i++) {
+        free(inputs[i].buf);
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#!/bin/bash
+
+# Times one mode of shengloong over a freshly generated synthetic sysroot.
+#
+# The number of files and the seed of the sysroot can be changed with
+# SL_BENCH_FILES and SL_BENCH_SEED; SL_BENCH_ARGS is passed on to shengloong,
+# e.g. "-j 0" or "-l".
+
+mydir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+. "$mydir/../tests/_common.sh"
+
+if [[ $# -ne 3 ]]; then
+  dief 'usage: %s <shengloong executable> <gen-sysroot executable> <patch|syscall-abi|objabi>' "$0"
+fi
+
+export LC_ALL=C.UTF-8
+export LANG=C.UTF-8
+
+sl_prog="$(realpath "$1")"
+gen_prog="$(realpath "$2")"
+mode="$3"
+
+case "$mode" in
+patch) sl_args=() ;;
+syscall-abi) sl_args=(-a) ;;
+objabi) sl_args=(-o) ;;
+*) dief 'unknown mode %s' "$mode" ;;
+esac
+# word splitting is wanted here
+sl_args+=($SL_BENCH_ARGS)
+
+workdir="$(mktemp -d)"
+
+cleanup() {
+  dbgrun rm -rf "$workdir" || true
+}
+
+trap cleanup EXIT
+
+generate() {
+  rm -rf "$workdir/root"
+  "$gen_prog" "$workdir/root" "${SL_BENCH_FILES:-2000}" "${SL_BENCH_SEED:-0x5eed}" > "$workdir/summary" \
+    || dief 'gen-sysroot failed'
+}
+
+summary() {
+  awk -v key="$1" '$1 == key { print $2 }' "$workdir/summary"
+}
+
+generate
+nr_files="$(summary files)"
+nr_bytes="$(summary bytes)"
+
+start="$(date +%s%N)"
+"$sl_prog" "${sl_args[@]}" "$workdir/root" > "$workdir/stdout" || dief 'shengloong failed'
+end="$(date +%s%N)"
+
+infof '%s: %s files, %s bytes, shengloong %s' "$mode" "$nr_files" "$nr_bytes" "${sl_args[*]}"
+awk -v ns="$((end - start))" -v files="$nr_files" -v bytes="$nr_bytes" 'BEGIN {
+  s = ns / 1e9
+  printf "info: %.3f s, %.1f files/s, %.1f MB/s\n", s, files / s, bytes / s / 1e6
+}'
+
+case "$mode" in
+patch)
+  infof '%s of %s files needing it were patched' "$(grep -c '^patching ' "$workdir/stdout")" "$(summary to_patch)"
+  ;;
+syscall-abi)
+  infof '%s of %s removed syscall sites were found' "$(grep -c 'usage of removed syscall' "$workdir/stdout")" "$(summary removed_syscall_sites)"
+  ;;
+esac
+
+# counting syscalls slows everything down, so it's done in a run of its own
+if command -v strace > /dev/null; then
+  [[ $mode == patch ]] && generate
+  strace -f -c -o "$workdir/strace" "$sl_prog" "${sl_args[@]}" "$workdir/root" > /dev/null || dief 'shengloong failed'
+  awk -v files="$nr_files" '$NF == "total" { printf "info: %.1f syscalls per file\n", $4 / files }' "$workdir/strace"
+else
+  info 'strace not found, not counting syscalls'
+fi
@@ -0,0 +1,251 @@
+#include <ar.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "stats.h"
+
+// BSD ar keeps names that are too long or contain spaces right after the
+// header, as "#1/" followed by their length
+#define BSD_LONG_NAME "#1/"
+#define BSD_SYMTAB "__.SYMDEF"
+
+static bool in_bounds(uint64_t size, uint64_t off, uint64_t len)
+{
+    return off <= size && len <= size - off;
+}
+
+// parses a decimal number padded with spaces, as found in member headers
+static bool parse_dec(const char *s, size_t n, uint64_t *out)
+{
+    uint64_t v = 0;
+    size_t i = 0;
+    for (; i < n && s[i] >= '0' && s[i] <= '9'; i++) {
+        if (v > (UINT64_MAX - 9) / 10) {
+            return false;
+        }
+        v = v * 10 + (uint64_t)(s[i] - '0');
+    }
+    if (i == 0) {
+        return false;
+    }
+    for (; i < n; i++) {
+        if (s[i] != ' ') {
+            return false;
+        }
+    }
+
+    *out = v;
+    return true;
+}
+
+static void set_name(struct sl_ar *ar, const char *s, size_t n)
+{
+    if (n > NAME_MAX) {
+        n = NAME_MAX;
+    }
+    memcpy(ar->name, s, n);
+    ar->name[n] = '\0';
+}
+
+// whether the file starting with the len bytes at head is an archive
+bool sl_ar_is_archive(const void *head, size_t len)
+{
+    return len >= SARMAG && !memcmp(head, ARMAG, SARMAG);
+}
+
+// Looks at the archive in buf, all of which is kept in memory.
+void sl_ar_init(struct sl_ar *ar, const void *buf, size_t size)
+{
+    memset(ar, 0, sizeof(*ar));
+    ar->buf = buf;
+    ar->fd = -1;
+    ar->size = size;
+    ar->pos = SARMAG;
+}
+
+// Looks at the archive behind fd, reading member headers one by one;
+// sl_ar_fini has to be called afterwards.
+void sl_ar_open(struct sl_ar *ar, int fd, uint64_t size)
+{
+    memset(ar, 0, sizeof(*ar));
+    ar->fd = fd;
+    ar->size = size;
+    ar->pos = SARMAG;
+}
+
+void sl_ar_fini(struct sl_ar *ar)
+{
+    free(ar->own_names);
+    ar->own_names = NULL;
+    ar->names = NULL;
+}
+
+// Copies len bytes at off in the archive to out. Returns false if they're
+// not all there, or cannot be read, with errno set then.
+bool sl_ar_read(const struct sl_ar *ar, uint64_t off, void *out, size_t len)
+{
+    if (!in_bounds(ar->size, off, len)) {
+        errno = ERANGE;
+        return false;
+    }
+
+    if (ar->buf) {
+        memcpy(out, ar->buf + off, len);
+        return true;
+    }
+
+    uint8_t *p = out;
+    while (len > 0) {
+        ssize_t n = pread(ar->fd, p, len, (off_t)off);
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // GCOVR_EXCL_STOP
+        // GCOVR_EXCL_START: racing with other writers
+        if (n == 0) {
+            errno = EIO;
+            return false;
+        }
+        // GCOVR_EXCL_STOP
+
+        sl_stats_add(SL_STAT_BYTES_READ, (uint64_t)n);
+        p += n;
+        len -= (size_t)n;
+        off += (uint64_t)n;
+    }
+
+    return true;
+}
+
+static enum sl_ar_status load_names(struct sl_ar *ar, uint64_t off, uint64_t size)
+{
+    if (ar->buf) {
+        ar->names = (const char *)ar->buf + off;
+        ar->names_size = (size_t)size;
+        return SL_AR_OK;
+    }
+
+    free(ar->own_names);
+    ar->own_names = malloc(size ? (size_t)size : 1);
+    // GCOVR_EXCL_START: OOM
+    if (!ar->own_names) {
+        errno = ENOMEM;
+        return SL_AR_IO_ERROR;
+    }
+    // GCOVR_EXCL_STOP
+    if (!sl_ar_read(ar, off, ar->own_names, (size_t)size)) {
+        return SL_AR_IO_ERROR;  // GCOVR_EXCL_LINE: media error
+    }
+    ar->names = ar->own_names;
+    ar->names_size = (size_t)size;
+
+    return SL_AR_OK;
+}
+
+// GNU long names are kept in the table at the given offset, each ending with
+// "/\n"
+static bool get_long_name(struct sl_ar *ar, uint64_t off)
+{
+    if (!ar->names || off >= ar->names_size) {
+        return false;
+    }
+
+    const char *s = ar->names + off;
+    const char *end = memchr(s, '\n', ar->names_size - (size_t)off);
+    if (!end) {
+        return false;
+    }
+    if (end > s && end[-1] == '/') {
+        end--;
+    }
+
+    set_name(ar, s, (size_t)(end - s));
+    return true;
+}
+
+// Gets the next member, skipping the symbol tables and the long name table.
+enum sl_ar_status sl_ar_next(struct sl_ar *ar, struct sl_ar_member *m)
+{
+    for (;;) {
+        if (ar->pos >= ar->size) {
+            return SL_AR_END;
+        }
+
+        struct ar_hdr h;
+        if (!in_bounds(ar->size, ar->pos, sizeof(h))) {
+            return SL_AR_MALFORMED;
+        }
+        if (!sl_ar_read(ar, ar->pos, &h, sizeof(h))) {
+            return SL_AR_IO_ERROR;  // GCOVR_EXCL_LINE: media error
+        }
+
+        uint64_t off = ar->pos + sizeof(h);
+        uint64_t size;
+        if (memcmp(h.ar_fmag, ARFMAG, sizeof(h.ar_fmag))
+                || !parse_dec(h.ar_size, sizeof(h.ar_size), &size)
+                || !in_bounds(ar->size, off, size)
+                || size > SIZE_MAX) {
+            return SL_AR_MALFORMED;
+        }
+        // members are 2-byte aligned
+        ar->pos = off + size + (size & 1);
+
+        if (h.ar_name[0] == '/') {
+            uint64_t name_off;
+            if (h.ar_name[1] == '/') {
+                enum sl_ar_status status = load_names(ar, off, size);
+                if (status != SL_AR_OK) {
+                    return status;  // GCOVR_EXCL_LINE: OOM or media error
+                }
+                continue;
+            }
+            if (!parse_dec(h.ar_name + 1, sizeof(h.ar_name) - 1, &name_off)) {
+                // the symbol table, as "/" or "/SYM64/"
+                continue;
+            }
+            if (!get_long_name(ar, name_off)) {
+                return SL_AR_MALFORMED;
+            }
+        } else if (!memcmp(h.ar_name, BSD_LONG_NAME, strlen(BSD_LONG_NAME))) {
+            uint64_t len;
+            size_t n = strlen(BSD_LONG_NAME);
+            if (!parse_dec(h.ar_name + n, sizeof(h.ar_name) - n, &len) || len > size) {
+                return SL_AR_MALFORMED;
+            }
+
+            char name[NAME_MAX];
+            n = len < sizeof(name) ? (size_t)len : sizeof(name);
+            if (!sl_ar_read(ar, off, name, n)) {
+                return SL_AR_IO_ERROR;  // GCOVR_EXCL_LINE: media error
+            }
+            // padded with NULs to a multiple of 4 or 8
+            set_name(ar, name, strnlen(name, n));
+            off += len;
+            size -= len;
+        } else {
+            // GNU ar ends names with a '/', BSD ar pads them with spaces
+            const char *end = memchr(h.ar_name, '/', sizeof(h.ar_name));
+            size_t n = end ? (size_t)(end - h.ar_name) : sizeof(h.ar_name);
+            while (!end && n > 0 && h.ar_name[n - 1] == ' ') {
+                n--;
+            }
+            set_name(ar, h.ar_name, n);
+        }
+
+        if (!strncmp(ar->name, BSD_SYMTAB, strlen(BSD_SYMTAB))) {
+            continue;
+        }
+
+        m->name = ar->name;
+        m->offset = off;
+        m->size = (size_t)size;
+        return SL_AR_OK;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef _shengloong_archive_h
+#define _shengloong_archive_h
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A Unix ar archive as made by GNU or BSD ar, either in memory or read piece
+// by piece from fd. Going through the members only ever looks at their
+// headers and the long name table; members are never copied out, but left
+// where they are for the caller to look at. Thin archives are not supported.
+struct sl_ar {
+    // NULL if reading from fd
+    const uint8_t *buf;
+    int fd;
+    uint64_t size;
+
+    // where the next member header is
+    uint64_t pos;
+
+    // the GNU long name table, if seen already; only if reading from fd is
+    // it read into own_names
+    const char *names;
+    size_t names_size;
+    char *own_names;
+
+    // the name of the current member
+    char name[NAME_MAX + 1];
+};
+
+struct sl_ar_member {
+    const char *name;
+    // where the contents are in the archive
+    uint64_t offset;
+    size_t size;
+};
+
+enum sl_ar_status {
+    SL_AR_OK,
+    SL_AR_END,
+    // a member header is cut short or otherwise unreadable; there's no
+    // telling where the members after it are
+    SL_AR_MALFORMED,
+    // only if reading from fd, errno tells why
+    SL_AR_IO_ERROR,
+};
+
+bool sl_ar_is_archive(const void *head, size_t len);
+void sl_ar_init(struct sl_ar *ar, const void *buf, size_t size);
+void sl_ar_open(struct sl_ar *ar, int fd, uint64_t size);
+void sl_ar_fini(struct sl_ar *ar);
+enum sl_ar_status sl_ar_next(struct sl_ar *ar, struct sl_ar_member *m);
+bool sl_ar_read(const struct sl_ar *ar, uint64_t off, void *out, size_t len);
+
+#endif  // _shengloong_archive_h
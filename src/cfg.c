@@ -2,6 +2,25 @@
 
 #include "cfg.h"
 
+bool sl_cfg_needs_only_ehdr(const struct sl_cfg *cfg)
+{
+    // object file ABI is fully described by e_flags
+    return cfg->check_objabi && !cfg->check_syscall_abi;
+}
+
+// whether the symbol versions are looked at; not in the check-only modes
+bool sl_cfg_wants_patch(const struct sl_cfg *cfg)
+{
+    return cfg->check_all || (!cfg->check_syscall_abi && !cfg->check_objabi);
+}
+
+// whether the changes are described as they're made; records of them are
+// written instead in the JSON Lines format
+bool sl_cfg_narrates(const struct sl_cfg *cfg)
+{
+    return !cfg->dry_run && cfg->verbose && cfg->format == SL_FORMAT_TEXT;
+}
+
 bool sl_cfg_is_ver_interesting(
     const struct sl_cfg *cfg __attribute__((unused)),
     const char *ver)
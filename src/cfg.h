@@ -2,25 +2,92 @@
 #define _shengloong_cfg_h
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <elf.h>
 
+struct sl_pathrules;
+struct sl_syscall_set;
+
+enum sl_format {
+    // messages for humans, possibly translated
+    SL_FORMAT_TEXT,
+    // one JSON object per line for every finding and every patch
+    SL_FORMAT_JSONL,
+};
+
+// the order files found by the walker are opened in
+enum sl_io_order {
+    // as they're found
+    SL_IO_ORDER_WALK,
+    // by inode number, which is close to where filesystems like ext4 put
+    // their data
+    SL_IO_ORDER_INODE,
+    // by where their data starts on disk, as told by FIEMAP
+    SL_IO_ORDER_EXTENT,
+    // extent order for roots on rotational disks, else as they're found
+    SL_IO_ORDER_AUTO,
+};
+
 struct sl_cfg {
     int verbose;
     int dry_run;
 
+    // how findings are written to stdout
+    enum sl_format format;
+
     // when these are on, don't do the patching
     int check_syscall_abi;
     int check_objabi;
+    // all of the checks above, but still patching
+    int check_all;
+
+    // the syscalls whose usage is looked for
+    const struct sl_syscall_set *removed_syscalls;
+    uint32_t removed_syscalls_hash;
 
     const char *from_ver;
     const char *to_ver;
     Elf64_Word from_elfhash;
     Elf64_Word to_elfhash;
+
+    // number of worker threads; 1 means processing inline in the walker
+    int jobs;
+
+    // how much of the files waiting to be processed may be read ahead, or 0
+    // to not read ahead at all
+    uint64_t prefetch_bytes;
+
+    // don't descend into directories on other filesystems than the root's
+    int one_file_system;
+    // which paths under the roots are looked at, or NULL for all
+    const struct sl_pathrules *path_rules;
+
+    // files are gathered and sorted first, unless SL_IO_ORDER_WALK
+    enum sl_io_order io_order;
+
+    // where to keep the per-root indices of scan results, or NULL
+    const char *index_dir;
+
+    // share results between files of identical content
+    int content_cache;
+
+    // patch copies of files, then rename them over the originals
+    int replace;
+
+    // read only the parts of files looked at, instead of mapping them whole
+    int low_memory;
+
+    // print counters and timings to stderr at exit, as JSON if stats_json
+    int stats;
+    int stats_json;
 };
 
 extern struct sl_cfg global_cfg;
 
+bool sl_cfg_needs_only_ehdr(const struct sl_cfg *cfg);
+bool sl_cfg_wants_patch(const struct sl_cfg *cfg);
+bool sl_cfg_narrates(const struct sl_cfg *cfg);
 bool sl_cfg_is_ver_interesting(const struct sl_cfg *cfg, const char *ver);
 
 #endif  // _shengloong_cfg_h
@@ -1,36 +1,166 @@
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
+#include <unistd.h>
+#include <sys/param.h>
 
 #include "buildconfig.gen.h"
 #include "ctx.h"
 #include "gettext.h"
+#include "stats.h"
+#include "utils.h"
 
 #define _(x) gettext(x)
 
-const char *sl_elf_dynstr(const struct sl_elf_ctx *ctx, size_t idx)
+const char *sl_elf_path(struct sl_elf_ctx *ctx)
 {
-    return elf_strptr(ctx->e, ctx->dynstr, idx);
+    if (!ctx->path) {
+        ctx->path = sl_dir_path(ctx->file->dir, ctx->file->name);
+    }
+
+    return ctx->path;
+}
+
+// Shows the finding if wanted, and keeps it with the file's results for
+// sharing and indexing.
+void sl_report(struct sl_elf_ctx *ctx, const struct sl_finding *f)
+{
+    // the member name is recorded along with the rest, so replays from the
+    // index or of identical files name it too
+    struct sl_finding mf;
+    if (ctx->member) {
+        mf = *f;
+        mf.str = ctx->member;
+        f = &mf;
+    }
+
+    sl_result_add(&ctx->file->res, f);
+
+    // don't bother assembling the path for findings not shown
+    if (sl_finding_shown(ctx->cfg, f->kind)) {
+        sl_finding_emit(ctx->cfg, &ctx->file->out, sl_elf_path(ctx), f);
+    }
+}
+
+static bool has_patch(const struct sl_elf_ctx *ctx, uint64_t off, const void *newval, size_t len)
+{
+    size_t i;
+    for (i = 0; i < ctx->nr_patches; i++) {
+        const struct sl_patch *p = &ctx->patches[i];
+        if (p->off == off && p->len == len && !memcmp(p->new, newval, len)) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-const char *sl_elf_raw_dynstr(const struct sl_elf_ctx *ctx, size_t off)
+// Records that the len bytes at p, which points into the loaded section s,
+// are to be changed to newval. The changes are all made once the whole file
+// has been looked at.
+void sl_elf_patch(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s, const void *p, const void *newval, size_t len)
 {
-    return (const char *)((char *)ctx->dynstr_d->d_buf + off);
+    ctx->dirty = true;
+    if (ctx->cfg->dry_run) {
+        return;
+    }
+
+    const uint8_t *oldval = p;
+    const uint8_t *newbytes = newval;
+    uint64_t off = s->offset + (uint64_t)(oldval - s->data);
+    while (len > 0) {
+        size_t n = MIN(len, SL_PATCH_MAX);
+
+        // parts may be unchanged, like the upper bits of a hash, and the
+        // same string may be referred to more than once
+        if (memcmp(oldval, newbytes, n) && !has_patch(ctx, off, newbytes, n)) {
+            ctx->patches = grow_array(ctx->patches, &ctx->cap_patches, ctx->nr_patches + 1, sizeof(*ctx->patches));
+            struct sl_patch *patch = &ctx->patches[ctx->nr_patches++];
+            // the sections ever patched all have short names
+            snprintf(patch->scn, sizeof(patch->scn), "%s", s->name ? s->name : "");
+            patch->off = off;
+            patch->len = n;
+            memcpy(patch->old, oldval, n);
+            memcpy(patch->new, newbytes, n);
+        }
+
+        off += n;
+        oldval += n;
+        newbytes += n;
+        len -= n;
+    }
 }
 
-int sl_elf_patch_dynstr_by_off(struct sl_elf_ctx *ctx, size_t off, const char *newval)
+// Makes the recorded changes to the file behind fd, writing nothing but the
+// changed bytes. Nothing is written unless all the bytes to change are still
+// what they were when the file was looked at.
+int sl_elf_apply_patches(struct sl_elf_ctx *ctx, int fd)
 {
-    char *oldval = (char *)ctx->dynstr_d->d_buf + off;
+    size_t i;
+    for (i = 0; i < ctx->nr_patches; i++) {
+        const struct sl_patch *p = &ctx->patches[i];
+        uint8_t cur[SL_PATCH_MAX];
+
+        ssize_t n = pread(fd, cur, p->len, (off_t)p->off);
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        if (n < 0) {
+            fprintf(stderr, _("%s: cannot read: %s\n"), sl_elf_path(ctx), strerror(errno));
+            return EX_IOERR;
+        }
+        // GCOVR_EXCL_STOP
+
+        // GCOVR_EXCL_START: racing with other writers
+        if ((size_t)n != p->len || memcmp(cur, p->old, p->len)) {
+            fprintf(stderr, _("%s: changed while being looked at, not patching\n"), sl_elf_path(ctx));
+            return EX_TEMPFAIL;
+        }
+        // GCOVR_EXCL_STOP
+    }
+
+    for (i = 0; i < ctx->nr_patches; i++) {
+        const struct sl_patch *p = &ctx->patches[i];
+
+        ssize_t n = pwrite(fd, p->new, p->len, (off_t)p->off);
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        if (n < 0 || (size_t)n != p->len) {
+            fprintf(stderr, _("%s: cannot write: %s\n"), sl_elf_path(ctx), n < 0 ? strerror(errno) : _("short write"));
+            return EX_IOERR;
+        }
+        // GCOVR_EXCL_STOP
+        sl_stats_add(SL_STAT_BYTES_WRITTEN, p->len);
+    }
+
+    return 0;
+}
+
+// Returns the string at off in .dynstr, or NULL if there's none.
+const char *sl_elf_dynstr(const struct sl_elf_ctx *ctx, size_t off)
+{
+    return sl_elf64_str(&ctx->dynstr, off);
+}
+
+// off must point at a string, i.e. sl_elf_dynstr is not NULL for it
+int sl_elf_patch_dynstr(struct sl_elf_ctx *ctx, size_t off, const char *newval)
+{
+    const char *oldval = (const char *)ctx->dynstr.data + off;
     size_t oldlen = strlen(oldval);
     size_t newlen = strlen(newval);
 
     // we cannot alter string's length at present, but this is not a problem
     // as all strings we're interested in are like "GLIBC_2.xx"
     if (oldlen != newlen) {
+        // only a problem when actually patching
+        ctx->dirty = true;
+        if (ctx->cfg->dry_run) {
+            return 0;
+        }
+
         fprintf(
             stderr,
             _("%s: cannot patch string with unequal lengths: attempted '%s' -> '%s'\n"),
-            ctx->path,
+            sl_elf_path(ctx),
             oldval,
             newval
         );
@@ -42,17 +172,7 @@ int sl_elf_patch_dynstr_by_off(struct sl_elf_ctx *ctx, size_t off, const char *n
         return 0;
     }
 
-    ctx->dirty = true;
-    memmove(oldval, newval, newlen);
-    elf_flagdata(ctx->dynstr_d, ELF_C_SET, ELF_F_DIRTY);
+    sl_elf_patch(ctx, &ctx->dynstr, oldval, newval, newlen);
 
     return 0;
 }
-
-int sl_elf_patch_dynstr_by_idx(struct sl_elf_ctx *ctx, size_t idx, const char *newval)
-{
-    // get the idx-th string's offset
-    const char *s = sl_elf_dynstr(ctx, idx);
-    size_t off = (size_t)(s - (char *)ctx->dynstr_d->d_buf);
-    return sl_elf_patch_dynstr_by_off(ctx, off, newval);
-}
@@ -2,24 +2,55 @@
 #define _shengloong_ctx_h
 
 #include <stdbool.h>
-
-#include <libelf.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "elf64.h"
+#include "file.h"
+#include "report.h"
+
+#define SL_PATCH_MAX 16
+
+// A change to make to the file, along with the bytes expected there before.
+// Only the name of the section is kept, as the section itself is gone by the
+// time the change is made.
+struct sl_patch {
+    char scn[16];
+    uint64_t off;
+    size_t len;
+    uint8_t old[SL_PATCH_MAX];
+    uint8_t new[SL_PATCH_MAX];
+};
 
 struct sl_elf_ctx {
     const struct sl_cfg *cfg;
 
-    const char *path;
-    Elf *e;
+    // path is only assembled on first use by sl_elf_path
+    struct sl_file *file;
+    char *path;
+
+    struct sl_elf64 elf;
+
+    // the archive member being looked at, named by the findings about it
+    const char *member;
 
-    size_t dynstr;
-    Elf_Data *dynstr_d;
+    // data is NULL if there's no .dynstr
+    struct sl_elf64_scn dynstr;
 
+    // the file is only ever looked at through a read-only mapping, or what's
+    // read from it; the changes it needs are collected here, except in dry
+    // runs
     bool dirty;
+    struct sl_patch *patches;
+    size_t nr_patches;
+    size_t cap_patches;
 };
 
-const char *sl_elf_dynstr(const struct sl_elf_ctx *ctx, size_t idx);
-const char *sl_elf_raw_dynstr(const struct sl_elf_ctx *ctx, size_t off);
-int sl_elf_patch_dynstr_by_off(struct sl_elf_ctx *ctx, size_t off, const char *newval);
-int sl_elf_patch_dynstr_by_idx(struct sl_elf_ctx *ctx, size_t idx, const char *newval);
+const char *sl_elf_path(struct sl_elf_ctx *ctx);
+void sl_report(struct sl_elf_ctx *ctx, const struct sl_finding *f);
+void sl_elf_patch(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s, const void *p, const void *newval, size_t len);
+int sl_elf_apply_patches(struct sl_elf_ctx *ctx, int fd);
+const char *sl_elf_dynstr(const struct sl_elf_ctx *ctx, size_t off);
+int sl_elf_patch_dynstr(struct sl_elf_ctx *ctx, size_t off, const char *newval);
 
 #endif  // _shengloong_ctx_h
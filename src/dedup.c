@@ -0,0 +1,313 @@
+#include <endian.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "buildconfig.gen.h"
+#include "dedup.h"
+#include "gettext.h"
+#include "utils.h"
+
+#define _(x) gettext(x)
+
+// as long as the content keys; inode keys leave the rest 0
+#define KEY_WORDS 5
+
+// another path to an inode that's being processed
+struct alias {
+    struct alias *next;
+    struct sl_file file;
+    char name[];
+};
+
+struct sl_dedup_ent {
+    struct sl_dedup_ent *next;
+    uint64_t key[KEY_WORDS];
+
+    bool done;
+    enum sl_file_outcome outcome;
+    struct sl_file_result res;
+
+    // waiting for the results, only for inodes
+    struct alias *aliases;
+};
+
+struct table {
+    struct sl_dedup_ent **buckets;
+    size_t nr_buckets;
+    size_t nr;
+};
+
+struct sl_dedup {
+    const struct sl_cfg *cfg;
+
+    pthread_mutex_t lock;
+    // (dev, ino) of files with more than one link
+    struct table inodes;
+    // (size, content hash) of fully processed files
+    struct table contents;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+static size_t key_hash(const uint64_t key[KEY_WORDS])
+{
+    uint64_t h = key[0] * 0x9e3779b97f4a7c15ULL;
+    size_t i;
+    for (i = 1; i < KEY_WORDS; i++) {
+        h ^= key[i] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+    return (size_t)h;
+}
+
+static struct sl_dedup_ent *table_find(const struct table *t, const uint64_t key[KEY_WORDS])
+{
+    if (!t->nr_buckets) {
+        return NULL;
+    }
+
+    struct sl_dedup_ent *e = t->buckets[key_hash(key) & (t->nr_buckets - 1)];
+    for (; e; e = e->next) {
+        if (!memcmp(e->key, key, sizeof(e->key))) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static void table_grow(struct table *t)
+{
+    size_t nr_buckets = t->nr_buckets ? t->nr_buckets * 2 : 1024;
+    struct sl_dedup_ent **buckets = calloc(nr_buckets, sizeof(*buckets));
+    // GCOVR_EXCL_START: OOM
+    if (!buckets) {
+        err(EX_OSERR, _("cannot allocate dedup table"));
+    }
+    // GCOVR_EXCL_STOP
+
+    size_t i;
+    for (i = 0; i < t->nr_buckets; i++) {
+        struct sl_dedup_ent *e = t->buckets[i];
+        while (e) {
+            struct sl_dedup_ent *next = e->next;
+            size_t b = key_hash(e->key) & (nr_buckets - 1);
+            e->next = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+
+    free(t->buckets);
+    t->buckets = buckets;
+    t->nr_buckets = nr_buckets;
+}
+
+static struct sl_dedup_ent *table_insert(struct table *t, const uint64_t key[KEY_WORDS])
+{
+    if (t->nr >= t->nr_buckets) {
+        table_grow(t);
+    }
+
+    struct sl_dedup_ent *e = calloc(1, sizeof(*e));
+    // GCOVR_EXCL_START: OOM
+    if (!e) {
+        err(EX_OSERR, _("cannot allocate dedup table"));
+    }
+    // GCOVR_EXCL_STOP
+
+    memcpy(e->key, key, sizeof(e->key));
+    size_t b = key_hash(key) & (t->nr_buckets - 1);
+    e->next = t->buckets[b];
+    t->buckets[b] = e;
+    t->nr++;
+
+    return e;
+}
+
+static void table_free(struct table *t)
+{
+    size_t i;
+    for (i = 0; i < t->nr_buckets; i++) {
+        struct sl_dedup_ent *e = t->buckets[i];
+        while (e) {
+            struct sl_dedup_ent *next = e->next;
+            sl_result_free(&e->res);
+            free(e);
+            e = next;
+        }
+    }
+
+    free(t->buckets);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+struct sl_dedup *sl_dedup_new(const struct sl_cfg *cfg)
+{
+    struct sl_dedup *dd = calloc(1, sizeof(*dd));
+    // GCOVR_EXCL_START: OOM
+    if (!dd) {
+        err(EX_OSERR, _("cannot allocate dedup table"));
+    }
+    // GCOVR_EXCL_STOP
+
+    dd->cfg = cfg;
+    pthread_mutex_init(&dd->lock, NULL);
+
+    return dd;
+}
+
+void sl_dedup_free(struct sl_dedup *dd)
+{
+    table_free(&dd->inodes);
+    table_free(&dd->contents);
+    pthread_mutex_destroy(&dd->lock);
+    free(dd);
+}
+
+// shows and keeps results obtained for another path of the same file
+static void replay(struct sl_file *f, const struct sl_dedup_ent *e, unsigned int skip_analyses)
+{
+    sl_result_free(&f->res);
+    sl_result_copy(&f->res, &e->res);
+    sl_file_emit(f->dedup->cfg, f, SL_ANALYSIS_ALL & ~skip_analyses);
+}
+
+// Makes sure every inode with several links is only processed once. Returns
+// true if the file is taken care of, because it's another path to an inode
+// already seen; its findings are then shown once the inode is done.
+bool sl_dedup_inode(struct sl_dedup *dd, struct sl_file *f, uint64_t nlink)
+{
+    if (nlink < 2) {
+        return false;
+    }
+
+    // a hard link named like ld.so is processed apart from the others
+    uint64_t key[KEY_WORDS] = { f->key.dev, f->key.ino, sl_file_is_ldso(f) };
+
+    pthread_mutex_lock(&dd->lock);
+
+    struct sl_dedup_ent *e = table_find(&dd->inodes, key);
+    if (!e) {
+        // first seen, this path is the one to process
+        f->inode_ent = table_insert(&dd->inodes, key);
+        pthread_mutex_unlock(&dd->lock);
+        return false;
+    }
+
+    if (!e->done) {
+        size_t len = strlen(f->name) + 1;
+        struct alias *a = malloc(sizeof(*a) + len);
+        // GCOVR_EXCL_START: OOM
+        if (!a) {
+            err(EX_OSERR, _("cannot allocate dedup table"));
+        }
+        // GCOVR_EXCL_STOP
+
+        a->file = *f;
+        a->file.dir = sl_dir_get(f->dir);
+        memcpy(a->name, f->name, len);
+        a->file.name = a->name;
+        a->next = e->aliases;
+        e->aliases = a;
+
+        pthread_mutex_unlock(&dd->lock);
+        return true;
+    }
+
+    // results never change once done
+    pthread_mutex_unlock(&dd->lock);
+
+    replay(f, e, 0);
+    sl_file_done(f, e->outcome);
+    return true;
+}
+
+// Looks for the results of a file with the same content as the size bytes
+// at p, the file mapped whole, which has to be fully processed already.
+// Returns true if the results were taken over; findings of analyses already
+// done on the file are not shown again.
+bool sl_dedup_content(struct sl_dedup *dd, struct sl_file *f, const void *p, size_t size)
+{
+    if (sl_file_is_ldso(f)) {
+        return false;
+    }
+
+    // the hash is collision-resistant, so files can be told apart without
+    // comparing them to the one the results are from
+    uint8_t digest[32];
+    blake2b_256(p, size, digest);
+    f->content_key[0] = (uint64_t)size;
+    size_t i;
+    for (i = 0; i < 4; i++) {
+        uint64_t w;
+        memcpy(&w, digest + i * 8, 8);
+        f->content_key[i + 1] = le64toh(w);
+    }
+    f->has_content_key = true;
+
+    pthread_mutex_lock(&dd->lock);
+    struct sl_dedup_ent *e = table_find(&dd->contents, f->content_key);
+    pthread_mutex_unlock(&dd->lock);
+
+    if (!e) {
+        return false;
+    }
+    if ((sl_cfg_analyses(dd->cfg) & SL_ANALYSIS_PATCH) && !dd->cfg->dry_run && (e->res.flags & SL_RESULT_NEEDS_PATCH)) {
+        // the copy needs to be patched all the same
+        return false;
+    }
+
+    // already known under this key, no need to add it again
+    f->has_content_key = false;
+    replay(f, e, f->res.analyses);
+    return true;
+}
+
+// Shares the file's results with other paths to the same inode or content.
+void sl_dedup_publish(struct sl_dedup *dd, struct sl_file *f, enum sl_file_outcome outcome)
+{
+    struct alias *aliases = NULL;
+
+    pthread_mutex_lock(&dd->lock);
+
+    if (f->inode_ent) {
+        struct sl_dedup_ent *e = f->inode_ent;
+        sl_result_copy(&e->res, &f->res);
+        e->outcome = outcome;
+        e->done = true;
+        aliases = e->aliases;
+        e->aliases = NULL;
+        f->inode_ent = NULL;
+    }
+
+    if (f->has_content_key && outcome != SL_FILE_FAILED) {
+        if (!table_find(&dd->contents, f->content_key)) {
+            struct sl_dedup_ent *e = table_insert(&dd->contents, f->content_key);
+            sl_result_copy(&e->res, &f->res);
+            e->outcome = outcome;
+            e->done = true;
+        }
+        f->has_content_key = false;
+    }
+
+    pthread_mutex_unlock(&dd->lock);
+
+    while (aliases) {
+        struct alias *a = aliases;
+        aliases = a->next;
+
+        a->file.inode_ent = NULL;
+        a->file.has_content_key = false;
+        if (outcome != SL_FILE_FAILED) {
+            sl_result_copy(&a->file.res, &f->res);
+            sl_file_emit(dd->cfg, &a->file, SL_ANALYSIS_ALL);
+        }
+        sl_file_done(&a->file, outcome);
+        sl_dir_put(a->file.dir);
+        free(a);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef _shengloong_dedup_h
+#define _shengloong_dedup_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfg.h"
+#include "file.h"
+
+// Sharing of results between paths to the same inode, and optionally files
+// of identical content, across all roots.
+struct sl_dedup;
+
+struct sl_dedup *sl_dedup_new(const struct sl_cfg *cfg);
+void sl_dedup_free(struct sl_dedup *dd);
+bool sl_dedup_inode(struct sl_dedup *dd, struct sl_file *f, uint64_t nlink);
+bool sl_dedup_content(struct sl_dedup *dd, struct sl_file *f, const void *p, size_t size);
+void sl_dedup_publish(struct sl_dedup *dd, struct sl_file *f, enum sl_file_outcome outcome);
+
+#endif  // _shengloong_dedup_h
@@ -0,0 +1,81 @@
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "buildconfig.gen.h"
+#include "dirref.h"
+#include "gettext.h"
+
+#define _(x) gettext(x)
+
+// takes ownership of fd, and a new reference to parent if non-NULL
+struct sl_dir *sl_dir_new(struct sl_dir *parent, const char *name, int fd)
+{
+    size_t namelen = strlen(name);
+    struct sl_dir *d = malloc(sizeof(*d) + namelen + 1);
+    // GCOVR_EXCL_START: OOM
+    if (!d) {
+        err(EX_OSERR, _("cannot allocate directory entry"));
+    }
+    // GCOVR_EXCL_STOP
+
+    d->parent = parent ? sl_dir_get(parent) : NULL;
+    d->fd = fd;
+    d->refcnt = 1;
+    memcpy(d->name, name, namelen + 1);
+
+    return d;
+}
+
+struct sl_dir *sl_dir_get(struct sl_dir *d)
+{
+    // references are taken and dropped from both the walker and the workers
+    __atomic_add_fetch(&d->refcnt, 1, __ATOMIC_RELAXED);
+    return d;
+}
+
+void sl_dir_put(struct sl_dir *d)
+{
+    while (d && __atomic_sub_fetch(&d->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        struct sl_dir *parent = d->parent;
+        (void) close(d->fd);
+        free(d);
+        d = parent;
+    }
+}
+
+// returns a newly allocated path of name under d
+char *sl_dir_path(const struct sl_dir *d, const char *name)
+{
+    size_t len = strlen(name);
+    const struct sl_dir *p;
+    for (p = d; p; p = p->parent) {
+        len += strlen(p->name) + 1;
+    }
+
+    char *buf = malloc(len + 1);
+    // GCOVR_EXCL_START: OOM
+    if (!buf) {
+        err(EX_OSERR, _("cannot allocate path"));
+    }
+    // GCOVR_EXCL_STOP
+
+    // fill in from the back
+    char *q = buf + len;
+    *q = '\0';
+
+    size_t n = strlen(name);
+    q -= n;
+    memcpy(q, name, n);
+
+    for (p = d; p; p = p->parent) {
+        *--q = '/';
+        n = strlen(p->name);
+        q -= n;
+        memcpy(q, p->name, n);
+    }
+
+    return buf;
+}
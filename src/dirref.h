@@ -0,0 +1,23 @@
+#ifndef _shengloong_dirref_h
+#define _shengloong_dirref_h
+
+// A reference-counted directory visited by the walker.
+//
+// Files are opened relative to the fd of their parent directory, and full
+// path strings are only assembled from the chain of names when something
+// needs to be reported.
+struct sl_dir {
+    struct sl_dir *parent;
+    int fd;
+    unsigned int refcnt;
+
+    // relative to parent, or the root path as given for roots
+    char name[];
+};
+
+struct sl_dir *sl_dir_new(struct sl_dir *parent, const char *name, int fd);
+struct sl_dir *sl_dir_get(struct sl_dir *d);
+void sl_dir_put(struct sl_dir *d);
+char *sl_dir_path(const struct sl_dir *d, const char *name);
+
+#endif  // _shengloong_dirref_h
@@ -0,0 +1,371 @@
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elf64.h"
+#include "stats.h"
+
+// sections loaded together are kept at least this aligned, like they would
+// be in a mapping of a well-formed file
+#define SCN_ALIGN 16
+
+// whether [off, off + len) is within a buffer of the given size
+static bool in_bounds(size_t size, uint64_t off, uint64_t len)
+{
+    return off <= size && len <= size - off;
+}
+
+static bool pread_full(int fd, void *out, size_t len, uint64_t off)
+{
+    uint8_t *p = out;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, (off_t)off);
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // GCOVR_EXCL_STOP
+        // GCOVR_EXCL_START: racing with other writers
+        if (n == 0) {
+            // truncated since it was looked at
+            errno = ENODATA;
+            return false;
+        }
+        // GCOVR_EXCL_STOP
+
+        sl_stats_add(SL_STAT_BYTES_READ, (uint64_t)n);
+        p += n;
+        len -= (size_t)n;
+        off += (uint64_t)n;
+    }
+
+    return true;
+}
+
+// copies [off, off + len) of the file, which the caller has checked to be
+// within the bounds
+static bool get_bytes(const struct sl_elf64 *e, uint64_t off, void *out, size_t len)
+{
+    if (e->buf) {
+        memcpy(out, e->buf + off, len);
+        return true;
+    }
+
+    if (e->reader) {
+        return e->reader(e->reader_arg, out, len, off);
+    }
+
+    return pread_full(e->fd, out, len, e->base + off);
+}
+
+static void swap_shdr(Elf64_Shdr *shdr)
+{
+    shdr->sh_name = le32toh(shdr->sh_name);
+    shdr->sh_type = le32toh(shdr->sh_type);
+    shdr->sh_flags = le64toh(shdr->sh_flags);
+    shdr->sh_addr = le64toh(shdr->sh_addr);
+    shdr->sh_offset = le64toh(shdr->sh_offset);
+    shdr->sh_size = le64toh(shdr->sh_size);
+    shdr->sh_link = le32toh(shdr->sh_link);
+    shdr->sh_info = le32toh(shdr->sh_info);
+    shdr->sh_addralign = le64toh(shdr->sh_addralign);
+    shdr->sh_entsize = le64toh(shdr->sh_entsize);
+}
+
+static void get_shdr(const struct sl_elf64 *e, size_t idx, Elf64_Shdr *shdr)
+{
+    memcpy(shdr, e->shdrs + idx * sizeof(*shdr), sizeof(*shdr));
+    swap_shdr(shdr);
+}
+
+static void get_scn(const struct sl_elf64 *e, size_t idx, struct sl_elf64_scn *out, Elf64_Word *sh_name)
+{
+    Elf64_Shdr shdr;
+    get_shdr(e, idx, &shdr);
+
+    out->name = NULL;
+    out->type = shdr.sh_type;
+    out->info = shdr.sh_info;
+    out->offset = 0;
+    out->data = NULL;
+    out->size = 0;
+    if (shdr.sh_type != SHT_NOBITS && in_bounds(e->size, shdr.sh_offset, shdr.sh_size)) {
+        out->offset = shdr.sh_offset;
+        out->size = (size_t)shdr.sh_size;
+        if (e->buf) {
+            out->data = e->buf + shdr.sh_offset;
+        }
+    }
+
+    *sh_name = shdr.sh_name;
+}
+
+// Tells whether a read failed for the data not being all there or being
+// corrupt, rather than for not being readable at all.
+bool sl_elf64_is_malformed_errno(int error)
+{
+    return error == ENODATA || error == EBADMSG;
+}
+
+static enum sl_elf64_status read_failed(void)
+{
+    return sl_elf64_is_malformed_errno(errno) ? SL_ELF64_MALFORMED : SL_ELF64_IO_ERROR;
+}
+
+static enum sl_elf64_status parse(struct sl_elf64 *e)
+{
+    Elf64_Ehdr ehdr;
+    if (e->size < sizeof(ehdr)) {
+        return SL_ELF64_BAD_HEADER;
+    }
+    if (!get_bytes(e, 0, &ehdr, sizeof(ehdr))) {
+        return read_failed();  // GCOVR_EXCL_LINE: media error
+    }
+
+    if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0
+            || ehdr.e_ident[EI_CLASS] != ELFCLASS64
+            || ehdr.e_ident[EI_DATA] != ELFDATA2LSB) {
+        return SL_ELF64_BAD_HEADER;
+    }
+
+    uint64_t shoff = le64toh(ehdr.e_shoff);
+    if (shoff == 0) {
+        // no sections at all, which is fine
+        return SL_ELF64_OK;
+    }
+
+    if (le16toh(ehdr.e_shentsize) != sizeof(Elf64_Shdr) || !in_bounds(e->size, shoff, sizeof(Elf64_Shdr))) {
+        return SL_ELF64_NO_SHSTRNDX;
+    }
+
+    // the real numbers are kept in the first entry if they don't fit in the
+    // ELF header
+    Elf64_Shdr shdr0;
+    if (!get_bytes(e, shoff, &shdr0, sizeof(shdr0))) {
+        return read_failed();  // GCOVR_EXCL_LINE: media error
+    }
+    swap_shdr(&shdr0);
+
+    uint64_t shnum = le16toh(ehdr.e_shnum);
+    if (shnum == 0) {
+        shnum = shdr0.sh_size;
+    }
+    if (shnum > (e->size - shoff) / sizeof(Elf64_Shdr)) {
+        return SL_ELF64_NO_SHSTRNDX;
+    }
+    e->shnum = (size_t)shnum;
+    if (shnum == 0) {
+        return SL_ELF64_OK;
+    }
+
+    size_t shstrndx = le16toh(ehdr.e_shstrndx);
+    if (shstrndx == SHN_XINDEX) {
+        shstrndx = shdr0.sh_link;
+    }
+    if (shstrndx == SHN_UNDEF || shstrndx >= e->shnum) {
+        return SL_ELF64_NO_SHSTRNDX;
+    }
+
+    if (e->buf) {
+        e->shdrs = e->buf + shoff;
+    } else {
+        size_t len = e->shnum * sizeof(Elf64_Shdr);
+        e->own_shdrs = malloc(len);
+        if (!e->own_shdrs || !get_bytes(e, shoff, e->own_shdrs, len)) {
+            // malloc sets errno too
+            return read_failed();
+        }
+        e->shdrs = e->own_shdrs;
+    }
+
+    Elf64_Word unused;
+    get_scn(e, shstrndx, &e->shstrtab, &unused);
+
+    if (!e->buf && e->shstrtab.size) {
+        e->own_shstrtab = malloc(e->shstrtab.size);
+        if (!e->own_shstrtab || !get_bytes(e, e->shstrtab.offset, e->own_shstrtab, e->shstrtab.size)) {
+            return read_failed();
+        }
+        e->shstrtab.data = e->own_shstrtab;
+    }
+
+    return SL_ELF64_OK;
+}
+
+// Looks at the file in buf, all of which is kept in memory.
+enum sl_elf64_status sl_elf64_init(struct sl_elf64 *e, void *buf, size_t size)
+{
+    memset(e, 0, sizeof(*e));
+    e->buf = buf;
+    e->fd = -1;
+    e->size = size;
+
+    return parse(e);
+}
+
+// Looks at the file behind fd, only reading what's asked for: the ELF header
+// and section headers first, then the sections passed to sl_elf64_load or
+// sl_elf64_copy. sl_elf64_fini has to be called afterwards, even on errors.
+enum sl_elf64_status sl_elf64_open(struct sl_elf64 *e, int fd, size_t size)
+{
+    return sl_elf64_open_at(e, fd, 0, size);
+}
+
+// Like sl_elf64_open, for a file that's the size bytes at base in fd.
+enum sl_elf64_status sl_elf64_open_at(struct sl_elf64 *e, int fd, uint64_t base, size_t size)
+{
+    memset(e, 0, sizeof(*e));
+    e->fd = fd;
+    e->base = base;
+    e->size = size;
+
+    return parse(e);
+}
+
+// Like sl_elf64_open, reading through reader instead, e.g. from a compressed
+// file. Parts of the file are asked for in the order they're looked at,
+// mostly front to back.
+enum sl_elf64_status sl_elf64_open_reader(struct sl_elf64 *e, sl_elf64_reader reader, void *arg, size_t size)
+{
+    memset(e, 0, sizeof(*e));
+    e->fd = -1;
+    e->reader = reader;
+    e->reader_arg = arg;
+    e->size = size;
+
+    return parse(e);
+}
+
+void sl_elf64_fini(struct sl_elf64 *e)
+{
+    free(e->own_shdrs);
+    free(e->own_shstrtab);
+    free(e->own_scns);
+    e->own_shdrs = NULL;
+    e->own_shstrtab = NULL;
+    e->own_scns = NULL;
+}
+
+// Gets the idx-th section. Returns false if there's no such section; a name
+// that cannot be found is left NULL.
+bool sl_elf64_scn(const struct sl_elf64 *e, size_t idx, struct sl_elf64_scn *out)
+{
+    if (idx >= e->shnum) {
+        return false;
+    }
+
+    Elf64_Word sh_name;
+    get_scn(e, idx, out, &sh_name);
+    out->name = sl_elf64_str(&e->shstrtab, sh_name);
+
+    return true;
+}
+
+// Makes the contents of the given sections available through their data,
+// reading them all into one buffer if needed; sections loaded before are let
+// go. Returns false with errno set if they cannot be read.
+bool sl_elf64_load(struct sl_elf64 *e, struct sl_elf64_scn *const *scns, size_t n)
+{
+    if (e->buf) {
+        return true;
+    }
+
+    free(e->own_scns);
+    e->own_scns = NULL;
+
+    size_t total = 0;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        total += (scns[i]->size + SCN_ALIGN - 1) & ~(size_t)(SCN_ALIGN - 1);
+    }
+    if (total == 0) {
+        return true;
+    }
+
+    if (posix_memalign((void **)&e->own_scns, SCN_ALIGN, total)) {
+        // GCOVR_EXCL_START: OOM
+        errno = ENOMEM;
+        return false;
+        // GCOVR_EXCL_STOP
+    }
+
+    uint8_t *p = e->own_scns;
+    for (i = 0; i < n; i++) {
+        struct sl_elf64_scn *scn = scns[i];
+        if (!scn->size) {
+            continue;
+        }
+
+        if (!get_bytes(e, scn->offset, p, scn->size)) {
+            return false;  // GCOVR_EXCL_LINE: media error
+        }
+
+        scn->data = p;
+        p += (scn->size + SCN_ALIGN - 1) & ~(size_t)(SCN_ALIGN - 1);
+    }
+
+    return true;
+}
+
+// Copies len bytes at off in the section to out, whether or not the section
+// is loaded, e.g. to go through a large section piece by piece. Returns
+// false if they're not all there, or cannot be read, with errno set then.
+bool sl_elf64_copy(const struct sl_elf64 *e, const struct sl_elf64_scn *scn, size_t off, void *out, size_t len)
+{
+    if (!in_bounds(scn->size, off, len)) {
+        errno = ERANGE;
+        return false;
+    }
+
+    if (scn->data) {
+        memcpy(out, scn->data + off, len);
+        return true;
+    }
+
+    return get_bytes(e, scn->offset + off, out, len);
+}
+
+// Returns the NUL-terminated string at off in the string table, or NULL if
+// there's none.
+const char *sl_elf64_str(const struct sl_elf64_scn *strtab, size_t off)
+{
+    if (!strtab->data || off >= strtab->size) {
+        return NULL;
+    }
+
+    const char *s = (const char *)strtab->data + off;
+    if (!memchr(s, '\0', strtab->size - off)) {
+        return NULL;
+    }
+
+    return s;
+}
+
+// Copies len bytes at off in the section to out, e.g. to get a structure
+// regardless of its alignment. Returns false if they're not all there.
+bool sl_elf64_read(const struct sl_elf64_scn *scn, size_t off, void *out, size_t len)
+{
+    const void *p = sl_elf64_ptr(scn, off, len);
+    if (!p) {
+        return false;
+    }
+
+    memcpy(out, p, len);
+    return true;
+}
+
+// Returns where the len bytes at off in the section are, or NULL if they're
+// not all there.
+void *sl_elf64_ptr(const struct sl_elf64_scn *scn, size_t off, size_t len)
+{
+    if (!scn->data || !in_bounds(scn->size, off, len)) {
+        return NULL;
+    }
+
+    return scn->data + off;
+}
@@ -0,0 +1,78 @@
+#ifndef _shengloong_elf64_h
+#define _shengloong_elf64_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <elf.h>
+
+// A section's header in host byte order, along with its contents. offset
+// and size tell where the contents are in the file; size is 0 if the section
+// occupies no space in the file, or not all of the space it claims to occupy
+// is within the file. data is NULL if there's nothing, or if the contents
+// are not loaded yet.
+struct sl_elf64_scn {
+    const char *name;
+    Elf64_Word type;
+    Elf64_Word info;
+    uint64_t offset;
+    uint8_t *data;
+    size_t size;
+};
+
+// Copies len bytes at off in a file to out, returning false with errno set
+// if they cannot be read: ENODATA if the file ends before, EBADMSG if it's
+// corrupt, like a compressed stream can be.
+typedef bool (*sl_elf64_reader)(void *arg, void *out, size_t len, uint64_t off);
+
+// A little-endian ELF64 file, either in memory, mmap'd or otherwise, or read
+// piece by piece from fd or through a reader. Every access is checked against
+// the file bounds.
+struct sl_elf64 {
+    // NULL if reading from fd or through a reader
+    uint8_t *buf;
+    int fd;
+    sl_elf64_reader reader;
+    void *reader_arg;
+    // where the file starts in fd, e.g. as a member of an archive
+    uint64_t base;
+    size_t size;
+
+    // raw section header table, in file byte order
+    const uint8_t *shdrs;
+    size_t shnum;
+    struct sl_elf64_scn shstrtab;
+
+    // only if reading from fd or through a reader: what's been read in, i.e. the section header
+    // table, the section names, and the sections loaded
+    uint8_t *own_shdrs;
+    uint8_t *own_shstrtab;
+    uint8_t *own_scns;
+};
+
+enum sl_elf64_status {
+    SL_ELF64_OK,
+    SL_ELF64_BAD_HEADER,
+    // the section headers or their names are not all there
+    SL_ELF64_NO_SHSTRNDX,
+    // only if reading from fd or through a reader, errno tells why
+    SL_ELF64_IO_ERROR,
+    // only if reading through a reader, and the data ran out or is corrupt
+    SL_ELF64_MALFORMED,
+};
+
+enum sl_elf64_status sl_elf64_init(struct sl_elf64 *e, void *buf, size_t size);
+enum sl_elf64_status sl_elf64_open(struct sl_elf64 *e, int fd, size_t size);
+enum sl_elf64_status sl_elf64_open_at(struct sl_elf64 *e, int fd, uint64_t base, size_t size);
+enum sl_elf64_status sl_elf64_open_reader(struct sl_elf64 *e, sl_elf64_reader reader, void *arg, size_t size);
+void sl_elf64_fini(struct sl_elf64 *e);
+bool sl_elf64_scn(const struct sl_elf64 *e, size_t idx, struct sl_elf64_scn *out);
+bool sl_elf64_load(struct sl_elf64 *e, struct sl_elf64_scn *const *scns, size_t n);
+bool sl_elf64_copy(const struct sl_elf64 *e, const struct sl_elf64_scn *scn, size_t off, void *out, size_t len);
+const char *sl_elf64_str(const struct sl_elf64_scn *strtab, size_t off);
+bool sl_elf64_read(const struct sl_elf64_scn *scn, size_t off, void *out, size_t len);
+bool sl_elf64_is_malformed_errno(int error);
+void *sl_elf64_ptr(const struct sl_elf64_scn *scn, size_t off, size_t len);
+
+#endif  // _shengloong_elf64_h
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+
+#include "dedup.h"
+#include "file.h"
+#include "index.h"
+#include "processing.h"
+#include "reorder.h"
+#include "utils.h"
+
+// ld.so gets patched in more ways than other files, so the results of
+// processing it depend on the name it's found under too, which rules out
+// sharing them with other paths or keeping them in the index.
+bool sl_file_is_ldso(const struct sl_file *f)
+{
+    return endswith(f->name, "ld-linux-loongarch-lp64d.so.1", 29);
+}
+
+// Shows the findings of the given analyses already in the file's results, as
+// if it had just been processed.
+void sl_file_emit(const struct sl_cfg *cfg, struct sl_file *f, unsigned int analyses)
+{
+    char *path = NULL;
+    size_t i;
+    for (i = 0; i < f->res.nr_findings; i++) {
+        struct sl_finding finding;
+        sl_result_get(&f->res.findings[i], f->res.strs, &finding);
+        if (!(analyses & sl_finding_analysis(finding.kind)) || !sl_finding_shown(cfg, finding.kind)) {
+            continue;
+        }
+
+        if (!path) {
+            path = sl_dir_path(f->dir, f->name);
+        }
+        sl_finding_emit(cfg, &f->out, path, &finding);
+    }
+    free(path);
+}
+
+// writes out the output about the file, after that of the files before it
+// if need be
+static void commit_output(struct sl_file *f)
+{
+    if (f->reorder) {
+        sl_reorder_commit(f->reorder, f->seq, &f->out);
+    } else {
+        sl_output_commit(&f->out);
+    }
+}
+
+// Done with the file: writes out its records, keeps the results in the index
+// if they still describe the file, shares them with other paths waiting for
+// them, then frees them.
+void sl_file_done(struct sl_file *f, enum sl_file_outcome outcome)
+{
+    commit_output(f);
+
+    if (outcome == SL_FILE_FAILED) {
+        sl_result_free(&f->res);
+    } else if (f->res.flags & SL_RESULT_NEEDS_PATCH) {
+        patch_note_file(outcome == SL_FILE_CHANGED);
+    }
+
+    if (f->index && outcome == SL_FILE_UNCHANGED && !sl_file_is_ldso(f)) {
+        sl_index_record(f->index, &f->key, &f->res);
+    }
+
+    if (f->dedup) {
+        sl_dedup_publish(f->dedup, f, outcome);
+    }
+
+    sl_result_free(&f->res);
+}
+
+// for files that are not ELF at all
+void sl_file_done_uninteresting(struct sl_file *f)
+{
+    f->res.analyses = SL_ANALYSIS_ALL;
+    sl_file_done(f, SL_FILE_UNCHANGED);
+}
+
+// for files given up on before anything is learned about them, like those
+// removed since the walker saw them
+void sl_file_skip(struct sl_file *f)
+{
+    commit_output(f);
+}
@@ -0,0 +1,75 @@
+#ifndef _shengloong_file_h
+#define _shengloong_file_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfg.h"
+#include "dirref.h"
+#include "output.h"
+#include "report.h"
+#include "zstream.h"
+
+struct sl_dedup;
+struct sl_dedup_ent;
+struct sl_index;
+struct sl_reorder;
+
+// identifies a particular state of an inode; any change to the file's
+// content changes at least the ctime
+struct sl_file_key {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+};
+
+// A file found by the walker, along with what's learned about it so far.
+struct sl_file {
+    struct sl_dir *dir;
+    const char *name;
+    struct sl_file_key key;
+
+    // an ar archive, whose members are looked into instead
+    bool is_archive;
+    // compressed as a whole, and decompressed as it's looked into
+    enum sl_compression compression;
+
+    // only used if an index is being kept
+    struct sl_index *index;
+
+    // set if other paths to the same inode wait for this file's results, or
+    // if its content got hashed; the content key is the size, then the
+    // BLAKE2b-256 of the content
+    struct sl_dedup *dedup;
+    struct sl_dedup_ent *inode_ent;
+    bool has_content_key;
+    uint64_t content_key[5];
+
+    struct sl_file_result res;
+
+    // output about the file not written out yet, and where it goes if it
+    // has to wait for that of files found before
+    struct sl_output out;
+    struct sl_reorder *reorder;
+    size_t seq;
+};
+
+enum sl_file_outcome {
+    // the results describe the file as it is now
+    SL_FILE_UNCHANGED,
+    // the results describe the file before it got patched
+    SL_FILE_CHANGED,
+    // nothing useful was learned
+    SL_FILE_FAILED,
+};
+
+bool sl_file_is_ldso(const struct sl_file *f);
+void sl_file_emit(const struct sl_cfg *cfg, struct sl_file *f, unsigned int analyses);
+void sl_file_done(struct sl_file *f, enum sl_file_outcome outcome);
+void sl_file_done_uninteresting(struct sl_file *f);
+void sl_file_skip(struct sl_file *f);
+
+#endif  // _shengloong_file_h
@@ -0,0 +1,93 @@
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "buildconfig.gen.h"
+#include "filelist.h"
+#include "gettext.h"
+#include "utils.h"
+
+#define _(x) gettext(x)
+
+// Loads the paths listed in the file at path, or stdin if it's "-". They're
+// separated by NULs if there's any NUL at all, like the output of find
+// -print0, and by newlines otherwise; empty ones are skipped. Returns 0 on
+// success, or an exit code after telling what went wrong.
+int sl_filelist_load(struct sl_filelist *list, const char *path)
+{
+    bool is_stdin = !strcmp(path, "-");
+    FILE *fp = is_stdin ? stdin : fopen(path, "re");
+    if (!fp) {
+        warn(_("cannot open %s"), path);
+        return EX_NOINPUT;
+    }
+
+    memset(list, 0, sizeof(*list));
+
+    // the whole list is needed anyway, as it's gone through once per root
+    size_t len = 0;
+    size_t cap = 0;
+    for (;;) {
+        if (cap - len < BUFSIZ) {
+            cap = cap ? cap * 2 : BUFSIZ * 4;
+            list->buf = realloc(list->buf, cap + 1);
+            // GCOVR_EXCL_START: OOM
+            if (!list->buf) {
+                err(EX_OSERR, _("cannot allocate file list"));
+            }
+            // GCOVR_EXCL_STOP
+        }
+
+        size_t n = fread(list->buf + len, 1, cap - len, fp);
+        len += n;
+        if (n == 0) {
+            break;
+        }
+    }
+
+    int ret = 0;
+    if (ferror(fp)) {
+        warnx(_("cannot read %s"), path);
+        ret = EX_IOERR;
+    }
+    if (!is_stdin) {
+        (void) fclose(fp);
+    }
+    if (ret) {
+        sl_filelist_free(list);
+        return ret;
+    }
+
+    list->buf[len] = '\0';
+    char sep = memchr(list->buf, '\0', len) ? '\0' : '\n';
+
+    size_t cap_paths = 0;
+    char *p = list->buf;
+    char *end = list->buf + len;
+    while (p < end) {
+        char *q = memchr(p, sep, (size_t)(end - p));
+        if (!q) {
+            q = end;
+        }
+        *q = '\0';
+
+        if (*p) {
+            list->paths = grow_array(list->paths, &cap_paths, list->nr + 1, sizeof(*list->paths));
+            list->paths[list->nr++] = p;
+        }
+
+        p = q + 1;
+    }
+
+    return 0;
+}
+
+void sl_filelist_free(struct sl_filelist *list)
+{
+    free(list->paths);
+    free(list->buf);
+    memset(list, 0, sizeof(*list));
+}
@@ -0,0 +1,18 @@
+#ifndef _shengloong_filelist_h
+#define _shengloong_filelist_h
+
+#include <stddef.h>
+
+// Paths to look at under every root, instead of walking the whole trees,
+// like a package manager's list of the files just installed.
+struct sl_filelist {
+    // pointing into buf, in the order listed
+    char **paths;
+    size_t nr;
+    char *buf;
+};
+
+int sl_filelist_load(struct sl_filelist *list, const char *path);
+void sl_filelist_free(struct sl_filelist *list);
+
+#endif  // _shengloong_filelist_h
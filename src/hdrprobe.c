@@ -0,0 +1,481 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+#include "archive.h"
+#include "buildconfig.gen.h"
+#include "gettext.h"
+#include "hdrprobe.h"
+#include "processing.h"
+#include "stats.h"
+
+#define _(x) gettext(x)
+
+// how many files to open and probe per round-trip
+#define BATCH_SIZE 256
+
+// each file needs a statx, then an openat, then a read hard-linked to a
+// close, and has at most two of them in flight at once
+#define SQ_ENTRIES (2 * BATCH_SIZE)
+
+enum probe_op {
+    PROBE_OP_OPEN = 0,
+    PROBE_OP_READ = 1,
+    PROBE_OP_CLOSE = 2,
+    PROBE_OP_STAT = 3,
+};
+
+#define USER_DATA(idx, op) (((uint64_t)(idx) << 2) | (op))
+#define USER_DATA_IDX(x) ((size_t)((x) >> 2))
+#define USER_DATA_OP(x) ((enum probe_op)((x) & 3))
+
+struct probe_slot {
+    struct sl_file file;
+    char name[NAME_MAX + 1];
+    // if the walker hasn't looked at the file's size yet
+    bool needs_stat;
+    struct statx stx;
+    // bytes read, or the negated errno of what failed; 0 too for files left
+    // alone for not being large enough
+    int res;
+    Elf64_Ehdr ehdr;
+};
+
+struct sl_hdrprobe {
+    const struct sl_cfg *cfg;
+    int ring_fd;
+
+    // submission queue
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sq_pending;
+
+    // completion queue
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    struct probe_slot slots[BATCH_SIZE];
+    size_t nr_slots;
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// the ops we need all appeared in Linux 5.6
+static bool are_ops_supported(int ring_fd)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *p = calloc(1, len);
+    // GCOVR_EXCL_START: OOM
+    if (!p) {
+        return false;
+    }
+    // GCOVR_EXCL_STOP
+
+    bool ret = false;
+    if (sys_io_uring_register(ring_fd, IORING_REGISTER_PROBE, p, 256) < 0) {
+        goto out;
+    }
+
+    static const uint8_t needed_ops[] = { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+    size_t i;
+    for (i = 0; i < sizeof(needed_ops); i++) {
+        uint8_t op = needed_ops[i];
+        if (op > p->last_op || !(p->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            goto out;
+        }
+    }
+
+    ret = true;
+
+out:
+    free(p);
+    return ret;
+}
+
+struct sl_hdrprobe *sl_hdrprobe_new(const struct sl_cfg *cfg)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int ring_fd = sys_io_uring_setup(SQ_ENTRIES, &params);
+    if (ring_fd < 0) {
+        // not supported by the kernel, or disabled by policy
+        return NULL;
+    }
+
+    if (!are_ops_supported(ring_fd) || !(params.features & IORING_FEAT_NODROP)) {
+        (void) close(ring_fd);
+        return NULL;
+    }
+
+    struct sl_hdrprobe *hp = calloc(1, sizeof(*hp));
+    // GCOVR_EXCL_START: OOM
+    if (!hp) {
+        err(EX_OSERR, _("cannot allocate header prober"));
+    }
+    // GCOVR_EXCL_STOP
+
+    hp->cfg = cfg;
+    hp->ring_fd = ring_fd;
+
+    hp->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    hp->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (hp->cq_ring_size > hp->sq_ring_size) {
+            hp->sq_ring_size = hp->cq_ring_size;
+        }
+        hp->cq_ring_size = hp->sq_ring_size;
+    }
+
+    hp->sq_ring = mmap(NULL, hp->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (hp->sq_ring == MAP_FAILED) {
+        goto fail_close;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        hp->cq_ring = hp->sq_ring;
+    } else {
+        hp->cq_ring = mmap(NULL, hp->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (hp->cq_ring == MAP_FAILED) {
+            goto fail_unmap_sq;
+        }
+    }
+
+    hp->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    hp->sqes = mmap(NULL, hp->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (hp->sqes == MAP_FAILED) {
+        goto fail_unmap_cq;
+    }
+
+    uint8_t *sq = hp->sq_ring;
+    hp->sq_head = (unsigned int *)(sq + params.sq_off.head);
+    hp->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    hp->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    hp->sq_array = (unsigned int *)(sq + params.sq_off.array);
+
+    uint8_t *cq = hp->cq_ring;
+    hp->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    hp->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    hp->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    hp->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return hp;
+
+fail_unmap_cq:
+    if (hp->cq_ring != hp->sq_ring) {
+        (void) munmap(hp->cq_ring, hp->cq_ring_size);
+    }
+fail_unmap_sq:
+    (void) munmap(hp->sq_ring, hp->sq_ring_size);
+fail_close:
+    (void) close(ring_fd);
+    free(hp);
+    return NULL;
+}
+
+void sl_hdrprobe_free(struct sl_hdrprobe *hp)
+{
+    (void) munmap(hp->sqes, hp->sqes_size);
+    if (hp->cq_ring != hp->sq_ring) {
+        (void) munmap(hp->cq_ring, hp->cq_ring_size);
+    }
+    (void) munmap(hp->sq_ring, hp->sq_ring_size);
+    (void) close(hp->ring_fd);
+    free(hp);
+}
+
+static struct io_uring_sqe *get_sqe(struct sl_hdrprobe *hp)
+{
+    // the kernel consumes all pending entries at every io_uring_enter, and
+    // the ring is sized for the worst case of a whole batch, so this never
+    // overflows
+    unsigned int tail = *hp->sq_tail + hp->sq_pending;
+    unsigned int idx = tail & *hp->sq_mask;
+    struct io_uring_sqe *sqe = &hp->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    hp->sq_array[idx] = idx;
+    hp->sq_pending++;
+    return sqe;
+}
+
+static void queue_stat(struct sl_hdrprobe *hp, size_t idx)
+{
+    struct probe_slot *slot = &hp->slots[idx];
+    struct io_uring_sqe *sqe = get_sqe(hp);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = slot->file.dir->fd;
+    sqe->addr = (uint64_t)(uintptr_t)slot->name;
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = (uint64_t)(uintptr_t)&slot->stx;
+    sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+    sqe->user_data = USER_DATA(idx, PROBE_OP_STAT);
+}
+
+static void queue_open(struct sl_hdrprobe *hp, size_t idx)
+{
+    struct probe_slot *slot = &hp->slots[idx];
+    struct io_uring_sqe *sqe = get_sqe(hp);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = slot->file.dir->fd;
+    sqe->addr = (uint64_t)(uintptr_t)slot->name;
+    // never block the ring on the likes of FIFOs swapped in since the walk
+    sqe->open_flags = O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NONBLOCK;
+    sqe->user_data = USER_DATA(idx, PROBE_OP_OPEN);
+}
+
+static void queue_read_and_close(struct sl_hdrprobe *hp, size_t idx, int fd)
+{
+    struct probe_slot *slot = &hp->slots[idx];
+
+    struct io_uring_sqe *sqe = get_sqe(hp);
+    sqe->opcode = IORING_OP_READ;
+    // the close must happen even if the read fails or comes up short
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->ehdr;
+    sqe->len = sizeof(slot->ehdr);
+    sqe->off = 0;
+    sqe->user_data = USER_DATA(idx, PROBE_OP_READ);
+
+    sqe = get_sqe(hp);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = USER_DATA(idx, PROBE_OP_CLOSE);
+}
+
+static int submit_and_wait(struct sl_hdrprobe *hp)
+{
+    __atomic_store_n(hp->sq_tail, *hp->sq_tail + hp->sq_pending, __ATOMIC_RELEASE);
+    unsigned int to_submit = hp->sq_pending;
+    hp->sq_pending = 0;
+
+    for (;;) {
+        int ret = sys_io_uring_enter(hp->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (ret >= 0) {
+            return 0;
+        }
+        // GCOVR_EXCL_START: interrupted, or kernel out of memory
+        if (errno != EINTR && errno != EAGAIN) {
+            return -1;
+        }
+        // the SQEs were not consumed if the call failed before submission
+        to_submit = *hp->sq_tail - __atomic_load_n(hp->sq_head, __ATOMIC_ACQUIRE);
+        // GCOVR_EXCL_STOP
+    }
+}
+
+// archives and compressed files are the only ones needing more than their
+// first bytes; they're few enough to be gone through right away, outside the
+// ring
+static void process_slot(struct sl_hdrprobe *hp, struct probe_slot *slot)
+{
+    int fd = openat(slot->file.dir->fd, slot->name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    // GCOVR_EXCL_START: racing with other writers
+    if (fd < 0) {
+        sl_file_done(&slot->file, SL_FILE_FAILED);
+        return;
+    }
+    // GCOVR_EXCL_STOP
+
+    // fd is moved into process
+    (void) process(hp->cfg, &slot->file, fd);
+    sl_stats_phase(SL_PHASE_OPEN);
+}
+
+// Errors that only concern the file at hand, like it being removed after
+// the walker saw it, or not being readable; the walk goes on without it.
+static bool is_file_error(int error)
+{
+    switch (error) {
+    case ENOENT:
+    case EACCES:
+    case EPERM:
+    case EIO:
+    case ENXIO:
+    case EAGAIN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// handles what the probe came to for a file; returns false if it failed in a
+// way that stops the walk, just like the synchronous path does
+static bool finish_slot(struct sl_hdrprobe *hp, struct probe_slot *slot)
+{
+    if (slot->res < 0) {
+        if (slot->res == -ENOENT) {
+            // vanished in the meantime
+            sl_file_skip(&slot->file);
+            return true;
+        }
+        sl_file_done(&slot->file, SL_FILE_FAILED);
+        return is_file_error(-slot->res);
+    }
+
+    size_t nr_read = (size_t)slot->res;
+    if (sl_ar_is_archive(&slot->ehdr, nr_read)) {
+        if (process_armag(hp->cfg, &slot->file)) {
+            process_slot(hp, slot);
+        }
+        return true;
+    }
+
+    enum sl_compression c = sl_compression_detect(&slot->ehdr, nr_read);
+    if (c != SL_COMPRESSION_NONE) {
+        if (process_zmagic(hp->cfg, &slot->file, c)) {
+            process_slot(hp, slot);
+        }
+        return true;
+    }
+
+    if (nr_read < sizeof(slot->ehdr) || memcmp(slot->ehdr.e_ident, ELFMAG, SELFMAG)) {
+        // too small to be an ELF, or not an ELF at all
+        sl_file_done_uninteresting(&slot->file);
+        return true;
+    }
+
+    // everything that's needed is in the header, so this completes the
+    // processing
+    (void) process_ehdr(hp->cfg, &slot->file, &slot->ehdr);
+    return true;
+}
+
+// Probes all queued files. The results are only handled once the whole
+// batch is done, in the order the files were queued, so that the output
+// doesn't depend on the order the reads complete in.
+bool sl_hdrprobe_flush(struct sl_hdrprobe *hp)
+{
+    size_t i;
+
+    sl_stats_phase(SL_PHASE_OPEN);
+    for (i = 0; i < hp->nr_slots; i++) {
+        if (hp->slots[i].needs_stat) {
+            queue_stat(hp, i);
+        } else {
+            queue_open(hp, i);
+        }
+    }
+
+    size_t in_flight = hp->nr_slots;
+    while (in_flight > 0) {
+        // GCOVR_EXCL_START: ring fd went bad
+        if (submit_and_wait(hp) < 0) {
+            err(EX_OSERR, _("io_uring_enter failed"));
+        }
+        // GCOVR_EXCL_STOP
+
+        unsigned int head = *hp->cq_head;
+        unsigned int tail = __atomic_load_n(hp->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &hp->cqes[head & *hp->cq_mask];
+            size_t idx = USER_DATA_IDX(cqe->user_data);
+            struct probe_slot *slot = &hp->slots[idx];
+            in_flight--;
+
+            switch (USER_DATA_OP(cqe->user_data)) {
+            case PROBE_OP_STAT:
+                if (cqe->res < 0) {
+                    slot->res = cqe->res;
+                } else if (S_ISREG(slot->stx.stx_mode) && slot->stx.stx_size >= sizeof(Elf64_Ehdr)) {
+                    queue_open(hp, idx);
+                    in_flight++;
+                }
+                // otherwise not worth opening: ELF files must be at least
+                // as large as their header, and pseudo files like the ones
+                // in /proc claim to be empty, and may block or have side
+                // effects when read
+                break;
+
+            case PROBE_OP_OPEN:
+                if (cqe->res < 0) {
+                    slot->res = cqe->res;
+                    break;
+                }
+                queue_read_and_close(hp, idx, cqe->res);
+                in_flight += 2;
+                break;
+
+            case PROBE_OP_READ:
+                slot->res = cqe->res;
+                if (cqe->res > 0) {
+                    sl_stats_add(SL_STAT_BYTES_READ, (uint64_t)cqe->res);
+                }
+                break;
+
+            case PROBE_OP_CLOSE:
+                break;
+            }
+        }
+        __atomic_store_n(hp->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    bool ok = true;
+    for (i = 0; i < hp->nr_slots; i++) {
+        struct probe_slot *slot = &hp->slots[i];
+        if (ok) {
+            ok = finish_slot(hp, slot);
+        }
+        sl_dir_put(slot->file.dir);
+    }
+    hp->nr_slots = 0;
+
+    return ok;
+}
+
+// Queues the file for probing; returns false if a batch got flushed and had
+// errors. Files the walker has not stat'ed yet are only opened if they're
+// regular files large enough to be an ELF.
+bool sl_hdrprobe_add(struct sl_hdrprobe *hp, const struct sl_file *f, bool needs_stat)
+{
+    struct probe_slot *slot = &hp->slots[hp->nr_slots++];
+    slot->needs_stat = needs_stat;
+    slot->res = 0;
+    slot->file = *f;
+    slot->file.dir = sl_dir_get(f->dir);
+    // d_name is bounded by NAME_MAX
+    strcpy(slot->name, f->name);
+    slot->file.name = slot->name;
+
+    if (hp->nr_slots < BATCH_SIZE) {
+        return true;
+    }
+
+    return sl_hdrprobe_flush(hp);
+}
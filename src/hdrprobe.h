@@ -0,0 +1,20 @@
+#ifndef _shengloong_hdrprobe_h
+#define _shengloong_hdrprobe_h
+
+#include <stdbool.h>
+
+#include "cfg.h"
+#include "file.h"
+
+// Batched ELF header probing with io_uring, for modes where nothing beyond
+// the ELF header is ever needed; the odd archive or compressed file found is
+// gone through synchronously.
+struct sl_hdrprobe;
+
+// returns NULL if io_uring is not usable on the running kernel
+struct sl_hdrprobe *sl_hdrprobe_new(const struct sl_cfg *cfg);
+void sl_hdrprobe_free(struct sl_hdrprobe *hp);
+bool sl_hdrprobe_add(struct sl_hdrprobe *hp, const struct sl_file *f, bool needs_stat);
+bool sl_hdrprobe_flush(struct sl_hdrprobe *hp);
+
+#endif  // _shengloong_hdrprobe_h
@@ -0,0 +1,454 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "buildconfig.gen.h"
+#include "gettext.h"
+#include "index.h"
+#include "utils.h"
+
+#define _(x) gettext(x)
+
+// On-disk layout, in host byte order as the index is never meant to be
+// shared between machines:
+//
+//   struct index_header
+//   struct index_entry[nr_entries], sorted by (dev, ino)
+//   struct sl_rec_finding[nr_findings]
+//   char strs[strs_size]
+//
+// The whole file is mapped read-only, and looked up by binary search.
+#define INDEX_MAGIC "SLINDEX"
+#define INDEX_VERSION 4
+#define INDEX_BYTE_ORDER 0x01020304U
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    // findings of the patching analysis are only valid for the same versions
+    uint32_t from_elfhash;
+    uint32_t to_elfhash;
+    // and those of the syscall ABI analysis for the same syscalls
+    uint32_t removed_syscalls_hash;
+    uint32_t reserved;
+    uint64_t nr_entries;
+    uint64_t nr_findings;
+    uint64_t strs_size;
+};
+
+struct index_entry {
+    struct sl_file_key key;
+    uint32_t analyses;
+    uint32_t flags;
+    uint32_t e_flags;
+    uint32_t nr_findings;
+    uint64_t first_finding;
+};
+
+struct sl_index {
+    const struct sl_cfg *cfg;
+    char *path;
+
+    // the previous run's index, if any
+    void *map;
+    size_t map_size;
+    const struct index_entry *old_entries;
+    size_t nr_old_entries;
+    const struct sl_rec_finding *old_findings;
+    const char *old_strs;
+    unsigned int old_valid_analyses;
+    // whether the old entries of files not seen this run are written too
+    bool keep_unseen;
+
+    // results gathered during this run, possibly from worker threads
+    pthread_mutex_t lock;
+    struct index_entry *entries;
+    size_t nr_entries;
+    size_t cap_entries;
+    struct sl_file_result pool;  // only the findings and strs are used
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int key_cmp(const struct sl_file_key *a, const struct sl_file_key *b)
+{
+    if (a->dev != b->dev) {
+        return a->dev < b->dev ? -1 : 1;
+    }
+    if (a->ino != b->ino) {
+        return a->ino < b->ino ? -1 : 1;
+    }
+    return 0;
+}
+
+static bool key_same_state(const struct sl_file_key *a, const struct sl_file_key *b)
+{
+    return a->size == b->size && a->mtime_ns == b->mtime_ns && a->ctime_ns == b->ctime_ns;
+}
+
+// FNV-1a, good enough for naming index files after their roots
+static uint64_t hash_str(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static bool load(struct sl_index *idx)
+{
+    int fd = open(idx->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        // first run
+        return errno == ENOENT;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(struct index_header)) {
+        (void) close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    (void) close(fd);
+    // GCOVR_EXCL_START: unlikely
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    // GCOVR_EXCL_STOP
+
+    idx->map = map;
+    idx->map_size = (size_t)sb.st_size;
+
+    const struct index_header *h = map;
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) || h->version != INDEX_VERSION || h->byte_order != INDEX_BYTE_ORDER) {
+        return false;
+    }
+
+    // all sizes must add up exactly
+    uint64_t size = sizeof(*h);
+    if (h->nr_entries > idx->map_size / sizeof(struct index_entry) || h->nr_findings > idx->map_size / sizeof(struct sl_rec_finding)) {
+        return false;
+    }
+    size += h->nr_entries * sizeof(struct index_entry);
+    size += h->nr_findings * sizeof(struct sl_rec_finding);
+    size += h->strs_size;
+    if (size != idx->map_size || (h->strs_size && ((const char *)map)[size - 1] != '\0')) {
+        return false;
+    }
+
+    idx->old_entries = (const struct index_entry *)(h + 1);
+    idx->nr_old_entries = h->nr_entries;
+    idx->old_findings = (const struct sl_rec_finding *)(idx->old_entries + h->nr_entries);
+    idx->old_strs = (const char *)(idx->old_findings + h->nr_findings);
+
+    size_t i;
+    for (i = 0; i < idx->nr_old_entries; i++) {
+        const struct index_entry *e = &idx->old_entries[i];
+        if (e->first_finding > h->nr_findings || e->nr_findings > h->nr_findings - e->first_finding) {
+            idx->nr_old_entries = 0;
+            return false;
+        }
+    }
+
+    for (i = 0; i < h->nr_findings; i++) {
+        const struct sl_rec_finding *rf = &idx->old_findings[i];
+        if (rf->kind >= SL_FINDING_KIND_MAX || (rf->str_off != SL_NO_STR && rf->str_off >= h->strs_size)) {
+            idx->nr_old_entries = 0;
+            return false;
+        }
+    }
+
+    idx->old_valid_analyses = SL_ANALYSIS_ALL;
+    if (h->from_elfhash != idx->cfg->from_elfhash || h->to_elfhash != idx->cfg->to_elfhash) {
+        idx->old_valid_analyses &= ~SL_ANALYSIS_PATCH;
+    }
+    if (h->removed_syscalls_hash != idx->cfg->removed_syscalls_hash) {
+        idx->old_valid_analyses &= ~SL_ANALYSIS_SYSCALL;
+    }
+
+    return true;
+}
+
+// Opens the index for the given root, loading the previous run's results if
+// there are any. Returns NULL if the index cannot be used at all.
+struct sl_index *sl_index_open(const struct sl_cfg *cfg, const char *index_dir, const char *root)
+{
+    char *real_root = realpath(root, NULL);
+    if (!real_root) {
+        return NULL;
+    }
+
+    if (mkdir(index_dir, 0755) < 0 && errno != EEXIST) {
+        warn(_("cannot create index directory %s"), index_dir);
+        free(real_root);
+        return NULL;
+    }
+
+    struct sl_index *idx = calloc(1, sizeof(*idx));
+    // GCOVR_EXCL_START: OOM
+    if (!idx) {
+        err(EX_OSERR, _("cannot allocate index"));
+    }
+    // GCOVR_EXCL_STOP
+
+    idx->cfg = cfg;
+    if (asprintf(&idx->path, "%s/%016llx.idx", index_dir, (unsigned long long)hash_str(real_root)) < 0) {
+        err(EX_OSERR, _("cannot allocate index"));  // GCOVR_EXCL_LINE: OOM
+    }
+    free(real_root);
+
+    if (!load(idx)) {
+        warnx(_("%s: ignoring invalid index"), idx->path);
+        if (idx->map) {
+            (void) munmap(idx->map, idx->map_size);
+            idx->map = NULL;
+        }
+        idx->nr_old_entries = 0;
+    }
+
+    pthread_mutex_init(&idx->lock, NULL);
+
+    return idx;
+}
+
+// returns the old entry for the same inode, regardless of its state
+static const struct index_entry *lookup(const struct sl_index *idx, const struct sl_file_key *key)
+{
+    size_t lo = 0;
+    size_t hi = idx->nr_old_entries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = key_cmp(&idx->old_entries[mid].key, key);
+        if (c == 0) {
+            return &idx->old_entries[mid];
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
+// Takes the previous run's results for the file if they are still accurate
+// and cover everything the current mode asks for. Only called from the
+// walker thread.
+bool sl_index_lookup(struct sl_index *idx, struct sl_file *f)
+{
+    const struct index_entry *e = lookup(idx, &f->key);
+    if (!e || !key_same_state(&e->key, &f->key)) {
+        return false;
+    }
+
+    unsigned int wanted = sl_cfg_analyses(idx->cfg);
+    if (wanted & ~(e->analyses & idx->old_valid_analyses)) {
+        return false;
+    }
+
+    // the file still needs to be actually patched
+    if ((wanted & SL_ANALYSIS_PATCH) && !idx->cfg->dry_run && (e->flags & SL_RESULT_NEEDS_PATCH)) {
+        return false;
+    }
+
+    f->res.analyses = e->analyses & idx->old_valid_analyses;
+    f->res.flags = e->flags;
+    f->res.e_flags = e->e_flags;
+
+    uint64_t i;
+    for (i = 0; i < e->nr_findings; i++) {
+        struct sl_finding finding;
+        sl_result_get(&idx->old_findings[e->first_finding + i], idx->old_strs, &finding);
+        if (f->res.analyses & sl_finding_analysis(finding.kind)) {
+            sl_result_add(&f->res, &finding);
+        }
+    }
+
+    return true;
+}
+
+// Keeps the results for the next run. The results get completed with what
+// was learned about the same file previously, if still accurate.
+void sl_index_record(struct sl_index *idx, const struct sl_file_key *key, struct sl_file_result *res)
+{
+    // findings of analyses not done this time are still valid if the file
+    // didn't change
+    const struct index_entry *old = lookup(idx, key);
+    if (old && key_same_state(&old->key, key)) {
+        unsigned int extra = old->analyses & idx->old_valid_analyses & ~res->analyses;
+        uint64_t i;
+        for (i = 0; extra && i < old->nr_findings; i++) {
+            struct sl_finding finding;
+            sl_result_get(&idx->old_findings[old->first_finding + i], idx->old_strs, &finding);
+            if (extra & sl_finding_analysis(finding.kind)) {
+                sl_result_add(res, &finding);
+            }
+        }
+        if (extra & SL_ANALYSIS_PATCH) {
+            res->flags |= old->flags & SL_RESULT_NEEDS_PATCH;
+        }
+        res->analyses |= extra;
+    }
+
+    pthread_mutex_lock(&idx->lock);
+
+    idx->entries = grow_array(idx->entries, &idx->cap_entries, idx->nr_entries + 1, sizeof(*idx->entries));
+    struct index_entry *e = &idx->entries[idx->nr_entries++];
+    e->key = *key;
+    e->analyses = res->analyses;
+    e->flags = res->flags;
+    e->e_flags = res->e_flags;
+    e->nr_findings = (uint32_t)res->nr_findings;
+    e->first_finding = idx->pool.nr_findings;
+
+    size_t i;
+    for (i = 0; i < res->nr_findings; i++) {
+        struct sl_finding finding;
+        sl_result_get(&res->findings[i], res->strs, &finding);
+        sl_result_add(&idx->pool, &finding);
+    }
+
+    pthread_mutex_unlock(&idx->lock);
+}
+
+// Makes the old entries of files not seen during this run stay, for runs
+// that only look at some of the files under the root.
+void sl_index_keep_unseen(struct sl_index *idx)
+{
+    idx->keep_unseen = true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int entry_cmp(const void *a, const void *b)
+{
+    return key_cmp(&((const struct index_entry *)a)->key, &((const struct index_entry *)b)->key);
+}
+
+// carries the still valid parts of the old entries of files not seen during
+// this run over
+static void carry_over_unseen(struct sl_index *idx)
+{
+    qsort(idx->entries, idx->nr_entries, sizeof(*idx->entries), entry_cmp);
+    size_t nr_seen = idx->nr_entries;
+
+    size_t i;
+    for (i = 0; i < idx->nr_old_entries; i++) {
+        const struct index_entry *old = &idx->old_entries[i];
+        unsigned int valid = old->analyses & idx->old_valid_analyses;
+        if (!valid || bsearch(old, idx->entries, nr_seen, sizeof(*idx->entries), entry_cmp)) {
+            continue;
+        }
+
+        idx->entries = grow_array(idx->entries, &idx->cap_entries, idx->nr_entries + 1, sizeof(*idx->entries));
+        struct index_entry *e = &idx->entries[idx->nr_entries++];
+        *e = *old;
+        e->analyses = valid;
+        e->nr_findings = 0;
+        e->first_finding = idx->pool.nr_findings;
+
+        uint64_t j;
+        for (j = 0; j < old->nr_findings; j++) {
+            struct sl_finding finding;
+            sl_result_get(&idx->old_findings[old->first_finding + j], idx->old_strs, &finding);
+            if (valid & sl_finding_analysis(finding.kind)) {
+                sl_result_add(&idx->pool, &finding);
+                e->nr_findings++;
+            }
+        }
+    }
+}
+
+// Only what was seen during this run gets written, so entries of vanished
+// files don't accumulate; unless asked to keep the unseen ones.
+static bool write_out(struct sl_index *idx, FILE *fp)
+{
+    if (idx->keep_unseen) {
+        carry_over_unseen(idx);
+    }
+
+    // findings are found through first_finding, so the pool needs no
+    // reordering
+    qsort(idx->entries, idx->nr_entries, sizeof(*idx->entries), entry_cmp);
+
+    // drop duplicates, which happen for hard links
+    size_t nr_out = 0;
+    size_t i;
+    for (i = 0; i < idx->nr_entries; i++) {
+        if (nr_out && !key_cmp(&idx->entries[nr_out - 1].key, &idx->entries[i].key)) {
+            continue;
+        }
+        idx->entries[nr_out++] = idx->entries[i];
+    }
+
+    const struct sl_file_result *pool = &idx->pool;
+    struct index_header h = {
+        .magic = INDEX_MAGIC,
+        .version = INDEX_VERSION,
+        .byte_order = INDEX_BYTE_ORDER,
+        .from_elfhash = idx->cfg->from_elfhash,
+        .to_elfhash = idx->cfg->to_elfhash,
+        .removed_syscalls_hash = idx->cfg->removed_syscalls_hash,
+        .reserved = 0,
+        .nr_entries = nr_out,
+        .nr_findings = pool->nr_findings,
+        .strs_size = pool->strs_len,
+    };
+
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    ok = ok && (!nr_out || fwrite(idx->entries, sizeof(*idx->entries), nr_out, fp) == nr_out);
+    ok = ok && (!pool->nr_findings || fwrite(pool->findings, sizeof(*pool->findings), pool->nr_findings, fp) == pool->nr_findings);
+    ok = ok && (!pool->strs_len || fwrite(pool->strs, 1, pool->strs_len, fp) == pool->strs_len);
+
+    return ok;
+}
+
+// Writes the index out for the next run, then frees it. All results must be
+// recorded by now.
+void sl_index_close(struct sl_index *idx)
+{
+    char *tmp_path;
+    if (asprintf(&tmp_path, "%s.tmp", idx->path) < 0) {
+        err(EX_OSERR, _("cannot allocate index"));  // GCOVR_EXCL_LINE: OOM
+    }
+
+    // the index only ever saves time, so failing to write it is no big deal
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        warn(_("cannot write index %s"), tmp_path);
+    } else {
+        bool ok = write_out(idx, fp);
+        if (fclose(fp) != 0) {
+            ok = false;
+        }
+
+        if (!ok || rename(tmp_path, idx->path) < 0) {
+            warn(_("cannot write index %s"), idx->path);
+            (void) unlink(tmp_path);
+        }
+    }
+    free(tmp_path);
+
+    pthread_mutex_destroy(&idx->lock);
+    if (idx->map) {
+        (void) munmap(idx->map, idx->map_size);
+    }
+    sl_result_free(&idx->pool);
+    free(idx->entries);
+    free(idx->path);
+    free(idx);
+}
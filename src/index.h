@@ -0,0 +1,19 @@
+#ifndef _shengloong_index_h
+#define _shengloong_index_h
+
+#include <stdbool.h>
+
+#include "cfg.h"
+#include "file.h"
+
+// Persistent per-root index of scan results, keyed by inode state, so that
+// repeated runs only have to look at changed files.
+struct sl_index;
+
+struct sl_index *sl_index_open(const struct sl_cfg *cfg, const char *index_dir, const char *root);
+bool sl_index_lookup(struct sl_index *idx, struct sl_file *f);
+void sl_index_record(struct sl_index *idx, const struct sl_file_key *key, struct sl_file_result *res);
+void sl_index_keep_unseen(struct sl_index *idx);
+void sl_index_close(struct sl_index *idx);
+
+#endif  // _shengloong_index_h
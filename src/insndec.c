@@ -0,0 +1,198 @@
+#include <stddef.h>
+
+#include "insndec.h"
+
+#define NONE 0
+#define RD SL_INSN_WRITES_RD
+#define RJ SL_INSN_WRITES_RJ
+#define RA SL_INSN_WRITES_RA
+#define JUMPS SL_INSN_JUMPS
+
+// Within a major opcode (insn[31:26]), the first rule matching decides;
+// insns matching none get the default of the major opcode.
+struct rule {
+    uint32_t mask;
+    uint32_t match;
+    unsigned int flags;
+};
+
+struct major {
+    const struct rule *rules;
+    size_t nr_rules;
+    unsigned int dflt;
+};
+
+#define RULES(x) x, sizeof(x) / sizeof(x[0])
+#define NO_RULES NULL, 0
+
+// integer ops with registers or small immediates, and floating-point
+// arithmetic
+static const struct rule op_00[] = {
+    { 0xffff0000, 0x00010000, NONE },  // asrtle.d, asrtgt.d
+    { 0xfffff800, 0x00006000, RD | RJ },  // rdtimel.w, rdtimeh.w
+    { 0xfffffc00, 0x00006800, RD | RJ },  // rdtime.d
+    { 0xfffe0000, 0x002a0000, NONE },  // break, dbcall, syscall, hvcl
+    { 0xfffffc00, 0x0114b400, RD },  // movfr2gr.s
+    { 0xfffffc00, 0x0114b800, RD },  // movfr2gr.d
+    { 0xfffffc00, 0x0114bc00, RD },  // movfrh2gr.s
+    { 0xfffffc00, 0x0114c800, RD },  // movfcsr2gr
+    { 0xffffff00, 0x0114dc00, RD },  // movcf2gr
+    { 0xff000000, 0x01000000, NONE },  // the rest of floating-point
+};
+
+// privileged: csr*, cacop, lddir, ldpte, iocsr*, tlb*, ertn, idle, invtlb
+static const struct rule op_01[] = {
+    { 0xff000000, 0x04000000, RD },  // csrrd, csrwr, csrxchg
+    { 0xffc00000, 0x06000000, NONE },  // cacop
+    { 0xfffc0000, 0x06400000, RD },  // lddir
+    { 0xfffc0000, 0x06440000, NONE },  // ldpte
+    { 0xfffff000, 0x06480000, RD },  // iocsrrd.[bhwd]
+    { 0xffff8000, 0x06480000, NONE },  // iocsrwr.[bhwd], tlb*, ertn
+    { 0xffff8000, 0x06488000, NONE },  // idle
+    { 0xffff8000, 0x06498000, NONE },  // invtlb
+};
+
+// ldptr.[wd], stptr.[wd]
+static const struct rule op_09[] = {
+    { 0xfd000000, 0x25000000, NONE },  // stptr.[wd]
+};
+
+// ld.*, st.*, preld, fld.*, fst.*
+static const struct rule op_0a[] = {
+    { 0xff000000, 0x29000000, NONE },  // st.[bhwd]
+    { 0xffc00000, 0x2ac00000, NONE },  // preld
+    { 0xff000000, 0x2b000000, NONE },  // fld.[sd], fst.[sd]
+};
+
+// indexed and bound-checked loads and stores, atomics and barriers
+static const struct rule op_0e[] = {
+    { 0xfff00000, 0x38100000, NONE },  // stx.[bhwd]
+    { 0xfffc0000, 0x382c0000, NONE },  // preldx
+    { 0xfff00000, 0x38300000, NONE },  // fldx.[sd], fstx.[sd]
+    { 0xfff00000, 0x38400000, NONE },  // [x]vldx, [x]vstx
+    { 0xffff0000, 0x38720000, NONE },  // dbar, ibar
+    { 0xfffc0000, 0x38740000, NONE },  // fld{gt,le}.[sd], fst{gt,le}.[sd]
+    { 0xfffc0000, 0x387c0000, NONE },  // st{gt,le}.[bhwd]
+};
+
+// LSX
+static const struct rule op_1c[] = {
+    { 0xffff8000, 0x72ef8000, RD },  // vpickve2gr.[bhwd]
+    { 0xffff8000, 0x72f38000, RD },  // vpickve2gr.[bhwd]u
+};
+
+// LASX
+static const struct rule op_1d[] = {
+    { 0xffffc000, 0x76efc000, RD },  // xvpickve2gr.[wd]
+    { 0xffffc000, 0x76f3c000, RD },  // xvpickve2gr.[wd]u
+};
+
+static const struct major majors[] = {
+    [0x00] = { RULES(op_00), RD },
+    [0x01] = { RULES(op_01), RD },
+    // floating-point fused multiply-add, compares and selects, and their
+    // vector counterparts
+    [0x02] = { NO_RULES, NONE },
+    [0x03] = { NO_RULES, NONE },
+    // addu16i.d
+    [0x04] = { NO_RULES, RD },
+    // lu12i.w, lu32i.d
+    [0x05] = { NO_RULES, RD },
+    // pcaddi, pcalau12i
+    [0x06] = { NO_RULES, RD },
+    // pcaddu12i, pcaddu18i
+    [0x07] = { NO_RULES, RD },
+    // ll.[wd], and sc.[wd] writing whether it succeeded
+    [0x08] = { NO_RULES, RD },
+    [0x09] = { RULES(op_09), RD },
+    [0x0a] = { RULES(op_0a), RD },
+    // [x]vld, [x]vst
+    [0x0b] = { NO_RULES, NONE },
+    // [x]vldrepl.*, [x]vstelm.*
+    [0x0c] = { NO_RULES, NONE },
+    [0x0d] = { NO_RULES, RD },
+    // the rest of it are ldx.*, am*, ldgt.* and ldle.*
+    [0x0e] = { RULES(op_0e), RD },
+    [0x0f] = { NO_RULES, RD },
+    // beqz, bnez, bceqz, bcnez
+    [0x10] = { NO_RULES, NONE },
+    [0x11] = { NO_RULES, NONE },
+    [0x12] = { NO_RULES, NONE },
+    // jirl
+    [0x13] = { NO_RULES, RD | JUMPS },
+    // b
+    [0x14] = { NO_RULES, JUMPS },
+    // bl
+    [0x15] = { NO_RULES, RA | JUMPS },
+    // beq, bne, blt, bge, bltu, bgeu
+    [0x16] = { NO_RULES, NONE },
+    [0x17] = { NO_RULES, NONE },
+    [0x18] = { NO_RULES, NONE },
+    [0x19] = { NO_RULES, NONE },
+    [0x1a] = { NO_RULES, NONE },
+    [0x1b] = { NO_RULES, NONE },
+    [0x1c] = { RULES(op_1c), NONE },
+    [0x1d] = { RULES(op_1d), NONE },
+};
+
+static unsigned int decode_by_rules(uint32_t insn)
+{
+    uint32_t op6 = insn >> 26;
+    if (op6 >= sizeof(majors) / sizeof(majors[0])) {
+        return RD;
+    }
+
+    const struct major *m = &majors[op6];
+    size_t i;
+    for (i = 0; i < m->nr_rules; i++) {
+        if ((insn & m->rules[i].mask) == m->rules[i].match) {
+            return m->rules[i].flags;
+        }
+    }
+
+    return m->dflt;
+}
+
+#define SLOT_SHIFT (32 - SL_INSN_SLOT_BITS)
+#define SLOT_MASK (~0u << SLOT_SHIFT)
+
+// filled in on first use; racing threads all arrive at the same values
+uint8_t sl_insn_slots[1 << SL_INSN_SLOT_BITS];
+
+// Works out the slot of insn from the rules, which decide for the whole
+// slot unless one of them looks at bits below it.
+static uint8_t slot_of(uint32_t insn)
+{
+    insn &= SLOT_MASK;
+    uint32_t op6 = insn >> 26;
+    if (op6 >= sizeof(majors) / sizeof(majors[0])) {
+        return RD + 1;
+    }
+
+    const struct major *m = &majors[op6];
+    size_t i;
+    for (i = 0; i < m->nr_rules; i++) {
+        const struct rule *r = &m->rules[i];
+        if ((insn ^ r->match) & r->mask & SLOT_MASK) {
+            // matches nothing in the slot
+            continue;
+        }
+        if (r->mask & ~SLOT_MASK) {
+            // matches only some of it
+            return SL_INSN_SLOT_BY_RULES;
+        }
+        return (uint8_t)(r->flags + 1);
+    }
+
+    return (uint8_t)(m->dflt + 1);
+}
+
+unsigned int sl_insn_decode_slow(uint32_t insn)
+{
+    uint8_t *slot = &sl_insn_slots[insn >> SLOT_SHIFT];
+    if (!__atomic_load_n(slot, __ATOMIC_RELAXED)) {
+        __atomic_store_n(slot, slot_of(insn), __ATOMIC_RELAXED);
+    }
+
+    return decode_by_rules(insn);
+}
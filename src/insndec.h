@@ -0,0 +1,67 @@
+#ifndef _shengloong_insndec_h
+#define _shengloong_insndec_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// What a LoongArch instruction does, as far as the scanners care: which
+// general-purpose registers it writes, and whether control unconditionally
+// goes elsewhere. Encodings not known are taken to write rd, so that nothing
+// is ever assumed to survive them.
+
+#define SL_INSN_WRITES_RD (1u << 0)
+#define SL_INSN_WRITES_RJ (1u << 1)
+// bl writes the return address to $ra
+#define SL_INSN_WRITES_RA (1u << 2)
+// b, bl and jirl
+#define SL_INSN_JUMPS (1u << 3)
+
+#define SL_REG_ZERO 0
+#define SL_REG_RA 1
+
+// Insns sharing their top SL_INSN_SLOT_BITS bits mostly share their flags
+// too. Each slot holds the flags plus 1 once looked up, SL_INSN_SLOT_BY_RULES
+// if lower bits have to be looked at, or 0 if not looked up yet. The lookup
+// is kept inline, as the scanners decode insns one by one in their hottest
+// loops.
+#define SL_INSN_SLOT_BITS 12
+#define SL_INSN_SLOT_BY_RULES 0xff
+
+extern uint8_t sl_insn_slots[1 << SL_INSN_SLOT_BITS];
+
+unsigned int sl_insn_decode_slow(uint32_t insn);
+
+// Returns the SL_INSN_* flags of insn, which is in host byte order.
+static inline unsigned int sl_insn_decode(uint32_t insn)
+{
+    unsigned int slot = __atomic_load_n(&sl_insn_slots[insn >> (32 - SL_INSN_SLOT_BITS)], __ATOMIC_RELAXED);
+    if (slot && slot != SL_INSN_SLOT_BY_RULES) {
+        return slot - 1;
+    }
+    return sl_insn_decode_slow(insn);
+}
+
+// Returns the registers written by insn, given its flags, with bit n set for
+// $rn; writes to $zero are dropped, as they don't change it.
+static inline uint32_t sl_insn_gprs_written(uint32_t insn, unsigned int flags)
+{
+    // without branches, as whether an insn writes rd is anyone's guess
+    uint32_t regs = (uint32_t)(flags & SL_INSN_WRITES_RD) << (insn & 0x1f);
+    regs |= (uint32_t)!!(flags & SL_INSN_WRITES_RJ) << ((insn >> 5) & 0x1f);
+    regs |= (uint32_t)!!(flags & SL_INSN_WRITES_RA) << SL_REG_RA;
+
+    return regs & ~(1u << SL_REG_ZERO);
+}
+
+static inline bool sl_insn_writes_gpr(uint32_t insn, uint32_t reg)
+{
+    // only insns naming reg can write it, except bl writing $ra, which most
+    // insns don't, so they're told apart without a lookup
+    if ((insn & 0x1f) != reg && ((insn >> 5) & 0x1f) != reg && reg != SL_REG_RA) {
+        return false;
+    }
+
+    return (sl_insn_gprs_written(insn, sl_insn_decode(insn)) >> reg) & 1;
+}
+
+#endif  // _shengloong_insndec_h
@@ -0,0 +1,136 @@
+#include <endian.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__loongarch__)
+#include <sys/auxv.h>
+#endif
+
+#include "buildconfig.gen.h"
+#include "insnscan.h"
+
+size_t sl_insn_find_scalar(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if ((insns[i] & mask) == match) {
+            return i;
+        }
+    }
+
+    return n;
+}
+
+static bool always_supported(void)
+{
+    return true;
+}
+
+#if defined(__SSE2__)
+// SSE2 is part of the x86_64 baseline, so no separate flags are needed
+size_t sl_insn_find_sse2(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match)
+{
+    const __m128i vmask = _mm_set1_epi32((int)mask);
+    const __m128i vmatch = _mm_set1_epi32((int)match);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(insns + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(insns + i + 4));
+        a = _mm_cmpeq_epi32(_mm_and_si128(a, vmask), vmatch);
+        b = _mm_cmpeq_epi32(_mm_and_si128(b, vmask), vmatch);
+
+        int hits = _mm_movemask_ps(_mm_castsi128_ps(a)) | (_mm_movemask_ps(_mm_castsi128_ps(b)) << 4);
+        if (hits) {
+            return i + (size_t)__builtin_ctz((unsigned int)hits);
+        }
+    }
+
+    return i + sl_insn_find_scalar(insns + i, n - i, mask, match);
+}
+#endif
+
+#if defined(HAVE_INSNSCAN_AVX2) && HAVE_INSNSCAN_AVX2
+static bool avx2_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#if defined(__loongarch__)
+#ifndef HWCAP_LOONGARCH_LSX
+#define HWCAP_LOONGARCH_LSX (1 << 4)
+#endif
+#ifndef HWCAP_LOONGARCH_LASX
+#define HWCAP_LOONGARCH_LASX (1 << 5)
+#endif
+
+#if defined(HAVE_INSNSCAN_LSX) && HAVE_INSNSCAN_LSX
+static bool lsx_supported(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_LOONGARCH_LSX) != 0;
+}
+#endif
+
+#if defined(HAVE_INSNSCAN_LASX) && HAVE_INSNSCAN_LASX
+static bool lasx_supported(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_LOONGARCH_LASX) != 0;
+}
+#endif
+#endif
+
+const struct sl_insnscan_impl sl_insnscan_impls[] = {
+    { "scalar", always_supported, sl_insn_find_scalar },
+#if defined(__SSE2__)
+    { "sse2", always_supported, sl_insn_find_sse2 },
+#endif
+#if defined(HAVE_INSNSCAN_AVX2) && HAVE_INSNSCAN_AVX2
+    { "avx2", avx2_supported, sl_insn_find_avx2 },
+#endif
+#if defined(HAVE_INSNSCAN_LSX) && HAVE_INSNSCAN_LSX
+    { "lsx", lsx_supported, sl_insn_find_lsx },
+#endif
+#if defined(HAVE_INSNSCAN_LASX) && HAVE_INSNSCAN_LASX
+    { "lasx", lasx_supported, sl_insn_find_lasx },
+#endif
+    { NULL, NULL, NULL },
+};
+
+static size_t find_resolve(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match);
+
+// resolved on first use; racing threads all arrive at the same answer
+static sl_insn_find_fn find_impl = find_resolve;
+
+static size_t find_resolve(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match)
+{
+    sl_insn_find_fn best = sl_insn_find_scalar;
+
+    const struct sl_insnscan_impl *impl;
+    for (impl = sl_insnscan_impls; impl->name; impl++) {
+        if (impl->supported()) {
+            best = impl->find;
+        }
+    }
+
+    __atomic_store_n(&find_impl, best, __ATOMIC_RELAXED);
+    return best(insns, n, mask, match);
+}
+
+// Makes sl_insn_find use the given variant from now on, which the running CPU
+// has to support, e.g. to compare the variants by what's built on them.
+void sl_insnscan_use(const struct sl_insnscan_impl *impl)
+{
+    __atomic_store_n(&find_impl, impl->find, __ATOMIC_RELAXED);
+}
+
+size_t sl_insn_find(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match)
+{
+    sl_insn_find_fn find = __atomic_load_n(&find_impl, __ATOMIC_RELAXED);
+    // bitwise and and comparison don't care about the order of bytes, as
+    // long as both sides agree
+    return find(insns, n, htole32(mask), htole32(match));
+}
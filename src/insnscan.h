@@ -0,0 +1,34 @@
+#ifndef _shengloong_insnscan_h
+#define _shengloong_insnscan_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Returns the index of the first of the n little-endian instruction words
+// for which (insn & mask) == match, or n if there is none. The fastest
+// variant supported by the running CPU is used.
+size_t sl_insn_find(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match);
+
+// The variants take mask and match in memory byte order, i.e. already
+// converted with htole32, so that no per-word conversion is needed.
+typedef size_t (*sl_insn_find_fn)(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match);
+
+struct sl_insnscan_impl {
+    const char *name;
+    bool (*supported)(void);
+    sl_insn_find_fn find;
+};
+
+// all variants built in, best last; terminated by an entry with NULL name
+extern const struct sl_insnscan_impl sl_insnscan_impls[];
+
+void sl_insnscan_use(const struct sl_insnscan_impl *impl);
+
+size_t sl_insn_find_scalar(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match);
+size_t sl_insn_find_sse2(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match);
+size_t sl_insn_find_avx2(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match);
+size_t sl_insn_find_lsx(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match);
+size_t sl_insn_find_lasx(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match);
+
+#endif  // _shengloong_insnscan_h
@@ -0,0 +1,26 @@
+// built with -mavx2, and only called if the running CPU supports it
+#include <immintrin.h>
+
+#include "insnscan.h"
+
+size_t sl_insn_find_avx2(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match)
+{
+    const __m256i vmask = _mm256_set1_epi32((int)mask);
+    const __m256i vmatch = _mm256_set1_epi32((int)match);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(insns + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(insns + i + 8));
+        a = _mm256_cmpeq_epi32(_mm256_and_si256(a, vmask), vmatch);
+        b = _mm256_cmpeq_epi32(_mm256_and_si256(b, vmask), vmatch);
+
+        unsigned int hits = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(a))
+            | ((unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(b)) << 8);
+        if (hits) {
+            return i + (size_t)__builtin_ctz(hits);
+        }
+    }
+
+    return i + sl_insn_find_scalar(insns + i, n - i, mask, match);
+}
@@ -0,0 +1,25 @@
+// built with -mlasx, and only called if the running CPU supports it
+#include <lasxintrin.h>
+
+#include "insnscan.h"
+
+size_t sl_insn_find_lasx(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match)
+{
+    const __m256i vmask = __lasx_xvreplgr2vr_w((int)mask);
+    const __m256i vmatch = __lasx_xvreplgr2vr_w((int)match);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = __lasx_xvld(insns + i, 0);
+        __m256i b = __lasx_xvld(insns + i + 8, 0);
+        a = __lasx_xvseq_w(__lasx_xvand_v(a, vmask), vmatch);
+        b = __lasx_xvseq_w(__lasx_xvand_v(b, vmask), vmatch);
+
+        // rare enough that pinpointing the hit is left to the scalar code
+        if (__lasx_xbnz_v(__lasx_xvor_v(a, b))) {
+            return i + sl_insn_find_scalar(insns + i, 16, mask, match);
+        }
+    }
+
+    return i + sl_insn_find_scalar(insns + i, n - i, mask, match);
+}
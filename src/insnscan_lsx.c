@@ -0,0 +1,25 @@
+// built with -mlsx, and only called if the running CPU supports it
+#include <lsxintrin.h>
+
+#include "insnscan.h"
+
+size_t sl_insn_find_lsx(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match)
+{
+    const __m128i vmask = __lsx_vreplgr2vr_w((int)mask);
+    const __m128i vmatch = __lsx_vreplgr2vr_w((int)match);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = __lsx_vld(insns + i, 0);
+        __m128i b = __lsx_vld(insns + i + 4, 0);
+        a = __lsx_vseq_w(__lsx_vand_v(a, vmask), vmatch);
+        b = __lsx_vseq_w(__lsx_vand_v(b, vmask), vmatch);
+
+        // rare enough that pinpointing the hit is left to the scalar code
+        if (__lsx_bnz_v(__lsx_vor_v(a, b))) {
+            return i + sl_insn_find_scalar(insns + i, 8, mask, match);
+        }
+    }
+
+    return i + sl_insn_find_scalar(insns + i, n - i, mask, match);
+}
@@ -0,0 +1,187 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
+
+#include "buildconfig.gen.h"
+#include "gettext.h"
+#include "ioorder.h"
+#include "utils.h"
+
+#if defined(HAVE_FIEMAP) && HAVE_FIEMAP
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#endif
+
+#define _(x) gettext(x)
+
+// files held back at most, before going through them anyway
+#define MAX_ENTRIES (1 << 18)
+
+// open files left for everything else, like the directories being walked,
+// the files queued for the workers or waiting to be read ahead, and the
+// batches of header probes
+#define RESERVED_FDS 512
+
+// Tells from sysfs whether the block device is a spinning disk. Partitions
+// have the queue attributes on the whole disk instead. Filesystems without a
+// single block device, like btrfs or NFS, can't be told about.
+static bool is_rotational(dev_t dev)
+{
+    static const char *const fmts[] = {
+        "/sys/dev/block/%u:%u/queue/rotational",
+        "/sys/dev/block/%u:%u/../queue/rotational",
+    };
+
+    size_t i;
+    for (i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++) {
+        char path[64];
+        snprintf(path, sizeof(path), fmts[i], major(dev), minor(dev));
+        FILE *fp = fopen(path, "re");
+        if (!fp) {
+            continue;
+        }
+
+        int c = fgetc(fp);
+        (void) fclose(fp);
+        return c == '1';
+    }
+
+    return false;
+}
+
+// resolves SL_IO_ORDER_AUTO for the filesystem of a root
+enum sl_io_order sl_io_order_for_dev(enum sl_io_order order, dev_t dev)
+{
+    if (order != SL_IO_ORDER_AUTO) {
+        return order;
+    }
+
+    return is_rotational(dev) ? SL_IO_ORDER_EXTENT : SL_IO_ORDER_WALK;
+}
+
+void sl_ioorder_init(struct sl_ioorder *io, enum sl_io_order order)
+{
+    memset(io, 0, sizeof(*io));
+#if defined(HAVE_FIEMAP) && HAVE_FIEMAP
+    io->order = order;
+#else
+    // there's no telling where the data is
+    io->order = order == SL_IO_ORDER_EXTENT ? SL_IO_ORDER_INODE : order;
+#endif
+
+    // the more directories can be kept open, the longer the sweeps get; the
+    // limit is left as it is, so raising it with ulimit -n is up to the user
+    struct rlimit rl;
+    size_t max_fds = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        max_fds = rl.rlim_cur > MAX_ENTRIES ? MAX_ENTRIES : (size_t)rl.rlim_cur;
+    }
+
+    size_t avail = max_fds > 2 * RESERVED_FDS ? max_fds - RESERVED_FDS : max_fds / 4;
+    if (avail < 2) {
+        // room for a directory and a file, however little the limit allows
+        avail = 2;
+    }
+    if (io->order == SL_IO_ORDER_EXTENT) {
+        // shared with the files opened for a sweep
+        io->max_dirs = avail / 2;
+        io->max_open = avail - io->max_dirs;
+    } else {
+        io->max_dirs = avail;
+    }
+}
+
+// Holds back the file. Returns true if no more can be, and the files held
+// back are to be gone through first.
+bool sl_ioorder_add(struct sl_ioorder *io, struct sl_dir *dir, const char *name, uint64_t ino)
+{
+    io->ents = grow_array(io->ents, &io->cap, io->nr + 1, sizeof(*io->ents));
+
+    // the walker is done with a directory before going on to the next, so
+    // those held open are counted as the files come
+    if (!io->nr || io->ents[io->nr - 1].dir != dir) {
+        io->nr_dirs++;
+    }
+
+    struct sl_ioorder_ent *e = &io->ents[io->nr];
+    e->dir = sl_dir_get(dir);
+    e->name = strdup(name);
+    // GCOVR_EXCL_START: OOM
+    if (!e->name) {
+        err(EX_OSERR, _("cannot allocate file list"));
+    }
+    // GCOVR_EXCL_STOP
+    e->ino = ino;
+    e->seq = io->next_seq++;
+    io->nr++;
+
+    return io->nr >= MAX_ENTRIES || io->nr_dirs >= io->max_dirs;
+}
+
+static int cmp_ent(const void *a, const void *b)
+{
+    const struct sl_ioorder_ent *x = a;
+    const struct sl_ioorder_ent *y = b;
+    if (x->ino != y->ino) {
+        return x->ino < y->ino ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Puts the files held back in inode order, which is the order they're to be
+// opened in, or for extent order, the order they're asked where their data
+// is in, as the inodes have to be read for this.
+void sl_ioorder_sort(struct sl_ioorder *io)
+{
+    qsort(io->ents, io->nr, sizeof(*io->ents), cmp_ent);
+}
+
+// Tells where the data of the open file starts on disk, or
+// SL_IOORDER_EXTENT_UNKNOWN if it has no extents, or they're inline or not
+// allocated yet.
+uint64_t sl_ioorder_extent(int fd)
+{
+#if defined(HAVE_FIEMAP) && HAVE_FIEMAP
+    // struct fiemap with room for a single extent
+    uint64_t buf[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(uint64_t)];
+    memset(buf, 0, sizeof(buf));
+    struct fiemap *fm = (struct fiemap *)buf;
+    fm->fm_start = 0;
+    fm->fm_length = FIEMAP_MAX_OFFSET;
+    fm->fm_extent_count = 1;
+
+    const unsigned int unplaced = FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_DATA_INLINE;
+    if (ioctl(fd, FS_IOC_FIEMAP, fm) < 0 || fm->fm_mapped_extents == 0 || (fm->fm_extents[0].fe_flags & unplaced)) {
+        return SL_IOORDER_EXTENT_UNKNOWN;
+    }
+
+    return fm->fm_extents[0].fe_physical;
+#else
+    (void) fd;
+    return SL_IOORDER_EXTENT_UNKNOWN;
+#endif
+}
+
+void sl_ioorder_clear(struct sl_ioorder *io)
+{
+    size_t i;
+    for (i = 0; i < io->nr; i++) {
+        sl_dir_put(io->ents[i].dir);
+        free(io->ents[i].name);
+    }
+    io->nr = 0;
+    io->nr_dirs = 0;
+}
+
+void sl_ioorder_fini(struct sl_ioorder *io)
+{
+    sl_ioorder_clear(io);
+    free(io->ents);
+    io->ents = NULL;
+    io->cap = 0;
+}
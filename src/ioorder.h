@@ -0,0 +1,54 @@
+#ifndef _shengloong_ioorder_h
+#define _shengloong_ioorder_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cfg.h"
+#include "dirref.h"
+
+// sorted after everything with a known place on disk
+#define SL_IOORDER_EXTENT_UNKNOWN UINT64_MAX
+
+// Files found by the walker, held back to be opened in the order they're
+// laid out on disk, so that reading them on rotational disks is mostly a
+// sweep instead of a seek per file.
+//
+// Each directory with files held back is kept open, so files are only held
+// back up to what the limit on open files allows, and then gone through in
+// batches. For extent order, the files are first opened in inode order, and
+// only those worth looking into are asked where their data is, so they're
+// also kept open until their sweep.
+struct sl_ioorder_ent {
+    struct sl_dir *dir;
+    char *name;
+    uint64_t ino;
+    // the order it was found in, over the whole walk
+    size_t seq;
+};
+
+struct sl_ioorder {
+    enum sl_io_order order;
+    struct sl_ioorder_ent *ents;
+    size_t nr;
+    size_t cap;
+    size_t nr_dirs;
+    size_t max_dirs;
+    // files kept open at most for a sweep in extent order
+    size_t max_open;
+    // the number of the next file found, or anything else the walker shows
+    size_t next_seq;
+};
+
+enum sl_io_order sl_io_order_for_dev(enum sl_io_order order, dev_t dev);
+
+void sl_ioorder_init(struct sl_ioorder *io, enum sl_io_order order);
+bool sl_ioorder_add(struct sl_ioorder *io, struct sl_dir *dir, const char *name, uint64_t ino);
+void sl_ioorder_sort(struct sl_ioorder *io);
+uint64_t sl_ioorder_extent(int fd);
+void sl_ioorder_clear(struct sl_ioorder *io);
+void sl_ioorder_fini(struct sl_ioorder *io);
+
+#endif  // _shengloong_ioorder_h
@@ -10,19 +10,25 @@
 #include <unistd.h>
 
 #include <elf.h>
-#include <gelf.h>
-#include <libelf.h>
 #include <popt.h>
 
 #include "buildconfig.gen.h"
 #include "cfg.h"
 #include "ctx.h"
+#include "dedup.h"
 #include "elfcompat.h"
+#include "filelist.h"
 #include "gettext.h"
+#include "output.h"
+#include "pathrules.h"
+#include "processing.h"
 #include "processing_objabi.h"
 #include "processing_syscall_abi.h"
+#include "stats.h"
 #include "utils.h"
 #include "walkdir.h"
+#include "watch.h"
+#include "workqueue.h"
 
 #define _(x) gettext(x)
 #define PO_PACKAGE_NAME "shengloong"
@@ -55,6 +61,12 @@ usage(poptContext pctx, const char *error)
     exit(EX_USAGE);
 }
 
+// options given more than once, in order
+enum {
+    OPT_EXCLUDE = 1,
+    OPT_INCLUDE,
+};
+
 #define DEFAULT_FROM "GLIBC_2.35"
 #define DEFAULT_TO "GLIBC_2.36"
 
@@ -69,18 +81,53 @@ int main(int argc, const char *argv[])
     struct sl_cfg cfg = {
         .verbose = false,
         .dry_run = false,
+        .format = SL_FORMAT_TEXT,
+
+        .removed_syscalls = &sl_removed_syscalls_default,
 
         .from_ver = DEFAULT_FROM,
         .to_ver = DEFAULT_TO,
+
+        .jobs = 1,
+        .index_dir = NULL,
+        .content_cache = false,
+        .replace = false,
+        .low_memory = false,
+        .stats = false,
+        .stats_json = false,
     };
 
+    const char *format = "text";
+    const char *io_order = "auto";
+    const char *removed_syscalls_path = NULL;
+    const char *files_from = NULL;
+    int watch = 0;
+    int prefetch_mib = 64;
+
     struct poptOption options[] = {
         { "verbose", 'v', POPT_ARG_NONE, &cfg.verbose, 0, _("produce more (debugging) output"), NULL },
         { "pretend", 'p', POPT_ARG_NONE, &cfg.dry_run, 0, _("don't actually patch the files"), NULL },
         { "from-ver", 'f', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &cfg.from_ver, 0, _("migrate from this glibc symbol version"), "GLIBC_2.3x" },
         { "to-ver", 't', POPT_ARG_STRING, NULL, 0, _("deprecated; no effect now"), NULL },
         { "check-syscall-abi", 'a', POPT_ARG_NONE, &cfg.check_syscall_abi, 0, _("scan for syscall ABI incompatibility, don't patch files"), NULL },
+        { "removed-syscalls", 'R', POPT_ARG_STRING, &removed_syscalls_path, 0, _("look for usage of the syscalls listed in FILE, instead of the ones removed from old-world kernels"), "FILE" },
         { "check-objabi", 'o', POPT_ARG_NONE, &cfg.check_objabi, 0, _("scan for obsolete object file ABI usage, don't patch files"), NULL },
+        { "check-all", 'A', POPT_ARG_NONE, &cfg.check_all, 0, _("do both scans while patching, in a single pass over the files"), NULL },
+        { "jobs", 'j', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &cfg.jobs, 0, _("process files with this many threads (0 for one per CPU)"), "N" },
+        { "prefetch", '\0', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &prefetch_mib, 0, _("read ahead up to this many MiB of the files waiting to be processed (0 to not)"), "MIB" },
+        { "files-from", 'T', POPT_ARG_STRING, &files_from, 0, _("only look at the files listed in FILE (- for stdin), by paths under the roots separated by NULs or newlines"), "FILE" },
+        { "one-file-system", 'x', POPT_ARG_NONE, &cfg.one_file_system, 0, _("don't descend into directories on other filesystems"), NULL },
+        { "exclude", '\0', POPT_ARG_STRING, NULL, OPT_EXCLUDE, _("leave out paths matching PATTERN, unless an earlier rule includes them"), "PATTERN" },
+        { "include", '\0', POPT_ARG_STRING, NULL, OPT_INCLUDE, _("look at paths matching PATTERN, unless an earlier rule excludes them"), "PATTERN" },
+        { "io-order", '\0', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &io_order, 0, _("open files as found (walk), or gathered and sorted by inode or by where their data is on disk (extent); auto is extent on rotational disks, else walk"), "ORDER" },
+        { "watch", 'W', POPT_ARG_NONE, &watch, 0, _("keep running, looking at files as they get written or moved into place"), NULL },
+        { "index-dir", 'i', POPT_ARG_STRING, &cfg.index_dir, 0, _("keep results in DIR, to only look at changed files next time"), "DIR" },
+        { "content-cache", 'c', POPT_ARG_NONE, &cfg.content_cache, 0, _("hash file contents, to only process identical files once"), NULL },
+        { "replace", 'r', POPT_ARG_NONE, &cfg.replace, 0, _("patch copies of the files and rename them over the originals"), NULL },
+        { "low-memory", 'l', POPT_ARG_NONE, &cfg.low_memory, 0, _("read only the parts of files looked at, instead of mapping them whole"), NULL },
+        { "format", 'F', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &format, 0, _("write findings as text, or as jsonl for one JSON object per line"), "FORMAT" },
+        { "stats", 'S', POPT_ARG_NONE, &cfg.stats, 0, _("print counters and timings of the run at exit"), NULL },
+        { "stats-json", '\0', POPT_ARG_NONE, &cfg.stats_json, 0, _("like --stats, but as a JSON object"), NULL },
         POPT_AUTOHELP
         POPT_TABLEEND
     };
@@ -92,7 +139,18 @@ int main(int argc, const char *argv[])
         usage(pctx, NULL);
     }
 
-    int ret = poptGetNextOpt(pctx);
+    struct sl_pathrules *path_rules = NULL;
+    int ret;
+    while ((ret = poptGetNextOpt(pctx)) > 0) {
+        char *pattern = poptGetOptArg(pctx);
+        if (!path_rules) {
+            path_rules = sl_pathrules_new();
+        }
+        sl_pathrules_add(path_rules, pattern, ret == OPT_INCLUDE);
+        free(pattern);
+    }
+    cfg.path_rules = path_rules;
+
     if (ret < -1) {
         fprintf(
             stderr,
@@ -107,35 +165,134 @@ int main(int argc, const char *argv[])
         usage(pctx, _("at least one directory argument is required"));
     }
 
+    if (watch && files_from) {
+        usage(pctx, _("--watch and --files-from cannot be used together"));
+    }
+
+    if (cfg.jobs < 0) {
+        usage(pctx, _("number of jobs must not be negative"));
+    }
+
+    if (prefetch_mib < 0) {
+        usage(pctx, _("prefetch size must not be negative"));
+    }
+    cfg.prefetch_bytes = (uint64_t)prefetch_mib << 20;
+
+    if (!strcmp(format, "jsonl")) {
+        cfg.format = SL_FORMAT_JSONL;
+        sl_output_init();
+    } else if (strcmp(format, "text")) {
+        usage(pctx, _("format must be text or jsonl"));
+    }
+
+    if (!strcmp(io_order, "auto")) {
+        cfg.io_order = SL_IO_ORDER_AUTO;
+    } else if (!strcmp(io_order, "walk")) {
+        cfg.io_order = SL_IO_ORDER_WALK;
+    } else if (!strcmp(io_order, "inode")) {
+        cfg.io_order = SL_IO_ORDER_INODE;
+    } else if (!strcmp(io_order, "extent")) {
+        cfg.io_order = SL_IO_ORDER_EXTENT;
+    } else {
+        usage(pctx, _("I/O order must be auto, walk, inode or extent"));
+    }
+
+    if (cfg.jobs == 0) {
+        long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        cfg.jobs = nr_cpus > 0 ? (int)nr_cpus : 1;
+    }
+
+    if (removed_syscalls_path) {
+        // kept until exit, like the rest of the configuration
+        static struct sl_syscall_set removed_syscalls;
+        ret = sl_syscall_set_load(&removed_syscalls, removed_syscalls_path);
+        if (ret) {
+            exit(ret);
+        }
+        cfg.removed_syscalls = &removed_syscalls;
+    }
+    cfg.removed_syscalls_hash = sl_syscall_set_hash(cfg.removed_syscalls);
+
+    // read up front, as it's gone through once for every root
+    struct sl_filelist files;
+    if (files_from) {
+        ret = sl_filelist_load(&files, files_from);
+        if (ret) {
+            exit(ret);
+        }
+    }
+
     cfg.from_elfhash = bfd_elf_hash(cfg.from_ver);
     cfg.to_elfhash = bfd_elf_hash(cfg.to_ver);
 
-    if (cfg.check_syscall_abi || cfg.check_objabi) {
+    if (cfg.check_all) {
+        // every file is still only looked at once
+        cfg.check_syscall_abi = 1;
+        cfg.check_objabi = 1;
+    } else if (cfg.check_syscall_abi || cfg.check_objabi) {
         cfg.dry_run = 1;
     }
 
+    if (cfg.stats || cfg.stats_json) {
+        sl_stats_enable(cfg.stats_json ? SL_STATS_JSON : SL_STATS_TEXT);
+    }
+
     global_cfg = cfg;
 
-    // GCOVR_EXCL_START: impossible to fail before ELF v2 is released which is extremely unlikely
-    if (elf_version(EV_CURRENT) == EV_NONE) {
-        errx(EX_SOFTWARE, _("libelf initialization failed: %s"), elf_errmsg(-1));
+    // global_cfg must not change after this point, as the workers share it
+    struct sl_workqueue *wq = NULL;
+    if (global_cfg.jobs > 1) {
+        wq = sl_workqueue_new(&global_cfg, global_cfg.jobs);
     }
-    // GCOVR_EXCL_STOP
+
+    // shared by all roots, as they often have many files in common
+    struct sl_dedup *dd = sl_dedup_new(&global_cfg);
 
     const char *dir;
-    while ((dir = poptGetArg(pctx)) != NULL) {
-        ret = process_dir(dir);
-        if (ret) {
-            return ret;
+    ret = 0;
+    if (watch) {
+        ret = watch_roots(poptGetArgs(pctx), wq);
+    } else {
+        while ((dir = poptGetArg(pctx)) != NULL) {
+            ret = process_dir(dir, files_from ? &files : NULL, wq, dd);
+            if (ret) {
+                break;
+            }
         }
     }
 
-    if (cfg.check_objabi) {
-        objabi_print_final_report();
+    if (wq) {
+        sl_workqueue_finish(wq);
     }
 
-    if (cfg.check_syscall_abi) {
-        print_final_report();
+    sl_dedup_free(dd);
+    if (path_rules) {
+        sl_pathrules_free(path_rules);
+    }
+    if (files_from) {
+        sl_filelist_free(&files);
+    }
+
+    // also when stopping early, to tell where it went wrong
+    sl_stats_print();
+
+    if (ret) {
+        return ret;
+    }
+
+    // with records, there's nothing to add to them
+    if (cfg.format == SL_FORMAT_TEXT) {
+        if (cfg.check_objabi) {
+            objabi_print_final_report();
+        }
+
+        if (cfg.check_syscall_abi) {
+            print_final_report();
+        }
+
+        if (cfg.check_all) {
+            patch_print_final_report(&cfg);
+        }
     }
 
     poptFreeContext(pctx);
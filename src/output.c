@@ -0,0 +1,320 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buildconfig.gen.h"
+#include "output.h"
+#include "processing_syscall_abi.h"
+#include "utils.h"
+
+// records of many files are gathered before hitting stdout
+#define STDOUT_BUF_SIZE (1 << 20)
+
+static const char *const finding_names[SL_FINDING_KIND_MAX] = {
+    [SL_FINDING_NOT_ELF64] = "not_elf64",
+    [SL_FINDING_NOT_LE] = "not_le",
+    [SL_FINDING_NOT_LOONGARCH] = "not_loongarch",
+    [SL_FINDING_NO_SHSTRNDX] = "no_shstrndx",
+    [SL_FINDING_NO_SCN_NAME] = "no_scn_name",
+    [SL_FINDING_OBSOLETE_OBJABI] = "obsolete_objabi",
+    [SL_FINDING_REMOVED_SYSCALL] = "removed_syscall",
+    [SL_FINDING_PATCH_DYNSYM] = "patch_dynsym",
+    [SL_FINDING_PATCH_VERDEF] = "patch_verdef",
+    [SL_FINDING_PATCH_VERNEED] = "patch_verneed",
+    [SL_FINDING_PATCH_RODATA] = "patch_rodata",
+    [SL_FINDING_PATCH_TEXT_HASH] = "patch_text_hash",
+};
+
+// Makes stdout fully buffered with a large buffer, as nothing but whole
+// records is ever written to it.
+void sl_output_init(void)
+{
+    (void) setvbuf(stdout, NULL, _IOFBF, STDOUT_BUF_SIZE);
+}
+
+static void reserve(struct sl_output *out, size_t n)
+{
+    out->buf = grow_array(out->buf, &out->cap, out->len + n, 1);
+}
+
+static void vput(struct sl_output *out, const char *fmt, va_list ap)
+{
+    reserve(out, 64);
+    for (;;) {
+        va_list aq;
+        va_copy(aq, ap);
+        int n = vsnprintf(out->buf + out->len, out->cap - out->len, fmt, aq);
+        va_end(aq);
+
+        if ((size_t)n < out->cap - out->len) {
+            out->len += (size_t)n;
+            return;
+        }
+        reserve(out, (size_t)n + 1);
+    }
+}
+
+static void put(struct sl_output *out, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vput(out, fmt, ap);
+    va_end(ap);
+}
+
+// Adds a message for humans to the output of the file, like printf would
+// write it to stdout.
+void sl_output_text(struct sl_output *out, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vput(out, fmt, ap);
+    va_end(ap);
+}
+
+// Returns the length of the UTF-8 sequence at s, or 0 if it's not a valid
+// one: overlong forms, surrogates and code points beyond U+10FFFF are not.
+static size_t utf8_len(const unsigned char *s)
+{
+    if (s[0] < 0x80) {
+        return 1;
+    }
+
+    size_t len;
+    uint32_t cp;
+    uint32_t min;
+    if ((s[0] & 0xe0) == 0xc0) {
+        len = 2;
+        cp = s[0] & 0x1f;
+        min = 0x80;
+    } else if ((s[0] & 0xf0) == 0xe0) {
+        len = 3;
+        cp = s[0] & 0x0f;
+        min = 0x800;
+    } else if ((s[0] & 0xf8) == 0xf0) {
+        len = 4;
+        cp = s[0] & 0x07;
+        min = 0x10000;
+    } else {
+        return 0;
+    }
+
+    size_t i;
+    for (i = 1; i < len; i++) {
+        // also stops at the terminating NUL
+        if ((s[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        cp = (cp << 6) | (s[i] & 0x3f);
+    }
+
+    if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+        return 0;
+    }
+    return len;
+}
+
+// Paths and member names are just bytes, while JSON strings have to be
+// UTF-8.
+static bool is_utf8(const char *s)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    while (*p) {
+        size_t len = utf8_len(p);
+        if (!len) {
+            return false;
+        }
+        p += len;
+    }
+    return true;
+}
+
+// as a JSON string; bytes that are not valid UTF-8 are replaced by U+FFFD,
+// so that the record stays valid JSON, and put_raw_if_needed keeps the exact
+// bytes alongside
+static void put_str(struct sl_output *out, const char *s)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    reserve(out, 2);
+    out->buf[out->len++] = '"';
+    while (*p) {
+        unsigned char c = *p;
+        reserve(out, 7);
+        if (c == '"' || c == '\\') {
+            out->buf[out->len++] = '\\';
+            out->buf[out->len++] = (char)c;
+            p++;
+        } else if (c < 0x20) {
+            out->len += (size_t)sprintf(out->buf + out->len, "\\u%04x", c);
+            p++;
+        } else {
+            size_t len = utf8_len(p);
+            if (!len) {
+                memcpy(out->buf + out->len, "\\ufffd", 6);
+                out->len += 6;
+                p++;
+                continue;
+            }
+            memcpy(out->buf + out->len, p, len);
+            out->len += len;
+            p += len;
+        }
+    }
+    reserve(out, 1);
+    out->buf[out->len++] = '"';
+}
+
+static void put_hex(struct sl_output *out, const uint8_t *p, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    reserve(out, len * 2 + 2);
+    out->buf[out->len++] = '"';
+    size_t i;
+    for (i = 0; i < len; i++) {
+        out->buf[out->len++] = hex[p[i] >> 4];
+        out->buf[out->len++] = hex[p[i] & 0xf];
+    }
+    out->buf[out->len++] = '"';
+}
+
+// the exact bytes of strings that are not UTF-8, as hex in key_hex, so that
+// nothing is lost
+static void put_raw_if_needed(struct sl_output *out, const char *key, const char *s)
+{
+    if (!is_utf8(s)) {
+        put(out, ",\"%s_hex\":", key);
+        put_hex(out, (const uint8_t *)s, strlen(s));
+    }
+}
+
+static void put_key_str(struct sl_output *out, const char *key, const char *s)
+{
+    put(out, ",\"%s\":", key);
+    put_str(out, s);
+    put_raw_if_needed(out, key, s);
+}
+
+static void begin(struct sl_output *out, const char *path, const char *kind)
+{
+    put(out, "{\"path\":");
+    put_str(out, path);
+    put_raw_if_needed(out, "path", path);
+    put(out, ",\"kind\":\"%s\"", kind);
+}
+
+static void end(struct sl_output *out)
+{
+    put(out, "}\n");
+}
+
+// One record per finding. Offsets are from the start of the section.
+void sl_output_finding(struct sl_output *out, const struct sl_cfg *cfg, const char *path, const struct sl_finding *f)
+{
+    begin(out, path, finding_names[f->kind]);
+
+    switch (f->kind) {
+    case SL_FINDING_NOT_ELF64:
+    case SL_FINDING_NOT_LE:
+    case SL_FINDING_NO_SHSTRNDX:
+    case SL_FINDING_NO_SCN_NAME:
+        break;
+
+    case SL_FINDING_NOT_LOONGARCH:
+        put(out, ",\"e_machine\":%u", (unsigned int) f->u1);
+        break;
+
+    case SL_FINDING_OBSOLETE_OBJABI:
+        if (f->str) {
+            put_key_str(out, "member", f->str);
+        }
+        put(out, ",\"e_flags\":%u", (unsigned int) f->u1);
+        break;
+
+    case SL_FINDING_REMOVED_SYSCALL:
+        if (f->str) {
+            put_key_str(out, "member", f->str);
+        }
+        put(out, ",\"section\":\".text\",\"offset\":%llu", (unsigned long long) f->off1);
+        put_key_str(out, "syscall", removed_syscall_name(cfg, f->u1));
+        put(out, ",\"nr\":%u", (unsigned int) f->u1);
+        break;
+
+    case SL_FINDING_PATCH_DYNSYM:
+        put(out, ",\"section\":\".dynsym\",\"index\":%u", (unsigned int) f->u1);
+        put_key_str(out, "old", f->str);
+        put_key_str(out, "new", cfg->to_ver);
+        break;
+
+    case SL_FINDING_PATCH_VERDEF:
+        put(out, ",\"section\":\".gnu.version_d\",\"index\":%u", (unsigned int) f->u1);
+        put_key_str(out, "old", f->str);
+        put_key_str(out, "new", cfg->to_ver);
+        break;
+
+    case SL_FINDING_PATCH_VERNEED:
+        put(out, ",\"section\":\".gnu.version_r\",\"index\":%u,\"aux\":%u", (unsigned int) f->u1, (unsigned int) f->u2);
+        put_key_str(out, "old", f->str);
+        put_key_str(out, "new", cfg->to_ver);
+        break;
+
+    case SL_FINDING_PATCH_RODATA:
+        put(out, ",\"section\":\".rodata\",\"offset\":%llu", (unsigned long long) f->off1);
+        put_key_str(out, "old", f->str);
+        put_key_str(out, "new", cfg->to_ver);
+        break;
+
+    case SL_FINDING_PATCH_TEXT_HASH:
+        put(
+            out,
+            ",\"section\":\".text\",\"offset\":%llu,\"ori_offset\":%llu",
+            (unsigned long long) f->off1,
+            (unsigned long long) f->off2
+        );
+        break;
+
+    // GCOVR_EXCL_START
+    case SL_FINDING_KIND_MAX:
+        __builtin_unreachable();
+    // GCOVR_EXCL_STOP
+    }
+
+    end(out);
+}
+
+// One record per change written to a file. Unlike with findings, the offset
+// is from the start of the file.
+void sl_output_patch(
+    struct sl_output *out,
+    const char *path,
+    const char *scn,
+    uint64_t off,
+    const uint8_t *old,
+    const uint8_t *new,
+    size_t len)
+{
+    begin(out, path, "patched");
+    put_key_str(out, "section", scn);
+    put(out, ",\"file_offset\":%llu,\"old\":", (unsigned long long) off);
+    put_hex(out, old, len);
+    put(out, ",\"new\":");
+    put_hex(out, new, len);
+    end(out);
+}
+
+// Writes out the records in one go, then lets go of them.
+void sl_output_commit(struct sl_output *out)
+{
+    if (out->len) {
+        // stdio keeps a single call together, even with other threads
+        // writing at the same time
+        (void) fwrite(out->buf, 1, out->len, stdout);
+    }
+
+    free(out->buf);
+    out->buf = NULL;
+    out->len = 0;
+    out->cap = 0;
+}
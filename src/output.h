@@ -0,0 +1,32 @@
+#ifndef _shengloong_output_h
+#define _shengloong_output_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfg.h"
+#include "report.h"
+
+// Output about a file, either records in the JSON Lines format or messages
+// for humans, held back until the file is done, so that it's written out
+// together even with multiple workers.
+struct sl_output {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+void sl_output_init(void);
+void sl_output_text(struct sl_output *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void sl_output_finding(struct sl_output *out, const struct sl_cfg *cfg, const char *path, const struct sl_finding *f);
+void sl_output_patch(
+    struct sl_output *out,
+    const char *path,
+    const char *scn,
+    uint64_t off,
+    const uint8_t *old,
+    const uint8_t *new,
+    size_t len);
+void sl_output_commit(struct sl_output *out);
+
+#endif  // _shengloong_output_h
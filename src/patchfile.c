@@ -0,0 +1,355 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "buildconfig.gen.h"
+
+#if defined(HAVE_FICLONE) && HAVE_FICLONE
+#include <linux/fs.h>
+#endif
+
+#if defined(HAVE_SYS_XATTR_H) && HAVE_SYS_XATTR_H
+#include <sys/xattr.h>
+#endif
+
+#include "gettext.h"
+#include "patchfile.h"
+#include "stats.h"
+#include "utils.h"
+
+#define _(x) gettext(x)
+
+// Makes the changes right in the file.
+int sl_patch_in_place(struct sl_elf_ctx *ctx)
+{
+    struct sl_file *f = ctx->file;
+
+    int fd = openat(f->dir->fd, f->name, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, _("%s: cannot open for writing: %s\n"), sl_elf_path(ctx), strerror(errno));
+        return EX_NOPERM;
+    }
+
+    int ret = sl_elf_apply_patches(ctx, fd);
+    if (!ret && fdatasync(fd) < 0) {
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        fprintf(stderr, _("%s: cannot write back changes: %s\n"), sl_elf_path(ctx), strerror(errno));
+        ret = EX_IOERR;
+        // GCOVR_EXCL_STOP
+    }
+
+    (void) close(fd);
+    return ret;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int copy_data(int dst, int src, size_t size)
+{
+#if defined(HAVE_FICLONE) && HAVE_FICLONE
+    // shares the extents on filesystems like btrfs or XFS, so nothing is
+    // actually copied
+    if (ioctl(dst, FICLONE, src) == 0) {
+        return 0;
+    }
+#endif
+
+    off_t off = 0;
+
+#if defined(HAVE_COPY_FILE_RANGE) && HAVE_COPY_FILE_RANGE
+    // the kernel may still be able to avoid the copy, e.g. on NFS
+    while ((size_t)off < size) {
+        ssize_t n = copy_file_range(src, &off, dst, NULL, size - (size_t)off, 0);
+        if (n <= 0) {
+            break;
+        }
+        sl_stats_add(SL_STAT_BYTES_WRITTEN, (uint64_t)n);
+    }
+#endif
+
+    char buf[65536];
+    while ((size_t)off < size) {
+        ssize_t n = pread(src, buf, sizeof(buf), off);
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        if (n < 0) {
+            return -1;
+        }
+        // GCOVR_EXCL_STOP
+        if (n == 0) {
+            break;  // GCOVR_EXCL_LINE: racing with other writers
+        }
+        sl_stats_add(SL_STAT_BYTES_READ, (uint64_t)n);
+
+        const char *p = buf;
+        while (n > 0) {
+            ssize_t w = pwrite(dst, p, (size_t)n, off);
+            // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+            if (w < 0) {
+                return -1;
+            }
+            // GCOVR_EXCL_STOP
+            sl_stats_add(SL_STAT_BYTES_WRITTEN, (uint64_t)w);
+            p += w;
+            n -= w;
+            off += w;
+        }
+    }
+
+    return 0;
+}
+
+#if defined(HAVE_SYS_XATTR_H) && HAVE_SYS_XATTR_H
+// copies all extended attributes, including ACLs, SELinux labels and file
+// capabilities
+static int copy_xattrs(int dst, int src)
+{
+    int ret = -1;
+    char *names = NULL;
+    size_t names_cap = 0;
+    char *value = NULL;
+    size_t value_cap = 0;
+
+    // sizes are asked for first, and asked again if they grew in between
+    ssize_t len;
+    do {
+        len = flistxattr(src, NULL, 0);
+        if (len <= 0) {
+            break;
+        }
+        names = grow_array(names, &names_cap, (size_t)len, 1);
+        len = flistxattr(src, names, (size_t)len);
+    } while (len < 0 && errno == ERANGE);
+
+    if (len < 0) {
+        // GCOVR_EXCL_START: depends on the filesystem
+        if (errno == ENOTSUP) {
+            ret = 0;
+        }
+        goto out;
+        // GCOVR_EXCL_STOP
+    }
+
+    const char *name;
+    for (name = names; len > 0 && name < names + len; name += strlen(name) + 1) {
+        ssize_t n;
+        do {
+            n = fgetxattr(src, name, NULL, 0);
+            if (n <= 0) {
+                break;
+            }
+            value = grow_array(value, &value_cap, (size_t)n, 1);
+            n = fgetxattr(src, name, value, (size_t)n);
+        } while (n < 0 && errno == ERANGE);
+
+        // GCOVR_EXCL_START: racing with other writers
+        if (n < 0) {
+            if (errno == ENODATA) {
+                continue;
+            }
+            goto out;
+        }
+        // GCOVR_EXCL_STOP
+
+        if (fsetxattr(dst, name, value, (size_t)n, 0) < 0) {
+            goto out;  // GCOVR_EXCL_LINE: lacking privileges
+        }
+    }
+
+    ret = 0;
+
+out:
+    free(names);
+    free(value);
+    return ret;
+}
+#endif
+
+// keeps the owner, mode and extended attributes of the original
+static int copy_metadata(int dst, int src, const struct stat *sb)
+{
+    if (fchown(dst, sb->st_uid, sb->st_gid) < 0) {
+        return -1;  // GCOVR_EXCL_LINE: lacking privileges
+    }
+
+#if defined(HAVE_SYS_XATTR_H) && HAVE_SYS_XATTR_H
+    if (copy_xattrs(dst, src) < 0) {
+        return -1;  // GCOVR_EXCL_LINE: lacking privileges
+    }
+#else
+    (void) src;
+#endif
+
+    // last, as changing the owner clears the set-user-ID and set-group-ID bits
+    return fchmod(dst, sb->st_mode & 07777);
+}
+
+// Swaps the copy in, making sure the original is still the file looked at.
+// If it's not, and the file found in its place cannot be swapped back, that
+// one is left at tmpname and *stranded is set.
+static int swap_in(int dirfd, const char *tmpname, const char *name, const struct stat *sb, bool *stranded)
+{
+#if defined(HAVE_RENAMEAT2) && HAVE_RENAMEAT2
+    if (renameat2(dirfd, tmpname, dirfd, name, RENAME_EXCHANGE) == 0) {
+        struct stat old;
+        if (fstatat(dirfd, tmpname, &old, AT_SYMLINK_NOFOLLOW) == 0
+                && old.st_dev == sb->st_dev
+                && old.st_ino == sb->st_ino) {
+            return 0;
+        }
+
+        // GCOVR_EXCL_START: racing with other writers
+        // replaced by someone else in the meantime, who wins
+        if (renameat2(dirfd, tmpname, dirfd, name, RENAME_EXCHANGE) < 0) {
+            *stranded = true;
+            return -1;
+        }
+        errno = EBUSY;
+        return -1;
+        // GCOVR_EXCL_STOP
+    }
+
+    // GCOVR_EXCL_START: depends on the filesystem
+    if (errno != EINVAL && errno != ENOSYS) {
+        return -1;
+    }
+    // GCOVR_EXCL_STOP
+#else
+    (void) stranded;
+#endif
+
+    // GCOVR_EXCL_START: depends on the filesystem
+    // the check and the rename are not atomic here, but this still keeps
+    // from overwriting files put in place long enough before
+    struct stat cur;
+    if (fstatat(dirfd, name, &cur, AT_SYMLINK_NOFOLLOW) < 0) {
+        return -1;
+    }
+    if (cur.st_dev != sb->st_dev || cur.st_ino != sb->st_ino) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    return renameat(dirfd, tmpname, dirfd, name);
+    // GCOVR_EXCL_STOP
+}
+
+// Makes the changes to a copy of the file, which is then renamed over the
+// original. Programs running off the file keep seeing the original, and
+// others see either all of the changes or none of them, even across crashes.
+// Files with several links are patched in place, so the links are kept.
+int sl_patch_replace(struct sl_elf_ctx *ctx)
+{
+    static unsigned int counter;
+    struct sl_file *f = ctx->file;
+    int dirfd = f->dir->fd;
+    int ret = EX_IOERR;
+
+    int src = openat(dirfd, f->name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (src < 0) {
+        fprintf(stderr, _("%s: cannot open: %s\n"), sl_elf_path(ctx), strerror(errno));
+        return EX_NOINPUT;
+    }
+
+    struct stat sb;
+    // GCOVR_EXCL_START: excessively unlikely to happen
+    if (fstat(src, &sb) < 0) {
+        fprintf(stderr, _("%s: cannot stat: %s\n"), sl_elf_path(ctx), strerror(errno));
+        (void) close(src);
+        return EX_IOERR;
+    }
+    // GCOVR_EXCL_STOP
+
+    if (sb.st_nlink > 1) {
+        (void) close(src);
+        return sl_patch_in_place(ctx);
+    }
+
+    char tmpname[64];
+    int dst = -1;
+    do {
+        unsigned int n = __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+        snprintf(tmpname, sizeof(tmpname), SL_PATCH_TMP_PREFIX "%ld-%u.tmp", (long)getpid(), n);
+        dst = openat(dirfd, tmpname, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    } while (dst < 0 && errno == EEXIST);
+
+    if (dst < 0) {
+        fprintf(stderr, _("%s: cannot create a copy to patch: %s\n"), sl_elf_path(ctx), strerror(errno));
+        (void) close(src);
+        return EX_CANTCREAT;
+    }
+
+    if (copy_data(dst, src, (size_t)sb.st_size) < 0) {
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        fprintf(stderr, _("%s: cannot copy: %s\n"), sl_elf_path(ctx), strerror(errno));
+        goto fail;
+        // GCOVR_EXCL_STOP
+    }
+
+    // the copy is checked against the bytes looked at, like the original
+    // would be
+    ret = sl_elf_apply_patches(ctx, dst);
+    if (ret) {
+        goto fail;  // GCOVR_EXCL_LINE: racing with other writers
+    }
+    ret = EX_IOERR;
+
+    if (copy_metadata(dst, src, &sb) < 0) {
+        // GCOVR_EXCL_START: lacking privileges
+        fprintf(stderr, _("%s: cannot keep the owner, mode or attributes: %s\n"), sl_elf_path(ctx), strerror(errno));
+        goto fail;
+        // GCOVR_EXCL_STOP
+    }
+
+    // all of it has to be on disk before the copy takes the original's place
+    if (fsync(dst) < 0) {
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        fprintf(stderr, _("%s: cannot write back changes: %s\n"), sl_elf_path(ctx), strerror(errno));
+        goto fail;
+        // GCOVR_EXCL_STOP
+    }
+
+    bool stranded = false;
+    if (swap_in(dirfd, tmpname, f->name, &sb, &stranded) < 0) {
+        // GCOVR_EXCL_START: racing with other writers
+        if (stranded) {
+            // our copy of the stale file is in place, and what replaced the
+            // original is at tmpname, which is then the only copy of it
+            char *path = sl_dir_path(f->dir, tmpname);
+            fprintf(
+                stderr,
+                _("%s: replaced while being patched, and cannot be put back: %s; the replacement is left at %s\n"),
+                sl_elf_path(ctx),
+                strerror(errno),
+                path
+            );
+            free(path);
+            (void) close(dst);
+            (void) close(src);
+            return EX_IOERR;
+        }
+        fprintf(stderr, _("%s: cannot replace: %s\n"), sl_elf_path(ctx), strerror(errno));
+        goto fail;
+        // GCOVR_EXCL_STOP
+    }
+
+    // with RENAME_EXCHANGE, the original is now at tmpname; otherwise this
+    // quietly does nothing
+    (void) unlinkat(dirfd, tmpname, 0);
+    (void) fsync(dirfd);
+    (void) close(dst);
+    (void) close(src);
+    return 0;
+
+fail:
+    (void) unlinkat(dirfd, tmpname, 0);
+    (void) close(dst);
+    (void) close(src);
+    return ret;
+}
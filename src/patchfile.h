@@ -0,0 +1,12 @@
+#ifndef _shengloong_patchfile_h
+#define _shengloong_patchfile_h
+
+#include "ctx.h"
+
+// copies being patched are named like this, in the same directory
+#define SL_PATCH_TMP_PREFIX ".shengloong-"
+
+int sl_patch_in_place(struct sl_elf_ctx *ctx);
+int sl_patch_replace(struct sl_elf_ctx *ctx);
+
+#endif  // _shengloong_patchfile_h
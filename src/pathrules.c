@@ -0,0 +1,194 @@
+#include <err.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "buildconfig.gen.h"
+#include "gettext.h"
+#include "pathrules.h"
+#include "utils.h"
+
+#define _(x) gettext(x)
+
+struct pathrule {
+    bool include;
+    bool anchored;
+    bool dir_only;
+
+    size_t nr_comps;
+    size_t cap_comps;
+    char **comps;
+    // components without glob characters are simply compared
+    bool *is_glob;
+};
+
+struct sl_pathrules {
+    struct pathrule *rules;
+    size_t nr;
+    size_t cap;
+    size_t nr_anchored;
+};
+
+struct sl_pathrules *sl_pathrules_new(void)
+{
+    struct sl_pathrules *pr = calloc(1, sizeof(*pr));
+    // GCOVR_EXCL_START: OOM
+    if (!pr) {
+        err(EX_OSERR, _("cannot allocate path rules"));
+    }
+    // GCOVR_EXCL_STOP
+    return pr;
+}
+
+void sl_pathrules_free(struct sl_pathrules *pr)
+{
+    size_t i;
+    for (i = 0; i < pr->nr; i++) {
+        size_t j;
+        for (j = 0; j < pr->rules[i].nr_comps; j++) {
+            free(pr->rules[i].comps[j]);
+        }
+        free(pr->rules[i].comps);
+        free(pr->rules[i].is_glob);
+    }
+    free(pr->rules);
+    free(pr);
+}
+
+// Adds a rule after the ones added before, which take precedence.
+void sl_pathrules_add(struct sl_pathrules *pr, const char *pattern, bool include)
+{
+    pr->rules = grow_array(pr->rules, &pr->cap, pr->nr + 1, sizeof(*pr->rules));
+    struct pathrule *r = &pr->rules[pr->nr++];
+    r->include = include;
+
+    size_t len = strlen(pattern);
+    if (len && pattern[len - 1] == '/') {
+        r->dir_only = true;
+    }
+    while (len && pattern[len - 1] == '/') {
+        len--;
+    }
+    r->anchored = memchr(pattern, '/', len) != NULL;
+
+    // empty components, like from a leading slash, are dropped
+    const char *p = pattern;
+    const char *end = pattern + len;
+    while (p < end) {
+        const char *q = memchr(p, '/', (size_t)(end - p));
+        if (!q) {
+            q = end;
+        }
+
+        if (q > p) {
+            // both arrays always have the same capacity
+            size_t cap = r->cap_comps;
+            r->comps = grow_array(r->comps, &r->cap_comps, r->nr_comps + 1, sizeof(*r->comps));
+            r->is_glob = grow_array(r->is_glob, &cap, r->nr_comps + 1, sizeof(*r->is_glob));
+            char *comp = strndup(p, (size_t)(q - p));
+            // GCOVR_EXCL_START: OOM
+            if (!comp) {
+                err(EX_OSERR, _("cannot allocate path rules"));
+            }
+            // GCOVR_EXCL_STOP
+            r->is_glob[r->nr_comps] = strpbrk(comp, "*?[\\") != NULL;
+            r->comps[r->nr_comps++] = comp;
+        }
+
+        p = q + 1;
+    }
+
+    // patterns of slashes alone are left without components, and never
+    // match, as the root itself is never checked
+    if (r->anchored) {
+        pr->nr_anchored++;
+    }
+}
+
+static bool comp_matches(const struct pathrule *r, size_t i, const char *name)
+{
+    if (!r->is_glob[i]) {
+        return !strcmp(r->comps[i], name);
+    }
+    return fnmatch(r->comps[i], name, 0) == 0;
+}
+
+// Sets up the state for the entries of the root, with every anchored rule
+// still to be matched from its first component.
+void sl_pathrules_root(const struct sl_pathrules *pr, struct sl_pathrules_state *root)
+{
+    root->active = NULL;
+    root->nr = 0;
+    if (!pr->nr_anchored) {
+        return;
+    }
+
+    size_t cap = 0;
+    root->active = grow_array(NULL, &cap, pr->nr_anchored, sizeof(*root->active));
+    size_t i;
+    for (i = 0; i < pr->nr; i++) {
+        if (pr->rules[i].anchored && pr->rules[i].nr_comps) {
+            root->active[root->nr++] = (uint32_t)i << 16;
+        }
+    }
+}
+
+// Returns whether the entry of the given name, in the directory with the
+// given state, is to be looked at. For directories, child gets the state
+// for their entries if non-NULL; it must be finalized either way.
+bool sl_pathrules_check(
+    const struct sl_pathrules *pr,
+    const struct sl_pathrules_state *parent,
+    const char *name,
+    bool is_dir,
+    struct sl_pathrules_state *child)
+{
+    if (child) {
+        child->active = NULL;
+        child->nr = 0;
+    }
+
+    // index of the first rule matching in full
+    size_t decider = pr->nr;
+
+    size_t i;
+    for (i = 0; i < parent->nr; i++) {
+        size_t ri = parent->active[i] >> 16;
+        size_t pos = parent->active[i] & 0xffff;
+        const struct pathrule *r = &pr->rules[ri];
+        if (!comp_matches(r, pos, name)) {
+            continue;
+        }
+
+        if (pos + 1 == r->nr_comps) {
+            if ((!r->dir_only || is_dir) && ri < decider) {
+                decider = ri;
+            }
+        } else if (is_dir && child && pos + 1 < 0xffff) {
+            if (!child->active) {
+                size_t cap = 0;
+                child->active = grow_array(NULL, &cap, parent->nr, sizeof(*child->active));
+            }
+            child->active[child->nr++] = parent->active[i] + 1;
+        }
+    }
+
+    // the rules are few, so going through the unanchored ones is cheap
+    for (i = 0; i < pr->nr && i < decider; i++) {
+        const struct pathrule *r = &pr->rules[i];
+        if (!r->anchored && r->nr_comps && (!r->dir_only || is_dir) && comp_matches(r, 0, name)) {
+            decider = i;
+            break;
+        }
+    }
+
+    return decider == pr->nr || pr->rules[decider].include;
+}
+
+void sl_pathrules_state_fini(struct sl_pathrules_state *s)
+{
+    free(s->active);
+    s->active = NULL;
+    s->nr = 0;
+}
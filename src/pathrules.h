@@ -0,0 +1,45 @@
+#ifndef _shengloong_pathrules_h
+#define _shengloong_pathrules_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Rules from --exclude and --include, deciding which paths under the roots
+// are looked at, like rsync(1) filter rules:
+//
+// * the first rule matching a path decides, and paths no rule matches are
+//   looked at;
+// * patterns are globs, matched against the path relative to the root if
+//   they have a slash other than at the end, or else against the name at
+//   any depth; * and ? never match a slash;
+// * patterns ending with a slash only match directories;
+// * excluded directories are never entered, so nothing under them can be
+//   included again.
+//
+// The patterns are split into components once, and every directory carries
+// the anchored rules still able to match below it, so that each entry is
+// only matched against those, and the unanchored ones.
+struct sl_pathrules;
+
+// anchored rules partially matched down to a directory
+struct sl_pathrules_state {
+    // rule index in the upper half, components matched in the lower
+    uint32_t *active;
+    size_t nr;
+};
+
+struct sl_pathrules *sl_pathrules_new(void);
+void sl_pathrules_free(struct sl_pathrules *pr);
+void sl_pathrules_add(struct sl_pathrules *pr, const char *pattern, bool include);
+
+void sl_pathrules_root(const struct sl_pathrules *pr, struct sl_pathrules_state *root);
+bool sl_pathrules_check(
+    const struct sl_pathrules *pr,
+    const struct sl_pathrules_state *parent,
+    const char *name,
+    bool is_dir,
+    struct sl_pathrules_state *child);
+void sl_pathrules_state_fini(struct sl_pathrules_state *s);
+
+#endif  // _shengloong_pathrules_h
@@ -0,0 +1,272 @@
+#include <endian.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "archive.h"
+#include "buildconfig.gen.h"
+#include "elf64.h"
+#include "elfcompat.h"
+#include "gettext.h"
+#include "prefetch.h"
+#include "processing.h"
+#include "stats.h"
+
+#define _(x) gettext(x)
+
+// how many files may wait in the stage; every one holds an open fd
+#define WINDOW_SIZE 32
+
+// how many files come in after one before its sections are asked for, so
+// that reading its section headers doesn't have to wait for the disk
+#define SCNS_LAG 2
+
+struct prefetch_item {
+    struct sl_file file;
+    int fd;
+    uint64_t size;
+    // the start of the file, as read by the walker
+    Elf64_Ehdr ehdr;
+    bool is_archive;
+    enum sl_compression compression;
+    // read ahead for this file so far
+    uint64_t bytes;
+    // nothing more to ask for
+    bool advised;
+    char name[NAME_MAX + 1];
+};
+
+struct sl_prefetch {
+    const struct sl_cfg *cfg;
+    struct sl_workqueue *wq;
+
+    // ring buffer of files waiting, oldest first
+    struct prefetch_item items[WINDOW_SIZE];
+    size_t head;
+    size_t len;
+
+    // read ahead for the files waiting
+    uint64_t bytes;
+};
+
+struct sl_prefetch *sl_prefetch_new(const struct sl_cfg *cfg, struct sl_workqueue *wq)
+{
+    struct sl_prefetch *pf = calloc(1, sizeof(*pf));
+    // GCOVR_EXCL_START: OOM
+    if (!pf) {
+        err(EX_OSERR, _("cannot allocate prefetch window"));
+    }
+    // GCOVR_EXCL_STOP
+
+    pf->cfg = cfg;
+    pf->wq = wq;
+    return pf;
+}
+
+static struct prefetch_item *item_at(struct sl_prefetch *pf, size_t i)
+{
+    return &pf->items[(pf->head + i) % WINDOW_SIZE];
+}
+
+// Tells whether the byte at off is in the page cache, without waiting for
+// it. When a run is repeated, everything usually is, and asking for every
+// page of large sections to be read ahead is then not free.
+static bool is_cached(int fd, uint64_t off)
+{
+#if defined(HAVE_RWF_NOWAIT) && HAVE_RWF_NOWAIT
+    uint8_t c;
+    struct iovec iov = { .iov_base = &c, .iov_len = 1 };
+    return preadv2(fd, &iov, 1, (off_t)off, RWF_NOWAIT) == 1;
+#else
+    (void) fd;
+    (void) off;
+    return false;
+#endif
+}
+
+// Asks for [off, off + len) of the file to be read in the background, as far
+// as the limit allows. Returns false if it's in the page cache already, as
+// far as can be told from its last byte; the start of the file never tells,
+// as the walker has just read it.
+static bool advise(struct sl_prefetch *pf, struct prefetch_item *it, uint64_t off, uint64_t len)
+{
+    if (off >= it->size || len == 0) {
+        return true;
+    }
+    if (len > it->size - off) {
+        len = it->size - off;
+    }
+    if (is_cached(it->fd, off + len - 1)) {
+        return false;
+    }
+
+    if (pf->bytes >= pf->cfg->prefetch_bytes) {
+        return true;
+    }
+    if (len > pf->cfg->prefetch_bytes - pf->bytes) {
+        len = pf->cfg->prefetch_bytes - pf->bytes;
+    }
+
+    (void) posix_fadvise(it->fd, (off_t)off, (off_t)len, POSIX_FADV_WILLNEED);
+    it->bytes += len;
+    pf->bytes += len;
+    sl_stats_add(SL_STAT_BYTES_PREFETCHED, len);
+    return true;
+}
+
+// like check_ehdr, without reporting anything
+static bool is_loongarch(const Elf64_Ehdr *ehdr)
+{
+    return ehdr->e_ident[EI_CLASS] == ELFCLASS64
+        && ehdr->e_ident[EI_DATA] == ELFDATA2LSB
+        && le16toh(ehdr->e_machine) == EM_LOONGARCH;
+}
+
+// the sections process_elf looks into in the current mode
+static bool is_scn_needed(const struct sl_cfg *cfg, bool is_ldso, const char *name)
+{
+    if (!strcmp(name, ".text")) {
+        return is_ldso || cfg->check_syscall_abi;
+    }
+
+    if (!sl_cfg_wants_patch(cfg)) {
+        return false;
+    }
+
+    if (!strcmp(name, ".rodata")) {
+        return is_ldso;
+    }
+
+    return !strcmp(name, ".dynstr")
+        || !strcmp(name, ".dynsym")
+        || !strcmp(name, ".gnu.version_d")
+        || !strcmp(name, ".gnu.version_r");
+}
+
+// By now the section headers and their names are hopefully in the page
+// cache, so this is cheap.
+static void advise_scns(struct sl_prefetch *pf, struct prefetch_item *it)
+{
+    it->advised = true;
+
+    struct sl_elf64 elf;
+    if (sl_elf64_open(&elf, it->fd, it->size) == SL_ELF64_OK) {
+        bool is_ldso = sl_file_is_ldso(&it->file);
+        size_t i;
+        for (i = 1; i < elf.shnum; i++) {
+            struct sl_elf64_scn scn;
+            if (sl_elf64_scn(&elf, i, &scn) && scn.name && is_scn_needed(pf->cfg, is_ldso, scn.name)) {
+                advise(pf, it, scn.offset, scn.size);
+            }
+        }
+    }
+    sl_elf64_fini(&elf);
+}
+
+// looks at the oldest file like the walker would have, and hands it over to
+// be processed if there's more to do
+static void dispatch(struct sl_prefetch *pf)
+{
+    struct prefetch_item *it = item_at(pf, 0);
+    pf->head = (pf->head + 1) % WINDOW_SIZE;
+    pf->len--;
+    pf->bytes -= it->bytes;
+
+    bool wanted;
+    if (it->is_archive) {
+        wanted = process_armag(pf->cfg, &it->file);
+    } else if (it->compression != SL_COMPRESSION_NONE) {
+        wanted = process_zmagic(pf->cfg, &it->file, it->compression);
+    } else {
+        wanted = process_ehdr(pf->cfg, &it->file, &it->ehdr);
+    }
+
+    if (!wanted) {
+        (void) close(it->fd);
+    } else if (pf->wq) {
+        // waiting for room in the queue is not part of opening the file
+        sl_stats_phase(SL_PHASE_NONE);
+        // fd is moved into the queue
+        sl_workqueue_submit(pf->wq, &it->file, it->fd);
+    } else {
+        // fd is moved into process; better to continue with the remaining
+        // files if anything goes wrong
+        (void) process(pf->cfg, &it->file, it->fd);
+    }
+    sl_dir_put(it->file.dir);
+}
+
+// Takes ownership of fd and the file's results, and a new reference to its
+// dir. ehdr is the start of the file as read by the walker, which has the
+// magic of an ELF, an archive or a compressed file; the file is only looked
+// at beyond that when it leaves the stage, so that everything shown comes in
+// the same order as without the stage.
+void sl_prefetch_submit(struct sl_prefetch *pf, const struct sl_file *f, int fd, uint64_t size, const Elf64_Ehdr *ehdr)
+{
+    // always room for a single file, however large
+    while (pf->len == WINDOW_SIZE || (pf->len && pf->bytes >= pf->cfg->prefetch_bytes)) {
+        dispatch(pf);
+    }
+
+    sl_stats_phase(SL_PHASE_OPEN);
+
+    struct prefetch_item *it = item_at(pf, pf->len++);
+    it->file = *f;
+    it->file.dir = sl_dir_get(f->dir);
+    // d_name is bounded by NAME_MAX
+    strcpy(it->name, f->name);
+    it->file.name = it->name;
+    it->fd = fd;
+    it->size = size;
+    it->ehdr = *ehdr;
+    it->is_archive = sl_ar_is_archive(ehdr, sizeof(*ehdr));
+    it->compression = it->is_archive ? SL_COMPRESSION_NONE : sl_compression_detect(ehdr, sizeof(*ehdr));
+    it->bytes = 0;
+    it->advised = true;
+
+    if (it->is_archive || it->compression != SL_COMPRESSION_NONE) {
+        // only ever looked into by the checks, from front to back
+        if (pf->cfg->check_objabi || pf->cfg->check_syscall_abi) {
+            advise(pf, it, 0, size);
+        }
+    } else if (sl_cfg_needs_only_ehdr(pf->cfg) || !is_loongarch(ehdr)) {
+        // nothing beyond the header is ever looked at
+    } else if (f->dedup && pf->cfg->content_cache) {
+        // hashed whole first
+        advise(pf, it, 0, size);
+    } else {
+        uint64_t shoff = le64toh(ehdr->e_shoff);
+        uint64_t shnum = le16toh(ehdr->e_shnum);
+        // the real number is in the first entry if it doesn't fit; with the
+        // section headers cached, the rest of the file likely is too
+        it->advised = !advise(pf, it, shoff, (shnum ? shnum : 1) * sizeof(Elf64_Shdr)) || shoff == 0;
+    }
+
+    size_t i;
+    for (i = 0; i + SCNS_LAG < pf->len; i++) {
+        it = item_at(pf, i);
+        if (!it->advised) {
+            advise_scns(pf, it);
+        }
+    }
+}
+
+// hands over every file waiting
+void sl_prefetch_flush(struct sl_prefetch *pf)
+{
+    while (pf->len) {
+        dispatch(pf);
+    }
+}
+
+void sl_prefetch_free(struct sl_prefetch *pf)
+{
+    sl_prefetch_flush(pf);
+    free(pf);
+}
@@ -0,0 +1,29 @@
+#ifndef _shengloong_prefetch_h
+#define _shengloong_prefetch_h
+
+#include <stdint.h>
+
+#include <elf.h>
+
+#include "cfg.h"
+#include "file.h"
+#include "workqueue.h"
+
+// A stage between the walker and the processing of files, asking the kernel
+// to read ahead what's going to be looked at in the files waiting, so that
+// the disk is kept busy while earlier files are processed.
+//
+// The section headers are asked for as soon as a file comes in, then the
+// sections the current mode needs, once the headers are likely read; files
+// found in the page cache already are left alone. Files stay in the stage
+// until what's read ahead for the files after them would go over
+// cfg->prefetch_bytes.
+struct sl_prefetch;
+
+// wq may be NULL, in which case files are processed inline
+struct sl_prefetch *sl_prefetch_new(const struct sl_cfg *cfg, struct sl_workqueue *wq);
+void sl_prefetch_submit(struct sl_prefetch *pf, const struct sl_file *f, int fd, uint64_t size, const Elf64_Ehdr *ehdr);
+void sl_prefetch_flush(struct sl_prefetch *pf);
+void sl_prefetch_free(struct sl_prefetch *pf);
+
+#endif  // _shengloong_prefetch_h
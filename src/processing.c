@@ -1,173 +1,416 @@
 #include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
 #include <unistd.h>
-
-#include <gelf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "buildconfig.gen.h"
+#include "dedup.h"
 #include "elfcompat.h"
 #include "gettext.h"
+#include "output.h"
+#include "patchfile.h"
 #include "processing.h"
+#include "processing_archive.h"
+#include "processing_compressed.h"
 #include "processing_ldso.h"
 #include "processing_objabi.h"
 #include "processing_syscall_abi.h"
+#include "stats.h"
 #include "utils.h"
 
 #define _(x) gettext(x)
 
 static int process_elf(struct sl_elf_ctx *ctx);
-static int process_elf_dynsym(struct sl_elf_ctx *ctx, Elf_Scn *s, size_t n);
-static int process_elf_gnu_version_d(struct sl_elf_ctx *ctx, Elf_Scn *s, size_t n);
-static int process_elf_gnu_version_r(struct sl_elf_ctx *ctx, Elf_Scn *s, size_t n);
+static int process_elf_dynsym(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s);
+static int process_elf_gnu_version_d(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s);
+static int process_elf_gnu_version_r(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s);
 
-// moves fd
-int process(const struct sl_cfg *cfg, const char *path, int fd)
+static void report_simple(struct sl_elf_ctx *ctx, enum sl_finding_kind kind, uint32_t u1)
 {
-    Elf *e;
-    int ret = 0;
+    struct sl_finding f = {
+        .kind = kind,
+        .u1 = u1,
+    };
+    sl_report(ctx, &f);
+}
 
-    e = elf_begin(fd, cfg->dry_run ? ELF_C_READ_MMAP : ELF_C_RDWR_MMAP, NULL);
-    // GCOVR_EXCL_START: excessively unlikely to happen
-    if (!e) {
-        fprintf(stderr, _("elf_begin on %s (fd %d) failed: %s\n"), path, fd, elf_errmsg(-1));
-        goto close;
+// Does everything that only needs the ELF header, whose magic is already
+// checked. Returns whether the file is a LoongArch one to look into further.
+bool check_ehdr(struct sl_elf_ctx *ctx, const Elf64_Ehdr *ehdr)
+{
+    struct sl_file *f = ctx->file;
+
+    sl_stats_add(SL_STAT_ELF_MAGIC, 1);
+
+    // only process ELF64 files for now
+    if (ehdr->e_ident[EI_CLASS] != ELFCLASS64) {
+        sl_stats_add(SL_STAT_REJECT_CLASS, 1);
+        report_simple(ctx, SL_FINDING_NOT_ELF64, 0);
+        goto reject;
     }
-    // GCOVR_EXCL_STOP
 
+    // only process little-endian files for now
+    if (ehdr->e_ident[EI_DATA] != ELFDATA2LSB) {
+        sl_stats_add(SL_STAT_REJECT_ENDIAN, 1);
+        report_simple(ctx, SL_FINDING_NOT_LE, 0);
+        goto reject;
+    }
+
+    // only process LoongArch files
+    Elf64_Half e_machine = le16toh(ehdr->e_machine);
+    if (e_machine != EM_LOONGARCH) {
+        sl_stats_add(SL_STAT_REJECT_MACHINE, 1);
+        report_simple(ctx, SL_FINDING_NOT_LOONGARCH, e_machine);
+        goto reject;
+    }
+
+    // the object file ABI is always checked, as nothing beyond the header is
+    // needed for this; it's only shown in the objabi check mode though
+    f->res.flags |= SL_RESULT_LOONGARCH;
+    f->res.e_flags = le32toh(ehdr->e_flags);
+    f->res.analyses |= SL_ANALYSIS_HDR | SL_ANALYSIS_OBJABI;
+    check_objabi(ctx, f->res.e_flags);
+
+    return true;
+
+reject:
+    // nothing else is ever done with files other than LoongArch ones
+    f->res.analyses = SL_ANALYSIS_ALL;
+    return false;
+}
+
+bool process_ehdr(const struct sl_cfg *cfg, struct sl_file *f, const Elf64_Ehdr *ehdr)
+{
     struct sl_elf_ctx ctx = {
         .cfg = cfg,
-        .path = path,
-        .e = e,
-        .dirty = false,
+        .file = f,
+        .path = NULL,
     };
 
-    switch (elf_kind(e)) {
-    case ELF_K_ELF:
-        ret = process_elf(&ctx);
-        break;
+    bool ret = check_ehdr(&ctx, ehdr) && !sl_cfg_needs_only_ehdr(cfg);
+    if (!ret) {
+        sl_file_done(f, SL_FILE_UNCHANGED);
+    }
 
-    // GCOVR_EXCL_START
-    default:
-        // currently impossible to reach, due to early checking of ELF magic
-        // during directorywalking
-        //
-        // specifically, ar(1) archives don't need patching, as the expected
-        // usage of this program is to patch sysroot then re-emerge world,
-        // so static libraries get properly rebuilt
-        __builtin_unreachable();
-        // GCOVR_EXCL_STOP
+    free(ctx.path);
+    return ret;
+}
+
+// whether files only ever looked into by the checks, like archives, are to
+// be looked into in the current mode; the file is done with otherwise
+static bool wants_checks_only(const struct sl_cfg *cfg, struct sl_file *f)
+{
+    if (cfg->check_objabi || cfg->check_syscall_abi) {
+        return true;
     }
 
-    (void) elf_end(e);
-    (void) close(fd);
+    // left for a later run doing the checks
+    f->res.analyses = SL_ANALYSIS_HDR | SL_ANALYSIS_PATCH;
+    sl_file_done(f, SL_FILE_UNCHANGED);
+    return false;
+}
 
-    return ret;
+// Like process_ehdr, for files starting with the magic of an ar archive.
+// Only the checks look into the members, as nothing in there is ever
+// patched.
+bool process_armag(const struct sl_cfg *cfg, struct sl_file *f)
+{
+    sl_stats_add(SL_STAT_ARCHIVES, 1);
+
+    if (!wants_checks_only(cfg, f)) {
+        return false;
+    }
+
+    f->is_archive = true;
+    return true;
+}
 
+// Likewise, for files compressed as a whole, which can only be checked as
+// nothing in them is ever patched.
+bool process_zmagic(const struct sl_cfg *cfg, struct sl_file *f, enum sl_compression c)
+{
+    sl_stats_add(SL_STAT_COMPRESSED, 1);
+
+    if (!wants_checks_only(cfg, f)) {
+        return false;
+    }
+
+    f->compression = c;
+    return true;
+}
+
+// maps the whole file, returning NULL if it cannot be
+static void *map_whole(struct sl_elf_ctx *ctx, int fd, size_t *size)
+{
+    struct stat sb;
+    // GCOVR_EXCL_START: racing with other writers
+    if (fstat(fd, &sb) < 0 || sb.st_size <= 0) {
+        return NULL;
+    }
+    // GCOVR_EXCL_STOP
+
+    void *buf = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     // GCOVR_EXCL_START: excessively unlikely to happen
-close:
-    (void) close(fd);
-    return EX_SOFTWARE;
+    if (buf == MAP_FAILED) {
+        fprintf(stderr, _("%s: cannot map: %s\n"), sl_elf_path(ctx), strerror(errno));
+        return NULL;
+    }
     // GCOVR_EXCL_STOP
+    sl_stats_add(SL_STAT_BYTES_MAPPED, (uint64_t)sb.st_size);
+
+    *size = (size_t)sb.st_size;
+    return buf;
 }
 
-static int process_elf(struct sl_elf_ctx *ctx)
+// maps the file, or reads only the parts needed, and processes it; moves fd,
+// and buf if the file is already mapped whole there
+static int process_fd(struct sl_elf_ctx *ctx, int fd, void *buf, size_t size)
 {
-    Elf *e = ctx->e;
+    int ret = 0;
+
+    sl_stats_phase(SL_PHASE_PARSE);
+    sl_stats_add(SL_STAT_FILES_PROCESSED, 1);
+
+    enum sl_elf64_status status;
+    if (!buf && ctx->cfg->low_memory) {
+        struct stat sb;
+        // GCOVR_EXCL_START: racing with other writers
+        if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(Elf64_Ehdr)) {
+            (void) close(fd);
+            return EX_SOFTWARE;
+        }
+        // GCOVR_EXCL_STOP
+        size = (size_t)sb.st_size;
+
+        // whatever gets read is likely never looked at again
+        (void) posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+        status = sl_elf64_open(&ctx->elf, fd, size);
+    } else {
+        if (!buf) {
+            buf = map_whole(ctx, fd, &size);
+            // GCOVR_EXCL_START: racing with other writers, or excessively
+            // unlikely to happen
+            if (!buf) {
+                (void) close(fd);
+                return EX_OSERR;
+            }
+            // GCOVR_EXCL_STOP
+        }
 
-    size_t len;
-    const char *ident = elf_getident(e, &len);
-    // GCOVR_EXCL_START: virtually impossible
-    if (len != EI_NIDENT) {
-        return EX_SOFTWARE;
+        // the mapping keeps the file around
+        (void) close(fd);
+        fd = -1;
+        status = sl_elf64_init(&ctx->elf, buf, size);
     }
+
+    switch (status) {
+    case SL_ELF64_OK:
+        ret = process_elf(ctx);
+        break;
+
+    // GCOVR_EXCL_START: excessively unlikely to happen
+    case SL_ELF64_NO_SHSTRNDX:
+        // ignore malformed files -- every "normal" binary out there should
+        // have named sections
+        report_simple(ctx, SL_FINDING_NO_SHSTRNDX, 0);
+        ctx->file->res.analyses = SL_ANALYSIS_ALL;
+        break;
+
+    case SL_ELF64_BAD_HEADER:
+        // the identification is already checked by process_ehdr, but the
+        // file may have been replaced since
+        ret = EX_SOFTWARE;
+        break;
+
+    case SL_ELF64_IO_ERROR:
+        fprintf(stderr, _("%s: cannot read: %s\n"), sl_elf_path(ctx), strerror(errno));
+        ret = EX_IOERR;
+        break;
+
+    case SL_ELF64_MALFORMED:
+        // truncated since it was looked at
+        ctx->file->res.analyses = SL_ANALYSIS_ALL;
+        break;
     // GCOVR_EXCL_STOP
+    }
 
-    // only process ELF64 files for now
-    if (ident[EI_CLASS] != ELFCLASS64) {
-        if (ctx->cfg->verbose) {
-            printf(_("%s: ignoring: not ELF64 file\n"), ctx->path);
-        }
-        return 0;
+    sl_elf64_fini(&ctx->elf);
+    if (buf) {
+        (void) munmap(buf, size);
+    } else {
+        (void) close(fd);
     }
 
-    // only process little-endian files for now
-    if (ident[EI_DATA] != ELFDATA2LSB) {
-        if (ctx->cfg->verbose) {
-            printf(_("%s: ignoring: not little-endian\n"), ctx->path);
+    return ret;
+}
+
+// moves fd, which is opened read-only
+int process(const struct sl_cfg *cfg, struct sl_file *f, int fd)
+{
+    struct sl_elf_ctx ctx = {
+        .cfg = cfg,
+        .file = f,
+        .path = NULL,
+        .dirty = false,
+        .patches = NULL,
+    };
+    enum sl_file_outcome outcome = SL_FILE_UNCHANGED;
+    int ret = 0;
+
+    // the mapping the content is hashed through is then looked at, so the
+    // file is only read once
+    void *buf = NULL;
+    size_t size = 0;
+    if (f->dedup && cfg->content_cache) {
+        sl_stats_phase(SL_PHASE_HASH);
+        buf = map_whole(&ctx, fd, &size);
+        if (buf) {
+            (void) madvise(buf, size, MADV_SEQUENTIAL);
+            bool done = sl_dedup_content(f->dedup, f, buf, size);
+            (void) madvise(buf, size, MADV_NORMAL);
+            if (done) {
+                // an identical file is already done
+                sl_stats_add(SL_STAT_DEDUP_HITS, 1);
+                (void) munmap(buf, size);
+                (void) close(fd);
+                goto out;
+            }
+        }
+
+        // the others are read their own way
+        if (buf && (f->is_archive || f->compression != SL_COMPRESSION_NONE || cfg->low_memory)) {
+            (void) munmap(buf, size);
+            buf = NULL;
         }
-        return 0;
     }
 
-    Elf64_Ehdr *ehdr = elf64_getehdr(e);
+    // everything is found through a read-only mapping or descriptor, so
+    // unchanged files are never opened for writing; this is also all there
+    // is to do for a dry run
+    if (f->is_archive) {
+        ret = process_archive(&ctx, fd);
+    } else if (f->compression != SL_COMPRESSION_NONE) {
+        ret = process_compressed(&ctx, fd);
+    } else {
+        ret = process_fd(&ctx, fd, buf, size);
+    }
+    if (ret) {
+        outcome = SL_FILE_FAILED;
+        goto out;
+    }
 
-    // only process LoongArch files
-    if (ehdr->e_machine != EM_LOONGARCH) {
-        if (ctx->cfg->verbose) {
-            printf(
-                _("%s: ignoring: not LoongArch file: e_machine = %d != %d\n"),
-                ctx->path,
-                ehdr->e_machine,
-                EM_LOONGARCH
-            );
-        }
-        return 0;
+    if (ctx.dirty) {
+        f->res.flags |= SL_RESULT_NEEDS_PATCH;
     }
 
-    // check object file ABI
-    if (ctx->cfg->check_objabi) {
-        check_objabi(ctx, ehdr->e_flags);
-        return 0;
+    if (cfg->dry_run || !ctx.dirty) {
+        goto out;
     }
 
-    bool is_ldso = endswith(ctx->path, "ld-linux-loongarch-lp64d.so.1", 29);
+    if (cfg->format == SL_FORMAT_TEXT) {
+        if (cfg->verbose) {
+            sl_output_text(&f->out, _("writing %s\n"), sl_elf_path(&ctx));
+        } else {
+            sl_output_text(&f->out, _("patching %s\n"), sl_elf_path(&ctx));
+        }
+    }
 
-    size_t shstrndx;
-    // GCOVR_EXCL_START: excessively unlikely to happen
-    if (elf_getshdrstrndx(e, &shstrndx) != 0) {
-        // ignore malformed files -- every "normal" binary out there should
-        // have named sections
-        if (ctx->cfg->verbose) {
-            printf(
-                _("%s: ignoring: malformed file: no shstrndx\n"),
-                ctx->path
-            );
+    sl_stats_phase(SL_PHASE_PATCH);
+    if (cfg->replace) {
+        ret = sl_patch_replace(&ctx);
+    } else {
+        ret = sl_patch_in_place(&ctx);
+    }
+    outcome = ret ? SL_FILE_FAILED : SL_FILE_CHANGED;
+    if (!ret) {
+        sl_stats_add(SL_STAT_FILES_PATCHED, 1);
+    }
+
+    if (!ret && cfg->format == SL_FORMAT_JSONL) {
+        size_t i;
+        for (i = 0; i < ctx.nr_patches; i++) {
+            const struct sl_patch *p = &ctx.patches[i];
+            sl_output_patch(&f->out, sl_elf_path(&ctx), p->scn, p->off, p->old, p->new, p->len);
         }
+    }
 
-        return 0;
+out:
+    sl_file_done(f, outcome);
+    free(ctx.path);
+    free(ctx.patches);
+    return ret;
+}
+
+static size_t g_nr_patch_needed;
+static size_t g_nr_patched;
+
+void patch_note_file(bool patched)
+{
+    __atomic_add_fetch(patched ? &g_nr_patched : &g_nr_patch_needed, 1, __ATOMIC_RELAXED);
+}
+
+void patch_print_final_report(const struct sl_cfg *cfg)
+{
+    size_t nr_needed = __atomic_load_n(&g_nr_patch_needed, __ATOMIC_RELAXED);
+    size_t nr_patched = __atomic_load_n(&g_nr_patched, __ATOMIC_RELAXED);
+
+    if (nr_patched) {
+        printf(
+            ngettext(
+                "\x1b[32m * \x1b[m%zu file was patched to use symbol version %s.\n\n",
+                "\x1b[32m * \x1b[m%zu files were patched to use symbol version %s.\n\n",
+                nr_patched
+            ),
+            nr_patched,
+            cfg->to_ver
+        );
     }
-    // GCOVR_EXCL_STOP
 
-    Elf_Scn *s_dynsym = NULL;
-    size_t nr_dynsym = 0;
-    Elf_Scn *s_gnu_version_d = NULL;
-    size_t nr_gnu_version_d = 0;
-    Elf_Scn *s_gnu_version_r = NULL;
-    size_t nr_gnu_version_r = 0;
-    Elf_Scn *s_rodata = NULL;
-    Elf_Scn *s_text = NULL;
+    if (nr_needed) {
+        printf(
+            ngettext(
+                "\x1b[33m * \x1b[m%zu file still uses symbol version %s and needs patching.\n\n",
+                "\x1b[33m * \x1b[m%zu files still use symbol version %s and need patching.\n\n",
+                nr_needed
+            ),
+            nr_needed,
+            cfg->from_ver
+        );
+        return;
+    }
+
+    if (!nr_patched) {
+        printf(_("\x1b[32m * \x1b[mNo file needs symbol version patching.\n\n"));
+    }
+}
+
+static int process_elf(struct sl_elf_ctx *ctx)
+{
+    bool is_ldso = sl_file_is_ldso(ctx->file);
+
+    // sections not found are left without data
+    struct sl_elf64_scn s_dynsym = { 0 };
+    struct sl_elf64_scn s_gnu_version_d = { 0 };
+    struct sl_elf64_scn s_gnu_version_r = { 0 };
+    struct sl_elf64_scn s_rodata = { 0 };
+    struct sl_elf64_scn s_text = { 0 };
     {
-        Elf_Scn *scn = NULL;
-        size_t i = 0;  // section idx, 0 is naturally skipped
-        while ((scn = elf_nextscn(e, scn)) != NULL) {
-            i++;
-
-            GElf_Shdr shdr;
-            if (gelf_getshdr(scn, &shdr) != &shdr) {
-                return EX_SOFTWARE;  // GCOVR_EXCL_LINE: virtually impossible
-            }
+        size_t i;
+        for (i = 1; i < ctx->elf.shnum; i++) {  // section 0 is naturally skipped
+            struct sl_elf64_scn scn;
+            (void) sl_elf64_scn(&ctx->elf, i, &scn);
 
-            const char *scn_name;
-            if ((scn_name = elf_strptr(e, shstrndx, shdr.sh_name)) == NULL) {
+            const char *scn_name = scn.name;
+            if (scn_name == NULL) {
                 // GCOVR_EXCL_START: virtually impossible
-                if (ctx->cfg->verbose) {
-                    printf(
-                        _("%s: ignoring: malformed file: cannot get section name\n"),
-                        ctx->path
-                    );
-                }
-
+                report_simple(ctx, SL_FINDING_NO_SCN_NAME, 0);
                 return EX_SOFTWARE;
                 // GCOVR_EXCL_STOP
             }
@@ -176,7 +419,7 @@ static int process_elf(struct sl_elf_ctx *ctx)
                 if (!strcmp(".text", scn_name)) {
                     s_text = scn;
 
-                    if (ctx->cfg->check_syscall_abi) {
+                    if (!sl_cfg_wants_patch(ctx->cfg)) {
                         // in syscall ABI check mode, only .text is needed
                         break;
                     }
@@ -186,25 +429,21 @@ static int process_elf(struct sl_elf_ctx *ctx)
             }
 
             if (!strcmp(".dynstr", scn_name)) {
-                ctx->dynstr = i;
-                ctx->dynstr_d = elf_getdata(scn, NULL);
+                ctx->dynstr = scn;
                 continue;
             }
             if (!strcmp(".dynsym", scn_name)) {
                 s_dynsym = scn;
-                nr_dynsym = shdr.sh_size;
                 continue;
             }
             // we don't really need to check .gnu.version, because the
             // versions referred to all come from here
             if (!strcmp(".gnu.version_d", scn_name)) {
                 s_gnu_version_d = scn;
-                nr_gnu_version_d = shdr.sh_info;
                 continue;
             }
             if (!strcmp(".gnu.version_r", scn_name)) {
                 s_gnu_version_r = scn;
-                nr_gnu_version_r = shdr.sh_info;
                 continue;
             }
 
@@ -217,15 +456,45 @@ static int process_elf(struct sl_elf_ctx *ctx)
         }
     }
 
+    if (sl_cfg_wants_patch(ctx->cfg)) {
+        // when reading piece by piece, .text is only read in whole for
+        // ld.so, and otherwise scanned a chunk at a time
+        struct sl_elf64_scn *scns[] = { &ctx->dynstr, &s_dynsym, &s_gnu_version_d, &s_gnu_version_r, &s_rodata, &s_text };
+        size_t nr_scns = sizeof(scns) / sizeof(scns[0]) - (is_ldso ? 0 : 1);
+        if (!sl_elf64_load(&ctx->elf, scns, nr_scns)) {
+            // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+            fprintf(stderr, _("%s: cannot read: %s\n"), sl_elf_path(ctx), strerror(errno));
+            return EX_IOERR;
+            // GCOVR_EXCL_STOP
+        }
+    }
+
+    sl_stats_phase(SL_PHASE_SCAN);
+
     if (ctx->cfg->check_syscall_abi) {
-        if (s_text) {
-            scan_for_removed_syscalls(ctx, s_text);
+        sl_stats_add(SL_STAT_SCANNED_TEXT, s_text.size);
+        int ret = scan_for_removed_syscalls(ctx, &s_text);
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        if (ret) {
+            return ret;
         }
+        // GCOVR_EXCL_STOP
+        ctx->file->res.analyses |= SL_ANALYSIS_SYSCALL;
+    }
+
+    if (!sl_cfg_wants_patch(ctx->cfg)) {
         return 0;
     }
 
-    if (s_gnu_version_d) {
-        int ret = process_elf_gnu_version_d(ctx, s_gnu_version_d, nr_gnu_version_d);
+    sl_stats_add(SL_STAT_SCANNED_VERSIONS, s_gnu_version_d.size + s_gnu_version_r.size);
+    sl_stats_add(SL_STAT_SCANNED_DYNSYM, s_dynsym.size);
+    if (is_ldso) {
+        sl_stats_add(SL_STAT_SCANNED_RODATA, s_rodata.size);
+        sl_stats_add(SL_STAT_SCANNED_TEXT, s_text.size);
+    }
+
+    {
+        int ret = process_elf_gnu_version_d(ctx, &s_gnu_version_d);
         // GCOVR_EXCL_START: unlikely because no I/O is involved
         if (ret) {
             return ret;
@@ -233,8 +502,8 @@ static int process_elf(struct sl_elf_ctx *ctx)
         // GCOVR_EXCL_STOP
     }
 
-    if (s_gnu_version_r) {
-        int ret = process_elf_gnu_version_r(ctx, s_gnu_version_r, nr_gnu_version_r);
+    {
+        int ret = process_elf_gnu_version_r(ctx, &s_gnu_version_r);
         // GCOVR_EXCL_START: unlikely because no I/O is involved
         if (ret) {
             return ret;
@@ -242,8 +511,8 @@ static int process_elf(struct sl_elf_ctx *ctx)
         // GCOVR_EXCL_STOP
     }
 
-    if (s_dynsym) {
-        int ret = process_elf_dynsym(ctx, s_dynsym, nr_dynsym);
+    {
+        int ret = process_elf_dynsym(ctx, &s_dynsym);
         // GCOVR_EXCL_START: unlikely because no I/O is involved
         if (ret) {
             return ret;
@@ -252,132 +521,178 @@ static int process_elf(struct sl_elf_ctx *ctx)
     }
 
     if (is_ldso) {
-        if (s_rodata) {
-            int ret = patch_ldso_rodata(ctx, s_rodata);
-            // GCOVR_EXCL_START: unlikely because no I/O is involved
-            if (ret) {
-                return ret;
-            }
-            // GCOVR_EXCL_STOP
+        int ret = patch_ldso_rodata(ctx, &s_rodata);
+        // GCOVR_EXCL_START: unlikely because no I/O is involved
+        if (ret) {
+            return ret;
         }
+        // GCOVR_EXCL_STOP
 
-        if (s_text) {
-            int ret = patch_ldso_text_hashes(ctx, s_text);
-            // GCOVR_EXCL_START: unlikely because no I/O is involved
-            if (ret) {
-                return ret;
-            }
-            // GCOVR_EXCL_STOP
+        ret = patch_ldso_text_hashes(ctx, &s_text);
+        // GCOVR_EXCL_START: unlikely because no I/O is involved
+        if (ret) {
+            return ret;
         }
+        // GCOVR_EXCL_STOP
     }
 
-    if (!ctx->cfg->dry_run && ctx->dirty) {
-        if (ctx->cfg->verbose) {
-            printf(_("writing %s\n"), ctx->path);
-        } else {
-            printf(_("patching %s\n"), ctx->path);
+    ctx->file->res.analyses |= SL_ANALYSIS_PATCH;
+
+    return 0;
+}
+
+static void patch_hash(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s, size_t off, Elf64_Word hash)
+{
+    hash = htole32(hash);
+    sl_elf_patch(ctx, s, s->data + off, &hash, sizeof(hash));
+}
+
+static int process_elf_dynsym(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s)
+{
+    size_t n = s->size / sizeof(Elf64_Sym);
+    size_t i;
+    for (i = 0; i < n; i++) {
+        Elf64_Sym sym;
+        (void) sl_elf64_read(s, i * sizeof(sym), &sym, sizeof(sym));
+
+        if (ELF64_ST_TYPE(sym.st_info) != STT_OBJECT) {
+            // STT_FUNC names are stored without version information,
+            // so only look at STT_OBJECT symbols
+            continue;
         }
 
-        // don't alter preexisting layout
-        elf_flagelf(e, ELF_C_SET, ELF_F_LAYOUT);
-        if (elf_update(e, ELF_C_WRITE_MMAP) < 0) {
-            // GCOVR_EXCL_START: unlikely to happen except in cases like media error
-            fprintf(stderr, _("%s: elf_update failed: %s\n"), ctx->path, elf_errmsg(-1));
-            return EX_SOFTWARE;
-            // GCOVR_EXCL_STOP
+        // it seems version symbols are all stored with STN_ABS
+        if (le16toh(sym.st_shndx) != SHN_ABS) {
+            continue;
+        }
+
+        Elf64_Word st_name = le32toh(sym.st_name);
+        const char *ver_name = sl_elf_dynstr(ctx, st_name);
+
+        if (ver_name == NULL || !sl_cfg_is_ver_interesting(ctx->cfg, ver_name)) {
+            continue;
+        }
+
+        struct sl_finding f = {
+            .kind = SL_FINDING_PATCH_DYNSYM,
+            .u1 = (uint32_t) i,
+            .str = ver_name,
+        };
+        sl_report(ctx, &f);
+        if (sl_cfg_narrates(ctx->cfg)) {
+            sl_output_text(&ctx->file->out, _("%s: patching symbol version %s at idx %zd -> %s\n"), sl_elf_path(ctx), ver_name, i, ctx->cfg->to_ver);
+        }
+
+        int ret = sl_elf_patch_dynstr(ctx, st_name, ctx->cfg->to_ver);
+        if (ret) {
+            return ret;
         }
     }
 
     return 0;
 }
 
-static int process_elf_dynsym(
-    struct sl_elf_ctx *ctx,
-    Elf_Scn *s,
-    size_t n)
+static int process_elf_gnu_version_d(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s)
 {
-    size_t i = 0;
-    Elf_Data *d = NULL;
-    while (i < n && (d = elf_getdata(s, d)) != NULL) {
-        Elf64_Sym *sym = (Elf64_Sym *)(d->d_buf);
-        while ((void *)sym < (void *)((uint8_t *)d->d_buf + d->d_size)) {
-            if (ELF64_ST_TYPE(sym->st_info) != STT_OBJECT) {
-                // STT_FUNC names are stored without version information,
-                // so only look at STT_OBJECT symbols
-                goto next_sym;
-            }
-
-            // it seems version symbols are all stored with STN_ABS
-            if (sym->st_shndx != SHN_ABS) {
-                goto next_sym;
-            }
+    size_t n = s->info;
+    size_t off = 0;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        Elf64_Verdef vd;
+        Elf64_Verdaux aux;
+        if (!sl_elf64_read(s, off, &vd, sizeof(vd))) {
+            break;
+        }
 
-            Elf64_Word st_name = sym->st_name;
-            const char *ver_name = sl_elf_dynstr(ctx, st_name);
+        // only look at the first aux, because this aux is the vd's name
+        if (!sl_elf64_read(s, off + le32toh(vd.vd_aux), &aux, sizeof(aux))) {
+            goto next;
+        }
 
-            if (!sl_cfg_is_ver_interesting(ctx->cfg, ver_name)) {
-                goto next_sym;
-            }
+        Elf64_Word vda_name = le32toh(aux.vda_name);
+        const char *vda_name_str = sl_elf_dynstr(ctx, vda_name);
 
-            if (ctx->cfg->dry_run) {
-                printf(_("%s: symbol version %s at idx %zd needs patching\n"), ctx->path, ver_name, i);
-                goto next_sym;
-            }
+        if (vda_name_str == NULL || !sl_cfg_is_ver_interesting(ctx->cfg, vda_name_str)) {
+            goto next;
+        }
 
-            if (ctx->cfg->verbose) {
-                printf(_("%s: patching symbol version %s at idx %zd -> %s\n"), ctx->path, ver_name, i, ctx->cfg->to_ver);
-            }
+        struct sl_finding f = {
+            .kind = SL_FINDING_PATCH_VERDEF,
+            .u1 = (uint32_t) i,
+            .str = vda_name_str,
+        };
+        sl_report(ctx, &f);
+        if (sl_cfg_narrates(ctx->cfg)) {
+            sl_output_text(&ctx->file->out, _("%s: patching verdef %zd -> %s\n"), sl_elf_path(ctx), i, ctx->cfg->to_ver);
+        }
 
-            int ret = sl_elf_patch_dynstr_by_idx(ctx, st_name, ctx->cfg->to_ver);
-            if (ret) {
-                return ret;
-            }
+        // patch dynstr
+        int ret = sl_elf_patch_dynstr(ctx, vda_name, ctx->cfg->to_ver);
+        // GCOVR_EXCL_START: unlikely because no I/O is involved
+        if (ret) {
+            return ret;
+        }
+        // GCOVR_EXCL_STOP
 
-next_sym:
-            i++;
-            sym++;
+        // patch hash
+        if (le32toh(vd.vd_hash) != ctx->cfg->to_elfhash) {
+            patch_hash(ctx, s, off + offsetof(Elf64_Verdef, vd_hash), ctx->cfg->to_elfhash);
         }
+
+next:
+        off += le32toh(vd.vd_next);
     }
 
     return 0;
 }
 
-static int process_elf_gnu_version_d(
-    struct sl_elf_ctx *ctx,
-    Elf_Scn *s,
-    size_t n)
+static int process_elf_gnu_version_r(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s)
 {
-    size_t i = 0;
-    Elf_Data *d = NULL;
-    while (i < n && (d = elf_getdata(s, d)) != NULL) {
-        Elf64_Verdef *vd = (Elf64_Verdef *)(d->d_buf);
-        while (i < n) {
-            Elf64_Verdaux *aux = (Elf64_Verdaux *)((uint8_t *)vd + vd->vd_aux);
-
-            // only look at the first aux, because this aux is the vd's name
-            Elf64_Word vda_name = aux->vda_name;
-            const char *vda_name_str = sl_elf_dynstr(ctx, vda_name);
-
-            if (!sl_cfg_is_ver_interesting(ctx->cfg, vda_name_str)) {
-                goto next;
+    size_t n = s->info;
+    size_t off = 0;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        Elf64_Verneed vn;
+        if (!sl_elf64_read(s, off, &vn, sizeof(vn))) {
+            break;
+        }
+
+        size_t aux_off = off + le32toh(vn.vn_aux);
+        size_t j;
+        for (j = 0; j < le16toh(vn.vn_cnt); j++) {
+            Elf64_Vernaux aux;
+            if (!sl_elf64_read(s, aux_off, &aux, sizeof(aux))) {
+                break;
             }
 
-            if (ctx->cfg->dry_run) {
-                printf(
-                    _("%s: verdef %zd: %s needs patching\n"),
-                    ctx->path,
-                    i,
-                    vda_name_str
-                );
-                goto next;
+            Elf64_Word vna_name = le32toh(aux.vna_name);
+            const char *vna_name_str = sl_elf_dynstr(ctx, vna_name);
+
+            if (vna_name_str == NULL || !sl_cfg_is_ver_interesting(ctx->cfg, vna_name_str)) {
+                goto next_aux;
             }
 
-            if (ctx->cfg->verbose) {
-                printf(_("%s: patching verdef %zd -> %s\n"), ctx->path, i, ctx->cfg->to_ver);
+            struct sl_finding f = {
+                .kind = SL_FINDING_PATCH_VERNEED,
+                .u1 = (uint32_t) i,
+                .u2 = (uint32_t) j,
+                .str = vna_name_str,
+            };
+            sl_report(ctx, &f);
+            if (sl_cfg_narrates(ctx->cfg)) {
+                sl_output_text(
+                    &ctx->file->out,
+                    _("%s: patching verneed %zd aux %zd %s -> %s\n"),
+                    sl_elf_path(ctx),
+                    i,
+                    j,
+                    vna_name_str,
+                    ctx->cfg->to_ver
+                );
             }
 
             // patch dynstr
-            int ret = sl_elf_patch_dynstr_by_idx(ctx, vda_name, ctx->cfg->to_ver);
+            int ret = sl_elf_patch_dynstr(ctx, vna_name, ctx->cfg->to_ver);
             // GCOVR_EXCL_START: unlikely because no I/O is involved
             if (ret) {
                 return ret;
@@ -385,83 +700,15 @@ static int process_elf_gnu_version_d(
             // GCOVR_EXCL_STOP
 
             // patch hash
-            if (vd->vd_hash != ctx->cfg->to_elfhash) {
-                vd->vd_hash = ctx->cfg->to_elfhash;
-                elf_flagdata(d, ELF_C_SET, ELF_F_DIRTY);
-                ctx->dirty = true;
+            if (le32toh(aux.vna_hash) != ctx->cfg->to_elfhash) {
+                patch_hash(ctx, s, aux_off + offsetof(Elf64_Vernaux, vna_hash), ctx->cfg->to_elfhash);
             }
 
-next:
-            i++;
-            vd = (Elf64_Verdef *)((uint8_t *)vd + vd->vd_next);
+next_aux:
+            aux_off += le32toh(aux.vna_next);
         }
-    }
-
-    return 0;
-}
-
-static int process_elf_gnu_version_r(
-    struct sl_elf_ctx *ctx,
-    Elf_Scn *s,
-    size_t n)
-{
-    size_t i = 0;
-    Elf_Data *d = NULL;
-    while (i < n && (d = elf_getdata(s, d)) != NULL) {
-        Elf64_Verneed *vn = (Elf64_Verneed *)(d->d_buf);
-        while (i < n) {
-            size_t j = 0;
-            Elf64_Vernaux *aux = (Elf64_Vernaux *)((uint8_t *)vn + vn->vn_aux);
-            for (j = 0; j < vn->vn_cnt; j++, aux = (Elf64_Vernaux *)((uint8_t *)aux + aux->vna_next)) {
-                Elf64_Word vna_name = aux->vna_name;
-                const char *vna_name_str = sl_elf_raw_dynstr(ctx, vna_name);
-
-                if (!sl_cfg_is_ver_interesting(ctx->cfg, vna_name_str)) {
-                    continue;
-                }
-
-                if (ctx->cfg->dry_run) {
-                    printf(
-                        _("%s: verneed %zd: aux %zd name %s needs patching\n"),
-                        ctx->path,
-                        i,
-                        j,
-                        vna_name_str
-                    );
-                    continue;
-                }
-
-                if (ctx->cfg->verbose) {
-                    printf(
-                        _("%s: patching verneed %zd aux %zd %s -> %s\n"),
-                        ctx->path,
-                        i,
-                        j,
-                        vna_name_str,
-                        ctx->cfg->to_ver
-                    );
-                }
 
-                // patch dynstr
-                int ret = sl_elf_patch_dynstr_by_off(ctx, vna_name, ctx->cfg->to_ver);
-                // GCOVR_EXCL_START: unlikely because no I/O is involved
-                if (ret) {
-                    return ret;
-                }
-                // GCOVR_EXCL_STOP
-
-                // patch hash
-                if (aux->vna_hash != ctx->cfg->to_elfhash) {
-                    aux->vna_hash = ctx->cfg->to_elfhash;
-                    elf_flagdata(d, ELF_C_SET, ELF_F_DIRTY);
-                    elf_flagscn(s, ELF_C_SET, ELF_F_DIRTY);
-                    ctx->dirty = true;
-                }
-            }
-
-            i++;
-            vn = (Elf64_Verneed *)((uint8_t *)vn + vn->vn_next);
-        }
+        off += le32toh(vn.vn_next);
     }
 
     return 0;
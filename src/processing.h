@@ -1,9 +1,21 @@
 #ifndef _shengloong_processing_h
 #define _shengloong_processing_h
 
+#include <stdbool.h>
+
+#include <elf.h>
+
 #include "cfg.h"
 #include "ctx.h"
+#include "file.h"
+
+bool check_ehdr(struct sl_elf_ctx *ctx, const Elf64_Ehdr *ehdr);
+bool process_ehdr(const struct sl_cfg *cfg, struct sl_file *f, const Elf64_Ehdr *ehdr);
+bool process_armag(const struct sl_cfg *cfg, struct sl_file *f);
+bool process_zmagic(const struct sl_cfg *cfg, struct sl_file *f, enum sl_compression c);
+int process(const struct sl_cfg *cfg, struct sl_file *f, int fd);
 
-int process(const struct sl_cfg *cfg, const char *path, int fd);
+void patch_note_file(bool patched);
+void patch_print_final_report(const struct sl_cfg *cfg);
 
 #endif  // _shengloong_processing_h
@@ -0,0 +1,178 @@
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <elf.h>
+
+#include "archive.h"
+#include "buildconfig.gen.h"
+#include "elfcompat.h"
+#include "gettext.h"
+#include "output.h"
+#include "processing_archive.h"
+#include "processing_objabi.h"
+#include "processing_syscall_abi.h"
+#include "stats.h"
+
+#define _(x) gettext(x)
+
+// does the checks on the member if it's a LoongArch object; anything else,
+// like objects for other architectures or LLVM bitcode, is quietly skipped
+static int process_member(struct sl_elf_ctx *ctx, const struct sl_ar *ar, const struct sl_ar_member *m)
+{
+    Elf64_Ehdr ehdr;
+    if (m->size < sizeof(ehdr)) {
+        return 0;
+    }
+    if (!sl_ar_read(ar, m->offset, &ehdr, sizeof(ehdr))) {
+        // GCOVR_EXCL_START: media error
+        fprintf(stderr, _("%s: cannot read: %s\n"), sl_elf_path(ctx), strerror(errno));
+        return EX_IOERR;
+        // GCOVR_EXCL_STOP
+    }
+
+    if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG)
+            || ehdr.e_ident[EI_CLASS] != ELFCLASS64
+            || ehdr.e_ident[EI_DATA] != ELFDATA2LSB
+            || le16toh(ehdr.e_machine) != EM_LOONGARCH) {
+        return 0;
+    }
+
+    sl_stats_add(SL_STAT_ARCHIVE_MEMBERS, 1);
+
+    // findings from here on name the member
+    ctx->member = m->name;
+    check_objabi(ctx, le32toh(ehdr.e_flags));
+
+    if (!ctx->cfg->check_syscall_abi) {
+        return 0;
+    }
+
+    // the member is looked at where it is, without copying it out
+    enum sl_elf64_status status;
+    if (ar->buf) {
+        status = sl_elf64_init(&ctx->elf, (uint8_t *)ar->buf + m->offset, m->size);
+    } else {
+        status = sl_elf64_open_at(&ctx->elf, ar->fd, m->offset, m->size);
+    }
+
+    int ret = 0;
+    switch (status) {
+    case SL_ELF64_OK:
+        break;
+
+    case SL_ELF64_IO_ERROR:
+        // GCOVR_EXCL_START: media error
+        fprintf(stderr, _("%s: cannot read: %s\n"), sl_elf_path(ctx), strerror(errno));
+        ret = EX_IOERR;
+        goto out;
+        // GCOVR_EXCL_STOP
+
+    default:
+        // GCOVR_EXCL_START: malformed members are not worth a mention
+        goto out;
+        // GCOVR_EXCL_STOP
+    }
+
+    ret = scan_text_for_removed_syscalls(ctx);
+
+out:
+    sl_elf64_fini(&ctx->elf);
+    return ret;
+}
+
+// Goes through the members of the archive behind fd in order, doing the
+// checks on each of the LoongArch objects among them; moves fd.
+int process_archive(struct sl_elf_ctx *ctx, int fd)
+{
+    int ret = 0;
+
+    sl_stats_phase(SL_PHASE_PARSE);
+    sl_stats_add(SL_STAT_FILES_PROCESSED, 1);
+
+    struct stat sb;
+    // GCOVR_EXCL_START: racing with other writers
+    if (fstat(fd, &sb) < 0) {
+        (void) close(fd);
+        return EX_SOFTWARE;
+    }
+    // GCOVR_EXCL_STOP
+
+    // the members are visited front to back, so the archive is read through
+    // once in a single sequential pass, however large it is
+    size_t size = (size_t)sb.st_size;
+    void *buf = NULL;
+    struct sl_ar ar;
+    if (ctx->cfg->low_memory) {
+        (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        (void) posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+        sl_ar_open(&ar, fd, size);
+    } else {
+        buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        (void) close(fd);
+        fd = -1;
+        // GCOVR_EXCL_START: excessively unlikely to happen
+        if (buf == MAP_FAILED) {
+            fprintf(stderr, _("%s: cannot map: %s\n"), sl_elf_path(ctx), strerror(errno));
+            return EX_OSERR;
+        }
+        // GCOVR_EXCL_STOP
+        (void) madvise(buf, size, MADV_SEQUENTIAL);
+        sl_stats_add(SL_STAT_BYTES_MAPPED, size);
+        sl_ar_init(&ar, buf, size);
+    }
+
+    for (;;) {
+        struct sl_ar_member m;
+        enum sl_ar_status status = sl_ar_next(&ar, &m);
+        if (status == SL_AR_END) {
+            break;
+        }
+
+        if (status == SL_AR_MALFORMED) {
+            // what's been found so far still stands
+            if (ctx->cfg->verbose) {
+                sl_output_text(&ctx->file->out, _("%s: ignoring the rest: malformed archive\n"), sl_elf_path(ctx));
+            }
+            break;
+        }
+
+        // GCOVR_EXCL_START: media error
+        if (status == SL_AR_IO_ERROR) {
+            fprintf(stderr, _("%s: cannot read: %s\n"), sl_elf_path(ctx), strerror(errno));
+            ret = EX_IOERR;
+            break;
+        }
+        // GCOVR_EXCL_STOP
+
+        ret = process_member(ctx, &ar, &m);
+        ctx->member = NULL;
+        if (ret) {
+            break;  // GCOVR_EXCL_LINE: media error
+        }
+    }
+
+    sl_ar_fini(&ar);
+    if (buf) {
+        (void) munmap(buf, size);
+    } else {
+        (void) close(fd);
+    }
+
+    if (!ret) {
+        // nothing in archives is ever patched
+        ctx->file->res.analyses |= SL_ANALYSIS_HDR | SL_ANALYSIS_OBJABI | SL_ANALYSIS_PATCH;
+        if (ctx->cfg->check_syscall_abi) {
+            ctx->file->res.analyses |= SL_ANALYSIS_SYSCALL;
+        }
+    }
+
+    return ret;
+}
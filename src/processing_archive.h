@@ -0,0 +1,8 @@
+#ifndef _shengloong_processing_archive_h
+#define _shengloong_processing_archive_h
+
+#include "ctx.h"
+
+int process_archive(struct sl_elf_ctx *ctx, int fd);
+
+#endif  // _shengloong_processing_archive_h
@@ -0,0 +1,80 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include <elf.h>
+
+#include "buildconfig.gen.h"
+#include "gettext.h"
+#include "processing.h"
+#include "processing_compressed.h"
+#include "processing_syscall_abi.h"
+#include "stats.h"
+#include "zstream.h"
+
+#define _(x) gettext(x)
+
+static bool read_decompressed(void *arg, void *out, size_t len, uint64_t off)
+{
+    return sl_zstream_pread(arg, out, len, off);
+}
+
+// Does the checks on the ELF file compressed in the file behind fd, such as
+// a kernel module, decompressing only as far as needed; moves fd.
+int process_compressed(struct sl_elf_ctx *ctx, int fd)
+{
+    int ret = 0;
+
+    sl_stats_phase(SL_PHASE_PARSE);
+    sl_stats_add(SL_STAT_FILES_PROCESSED, 1);
+
+    struct sl_zstream *z = sl_zstream_open(ctx->file->compression, fd);
+
+    // nothing beyond the first block is decompressed for the header
+    Elf64_Ehdr ehdr;
+    if (!sl_zstream_pread(z, &ehdr, sizeof(ehdr), 0) || memcmp(ehdr.e_ident, ELFMAG, SELFMAG)) {
+        // not an ELF, or too short or corrupt to tell
+        ctx->file->res.analyses = SL_ANALYSIS_ALL;
+        goto out;
+    }
+
+    if (!check_ehdr(ctx, &ehdr) || !ctx->cfg->check_syscall_abi) {
+        goto out;
+    }
+
+    // the section headers are usually at the end, so everything is
+    // decompressed once to get to them, then once more up to the end of
+    // .text as it's scanned; the size is not known beforehand, and reads
+    // past the end simply fail
+    enum sl_elf64_status status = sl_elf64_open_reader(&ctx->elf, read_decompressed, z, SIZE_MAX);
+    switch (status) {
+    case SL_ELF64_OK:
+        ret = scan_text_for_removed_syscalls(ctx);
+        if (!ret) {
+            ctx->file->res.analyses |= SL_ANALYSIS_SYSCALL;
+        }
+        break;
+
+    case SL_ELF64_IO_ERROR:
+        fprintf(stderr, _("%s: cannot read: %s\n"), sl_elf_path(ctx), strerror(errno));
+        ret = EX_IOERR;
+        break;
+
+    default:
+        // malformed files, including streams cut short or corrupt, are not
+        // worth a mention
+        break;
+    }
+    sl_elf64_fini(&ctx->elf);
+
+out:
+    if (!ret) {
+        // nothing in compressed files is ever patched
+        ctx->file->res.analyses |= SL_ANALYSIS_PATCH;
+    }
+
+    sl_zstream_close(z);
+    return ret;
+}
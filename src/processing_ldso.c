@@ -7,63 +7,65 @@
 #include "buildconfig.gen.h"
 #include "cfg.h"
 #include "gettext.h"
+#include "insndec.h"
+#include "insnscan.h"
+#include "output.h"
 #include "processing_ldso.h"
 
 #define _(x) gettext(x)
 
-int patch_ldso_rodata(struct sl_elf_ctx *ctx, Elf_Scn *s)
+int patch_ldso_rodata(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s)
 {
-    Elf_Data *d = NULL;
-    while ((d = elf_getdata(s, d)) != NULL) {
-        char *curr = d->d_buf;
-        size_t remaining = d->d_size;
-
-        while (remaining > 0) {
-            // search for "\0GLIBC_2.3x\0"
-            // there should be only one reference
-            char *p = memmem(curr, remaining, "\x00GLIBC_2.3", 10);
-            if (p == NULL) {
-                break;
-            }
+    if (!s->data) {
+        return 0;
+    }
 
-            remaining -= (p - curr) + 10;
-            curr = p + 10;
+    char *base = (char *)s->data;
+    char *curr = base;
+    size_t remaining = s->size;
 
-            char *version_tag = p + 1;
-            if (strlen(version_tag) != 10) {
-                continue;
-            }
+    while (remaining > 0) {
+        // search for "\0GLIBC_2.3x\0"
+        // there should be only one reference
+        char *p = memmem(curr, remaining, "\x00GLIBC_2.3", 10);
+        if (p == NULL) {
+            break;
+        }
 
-            if (!strcmp(version_tag, ctx->cfg->to_ver)) {
-                // idempotence
-                continue;
-            }
+        remaining -= (p - curr) + 10;
+        curr = p + 10;
 
-            if (ctx->cfg->dry_run) {
-                printf(
-                    _("%s: hard-coded symbol version in .rodata: %s (offset %zd) needs patching\n"),
-                    ctx->path,
-                    version_tag,
-                    version_tag - (char *)d->d_buf
-                );
-                continue;
-            }
+        // the tag and its terminating NUL have to be within the section
+        char *version_tag = p + 1;
+        if (remaining < 2 || strnlen(version_tag, 11) != 10) {
+            continue;
+        }
 
-            if (ctx->cfg->verbose) {
-                printf(
-                    _("%s: patching hard-coded symbol version in .rodata: %s (offset %zd) -> %s\n"),
-                    ctx->path,
-                    version_tag,
-                    version_tag - (char *)d->d_buf,
-                    ctx->cfg->to_ver
-                );
-            }
+        if (!strcmp(version_tag, ctx->cfg->to_ver)) {
+            // idempotence
+            continue;
+        }
 
-            // patch
-            memmove(version_tag, ctx->cfg->to_ver, 10);
-            elf_flagdata(d, ELF_C_SET, ELF_F_DIRTY);
-            ctx->dirty = true;
+        struct sl_finding f = {
+            .kind = SL_FINDING_PATCH_RODATA,
+            .off1 = (uint64_t)(version_tag - base),
+            .str = version_tag,
+        };
+        sl_report(ctx, &f);
+
+        if (sl_cfg_narrates(ctx->cfg)) {
+            sl_output_text(
+                &ctx->file->out,
+                _("%s: patching hard-coded symbol version in .rodata: %s (offset %zd) -> %s\n"),
+                sl_elf_path(ctx),
+                version_tag,
+                version_tag - base,
+                ctx->cfg->to_ver
+            );
         }
+
+        // patch
+        sl_elf_patch(ctx, s, version_tag, ctx->cfg->to_ver, 10);
     }
 
     return 0;
@@ -71,11 +73,12 @@ int patch_ldso_rodata(struct sl_elf_ctx *ctx, Elf_Scn *s)
 
 /////////////////////////////////////////////////////////////////////////////
 
-static bool is_lu12i_w_with_imm(uint32_t insn, uint32_t imm)
+// insn format is DSj20 -- we match both opcode and imm part
+#define LU12I_W_IMM_MASK 0xffffffe0
+
+static uint32_t lu12i_w_with_imm(uint32_t imm)
 {
-    // insn format is DSj20 -- we match both opcode and imm part
-    uint32_t match = 0x14000000 | ((imm & 0xfffff) << 5);
-    return (insn & 0xffffffe0) == match;
+    return 0x14000000 | ((imm & 0xfffff) << 5);
 }
 
 static bool is_ori_exact(uint32_t insn, int rd, int rj, uint32_t imm)
@@ -85,13 +88,6 @@ static bool is_ori_exact(uint32_t insn, int rd, int rj, uint32_t imm)
     return insn == match;
 }
 
-static bool is_clobbering_rd(uint32_t insn, int rd)
-{
-    // XXX not exact -- correct solution would require properly disassembling,
-    // hence complete opcode info
-    return (insn & 0x1f) == (uint32_t)rd;
-}
-
 static uint32_t patch_dsj20_imm(uint32_t old_insn, uint32_t new_imm)
 {
     return (old_insn & 0xfe00001f) | ((new_imm & 0xfffff) << 5);
@@ -103,89 +99,89 @@ static uint32_t patch_djuk12_imm(uint32_t old_insn, uint32_t new_imm)
 }
 
 #define READ_INSN(x) le32toh(*x)
-#define WRITE_INSN(p, x) do { *p = htole32(x); } while(0)
+#define WRITE_INSN(ctx, s, p, x) do { uint32_t w = htole32(x); sl_elf_patch(ctx, s, p, &w, sizeof(w)); } while(0)
 
-int patch_ldso_text_hashes(struct sl_elf_ctx *ctx, Elf_Scn *s)
+int patch_ldso_text_hashes(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s)
 {
     uint32_t old_hash_lo12 = ctx->cfg->from_elfhash & 0xfff;
     uint32_t old_hash_hi20 = ctx->cfg->from_elfhash >> 12;
 
     uint32_t new_hash_lo12 = ctx->cfg->to_elfhash & 0xfff;
     uint32_t new_hash_hi20 = ctx->cfg->to_elfhash >> 12;
+    uint32_t old_hash_lu12i_w = lu12i_w_with_imm(old_hash_hi20);
 
-    Elf_Data *d = NULL;
-    while ((d = elf_getdata(s, d)) != NULL) {
-        uint32_t *p = d->d_buf;
-        uint32_t *end = (uint32_t *)((uint8_t *)d->d_buf + d->d_size);
-
-        uint32_t *hi20_insn = NULL;
-        int reg = 0;
-        for (; p < end; p++) {
-            uint32_t insn_word = READ_INSN(p);
-
-            if (hi20_insn == NULL) {
-                // find first lu12i.w
-                if (!is_lu12i_w_with_imm(insn_word, old_hash_hi20)) {
-                    continue;
-                }
-
-                hi20_insn = p;
-                reg = insn_word & 0x1f;
-                continue;
-            }
+    // a misaligned .text can only come from a malformed file
+    if (!s->data || (s->offset & (sizeof(uint32_t) - 1))) {
+        return 0;
+    }
 
-            // find matching ori
-            if (is_ori_exact(insn_word, reg, reg, old_hash_lo12)) {
-                // found an immediate load of old hash
-                if (ctx->cfg->dry_run) {
-                    printf(
-                        _("%s: old hash in .text needs patching: lu12i.w offset %zd, ori offset %zd\n"),
-                        ctx->path,
-                        (uint8_t *)hi20_insn - (uint8_t *)d->d_buf,
-                        (uint8_t *)p - (uint8_t *)d->d_buf
-                    );
-                    goto reset_state;
-                }
-
-                // patch
-                uint32_t old_lu12i_w = READ_INSN(hi20_insn);
-
-                uint32_t new_lu12i_w = patch_dsj20_imm(old_lu12i_w, new_hash_hi20);
-                uint32_t new_ori = patch_djuk12_imm(insn_word, new_hash_lo12);
-
-                if (ctx->cfg->verbose) {
-                    printf(
-                        _("%s: patching old hash in .text: lu12i.w offset %zd %08x -> %08x, ori offset %zd %08x -> %08x\n"),
-                        ctx->path,
-                        (uint8_t *)hi20_insn - (uint8_t *)d->d_buf,
-                        old_lu12i_w,
-                        new_lu12i_w,
-                        (uint8_t *)p - (uint8_t *)d->d_buf,
-                        insn_word,
-                        new_ori
-                    );
-                }
-
-                WRITE_INSN(hi20_insn, new_lu12i_w);
-                WRITE_INSN(p, new_ori);
-                elf_flagdata(d, ELF_C_SET, ELF_F_DIRTY);
-                ctx->dirty = true;
-
-                goto reset_state;
-            }
+    const uint32_t *p = (const uint32_t *)s->data;
+    const uint32_t *end = p + s->size / sizeof(uint32_t);
 
-            // if rd becomes clobbered, then restart matching lu12i.w,
-            // otherwise keep searching for that ori
-            if (is_clobbering_rd(insn_word, reg)) {
-                goto reset_state;
+    const uint32_t *hi20_insn = NULL;
+    int reg = 0;
+    for (; p < end; p++) {
+        if (hi20_insn == NULL) {
+            // find first lu12i.w
+            p += sl_insn_find(p, (size_t)(end - p), LU12I_W_IMM_MASK, old_hash_lu12i_w);
+            if (p == end) {
+                break;
             }
 
+            hi20_insn = p;
+            reg = READ_INSN(p) & 0x1f;
             continue;
+        }
 
-reset_state:
-            hi20_insn = NULL;
-            reg = 0;
+        uint32_t insn_word = READ_INSN(p);
+
+        // find matching ori
+        if (is_ori_exact(insn_word, reg, reg, old_hash_lo12)) {
+            // found an immediate load of old hash
+            struct sl_finding f = {
+                .kind = SL_FINDING_PATCH_TEXT_HASH,
+                .off1 = (uint64_t)((const uint8_t *)hi20_insn - s->data),
+                .off2 = (uint64_t)((const uint8_t *)p - s->data),
+            };
+            sl_report(ctx, &f);
+
+            // patch
+            uint32_t old_lu12i_w = READ_INSN(hi20_insn);
+
+            uint32_t new_lu12i_w = patch_dsj20_imm(old_lu12i_w, new_hash_hi20);
+            uint32_t new_ori = patch_djuk12_imm(insn_word, new_hash_lo12);
+
+            if (sl_cfg_narrates(ctx->cfg)) {
+                sl_output_text(
+                    &ctx->file->out,
+                    _("%s: patching old hash in .text: lu12i.w offset %zd %08x -> %08x, ori offset %zd %08x -> %08x\n"),
+                    sl_elf_path(ctx),
+                    (const uint8_t *)hi20_insn - s->data,
+                    old_lu12i_w,
+                    new_lu12i_w,
+                    (const uint8_t *)p - s->data,
+                    insn_word,
+                    new_ori
+                );
+            }
+
+            WRITE_INSN(ctx, s, hi20_insn, new_lu12i_w);
+            WRITE_INSN(ctx, s, p, new_ori);
+
+            goto reset_state;
         }
+
+        // if rd becomes clobbered, then restart matching lu12i.w,
+        // otherwise keep searching for that ori
+        if (sl_insn_writes_gpr(insn_word, (uint32_t)reg)) {
+            goto reset_state;
+        }
+
+        continue;
+
+reset_state:
+        hi20_insn = NULL;
+        reg = 0;
     }
 
     return 0;
@@ -8,9 +8,11 @@
 #include "elfcompat.h"
 #include "gettext.h"
 #include "processing_objabi.h"
+#include "report.h"
 
 #define _(x) gettext(x)
 
+// set from any worker thread, hence the atomic accesses
 static bool g_has_objabi_problems = false;
 
 /////////////////////////////////////////////////////////////////////////////
@@ -26,17 +28,21 @@ void check_objabi(struct sl_elf_ctx *ctx, Elf64_Word e_flags)
         return;
     }
 
-    g_has_objabi_problems = true;
-    printf(
-        _("%s: file uses obsolete object file ABI: e_flags=0x%x\n"),
-        ctx->path,
-        (int) e_flags
-    );
+    struct sl_finding f = {
+        .kind = SL_FINDING_OBSOLETE_OBJABI,
+        .u1 = e_flags,
+    };
+    sl_report(ctx, &f);
+}
+
+void objabi_note_problem(void)
+{
+    __atomic_store_n(&g_has_objabi_problems, true, __ATOMIC_RELAXED);
 }
 
 void objabi_print_final_report()
 {
-    if (g_has_objabi_problems) {
+    if (__atomic_load_n(&g_has_objabi_problems, __ATOMIC_RELAXED)) {
         printf(_(
             "\n"
             "\x1b[31m * \x1b[mYour system has file(s) using obsolete object file ABI.\n"
@@ -1,6 +1,9 @@
 #include <endian.h>
+#include <err.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
 #include <sys/param.h>
@@ -8,147 +11,343 @@
 #include "buildconfig.gen.h"
 #include "cfg.h"
 #include "gettext.h"
+#include "insndec.h"
+#include "insnscan.h"
 #include "processing_syscall_abi.h"
+#include "report.h"
+#include "stats.h"
+#include "utils.h"
 
 #define _(x) gettext(x)
 
+// may be set concurrently by worker threads, so only access atomically
 static bool g_has_syscall_abi_problems = false;
 
 /////////////////////////////////////////////////////////////////////////////
 
-static bool is_syscall(uint32_t insn)
+// the syscalls of the old-world kernel ABI that mainline kernels don't have,
+// looked for unless told otherwise
+const struct sl_syscall_set sl_removed_syscalls_default = {
+    .bits = {
+        [79 / 64] = (1ULL << (79 % 64)) | (1ULL << (80 % 64)),
+        [163 / 64] = (1ULL << (163 % 64)) | (1ULL << (164 % 64)),
+    },
+    .names = {
+        [79] = "newfstatat",
+        [80] = "fstat",
+        [163] = "getrlimit",
+        [164] = "setrlimit",
+    },
+};
+
+static bool syscall_set_has(const struct sl_syscall_set *set, uint64_t nr)
 {
-    // insn format is Ud15
-    return (insn & 0xffff7000) == 0x002b0000;
+    return nr < SL_SYSCALL_NR_MAX && (set->bits[nr / 64] >> (nr % 64)) & 1;
 }
 
-// if insn is one of:
-//
-// - addi.[wd] $a7, $zero, <imm>
-// - ori       $a7, $zero, <imm>
-//
-// then return imm; else return 0.
-static uint32_t maybe_pull_out_syscall_nr(uint32_t insn)
+// Loads the syscalls listed in the file at path, one per line as the number
+// followed by the name; comments start with # on lines of their own, or after
+// the name. Returns 0 on success, or an exit code after telling what went wrong.
+int sl_syscall_set_load(struct sl_syscall_set *set, const char *path)
 {
-    // DJSk12 and DJUk12 are the same in this case
-    uint32_t opcode = insn & 0xffc00000;
-    uint32_t rd, rj;
-    switch (opcode) {
-    case 0x02800000: // addi.w
-    case 0x02c00000: // addi.d
-    case 0x03800000: // ori
-        rd = insn & 0x1f;
-        rj = (insn >> 5) & 0x1f;
-        if (rd != 11 || rj != 0) {
-            return 0;
+    FILE *fp = fopen(path, "re");
+    if (!fp) {
+        warn(_("cannot open %s"), path);
+        return EX_NOINPUT;
+    }
+
+    memset(set, 0, sizeof(*set));
+
+    int ret = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    size_t lineno = 0;
+    while (getline(&line, &cap, fp) >= 0) {
+        lineno++;
+
+        char *save;
+        char *nr_str = strtok_r(line, " \t\n", &save);
+        if (!nr_str || *nr_str == '#') {
+            continue;
+        }
+        char *name = strtok_r(NULL, " \t\n", &save);
+        char *rest = strtok_r(NULL, " \t\n", &save);
+
+        char *end;
+        errno = 0;
+        unsigned long nr = strtoul(nr_str, &end, 10);
+        if (*end || errno || !name || (rest && *rest != '#')) {
+            warnx(_("%s:%zu: expected a syscall number and name"), path, lineno);
+            ret = EX_DATAERR;
+            break;
+        }
+        if (nr >= SL_SYSCALL_NR_MAX) {
+            warnx(_("%s:%zu: syscall number %lu is too large"), path, lineno, nr);
+            ret = EX_DATAERR;
+            break;
         }
 
-        return (insn >> 10) & 0xfff;
+        char *name_copy = strdup(name);
+        // GCOVR_EXCL_START: OOM
+        if (!name_copy) {
+            err(EX_OSERR, _("cannot allocate syscall name"));
+        }
+        // GCOVR_EXCL_STOP
+        free((char *)set->names[nr]);
+        set->names[nr] = name_copy;
+        set->bits[nr / 64] |= 1ULL << (nr % 64);
     }
 
-    return 0;
+    free(line);
+    (void) fclose(fp);
+    return ret;
 }
 
-static bool is_clobbering_rd(uint32_t insn, int rd)
+// identifies the set in the index, as findings for one set are meaningless
+// for another
+uint32_t sl_syscall_set_hash(const struct sl_syscall_set *set)
 {
-    // XXX not exact -- correct solution would require properly disassembling,
-    // hence complete opcode info
-    return (insn & 0x1f) == (uint32_t)rd;
+    uint64_t h[2];
+    murmur3_x64_128(set->bits, sizeof(set->bits), 0, h);
+    return (uint32_t)h[0];
 }
 
+// returns the name of the syscall if it's one of the removed ones
+const char *removed_syscall_name(const struct sl_cfg *cfg, uint32_t nr)
+{
+    if (!syscall_set_has(cfg->removed_syscalls, nr)) {
+        return NULL;
+    }
+
+    return cfg->removed_syscalls->names[nr];
+}
+
+// insn format is Ud15
+#define SYSCALL_MASK 0xffff7000
+#define SYSCALL_MATCH 0x002b0000
+
+#define REG_A7 11
+
+// how many insns computing a value from others are followed back
+#define MAX_RESOLVE_DEPTH 4
+
 #define READ_INSN(x) le32toh(*x)
 
-// how many insns to look back for syscall number
-#define MAX_REVERSE_SEARCH_WINDOW 20
+// .text not loaded is gone through this many insns at a time
+#define SCAN_CHUNK_INSNS 65536
+
+// what's known about the value of a register at some point
+struct reg_val {
+    bool known;
+    uint64_t val;
+};
+
+static const struct reg_val unknown_val = { false, 0 };
 
-void scan_for_removed_syscalls(struct sl_elf_ctx *ctx, Elf_Scn *s)
+static int64_t sext(uint32_t x, int bits)
 {
-    Elf_Data *d = NULL;
-    while ((d = elf_getdata(s, d)) != NULL) {
-        uint32_t *p = d->d_buf;
-        uint32_t *end = (uint32_t *)((uint8_t *)d->d_buf + d->d_size);
-        size_t count = 0;
-
-        for (; p < end; p++, count++) {
-            uint32_t insn_word = READ_INSN(p);
-
-            // find all syscall insns
-            if (!is_syscall(insn_word)) {
-                continue;
-            }
+    return (int64_t)((uint64_t)x << (64 - bits)) >> (64 - bits);
+}
 
-            // we're looking at a syscall insn
-            // now, reverse search for an immediate load into $a7 (the syscall
-            // number)
-            if (count == 0) {
-                // Unlikely, but we're at the start of text section, and it's
-                // a syscall.
-                // This binary is very likely malformed, but it's unrelated to
-                // our syscall ABI check, so just quietly ignore.
-                continue;
-            }
+// Works out what's in reg right before insns[i], from the constants loaded
+// with addi.[wd], ori, lu12i.w and or (thus move) in insns[lo, i); for $a7,
+// what's in it before insns[lo] is given. Control flow is not followed: any
+// jump or call in between makes the value unknown, as the code after it is
+// reached from elsewhere, and calls don't preserve the argument registers.
+static struct reg_val resolve(const uint32_t *insns, size_t lo, size_t i, uint32_t reg, struct reg_val a7, int depth)
+{
+    if (reg == SL_REG_ZERO) {
+        return (struct reg_val) { true, 0 };
+    }
 
-            uint32_t syscall_nr = 0;
-            uint32_t *q = p - 1;
-            size_t search_window = MIN(count - 1, MAX_REVERSE_SEARCH_WINDOW);
-            for (; search_window > 0; q--, search_window--) {
-                insn_word = READ_INSN(q);
-                syscall_nr = maybe_pull_out_syscall_nr(insn_word);
-                if (syscall_nr != 0) {
-                    // Found it!
-                    break;
-                }
-
-                if (is_clobbering_rd(insn_word, 11)) {
-                    // stop looking; $a7 is being stuffed something we can't
-                    // process.
-                    break;
-                }
-            }
+    while (i > lo) {
+        uint32_t insn = READ_INSN(&insns[--i]);
+        unsigned int flags = sl_insn_decode(insn);
 
-            if (syscall_nr == 0) {
-                // we failed to statically pull out the syscall number
-                continue;
-            }
+        if (flags & SL_INSN_JUMPS) {
+            return unknown_val;
+        }
+        if (!((sl_insn_gprs_written(insn, flags) >> reg) & 1)) {
+            continue;
+        }
 
-            const char *problematic_syscall = NULL;
-            switch (syscall_nr) {
-            case 79:
-                problematic_syscall = "newfstatat";
-                break;
+        // found the last insn writing to reg
+        uint32_t rj = (insn >> 5) & 0x1f;
+        uint32_t rk = (insn >> 10) & 0x1f;
+        uint32_t imm12 = (insn >> 10) & 0xfff;
+        struct reg_val v;
 
-            case 80:
-                problematic_syscall = "fstat";
-                break;
+        if ((insn & 0xfe000000) == 0x14000000) {
+            // lu12i.w
+            return (struct reg_val) { true, (uint64_t)sext(((insn >> 5) & 0xfffff) << 12, 32) };
+        }
+
+        if (depth == 0) {
+            return unknown_val;
+        }
 
-            case 163:
-                problematic_syscall = "getrlimit";
-                break;
+        switch (insn & 0xffc00000) {
+        case 0x02800000:  // addi.w
+            v = resolve(insns, lo, i, rj, a7, depth - 1);
+            v.val = (uint64_t)sext((uint32_t)(v.val + (uint64_t)sext(imm12, 12)), 32);
+            return v.known ? v : unknown_val;
 
-            case 164:
-                problematic_syscall = "setrlimit";
-                break;
+        case 0x02c00000:  // addi.d
+            v = resolve(insns, lo, i, rj, a7, depth - 1);
+            v.val += (uint64_t)sext(imm12, 12);
+            return v.known ? v : unknown_val;
+
+        case 0x03800000:  // ori
+            v = resolve(insns, lo, i, rj, a7, depth - 1);
+            v.val |= imm12;
+            return v.known ? v : unknown_val;
+        }
+
+        if ((insn & 0xffff8000) == 0x00150000) {
+            // or
+            v = resolve(insns, lo, i, rj, a7, depth - 1);
+            struct reg_val vk = resolve(insns, lo, i, rk, a7, depth - 1);
+            if (!v.known || !vk.known) {
+                return unknown_val;
             }
+            v.val |= vk.val;
+            return v;
+        }
 
-            if (problematic_syscall == NULL) {
-                // legitimate syscall
-                continue;
+        // $a7 is being stuffed something we can't process
+        return unknown_val;
+    }
+
+    return reg == REG_A7 ? a7 : unknown_val;
+}
+
+// Looks at insns[0, n) for syscalls, insns[0] being at off in .text, with
+// *a7 telling what's in $a7 before insns[0], and after insns[n - 1] on
+// return.
+//
+// The insns are gone through once, front to back: the syscalls are found
+// first, then what's loaded into $a7 since the one before is looked for
+// backwards from each, which most of the time means only a few insns
+// preceding them are decoded. If nothing is, $a7 still has what it had at
+// the previous one, as the kernel leaves it alone.
+static void scan_insns(struct sl_elf_ctx *ctx, const uint32_t *insns, size_t n, uint64_t off, struct reg_val *a7)
+{
+    const struct sl_syscall_set *removed = ctx->cfg->removed_syscalls;
+    size_t pos = 0;
+    size_t count;
+
+    for (count = 0; count < n; count++) {
+        // find all syscall insns, the rest is only looked at before them
+        count += sl_insn_find(insns + count, n - count, SYSCALL_MASK, SYSCALL_MATCH);
+        if (count == n) {
+            break;
+        }
+
+        *a7 = resolve(insns, pos, count, REG_A7, *a7, MAX_RESOLVE_DEPTH);
+        pos = count + 1;
+
+        if (!a7->known || !syscall_set_has(removed, a7->val)) {
+            // unknown, or legitimate syscall
+            continue;
+        }
+
+        struct sl_finding f = {
+            .kind = SL_FINDING_REMOVED_SYSCALL,
+            .u1 = (uint32_t)a7->val,
+            .off1 = off + (uint64_t)count * sizeof(uint32_t),
+        };
+        sl_report(ctx, &f);
+    }
+
+    *a7 = resolve(insns, pos, n, REG_A7, *a7, MAX_RESOLVE_DEPTH);
+}
+
+int scan_for_removed_syscalls(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s)
+{
+    // a misaligned .text can only come from a malformed file
+    if (!s->size || (s->offset & (sizeof(uint32_t) - 1))) {
+        return 0;
+    }
+
+    size_t n = s->size / sizeof(uint32_t);
+    struct reg_val a7 = unknown_val;
+
+    if (s->data) {
+        scan_insns(ctx, (const uint32_t *)s->data, n, 0, &a7);
+        return 0;
+    }
+
+    // streamed through a buffer; nothing but what's in $a7 is carried over
+    // from one chunk to the next
+    uint32_t *buf = malloc(SCAN_CHUNK_INSNS * sizeof(uint32_t));
+    // GCOVR_EXCL_START: OOM
+    if (!buf) {
+        err(EX_OSERR, _("cannot allocate scan buffer"));
+    }
+    // GCOVR_EXCL_STOP
+
+    size_t pos = 0;
+    while (pos < n) {
+        size_t len = MIN(n - pos, SCAN_CHUNK_INSNS);
+        if (!sl_elf64_copy(&ctx->elf, s, pos * sizeof(uint32_t), buf, len * sizeof(uint32_t))) {
+            free(buf);
+            if (sl_elf64_is_malformed_errno(errno)) {
+                // like a compressed stream cut short or corrupt within .text;
+                // what's been scanned so far stands
+                return 0;
             }
+            // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+            fprintf(stderr, _("%s: cannot read: %s\n"), sl_elf_path(ctx), strerror(errno));
+            return EX_IOERR;
+            // GCOVR_EXCL_STOP
+        }
+
+        scan_insns(ctx, buf, len, (uint64_t)pos * sizeof(uint32_t), &a7);
+        pos += len;
+    }
 
-            g_has_syscall_abi_problems = true;
-            printf(
-                _("%s: usage of removed syscall `%s` at .text+0x%zx\n"),
-                ctx->path,
-                problematic_syscall,
-                (uint8_t *)p - (uint8_t *)d->d_buf
-            );
+    free(buf);
+    return 0;
+}
+
+// Finds .text in a file looked into on its own, e.g. an archive member, and
+// scans it.
+int scan_text_for_removed_syscalls(struct sl_elf_ctx *ctx)
+{
+    struct sl_elf64_scn s_text = { 0 };
+    size_t i;
+    for (i = 1; i < ctx->elf.shnum; i++) {
+        struct sl_elf64_scn scn;
+        (void) sl_elf64_scn(&ctx->elf, i, &scn);
+        if (scn.name && !strcmp(".text", scn.name)) {
+            s_text = scn;
+            break;
         }
     }
+
+    // archive members are only 2-byte aligned, so .text may not be aligned
+    // in memory even if it is in the file; it's streamed through an aligned
+    // buffer then
+    if ((uintptr_t)s_text.data & (sizeof(uint32_t) - 1)) {
+        s_text.data = NULL;
+    }
+
+    sl_stats_phase(SL_PHASE_SCAN);
+    sl_stats_add(SL_STAT_SCANNED_TEXT, s_text.size);
+    int ret = scan_for_removed_syscalls(ctx, &s_text);
+    sl_stats_phase(SL_PHASE_PARSE);
+
+    return ret;
+}
+
+void syscall_abi_note_problem(void)
+{
+    __atomic_store_n(&g_has_syscall_abi_problems, true, __ATOMIC_RELAXED);
 }
 
 void print_final_report()
 {
-    if (g_has_syscall_abi_problems) {
+    if (__atomic_load_n(&g_has_syscall_abi_problems, __ATOMIC_RELAXED)) {
         printf(_(
             "\n"
             "        \x1b[31m╔═══════════════════════════════════════════════════════════╗\x1b[m\n"
@@ -1,11 +1,28 @@
 #ifndef _shengloong_processing_syscall_abi_h
 #define _shengloong_processing_syscall_abi_h
 
-#include <libelf.h>
+#include <stdint.h>
 
+#include "cfg.h"
 #include "ctx.h"
 
-void scan_for_removed_syscalls(struct sl_elf_ctx *ctx, Elf_Scn *s);
+// syscall numbers are below this on every architecture there is
+#define SL_SYSCALL_NR_MAX 1024
+
+// A set of syscalls by number, along with their names.
+struct sl_syscall_set {
+    uint64_t bits[SL_SYSCALL_NR_MAX / 64];
+    const char *names[SL_SYSCALL_NR_MAX];
+};
+
+extern const struct sl_syscall_set sl_removed_syscalls_default;
+
+int sl_syscall_set_load(struct sl_syscall_set *set, const char *path);
+uint32_t sl_syscall_set_hash(const struct sl_syscall_set *set);
+const char *removed_syscall_name(const struct sl_cfg *cfg, uint32_t nr);
+int scan_for_removed_syscalls(struct sl_elf_ctx *ctx, const struct sl_elf64_scn *s);
+int scan_text_for_removed_syscalls(struct sl_elf_ctx *ctx);
+void syscall_abi_note_problem(void);
 void print_final_report(void);
 
 #endif  // _shengloong_processing_syscall_abi_h
@@ -0,0 +1,88 @@
+#include <err.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "buildconfig.gen.h"
+#include "gettext.h"
+#include "reorder.h"
+#include "utils.h"
+
+#define _(x) gettext(x)
+
+struct pending {
+    bool done;
+    struct sl_output out;
+};
+
+struct sl_reorder {
+    pthread_mutex_t lock;
+    // number of the next file to write the output of
+    size_t next;
+    // for that file and those after it, up to the last one done
+    struct pending *pending;
+    size_t nr;
+    size_t cap;
+};
+
+struct sl_reorder *sl_reorder_new(void)
+{
+    struct sl_reorder *r = calloc(1, sizeof(*r));
+    // GCOVR_EXCL_START: OOM
+    if (!r) {
+        err(EX_OSERR, _("cannot allocate memory"));
+    }
+    // GCOVR_EXCL_STOP
+
+    pthread_mutex_init(&r->lock, NULL);
+    return r;
+}
+
+// writes out the output of the files next in line, which are done
+static void write_ready(struct sl_reorder *r, bool all)
+{
+    size_t n = 0;
+    while (n < r->nr && (all || r->pending[n].done)) {
+        sl_output_commit(&r->pending[n].out);
+        n++;
+    }
+
+    memmove(r->pending, r->pending + n, (r->nr - n) * sizeof(*r->pending));
+    memset(r->pending + r->nr - n, 0, n * sizeof(*r->pending));
+    r->nr -= n;
+    r->next += n;
+}
+
+// Takes over the output of file number seq, and writes it out along with
+// that of the files after it, as soon as all files before it are done.
+void sl_reorder_commit(struct sl_reorder *r, size_t seq, struct sl_output *out)
+{
+    pthread_mutex_lock(&r->lock);
+
+    size_t i = seq - r->next;
+    r->pending = grow_array(r->pending, &r->cap, i + 1, sizeof(*r->pending));
+    r->pending[i].done = true;
+    r->pending[i].out = *out;
+    if (i >= r->nr) {
+        r->nr = i + 1;
+    }
+    memset(out, 0, sizeof(*out));
+
+    if (i == 0) {
+        write_ready(r, false);
+    }
+
+    pthread_mutex_unlock(&r->lock);
+}
+
+// Writes out what's left, which only has gaps for files not gone through
+// when the walk stopped early.
+void sl_reorder_free(struct sl_reorder *r)
+{
+    write_ready(r, true);
+    free(r->pending);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
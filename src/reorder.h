@@ -0,0 +1,20 @@
+#ifndef _shengloong_reorder_h
+#define _shengloong_reorder_h
+
+#include <stddef.h>
+
+#include "output.h"
+
+// Puts the output about files back in the order the walker found them in,
+// when they're opened in some other order.
+//
+// Every file found gets the next number in walk order, and its output is
+// written out once that of all files numbered before is; what comes early is
+// kept until then.
+struct sl_reorder;
+
+struct sl_reorder *sl_reorder_new(void);
+void sl_reorder_commit(struct sl_reorder *r, size_t seq, struct sl_output *out);
+void sl_reorder_free(struct sl_reorder *r);
+
+#endif  // _shengloong_reorder_h
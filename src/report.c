@@ -0,0 +1,244 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "buildconfig.gen.h"
+#include "elfcompat.h"
+#include "gettext.h"
+#include "output.h"
+#include "processing_objabi.h"
+#include "processing_syscall_abi.h"
+#include "report.h"
+#include "utils.h"
+
+#define _(x) gettext(x)
+
+static const enum sl_analysis finding_analyses[SL_FINDING_KIND_MAX] = {
+    [SL_FINDING_NOT_ELF64] = SL_ANALYSIS_HDR,
+    [SL_FINDING_NOT_LE] = SL_ANALYSIS_HDR,
+    [SL_FINDING_NOT_LOONGARCH] = SL_ANALYSIS_HDR,
+    [SL_FINDING_NO_SHSTRNDX] = SL_ANALYSIS_HDR,
+    [SL_FINDING_NO_SCN_NAME] = SL_ANALYSIS_HDR,
+    [SL_FINDING_OBSOLETE_OBJABI] = SL_ANALYSIS_OBJABI,
+    [SL_FINDING_REMOVED_SYSCALL] = SL_ANALYSIS_SYSCALL,
+    [SL_FINDING_PATCH_DYNSYM] = SL_ANALYSIS_PATCH,
+    [SL_FINDING_PATCH_VERDEF] = SL_ANALYSIS_PATCH,
+    [SL_FINDING_PATCH_VERNEED] = SL_ANALYSIS_PATCH,
+    [SL_FINDING_PATCH_RODATA] = SL_ANALYSIS_PATCH,
+    [SL_FINDING_PATCH_TEXT_HASH] = SL_ANALYSIS_PATCH,
+};
+
+// the analyses wanted by the current mode; header and object file ABI
+// checks come for free with every file
+unsigned int sl_cfg_analyses(const struct sl_cfg *cfg)
+{
+    unsigned int ret = SL_ANALYSIS_HDR | SL_ANALYSIS_OBJABI;
+
+    if (cfg->check_syscall_abi) {
+        ret |= SL_ANALYSIS_SYSCALL;
+    }
+
+    if (sl_cfg_wants_patch(cfg)) {
+        ret |= SL_ANALYSIS_PATCH;
+    }
+
+    return ret;
+}
+
+enum sl_analysis sl_finding_analysis(enum sl_finding_kind kind)
+{
+    return finding_analyses[kind];
+}
+
+// whether the current mode shows findings of this kind to the user
+bool sl_finding_shown(const struct sl_cfg *cfg, enum sl_finding_kind kind)
+{
+    switch (finding_analyses[kind]) {
+    case SL_ANALYSIS_HDR:
+        return cfg->verbose;
+    case SL_ANALYSIS_OBJABI:
+        return cfg->check_objabi;
+    case SL_ANALYSIS_SYSCALL:
+        return cfg->check_syscall_abi;
+    case SL_ANALYSIS_PATCH:
+        // the check-only modes imply dry runs, but don't show these
+        return cfg->dry_run && sl_cfg_wants_patch(cfg);
+    default:
+        __builtin_unreachable();  // GCOVR_EXCL_LINE
+    }
+}
+
+// Shows the finding to the user if the current mode asks for it, and
+// accounts for it in the final reports. What's shown is added to out, to be
+// written out with the rest about the same file.
+void sl_finding_emit(const struct sl_cfg *cfg, struct sl_output *out, const char *path, const struct sl_finding *f)
+{
+    if (!sl_finding_shown(cfg, f->kind)) {
+        return;
+    }
+
+    if (cfg->format == SL_FORMAT_JSONL) {
+        // there are no final reports then
+        sl_output_finding(out, cfg, path, f);
+        return;
+    }
+
+    // findings about archive members name them like ar(1) and ld(1) do
+    char *member_path = NULL;
+    if (f->str && (f->kind == SL_FINDING_OBSOLETE_OBJABI || f->kind == SL_FINDING_REMOVED_SYSCALL)) {
+        // GCOVR_EXCL_START: OOM
+        if (asprintf(&member_path, "%s(%s)", path, f->str) < 0) {
+            err(EX_OSERR, _("cannot allocate path"));
+        }
+        // GCOVR_EXCL_STOP
+        path = member_path;
+    }
+
+    switch (f->kind) {
+    case SL_FINDING_NOT_ELF64:
+        sl_output_text(out, _("%s: ignoring: not ELF64 file\n"), path);
+        break;
+
+    case SL_FINDING_NOT_LE:
+        sl_output_text(out, _("%s: ignoring: not little-endian\n"), path);
+        break;
+
+    case SL_FINDING_NOT_LOONGARCH:
+        sl_output_text(out, 
+            _("%s: ignoring: not LoongArch file: e_machine = %d != %d\n"),
+            path,
+            (int) f->u1,
+            EM_LOONGARCH
+        );
+        break;
+
+    // GCOVR_EXCL_START: excessively unlikely to happen
+    case SL_FINDING_NO_SHSTRNDX:
+        sl_output_text(out, _("%s: ignoring: malformed file: no shstrndx\n"), path);
+        break;
+
+    case SL_FINDING_NO_SCN_NAME:
+        sl_output_text(out, _("%s: ignoring: malformed file: cannot get section name\n"), path);
+        break;
+    // GCOVR_EXCL_STOP
+
+    case SL_FINDING_OBSOLETE_OBJABI:
+        objabi_note_problem();
+        sl_output_text(out, 
+            _("%s: file uses obsolete object file ABI: e_flags=0x%x\n"),
+            path,
+            (int) f->u1
+        );
+        break;
+
+    case SL_FINDING_REMOVED_SYSCALL:
+        syscall_abi_note_problem();
+        sl_output_text(out, 
+            _("%s: usage of removed syscall `%s` at .text+0x%zx\n"),
+            path,
+            removed_syscall_name(cfg, f->u1),
+            (size_t) f->off1
+        );
+        break;
+
+    case SL_FINDING_PATCH_DYNSYM:
+        sl_output_text(out, _("%s: symbol version %s at idx %zd needs patching\n"), path, f->str, (size_t) f->u1);
+        break;
+
+    case SL_FINDING_PATCH_VERDEF:
+        sl_output_text(out, _("%s: verdef %zd: %s needs patching\n"), path, (size_t) f->u1, f->str);
+        break;
+
+    case SL_FINDING_PATCH_VERNEED:
+        sl_output_text(out, 
+            _("%s: verneed %zd: aux %zd name %s needs patching\n"),
+            path,
+            (size_t) f->u1,
+            (size_t) f->u2,
+            f->str
+        );
+        break;
+
+    case SL_FINDING_PATCH_RODATA:
+        sl_output_text(out, 
+            _("%s: hard-coded symbol version in .rodata: %s (offset %zd) needs patching\n"),
+            path,
+            f->str,
+            (size_t) f->off1
+        );
+        break;
+
+    case SL_FINDING_PATCH_TEXT_HASH:
+        sl_output_text(out, 
+            _("%s: old hash in .text needs patching: lu12i.w offset %zd, ori offset %zd\n"),
+            path,
+            (size_t) f->off1,
+            (size_t) f->off2
+        );
+        break;
+
+    // GCOVR_EXCL_START
+    case SL_FINDING_KIND_MAX:
+        __builtin_unreachable();
+    // GCOVR_EXCL_STOP
+    }
+
+    free(member_path);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void sl_result_add(struct sl_file_result *res, const struct sl_finding *f)
+{
+    res->findings = grow_array(res->findings, &res->cap_findings, res->nr_findings + 1, sizeof(*res->findings));
+
+    struct sl_rec_finding *rf = &res->findings[res->nr_findings++];
+    rf->kind = (uint16_t) f->kind;
+    rf->reserved = 0;
+    rf->u1 = f->u1;
+    rf->u2 = f->u2;
+    rf->off1 = f->off1;
+    rf->off2 = f->off2;
+    rf->str_off = SL_NO_STR;
+
+    if (f->str) {
+        size_t len = strlen(f->str) + 1;
+        res->strs = grow_array(res->strs, &res->cap_strs, res->strs_len + len, 1);
+        memcpy(res->strs + res->strs_len, f->str, len);
+        rf->str_off = (uint32_t) res->strs_len;
+        res->strs_len += len;
+    }
+}
+
+void sl_result_get(const struct sl_rec_finding *rf, const char *strs, struct sl_finding *out)
+{
+    out->kind = (enum sl_finding_kind) rf->kind;
+    out->u1 = rf->u1;
+    out->u2 = rf->u2;
+    out->off1 = rf->off1;
+    out->off2 = rf->off2;
+    out->str = rf->str_off == SL_NO_STR ? NULL : strs + rf->str_off;
+}
+
+void sl_result_copy(struct sl_file_result *dst, const struct sl_file_result *src)
+{
+    dst->analyses = src->analyses;
+    dst->flags = src->flags;
+    dst->e_flags = src->e_flags;
+
+    size_t i;
+    for (i = 0; i < src->nr_findings; i++) {
+        struct sl_finding f;
+        sl_result_get(&src->findings[i], src->strs, &f);
+        sl_result_add(dst, &f);
+    }
+}
+
+void sl_result_free(struct sl_file_result *res)
+{
+    free(res->findings);
+    free(res->strs);
+    memset(res, 0, sizeof(*res));
+}
@@ -0,0 +1,98 @@
+#ifndef _shengloong_report_h
+#define _shengloong_report_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfg.h"
+
+struct sl_output;
+
+// Analyses that can be done on a file; a finding belongs to exactly one.
+enum sl_analysis {
+    SL_ANALYSIS_HDR = 1 << 0,
+    SL_ANALYSIS_OBJABI = 1 << 1,
+    SL_ANALYSIS_SYSCALL = 1 << 2,
+    SL_ANALYSIS_PATCH = 1 << 3,
+
+    SL_ANALYSIS_ALL = (1 << 4) - 1,
+};
+
+enum sl_finding_kind {
+    // SL_ANALYSIS_HDR; only shown in verbose mode
+    SL_FINDING_NOT_ELF64,
+    SL_FINDING_NOT_LE,
+    SL_FINDING_NOT_LOONGARCH,  // u1 = e_machine
+    SL_FINDING_NO_SHSTRNDX,
+    SL_FINDING_NO_SCN_NAME,
+
+    // SL_ANALYSIS_OBJABI
+    SL_FINDING_OBSOLETE_OBJABI,  // u1 = e_flags, str = archive member or NULL
+
+    // SL_ANALYSIS_SYSCALL
+    // u1 = syscall number, off1 = .text offset, str = archive member or NULL
+    SL_FINDING_REMOVED_SYSCALL,
+
+    // SL_ANALYSIS_PATCH; only shown in dry-run mode
+    SL_FINDING_PATCH_DYNSYM,   // u1 = symbol idx, str = version
+    SL_FINDING_PATCH_VERDEF,   // u1 = verdef idx, str = version
+    SL_FINDING_PATCH_VERNEED,  // u1 = verneed idx, u2 = aux idx, str = version
+    SL_FINDING_PATCH_RODATA,   // off1 = .rodata offset, str = version
+    SL_FINDING_PATCH_TEXT_HASH,  // off1 = lu12i.w offset, off2 = ori offset
+
+    SL_FINDING_KIND_MAX,
+};
+
+struct sl_finding {
+    enum sl_finding_kind kind;
+    uint32_t u1;
+    uint32_t u2;
+    uint64_t off1;
+    uint64_t off2;
+    const char *str;
+};
+
+// compact form of a finding as kept in results and the on-disk index
+struct sl_rec_finding {
+    uint16_t kind;
+    uint16_t reserved;
+    uint32_t u1;
+    uint32_t u2;
+    uint32_t str_off;  // into the string pool, or SL_NO_STR
+    uint64_t off1;
+    uint64_t off2;
+};
+
+#define SL_NO_STR UINT32_MAX
+
+// flags of struct sl_file_result
+#define SL_RESULT_LOONGARCH (1U << 0)
+#define SL_RESULT_NEEDS_PATCH (1U << 1)
+
+// Everything learned about a file, kept for replaying later.
+struct sl_file_result {
+    unsigned int analyses;
+    unsigned int flags;
+    uint32_t e_flags;
+
+    struct sl_rec_finding *findings;
+    size_t nr_findings;
+    size_t cap_findings;
+
+    char *strs;
+    size_t strs_len;
+    size_t cap_strs;
+};
+
+unsigned int sl_cfg_analyses(const struct sl_cfg *cfg);
+enum sl_analysis sl_finding_analysis(enum sl_finding_kind kind);
+bool sl_finding_shown(const struct sl_cfg *cfg, enum sl_finding_kind kind);
+void sl_finding_emit(const struct sl_cfg *cfg, struct sl_output *out, const char *path, const struct sl_finding *f);
+
+void sl_result_add(struct sl_file_result *res, const struct sl_finding *f);
+void sl_result_get(const struct sl_rec_finding *rf, const char *strs, struct sl_finding *out);
+void sl_result_copy(struct sl_file_result *dst, const struct sl_file_result *src);
+void sl_result_free(struct sl_file_result *res);
+
+#endif  // _shengloong_report_h
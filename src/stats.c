@@ -0,0 +1,203 @@
+#include <err.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <time.h>
+
+#include "buildconfig.gen.h"
+#include "gettext.h"
+#include "stats.h"
+
+#define _(x) gettext(x)
+
+struct thread_stats {
+    struct thread_stats *next;
+
+    uint64_t counts[SL_NR_STATS];
+    uint64_t phase_ns[SL_NR_PHASES];
+
+    enum sl_phase phase;
+    uint64_t phase_start_ns;
+};
+
+// only ever set before any other thread is started
+static bool g_enabled;
+static enum sl_stats_format g_format;
+static uint64_t g_start_ns;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_stats *g_threads;
+
+static __thread struct thread_stats *t_stats;
+
+static const struct {
+    const char *key;
+    const char *label;
+} stat_names[SL_NR_STATS] = {
+    [SL_STAT_ENTRIES] = { "entries", gettext_noop("directory entries walked") },
+    [SL_STAT_DIRS] = { "dirs", gettext_noop("directories") },
+    [SL_STAT_EXCLUDED] = { "excluded", gettext_noop("entries left out by the rules or at mount points") },
+    [SL_STAT_REGULAR_FILES] = { "regular_files", gettext_noop("regular files") },
+    [SL_STAT_ELF_MAGIC] = { "elf_magic", gettext_noop("files with the ELF magic") },
+    [SL_STAT_REJECT_CLASS] = { "reject_class", gettext_noop("rejected for not being ELF64") },
+    [SL_STAT_REJECT_ENDIAN] = { "reject_endian", gettext_noop("rejected for not being little-endian") },
+    [SL_STAT_REJECT_MACHINE] = { "reject_machine", gettext_noop("rejected for not being LoongArch") },
+    [SL_STAT_ARCHIVES] = { "archives", gettext_noop("files with the ar magic") },
+    [SL_STAT_ARCHIVE_MEMBERS] = { "archive_members", gettext_noop("LoongArch objects in archives checked") },
+    [SL_STAT_COMPRESSED] = { "compressed", gettext_noop("files with the magic of a compression format") },
+    [SL_STAT_INDEX_HITS] = { "index_hits", gettext_noop("files unchanged since the last run") },
+    [SL_STAT_DEDUP_HITS] = { "dedup_hits", gettext_noop("files sharing the results of another") },
+    [SL_STAT_FILES_PROCESSED] = { "files_processed", gettext_noop("files looked into") },
+    [SL_STAT_BYTES_MAPPED] = { "bytes_mapped", gettext_noop("bytes mapped") },
+    [SL_STAT_BYTES_READ] = { "bytes_read", gettext_noop("bytes read") },
+    [SL_STAT_BYTES_PREFETCHED] = { "bytes_prefetched", gettext_noop("bytes asked to be read ahead") },
+    [SL_STAT_BYTES_DECOMPRESSED] = { "bytes_decompressed", gettext_noop("bytes decompressed") },
+    [SL_STAT_SCANNED_TEXT] = { "scanned_text", gettext_noop("bytes of .text scanned") },
+    [SL_STAT_SCANNED_RODATA] = { "scanned_rodata", gettext_noop("bytes of .rodata scanned") },
+    [SL_STAT_SCANNED_DYNSYM] = { "scanned_dynsym", gettext_noop("bytes of .dynsym scanned") },
+    [SL_STAT_SCANNED_VERSIONS] = { "scanned_versions", gettext_noop("bytes of symbol versions scanned") },
+    [SL_STAT_FILES_PATCHED] = { "files_patched", gettext_noop("files patched") },
+    [SL_STAT_BYTES_WRITTEN] = { "bytes_written", gettext_noop("bytes written") },
+};
+
+static const struct {
+    const char *key;
+    const char *label;
+} phase_names[SL_NR_PHASES] = {
+    [SL_PHASE_NONE] = { "none", NULL },
+    [SL_PHASE_WALK] = { "walk", gettext_noop("walking directories") },
+    [SL_PHASE_OPEN] = { "open", gettext_noop("opening files") },
+    [SL_PHASE_HASH] = { "hash", gettext_noop("hashing contents") },
+    [SL_PHASE_PARSE] = { "parse", gettext_noop("finding sections") },
+    [SL_PHASE_SCAN] = { "scan", gettext_noop("scanning sections") },
+    [SL_PHASE_PATCH] = { "patch", gettext_noop("patching") },
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static struct thread_stats *get_stats(void)
+{
+    if (t_stats) {
+        return t_stats;
+    }
+
+    struct thread_stats *ts = calloc(1, sizeof(*ts));
+    // GCOVR_EXCL_START: OOM
+    if (!ts) {
+        err(EX_OSERR, _("cannot allocate statistics"));
+    }
+    // GCOVR_EXCL_STOP
+    ts->phase = SL_PHASE_NONE;
+    ts->phase_start_ns = now_ns();
+
+    pthread_mutex_lock(&g_lock);
+    ts->next = g_threads;
+    g_threads = ts;
+    pthread_mutex_unlock(&g_lock);
+
+    t_stats = ts;
+    return ts;
+}
+
+void sl_stats_enable(enum sl_stats_format format)
+{
+    g_enabled = true;
+    g_format = format;
+    g_start_ns = now_ns();
+}
+
+void sl_stats_add(enum sl_stat stat, uint64_t n)
+{
+    if (!g_enabled) {
+        return;
+    }
+
+    get_stats()->counts[stat] += n;
+}
+
+void sl_stats_phase(enum sl_phase phase)
+{
+    if (!g_enabled) {
+        return;
+    }
+
+    struct thread_stats *ts = get_stats();
+    if (ts->phase == phase) {
+        return;
+    }
+
+    uint64_t now = now_ns();
+    ts->phase_ns[ts->phase] += now - ts->phase_start_ns;
+    ts->phase = phase;
+    ts->phase_start_ns = now;
+}
+
+// Prints the totals of all threads to stderr. All other threads must be done
+// by now.
+void sl_stats_print(void)
+{
+    if (!g_enabled) {
+        return;
+    }
+
+    // the calling thread may still be in the middle of something
+    sl_stats_phase(SL_PHASE_NONE);
+    uint64_t wall_ns = now_ns() - g_start_ns;
+
+    uint64_t counts[SL_NR_STATS] = { 0 };
+    uint64_t phase_ns[SL_NR_PHASES] = { 0 };
+    unsigned int nr_threads = 0;
+    struct thread_stats *ts = g_threads;
+    while (ts) {
+        struct thread_stats *next = ts->next;
+        size_t i;
+        for (i = 0; i < SL_NR_STATS; i++) {
+            counts[i] += ts->counts[i];
+        }
+        for (i = 0; i < SL_NR_PHASES; i++) {
+            phase_ns[i] += ts->phase_ns[i];
+        }
+        nr_threads++;
+        free(ts);
+        ts = next;
+    }
+    g_threads = NULL;
+    t_stats = NULL;
+
+    size_t i;
+    switch (g_format) {
+    case SL_STATS_TEXT:
+        fprintf(stderr, _("Statistics:\n"));
+        for (i = 0; i < SL_NR_STATS; i++) {
+            fprintf(stderr, "  %s: %" PRIu64 "\n", _(stat_names[i].label), counts[i]);
+        }
+        fprintf(stderr, ngettext("Time spent, in %u thread:\n", "Time spent, summed over %u threads:\n", nr_threads), nr_threads);
+        // time spent waiting is not interesting on its own
+        for (i = SL_PHASE_NONE + 1; i < SL_NR_PHASES; i++) {
+            fprintf(stderr, _("  %s: %.3f s\n"), _(phase_names[i].label), (double)phase_ns[i] / 1e9);
+        }
+        fprintf(stderr, _("Wall-clock time: %.3f s\n"), (double)wall_ns / 1e9);
+        break;
+
+    case SL_STATS_JSON:
+        // integers only, so the locale cannot get in the way
+        fprintf(stderr, "{\"counters\":{");
+        for (i = 0; i < SL_NR_STATS; i++) {
+            fprintf(stderr, "%s\"%s\":%" PRIu64, i ? "," : "", stat_names[i].key, counts[i]);
+        }
+        fprintf(stderr, "},\"threads\":%u,\"ns\":{", nr_threads);
+        for (i = SL_PHASE_NONE + 1; i < SL_NR_PHASES; i++) {
+            fprintf(stderr, "%s\"%s\":%" PRIu64, i > SL_PHASE_NONE + 1 ? "," : "", phase_names[i].key, phase_ns[i]);
+        }
+        fprintf(stderr, "},\"wall_ns\":%" PRIu64 "}\n", wall_ns);
+        break;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef _shengloong_stats_h
+#define _shengloong_stats_h
+
+#include <stdint.h>
+
+// What a run did and where its time went, for --stats.
+//
+// Every thread counts into a set of its own, so nothing is shared while
+// counting; the sets are only added up when printed, after all the work is
+// done. Everything here is a no-op unless sl_stats_enable is called first.
+
+enum sl_stat {
+    SL_STAT_ENTRIES,
+    SL_STAT_DIRS,
+    SL_STAT_EXCLUDED,
+    SL_STAT_REGULAR_FILES,
+    SL_STAT_ELF_MAGIC,
+    SL_STAT_REJECT_CLASS,
+    SL_STAT_REJECT_ENDIAN,
+    SL_STAT_REJECT_MACHINE,
+    SL_STAT_ARCHIVES,
+    SL_STAT_ARCHIVE_MEMBERS,
+    SL_STAT_COMPRESSED,
+    SL_STAT_INDEX_HITS,
+    SL_STAT_DEDUP_HITS,
+    SL_STAT_FILES_PROCESSED,
+    SL_STAT_BYTES_MAPPED,
+    SL_STAT_BYTES_READ,
+    SL_STAT_BYTES_PREFETCHED,
+    SL_STAT_BYTES_DECOMPRESSED,
+    SL_STAT_SCANNED_TEXT,
+    SL_STAT_SCANNED_RODATA,
+    SL_STAT_SCANNED_DYNSYM,
+    SL_STAT_SCANNED_VERSIONS,
+    SL_STAT_FILES_PATCHED,
+    SL_STAT_BYTES_WRITTEN,
+
+    SL_NR_STATS,
+};
+
+// A thread is always in exactly one phase, and switching to another one
+// charges the time since the last switch to the phase being left.
+enum sl_phase {
+    // waiting for work, or anything not accounted for
+    SL_PHASE_NONE,
+    // reading directories and looking at their entries
+    SL_PHASE_WALK,
+    // opening files and reading their ELF headers
+    SL_PHASE_OPEN,
+    // hashing contents to find identical files
+    SL_PHASE_HASH,
+    // mapping or reading in files, and finding their sections
+    SL_PHASE_PARSE,
+    // looking through the sections
+    SL_PHASE_SCAN,
+    // writing the changes
+    SL_PHASE_PATCH,
+
+    SL_NR_PHASES,
+};
+
+enum sl_stats_format {
+    SL_STATS_TEXT,
+    SL_STATS_JSON,
+};
+
+void sl_stats_enable(enum sl_stats_format format);
+void sl_stats_add(enum sl_stat stat, uint64_t n);
+void sl_stats_phase(enum sl_phase phase);
+void sl_stats_print(void);
+
+#endif  // _shengloong_stats_h
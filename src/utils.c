@@ -1,7 +1,15 @@
+#include <endian.h>
+#include <err.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sysexits.h>
 
+#include "buildconfig.gen.h"
+#include "gettext.h"
 #include "utils.h"
 
+#define _(x) gettext(x)
+
 unsigned long bfd_elf_hash (const char *namearg)
 {
     const unsigned char *name = (const unsigned char *) namearg;
@@ -33,6 +41,217 @@ bool endswith(const char *s, const char *pattern, size_t n)
     return strncmp(s, pattern, n) == 0;
 }
 
+// Makes room for at least need elements in the array at p, of which *cap
+// are allocated, doubling its size as many times as needed; the elements
+// added are zeroed.
+void *grow_array(void *p, size_t *cap, size_t need, size_t elemsize)
+{
+    if (need <= *cap) {
+        return p;
+    }
+
+    size_t new_cap = *cap ? *cap * 2 : 8;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+
+    p = realloc(p, new_cap * elemsize);
+    // GCOVR_EXCL_START: OOM
+    if (!p) {
+        err(EX_OSERR, _("cannot allocate memory"));
+    }
+    // GCOVR_EXCL_STOP
+
+    memset((char *)p + *cap * elemsize, 0, (new_cap - *cap) * elemsize);
+    *cap = new_cap;
+    return p;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3_x64_128 by Austin Appleby, who placed it in the public domain;
+// fast, but only good for telling apart data nobody picked to collide
+void murmur3_x64_128(const void *key, size_t len, uint32_t seed, uint64_t out[2])
+{
+    const uint8_t *data = key;
+    const size_t nblocks = len / 16;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    size_t i;
+    for (i = 0; i < nblocks; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i * 16, 8);
+        memcpy(&k2, data + i * 16 + 8, 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = data + nblocks * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (len & 15) {
+    case 15: k2 ^= (uint64_t)tail[14] << 48; // fallthrough
+    case 14: k2 ^= (uint64_t)tail[13] << 40; // fallthrough
+    case 13: k2 ^= (uint64_t)tail[12] << 32; // fallthrough
+    case 12: k2 ^= (uint64_t)tail[11] << 24; // fallthrough
+    case 11: k2 ^= (uint64_t)tail[10] << 16; // fallthrough
+    case 10: k2 ^= (uint64_t)tail[9] << 8;   // fallthrough
+    case 9:
+        k2 ^= (uint64_t)tail[8];
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        // fallthrough
+    case 8: k1 ^= (uint64_t)tail[7] << 56; // fallthrough
+    case 7: k1 ^= (uint64_t)tail[6] << 48; // fallthrough
+    case 6: k1 ^= (uint64_t)tail[5] << 40; // fallthrough
+    case 5: k1 ^= (uint64_t)tail[4] << 32; // fallthrough
+    case 4: k1 ^= (uint64_t)tail[3] << 24; // fallthrough
+    case 3: k1 ^= (uint64_t)tail[2] << 16; // fallthrough
+    case 2: k1 ^= (uint64_t)tail[1] << 8;  // fallthrough
+    case 1:
+        k1 ^= (uint64_t)tail[0];
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    out[0] = h1;
+    out[1] = h2;
+}
+
+static const uint64_t blake2b_iv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const uint8_t blake2b_sigma[12][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+    { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+    { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+    { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+    { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+    { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+    { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+    { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+    { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+};
+
+static inline uint64_t rotr64(uint64_t x, int r)
+{
+    return (x >> r) | (x << (64 - r));
+}
+
+#define B2B_G(a, b, c, d, x, y) \
+    do { \
+        v[a] = v[a] + v[b] + (x); \
+        v[d] = rotr64(v[d] ^ v[a], 32); \
+        v[c] = v[c] + v[d]; \
+        v[b] = rotr64(v[b] ^ v[c], 24); \
+        v[a] = v[a] + v[b] + (y); \
+        v[d] = rotr64(v[d] ^ v[a], 16); \
+        v[c] = v[c] + v[d]; \
+        v[b] = rotr64(v[b] ^ v[c], 63); \
+    } while (0)
+
+static void blake2b_compress(uint64_t h[8], const uint8_t block[128], uint64_t t, bool last)
+{
+    uint64_t m[16];
+    uint64_t v[16];
+
+    size_t i;
+    for (i = 0; i < 16; i++) {
+        uint64_t w;
+        memcpy(&w, block + i * 8, 8);
+        m[i] = le64toh(w);
+    }
+    for (i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = blake2b_iv[i];
+    }
+    // inputs are never anywhere near 2^64 bytes, so the high word of the
+    // counter is always 0
+    v[12] ^= t;
+    if (last) {
+        v[14] = ~v[14];
+    }
+
+    for (i = 0; i < 12; i++) {
+        const uint8_t *s = blake2b_sigma[i];
+        B2B_G(0, 4, 8, 12, m[s[0]], m[s[1]]);
+        B2B_G(1, 5, 9, 13, m[s[2]], m[s[3]]);
+        B2B_G(2, 6, 10, 14, m[s[4]], m[s[5]]);
+        B2B_G(3, 7, 11, 15, m[s[6]], m[s[7]]);
+        B2B_G(0, 5, 10, 15, m[s[8]], m[s[9]]);
+        B2B_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        B2B_G(2, 7, 8, 13, m[s[12]], m[s[13]]);
+        B2B_G(3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (i = 0; i < 8; i++) {
+        h[i] ^= v[i] ^ v[i + 8];
+    }
+}
+
+// BLAKE2b with a 256-bit digest and no key, as in RFC 7693; for telling
+// apart data that may have been made to collide on purpose
+void blake2b_256(const void *in, size_t len, uint8_t out[32])
+{
+    const uint8_t *p = in;
+    uint64_t h[8];
+    memcpy(h, blake2b_iv, sizeof(h));
+    h[0] ^= 0x01010000 | 32;
+
+    uint64_t t = 0;
+    while (len > 128) {
+        t += 128;
+        blake2b_compress(h, p, t, false);
+        p += 128;
+        len -= 128;
+    }
+
+    uint8_t block[128] = { 0 };
+    memcpy(block, p, len);
+    t += len;
+    blake2b_compress(h, block, t, true);
+
+    size_t i;
+    for (i = 0; i < 4; i++) {
+        uint64_t w = htole64(h[i]);
+        memcpy(out + i * 8, &w, 8);
+    }
+}
+
 // GCOVR_EXCL_START
 #ifdef UTIL_BFDHASH
 #include <stdio.h>
@@ -3,8 +3,12 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 unsigned long bfd_elf_hash (const char *namearg);
 bool endswith(const char *s, const char *pattern, size_t n);
+void *grow_array(void *p, size_t *cap, size_t need, size_t elemsize);
+void murmur3_x64_128(const void *key, size_t len, uint32_t seed, uint64_t out[2]);
+void blake2b_256(const void *in, size_t len, uint8_t out[32]);
 
 #endif  // _shengloong_utils_h
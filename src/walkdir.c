@@ -1,88 +1,869 @@
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 
+#include <elf.h>
+
+#include "archive.h"
 #include "buildconfig.gen.h"
 #include "cfg.h"
+#include "dirref.h"
 #include "gettext.h"
+#include "dedup.h"
+#include "filelist.h"
+#include "hdrprobe.h"
+#include "index.h"
+#include "ioorder.h"
+#include "patchfile.h"
+#include "pathrules.h"
+#include "prefetch.h"
 #include "processing.h"
+#include "reorder.h"
+#include "stats.h"
+#include "utils.h"
+#include "walkdir.h"
+
+#if defined(HAVE_OPENAT2) && HAVE_OPENAT2
+#include <linux/openat2.h>
+#endif
 
 #define _(x) gettext(x)
 
-static int walk_fn(
-    const char *fpath,
-    const struct stat *sb,
-    int typeflag,
-    struct FTW *ftwbuf __attribute__((unused)))
+// size of the per-directory buffer for getdents64(2)
+#define DENTS_BUF_SIZE 16384
+
+enum walk_result {
+    WALK_CONTINUE,
+    WALK_STOP,
+};
+
+struct walk_state {
+    struct sl_workqueue *wq;
+    struct sl_dedup *dd;
+    struct sl_hdrprobe *hp;
+    struct sl_prefetch *pf;
+    struct sl_index *index;
+    // of the root, for --one-file-system
+    dev_t dev;
+    // files held back to be opened in the order they're on disk, or NULL,
+    // and what puts the output about them back in walk order
+    struct sl_ioorder *order;
+    struct sl_reorder *reorder;
+};
+
+static enum walk_result walk_dir(
+    struct walk_state *st,
+    struct sl_dir *dir,
+    const struct sl_pathrules_state *rs);
+
+// anything the walker shows by itself has to come after what's shown for
+// the files before, still waiting to be read ahead
+static void flush_prefetch(struct walk_state *st)
+{
+    if (st->pf) {
+        sl_prefetch_flush(st->pf);
+    }
+}
+
+// Shows a message about a path the walker gives up on, after what's shown
+// about the files found before.
+static void say_ignoring(struct walk_state *st, const char *path, int error)
+{
+    struct sl_output out = { NULL, 0, 0 };
+    sl_output_text(&out, _("%s: ignoring: %s\n"), path, strerror(error));
+
+    if (st->reorder) {
+        sl_reorder_commit(st->reorder, st->order->next_seq++, &out);
+    } else {
+        flush_prefetch(st);
+        sl_output_commit(&out);
+    }
+}
+
+// seq is the order the file was found in, if held back
+static void init_file(struct walk_state *st, struct sl_file *f, struct sl_dir *dir, const char *name, size_t seq)
 {
-    if (typeflag != FTW_F) {
-        return FTW_CONTINUE;
+    *f = (struct sl_file) {
+        .dir = dir,
+        .name = name,
+        .index = st->index,
+        .dedup = st->dd,
+        .reorder = st->reorder,
+        .seq = seq,
+    };
+}
+
+// Opens the file and reads its header, if it's worth looking into. *fdp is
+// left at -1 if there's nothing more to do with the file, either because
+// it's done with or because it's been handed over already. Only looks at
+// the file's size and identity, as the type is already known from d_type.
+static enum walk_result open_file(
+    struct walk_state *st,
+    struct sl_file *f,
+    int *fdp,
+    uint64_t *size,
+    Elf64_Ehdr *ehdr)
+{
+    struct sl_dir *dir = f->dir;
+    const char *name = f->name;
+    *fdp = -1;
+
+#if defined(HAVE_IO_URING) && HAVE_IO_URING
+    if (st->hp && !st->index) {
+        // short files are weeded out by a statx in the same batch; with only
+        // the header to read, hard links are cheaper to probe twice than to
+        // stat every file up front
+        f->dedup = NULL;
+        return sl_hdrprobe_add(st->hp, f, true) ? WALK_CONTINUE : WALK_STOP;
     }
+#endif
 
-    if ((sb->st_mode & S_IFMT) != S_IFREG) {
-        // we're only interested in regular files
-        return FTW_CONTINUE;
+#if defined(HAVE_STATX) && HAVE_STATX
+    struct statx stx;
+    unsigned int mask = STATX_SIZE | STATX_INO | STATX_NLINK | STATX_MTIME | STATX_CTIME;
+    if (statx(dir->fd, name, AT_SYMLINK_NOFOLLOW, mask, &stx) < 0) {
+        // vanished in the meantime
+        sl_file_skip(f);
+        return WALK_CONTINUE;
+    }
+    *size = stx.stx_size;
+    uint64_t nlink = stx.stx_nlink;
+    f->key = (struct sl_file_key) {
+        .dev = makedev(stx.stx_dev_major, stx.stx_dev_minor),
+        .ino = stx.stx_ino,
+        .size = stx.stx_size,
+        .mtime_ns = (int64_t)stx.stx_mtime.tv_sec * 1000000000 + stx.stx_mtime.tv_nsec,
+        .ctime_ns = (int64_t)stx.stx_ctime.tv_sec * 1000000000 + stx.stx_ctime.tv_nsec,
+    };
+#else
+    struct stat sb;
+    if (fstatat(dir->fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+        sl_file_skip(f);
+        return WALK_CONTINUE;
     }
+    *size = (uint64_t)sb.st_size;
+    uint64_t nlink = (uint64_t)sb.st_nlink;
+    f->key = (struct sl_file_key) {
+        .dev = sb.st_dev,
+        .ino = sb.st_ino,
+        .size = *size,
+        .mtime_ns = (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec,
+        .ctime_ns = (int64_t)sb.st_ctim.tv_sec * 1000000000 + sb.st_ctim.tv_nsec,
+    };
+#endif
 
-    if ((size_t)sb->st_size < sizeof(Elf64_Ehdr)) {
+    if (*size < sizeof(Elf64_Ehdr)) {
         // ELF files must be at least this large
-        return FTW_CONTINUE;
+        sl_file_skip(f);
+        return WALK_CONTINUE;
+    }
+
+    // other paths to the same inode are processed only once, and their
+    // findings shown right away if it's done
+    if (f->dedup && nlink > 1) {
+        flush_prefetch(st);
+    }
+    if (f->dedup && sl_dedup_inode(f->dedup, f, nlink)) {
+        sl_stats_add(SL_STAT_DEDUP_HITS, 1);
+        return WALK_CONTINUE;
+    }
+
+    // nothing more to do if the last run already saw the file as it is
+    if (st->index && !sl_file_is_ldso(f) && sl_index_lookup(st->index, f)) {
+        sl_stats_add(SL_STAT_INDEX_HITS, 1);
+        flush_prefetch(st);
+        sl_file_emit(&global_cfg, f, SL_ANALYSIS_ALL);
+        sl_file_done(f, SL_FILE_UNCHANGED);
+        return WALK_CONTINUE;
+    }
+
+#if defined(HAVE_IO_URING) && HAVE_IO_URING
+    if (st->hp) {
+        return sl_hdrprobe_add(st->hp, f, false) ? WALK_CONTINUE : WALK_STOP;
     }
+#endif
+
+    sl_stats_phase(SL_PHASE_OPEN);
 
-    // check ELF magic bytes
-    int fd = open(fpath, global_cfg.dry_run ? O_RDONLY : O_RDWR, 0);
+    // everything is opened read-only at first, and only files that really
+    // need patching get reopened for writing later
+    int fd = openat(dir->fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
     if (fd < 0) {
         // open failed, should not happen
-        return FTW_STOP;
+        sl_file_done(f, SL_FILE_FAILED);
+        return WALK_STOP;
+    }
+
+    // a single read of the whole ELF header is enough for rejecting most
+    // files, without involving libelf at all
+    ssize_t nr_read = pread(fd, ehdr, sizeof(*ehdr), 0);
+    if (nr_read < 0) {
+        // read failed
+        // GCOVR_EXCL_START: unlikely to happen except like media error, given open(2) already succeeded
+        (void) close(fd);
+        sl_file_done(f, SL_FILE_FAILED);
+        return WALK_STOP;
+        // GCOVR_EXCL_STOP
+    }
+    sl_stats_add(SL_STAT_BYTES_READ, (uint64_t)nr_read);
+
+    if ((size_t)nr_read < sizeof(*ehdr)) {
+        // definitely not an ELF; will happen on special files such as some
+        // pseudo files from /sys
+        (void) close(fd);
+        sl_file_done_uninteresting(f);
+        return WALK_CONTINUE;
+    }
+
+    bool is_archive = sl_ar_is_archive(ehdr, (size_t)nr_read);
+    enum sl_compression compression = is_archive ? SL_COMPRESSION_NONE : sl_compression_detect(ehdr, (size_t)nr_read);
+    if (!is_archive && compression == SL_COMPRESSION_NONE && memcmp(ehdr->e_ident, ELFMAG, SELFMAG)) {
+        // not an ELF
+        (void) close(fd);
+        sl_file_done_uninteresting(f);
+        return WALK_CONTINUE;
+    }
+
+    *fdp = fd;
+    return WALK_CONTINUE;
+}
+
+// Hands the file over to be looked into, given what open_file got.
+static void look_into(struct walk_state *st, struct sl_file *f, int fd, uint64_t size, const Elf64_Ehdr *ehdr)
+{
+    if (st->pf) {
+        // fd is moved into the stage, and looked into once it leaves
+        sl_prefetch_submit(st->pf, f, fd, size, ehdr);
+        return;
     }
 
-    char magic[4];
-    size_t nr_read = 0;
-    while (nr_read < sizeof(magic)) {
-        ssize_t n = read(fd, magic + nr_read, sizeof(magic) - nr_read);
-        if (n < 0) {
-            // read failed
-            // GCOVR_EXCL_START: unlikely to happen except like media error, given open(2) already succeeded
+    bool is_archive = sl_ar_is_archive(ehdr, sizeof(*ehdr));
+    enum sl_compression compression = is_archive ? SL_COMPRESSION_NONE : sl_compression_detect(ehdr, sizeof(*ehdr));
+    if (is_archive) {
+        // static libraries, whose members are looked into by the checks
+        if (!process_armag(&global_cfg, f)) {
             (void) close(fd);
-            return FTW_STOP;
-            // GCOVR_EXCL_STOP
+            return;
+        }
+    } else if (compression != SL_COMPRESSION_NONE) {
+        // possibly a compressed ELF, like a kernel module
+        if (!process_zmagic(&global_cfg, f, compression)) {
+            (void) close(fd);
+            return;
+        }
+    } else if (!process_ehdr(&global_cfg, f, ehdr)) {
+        (void) close(fd);
+        return;
+    }
+
+    if (st->wq) {
+        // waiting for room in the queue is not part of opening the file
+        sl_stats_phase(SL_PHASE_NONE);
+        // fd is moved into the queue
+        sl_workqueue_submit(st->wq, f, fd);
+        return;
+    }
+
+    // fd is moved into process; better to continue with the remaining files
+    // if anything goes wrong
+    (void) process(&global_cfg, f, fd);
+}
+
+static enum walk_result walk_file(
+    struct walk_state *st,
+    struct sl_dir *dir,
+    const char *name,
+    size_t seq)
+{
+    struct sl_file f;
+    init_file(st, &f, dir, name, seq);
+
+    int fd;
+    uint64_t size;
+    Elf64_Ehdr ehdr;
+    enum walk_result ret = open_file(st, &f, &fd, &size, &ehdr);
+    if (fd >= 0) {
+        look_into(st, &f, fd, size, &ehdr);
+    }
+    return ret;
+}
+
+// a file held back and opened for a sweep in extent order
+struct held_open {
+    struct sl_file file;
+    int fd;
+    uint64_t size;
+    Elf64_Ehdr ehdr;
+    // where its data starts on disk, and its place in inode order for ties
+    uint64_t extent;
+    size_t idx;
+};
+
+static int cmp_held_open(const void *a, const void *b)
+{
+    const struct held_open *x = a;
+    const struct held_open *y = b;
+    if (x->extent != y->extent) {
+        return x->extent < y->extent ? -1 : 1;
+    }
+    return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+// Opens the files held back in inode order, and only those worth looking
+// into are asked where their data is, through the fd already open. They're
+// then looked into in that order, in sweeps of as many as can be kept open.
+// Files not placed yet, or on filesystems not telling, come last, still in
+// inode order.
+static enum walk_result walk_held_by_extent(struct walk_state *st)
+{
+    struct sl_ioorder *io = st->order;
+    struct held_open *held = NULL;
+    size_t cap = 0;
+
+    enum walk_result ret = WALK_CONTINUE;
+    size_t i = 0;
+    while (i < io->nr && ret == WALK_CONTINUE) {
+        size_t nr = 0;
+        for (; i < io->nr && nr < io->max_open && ret == WALK_CONTINUE; i++) {
+            const struct sl_ioorder_ent *e = &io->ents[i];
+            held = grow_array(held, &cap, nr + 1, sizeof(*held));
+            struct held_open *h = &held[nr];
+
+            sl_stats_phase(SL_PHASE_WALK);
+            init_file(st, &h->file, e->dir, e->name, e->seq);
+            ret = open_file(st, &h->file, &h->fd, &h->size, &h->ehdr);
+            if (h->fd >= 0) {
+                h->extent = sl_ioorder_extent(h->fd);
+                h->idx = nr++;
+            }
+        }
+
+        qsort(held, nr, sizeof(*held), cmp_held_open);
+
+        size_t j;
+        for (j = 0; j < nr; j++) {
+            struct held_open *h = &held[j];
+            if (ret == WALK_CONTINUE) {
+                look_into(st, &h->file, h->fd, h->size, &h->ehdr);
+            } else {
+                // other paths to the same inode may be waiting for it
+                (void) close(h->fd);
+                sl_file_done(&h->file, SL_FILE_FAILED);
+            }
+        }
+    }
+
+    free(held);
+    return ret;
+}
+
+// goes through the files held back, in the order they're on disk; what's
+// shown about them still comes in the order they were found in
+static enum walk_result walk_held(struct walk_state *st)
+{
+    sl_stats_phase(SL_PHASE_WALK);
+    sl_ioorder_sort(st->order);
+
+    enum walk_result ret = WALK_CONTINUE;
+    if (st->order->order == SL_IO_ORDER_EXTENT) {
+        ret = walk_held_by_extent(st);
+    } else {
+        size_t i;
+        for (i = 0; i < st->order->nr && ret == WALK_CONTINUE; i++) {
+            const struct sl_ioorder_ent *e = &st->order->ents[i];
+            sl_stats_phase(SL_PHASE_WALK);
+            ret = walk_file(st, e->dir, e->name, e->seq);
+        }
+    }
+
+    sl_ioorder_clear(st->order);
+    return ret;
+}
+
+// the inode number is known without a stat, from d_ino
+static enum walk_result hold_file(
+    struct walk_state *st,
+    struct sl_dir *dir,
+    const char *name,
+    uint64_t ino)
+{
+    if (!sl_ioorder_add(st->order, dir, name, ino)) {
+        return WALK_CONTINUE;
+    }
+    return walk_held(st);
+}
+
+static enum walk_result walk_subdir(
+    struct walk_state *st,
+    struct sl_dir *dir,
+    const char *name,
+    const struct sl_pathrules_state *rs)
+{
+    if (global_cfg.one_file_system) {
+        // checked before opening, so that automounts aren't triggered
+        struct stat sb;
+        if (fstatat(dir->fd, name, &sb, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT) < 0) {
+            return WALK_CONTINUE;
+        }
+        if (sb.st_dev != st->dev) {
+            sl_stats_add(SL_STAT_EXCLUDED, 1);
+            return WALK_CONTINUE;
+        }
+    }
+
+    int fd = openat(dir->fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        // unreadable directories are skipped like nftw(3) did
+        return WALK_CONTINUE;
+    }
+
+    struct sl_dir *subdir = sl_dir_new(dir, name, fd);
+    enum walk_result ret = walk_dir(st, subdir, rs);
+    sl_dir_put(subdir);
+
+    return ret;
+}
+
+static enum walk_result walk_entry(
+    struct walk_state *st,
+    struct sl_dir *dir,
+    const struct sl_pathrules_state *rs,
+    const char *name,
+    uint64_t ino,
+    unsigned char d_type)
+{
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        return WALK_CONTINUE;
+    }
+
+    // files processed inline leave the walker in some other phase
+    sl_stats_phase(SL_PHASE_WALK);
+    sl_stats_add(SL_STAT_ENTRIES, 1);
+
+    // our own copies, when replacing files in the directory being walked
+    if (!strncmp(name, SL_PATCH_TMP_PREFIX, sizeof(SL_PATCH_TMP_PREFIX) - 1)) {
+        return WALK_CONTINUE;
+    }
+
+    if (d_type == DT_UNKNOWN) {
+        // the filesystem doesn't fill in d_type, so we have to ask
+        struct stat sb;
+        if (fstatat(dir->fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+            return WALK_CONTINUE;
         }
-        if (n == 0) {
-            // cannot get more data; will happen on special files such as some
-            // pseudo files from /sys
+
+        if (S_ISDIR(sb.st_mode)) {
+            d_type = DT_DIR;
+        } else if (S_ISREG(sb.st_mode)) {
+            d_type = DT_REG;
+        }
+    }
+
+    const struct sl_pathrules *rules = global_cfg.path_rules;
+    switch (d_type) {
+    case DT_DIR: {
+        sl_stats_add(SL_STAT_DIRS, 1);
+
+        // excluded subtrees are pruned whole
+        struct sl_pathrules_state sub = { NULL, 0 };
+        enum walk_result ret = WALK_CONTINUE;
+        if (rules && !sl_pathrules_check(rules, rs, name, true, &sub)) {
+            sl_stats_add(SL_STAT_EXCLUDED, 1);
+        } else {
+            ret = walk_subdir(st, dir, name, &sub);
+        }
+        sl_pathrules_state_fini(&sub);
+        return ret;
+    }
+
+    case DT_REG:
+        sl_stats_add(SL_STAT_REGULAR_FILES, 1);
+        if (rules && !sl_pathrules_check(rules, rs, name, false, NULL)) {
+            sl_stats_add(SL_STAT_EXCLUDED, 1);
+            return WALK_CONTINUE;
+        }
+        return st->order ? hold_file(st, dir, name, ino) : walk_file(st, dir, name, 0);
+
+    default:
+        // we're only interested in regular files, and never follow symlinks
+        return WALK_CONTINUE;
+    }
+}
+
+// rs is what's left of the rules to match the entries of dir against
+#if defined(HAVE_GETDENTS64) && HAVE_GETDENTS64
+static enum walk_result walk_dir(
+    struct walk_state *st,
+    struct sl_dir *dir,
+    const struct sl_pathrules_state *rs)
+{
+    char *buf = malloc(DENTS_BUF_SIZE);
+    // GCOVR_EXCL_START: OOM
+    if (!buf) {
+        err(EX_OSERR, _("cannot allocate directory buffer"));
+    }
+    // GCOVR_EXCL_STOP
+
+    enum walk_result ret = WALK_CONTINUE;
+    for (;;) {
+        sl_stats_phase(SL_PHASE_WALK);
+        ssize_t n = getdents64(dir->fd, buf, DENTS_BUF_SIZE);
+        if (n <= 0) {
+            // end of directory, or it became unreadable midway
             break;
         }
-        nr_read += (size_t)n;
+
+        ssize_t pos = 0;
+        while (pos < n) {
+            struct dirent64 *de = (struct dirent64 *)(buf + pos);
+            pos += de->d_reclen;
+
+            ret = walk_entry(st, dir, rs, de->d_name, de->d_ino, de->d_type);
+            if (ret != WALK_CONTINUE) {
+                goto out;
+            }
+        }
     }
 
-    if (nr_read < sizeof(magic)) {
-        // definitely not an ELF
-        (void) close(fd);
-        return FTW_CONTINUE;
+out:
+    free(buf);
+    return ret;
+}
+#else
+static enum walk_result walk_dir(
+    struct walk_state *st,
+    struct sl_dir *dir,
+    const struct sl_pathrules_state *rs)
+{
+    // closedir(3) closes the underlying fd, which is still needed afterwards
+    int fd = dup(dir->fd);
+    DIR *dp = fd < 0 ? NULL : fdopendir(fd);
+    if (!dp) {
+        if (fd >= 0) {
+            (void) close(fd);
+        }
+        return WALK_CONTINUE;
     }
 
-    if (strncmp(magic, ELFMAG, 4)) {
-        // not an ELF
-        (void) close(fd);
-        return FTW_CONTINUE;
+    enum walk_result ret = WALK_CONTINUE;
+    struct dirent *de;
+    for (;;) {
+        sl_stats_phase(SL_PHASE_WALK);
+        if ((de = readdir(dp)) == NULL) {
+            break;
+        }
+
+        ret = walk_entry(st, dir, rs, de->d_name, de->d_ino, de->d_type);
+        if (ret != WALK_CONTINUE) {
+            break;
+        }
+    }
+
+    (void) closedir(dp);
+    return ret;
+}
+#endif
+
+// opens the directory at path under root, resolving symlinks on the way as
+// if root were the root directory, so that absolute ones like /lib -> usr/lib
+// in a sysroot don't lead out of it
+static int open_under_root(const struct sl_dir *root, const char *path)
+{
+#if defined(HAVE_OPENAT2) && HAVE_OPENAT2
+    struct open_how how = {
+        .flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+        .resolve = RESOLVE_IN_ROOT,
+    };
+    int fd = (int)syscall(__NR_openat2, root->fd, path, &how, sizeof(how));
+    if (fd >= 0 || (errno != ENOSYS && errno != EPERM)) {
+        return fd;
+    }
+    // older kernels, or forbidden by a seccomp filter
+#endif
+
+    return openat(root->fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static enum walk_result walk_listed_file(
+    struct walk_state *st,
+    struct sl_dir *dir,
+    const struct sl_pathrules_state *rs,
+    const char *name)
+{
+    sl_stats_phase(SL_PHASE_WALK);
+    sl_stats_add(SL_STAT_ENTRIES, 1);
+
+    // like the walker, only regular files and never following symlinks;
+    // directories listed aren't walked into, as their files are listed too
+    struct stat sb;
+    if (fstatat(dir->fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+        if (global_cfg.verbose && global_cfg.format == SL_FORMAT_TEXT) {
+            char *path = sl_dir_path(dir, name);
+            say_ignoring(st, path, errno);
+            free(path);
+        }
+        return WALK_CONTINUE;
+    }
+    if (!S_ISREG(sb.st_mode)) {
+        return WALK_CONTINUE;
     }
 
-    // fd is moved into process
-    int ret = process(&global_cfg, fpath, fd);
-    if (ret) {
-        // better to continue with the remaining files
-        return FTW_CONTINUE;
+    sl_stats_add(SL_STAT_REGULAR_FILES, 1);
+    if (global_cfg.path_rules && !sl_pathrules_check(global_cfg.path_rules, rs, name, false, NULL)) {
+        sl_stats_add(SL_STAT_EXCLUDED, 1);
+        return WALK_CONTINUE;
     }
+    return st->order ? hold_file(st, dir, name, sb.st_ino) : walk_file(st, dir, name, 0);
+}
+
+// Gets the rules for the entries of the directory at path under the root,
+// going down its components. Returns false if the directory, or any of those
+// above it, is excluded.
+static bool list_dir_rules(const char *path, struct sl_pathrules_state *rs)
+{
+    const struct sl_pathrules *rules = global_cfg.path_rules;
+    sl_pathrules_root(rules, rs);
 
-    return FTW_CONTINUE;
+    char *copy = strdup(path);
+    // GCOVR_EXCL_START: OOM
+    if (!copy) {
+        err(EX_OSERR, _("cannot allocate path"));
+    }
+    // GCOVR_EXCL_STOP
+
+    bool ok = true;
+    char *save;
+    char *comp;
+    for (comp = strtok_r(copy, "/", &save); comp && ok; comp = strtok_r(NULL, "/", &save)) {
+        if (!strcmp(comp, ".")) {
+            continue;
+        }
+        struct sl_pathrules_state sub;
+        ok = sl_pathrules_check(rules, rs, comp, true, &sub);
+        sl_pathrules_state_fini(rs);
+        *rs = sub;
+    }
+
+    free(copy);
+    return ok;
 }
 
-int process_dir(const char *root)
+// Looks at only the listed paths under root. Package managers list files
+// grouped by directory, so each directory is opened once for the run of
+// paths in it.
+static enum walk_result walk_list(
+    struct walk_state *st,
+    struct sl_dir *root,
+    const struct sl_filelist *list)
 {
-    int ret = nftw(root, &walk_fn, 100, FTW_ACTIONRETVAL | FTW_PHYS);
-    if (ret == FTW_STOP) {
+    struct sl_dir *dir = NULL;
+    const char *dir_path = NULL;
+    size_t dir_len = 0;
+    int dir_errno = 0;
+    bool dir_excluded = false;
+    struct sl_pathrules_state rs = { NULL, 0 };
+
+    enum walk_result ret = WALK_CONTINUE;
+    size_t i;
+    for (i = 0; i < list->nr && ret == WALK_CONTINUE; i++) {
+        // absolute paths are taken as under root too, and so are those
+        // starting with ./ like from find(1)
+        const char *path = list->paths[i];
+        while (*path == '/' || (path[0] == '.' && path[1] == '/')) {
+            path += *path == '/' ? 1 : 2;
+        }
+
+        const char *slash = strrchr(path, '/');
+        const char *name = slash ? slash + 1 : path;
+        size_t len = slash ? (size_t)(slash - path) : 0;
+        if (!*name) {
+            continue;
+        }
+
+        if (!dir_path || len != dir_len || memcmp(path, dir_path, len)) {
+            sl_dir_put(dir);
+            dir = NULL;
+            dir_path = path;
+            dir_len = len;
+            sl_pathrules_state_fini(&rs);
+
+            char *sub = strndup(path, len);
+            // GCOVR_EXCL_START: OOM
+            if (!sub) {
+                err(EX_OSERR, _("cannot allocate path"));
+            }
+            // GCOVR_EXCL_STOP
+
+            dir_excluded = global_cfg.path_rules && !list_dir_rules(sub, &rs);
+            if (dir_excluded) {
+                // nothing to open
+            } else if (len == 0) {
+                dir = sl_dir_get(root);
+            } else {
+                struct stat sb;
+                int fd = open_under_root(root, sub);
+                if (fd < 0) {
+                    dir_errno = errno;
+                } else if (global_cfg.one_file_system && (fstat(fd, &sb) < 0 || sb.st_dev != st->dev)) {
+                    (void) close(fd);
+                    dir_excluded = true;
+                } else {
+                    dir = sl_dir_new(root, sub, fd);
+                }
+            }
+            free(sub);
+        }
+
+        if (dir_excluded) {
+            sl_stats_add(SL_STAT_EXCLUDED, 1);
+        } else if (dir) {
+            ret = walk_listed_file(st, dir, &rs, name);
+        } else if (global_cfg.verbose && global_cfg.format == SL_FORMAT_TEXT) {
+            char *full = sl_dir_path(root, path);
+            say_ignoring(st, full, dir_errno);
+            free(full);
+        }
+    }
+
+    sl_dir_put(dir);
+    sl_pathrules_state_fini(&rs);
+    return ret;
+}
+
+// Looks at the files under root: only those in files if non-NULL, or else
+// the whole tree.
+int process_dir(
+    const char *root,
+    const struct sl_filelist *files,
+    struct sl_workqueue *wq,
+    struct sl_dedup *dd)
+{
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        warn(_("cannot open %s"), root);
+        return EX_NOINPUT;
+    }
+
+    // strip trailing slashes for nicer paths, like nftw(3) does; the root
+    // directory itself becomes empty, which is fine because a slash is
+    // always added after it
+    char *name = strdup(root);
+    // GCOVR_EXCL_START: OOM
+    if (!name) {
+        err(EX_OSERR, _("cannot allocate path"));
+    }
+    // GCOVR_EXCL_STOP
+    size_t len = strlen(name);
+    while (len > 0 && name[len - 1] == '/') {
+        name[--len] = '\0';
+    }
+
+    struct walk_state st = {
+        .wq = wq,
+        .dd = dd,
+        .hp = NULL,
+        .pf = NULL,
+        .index = NULL,
+        .dev = 0,
+        .order = NULL,
+        .reorder = NULL,
+    };
+
+    struct stat sb;
+    if (fstat(fd, &sb) == 0) {
+        st.dev = sb.st_dev;
+    }
+
+    // seeks are what takes the time on spinning disks, so the files are
+    // gathered first there, and then opened in a sweep over the disk
+    struct sl_ioorder order;
+    enum sl_io_order io_order = sl_io_order_for_dev(global_cfg.io_order, st.dev);
+    if (io_order != SL_IO_ORDER_WALK) {
+        sl_ioorder_init(&order, io_order);
+        st.order = &order;
+        st.reorder = sl_reorder_new();
+    }
+
+    struct sl_pathrules_state rs = { NULL, 0 };
+    if (global_cfg.path_rules) {
+        sl_pathrules_root(global_cfg.path_rules, &rs);
+    }
+
+    if (global_cfg.index_dir) {
+        st.index = sl_index_open(&global_cfg, global_cfg.index_dir, root);
+        if (st.index && files) {
+            // most of the tree isn't seen this time, but is still as it was
+            sl_index_keep_unseen(st.index);
+        }
+    }
+
+#if defined(HAVE_IO_URING) && HAVE_IO_URING
+    // batch the probes if the header is all we need; the synchronous path is
+    // used if io_uring is unavailable
+    if (sl_cfg_needs_only_ehdr(&global_cfg)) {
+        st.hp = sl_hdrprobe_new(&global_cfg);
+    }
+#endif
+
+    // the disk reads ahead for the files waiting while earlier ones are
+    // processed
+    if (global_cfg.prefetch_bytes) {
+        st.pf = sl_prefetch_new(&global_cfg, wq);
+    }
+
+    struct sl_dir *dir = sl_dir_new(NULL, name, fd);
+    free(name);
+
+    enum walk_result ret = files ? walk_list(&st, dir, files) : walk_dir(&st, dir, &rs);
+    sl_dir_put(dir);
+    sl_pathrules_state_fini(&rs);
+
+    if (st.order) {
+        if (ret == WALK_CONTINUE) {
+            ret = walk_held(&st);
+        }
+        sl_ioorder_fini(st.order);
+    }
+
+    if (st.pf) {
+        sl_prefetch_free(st.pf);
+    }
+
+#if defined(HAVE_IO_URING) && HAVE_IO_URING
+    if (st.hp) {
+        if (!sl_hdrprobe_flush(st.hp)) {
+            ret = WALK_STOP;
+        }
+        sl_hdrprobe_free(st.hp);
+    }
+#endif
+
+    if (wq && (st.index || st.reorder)) {
+        // everything must be recorded before the index is written out, and
+        // shown before what's left of the output held back, including other
+        // paths waiting for their inode to be done
+        sl_workqueue_wait(wq);
+    }
+
+    if (st.index) {
+        sl_index_close(st.index);
+    }
+
+    if (st.reorder) {
+        sl_reorder_free(st.reorder);
+    }
+
+    if (ret == WALK_STOP) {
         return EX_SOFTWARE;
     }
 
@@ -1,6 +1,16 @@
 #ifndef _shengloong_walkdir_h
 #define _shengloong_walkdir_h
 
-int process_dir(const char *root);
+#include "dedup.h"
+#include "filelist.h"
+#include "workqueue.h"
+
+// wq may be NULL, in which case files are processed inline; so may files, in
+// which case the whole tree is walked
+int process_dir(
+    const char *root,
+    const struct sl_filelist *files,
+    struct sl_workqueue *wq,
+    struct sl_dedup *dd);
 
 #endif  // _shengloong_walkdir_h
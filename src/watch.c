@@ -0,0 +1,664 @@
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "buildconfig.gen.h"
+#include "cfg.h"
+#include "dedup.h"
+#include "filelist.h"
+#include "gettext.h"
+#include "patchfile.h"
+#include "utils.h"
+#include "walkdir.h"
+#include "watch.h"
+
+#if defined(HAVE_FANOTIFY) && HAVE_FANOTIFY
+#include <sys/fanotify.h>
+#endif
+#if defined(HAVE_INOTIFY) && HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#if (defined(HAVE_FANOTIFY) && HAVE_FANOTIFY) || (defined(HAVE_INOTIFY) && HAVE_INOTIFY)
+#define CAN_WATCH 1
+#endif
+
+#define _(x) gettext(x)
+
+// a batch is gone through once there's been no event for this long, so that
+// the files are looked at after the package manager is done with them
+#define QUIET_MS 250
+// but no later than this after the first change, under constant churn
+#define MAX_DELAY_MS 5000
+// nor with more files than this waiting
+#define MAX_PENDING 256
+
+#define EVENTS_BUF_SIZE 4096
+
+enum backend {
+    BACKEND_FANOTIFY,
+    BACKEND_INOTIFY,
+};
+
+struct watch_root {
+    // as given, for naming the files
+    const char *path;
+    char *real;
+    size_t real_len;
+    dev_t dev;
+
+    // fanotify: for telling which filesystem the events are on, and looking
+    // up the directories they name
+    int mount_fd;
+    fsid_t fsid;
+
+    // paths relative to the root of the files changed since the last batch
+    char **pending;
+    size_t nr_pending;
+    size_t cap_pending;
+};
+
+// a directory under watch by inotify
+struct watched_dir {
+    size_t root;
+    // relative to the root, or NULL if the watch descriptor is unused
+    char *rel;
+};
+
+struct watch {
+    enum backend backend;
+    int fd;
+
+    struct watch_root *roots;
+    size_t nr_roots;
+
+    // events were lost, so the roots are walked whole in the next batch
+    bool overflowed;
+    size_t nr_pending;
+    uint64_t first_ns;
+    uint64_t last_ns;
+
+    // inotify: the directories under watch, by watch descriptor
+    struct watched_dir *dirs;
+    size_t nr_dirs;
+    bool warned_full;
+};
+
+static volatile sig_atomic_t g_stop;
+
+static void on_signal(int sig __attribute__((unused)))
+{
+    g_stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+#if defined(CAN_WATCH)
+// returns a newly allocated name under dir, which may be empty for the root
+static char *join(const char *dir, const char *name)
+{
+    char *s;
+    size_t len = strlen(dir);
+    const char *sep = len && dir[len - 1] != '/' ? "/" : "";
+    // GCOVR_EXCL_START: OOM
+    if (asprintf(&s, "%s%s%s", dir, sep, name) < 0) {
+        err(EX_OSERR, _("cannot allocate path"));
+    }
+    // GCOVR_EXCL_STOP
+    return s;
+}
+
+static void note_pending(struct watch *w)
+{
+    uint64_t now = now_ns();
+    if (!w->nr_pending++) {
+        w->first_ns = now;
+    }
+    w->last_ns = now;
+}
+
+// takes ownership of rel
+static void queue_path(struct watch *w, size_t root, char *rel)
+{
+    const char *name = strrchr(rel, '/');
+    name = name ? name + 1 : rel;
+    // our own copies, when replacing files
+    if (!strncmp(name, SL_PATCH_TMP_PREFIX, sizeof(SL_PATCH_TMP_PREFIX) - 1)) {
+        free(rel);
+        return;
+    }
+
+    struct watch_root *r = &w->roots[root];
+    r->pending = grow_array(r->pending, &r->cap_pending, r->nr_pending + 1, sizeof(*r->pending));
+    r->pending[r->nr_pending++] = rel;
+    note_pending(w);
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+#if defined(HAVE_FANOTIFY) && HAVE_FANOTIFY
+// Marks the filesystems of the roots. Needs CAP_SYS_ADMIN, but only one mark
+// per filesystem, however many directories there are. The events name the
+// directory and the entry, so files renamed into place are seen as such,
+// wherever they were written. Needs Linux 5.9.
+static bool fanotify_setup(struct watch *w)
+{
+    w->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (w->fd < 0) {
+        return false;
+    }
+
+    const uint64_t mask = FAN_CLOSE_WRITE | FAN_MOVED_TO | FAN_ONDIR;
+    size_t i;
+    for (i = 0; i < w->nr_roots; i++) {
+        struct watch_root *r = &w->roots[i];
+        struct statfs sfs;
+        r->mount_fd = open(r->real, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (r->mount_fd < 0
+                || fstatfs(r->mount_fd, &sfs) < 0
+                || fanotify_mark(w->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, r->real) < 0) {
+            (void) close(w->fd);
+            w->fd = -1;
+            return false;
+        }
+        r->fsid = sfs.f_fsid;
+    }
+
+    w->backend = BACKEND_FANOTIFY;
+    return true;
+}
+
+// Queues the regular files below the directory at rel under the root, for
+// directories moved into place whole.
+static void queue_tree(struct watch *w, size_t root, const char *rel)
+{
+    char *path = join(w->roots[root].real, rel);
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    free(path);
+    DIR *dp = fd < 0 ? NULL : fdopendir(fd);
+    if (!dp) {
+        if (fd >= 0) {
+            (void) close(fd);
+        }
+        return;
+    }
+
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        struct stat sb;
+        if (fstatat(dirfd(dp), name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+            continue;
+        }
+
+        if (S_ISDIR(sb.st_mode) && sb.st_dev == w->roots[root].dev) {
+            char *sub = join(rel, name);
+            queue_tree(w, root, sub);
+            free(sub);
+        } else if (S_ISREG(sb.st_mode)) {
+            queue_path(w, root, join(rel, name));
+        }
+    }
+
+    (void) closedir(dp);
+}
+
+// finds out where the entry named by the event is, and queues it if it's
+// under a root
+static void fanotify_queue(struct watch *w, const struct fanotify_event_metadata *m)
+{
+    const struct fanotify_event_info_fid *fid = (const struct fanotify_event_info_fid *)(m + 1);
+    if (m->event_len < sizeof(*m) + sizeof(*fid) || fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+        return;
+    }
+
+    // the same filesystem may have more than one root on it, but any fd on
+    // it does for looking up the directory
+    size_t i;
+    for (i = 0; i < w->nr_roots; i++) {
+        if (!memcmp(&w->roots[i].fsid, &fid->fsid, sizeof(fid->fsid))) {
+            break;
+        }
+    }
+    if (i == w->nr_roots) {
+        return;
+    }
+
+    struct file_handle *fh = (struct file_handle *)fid->handle;
+    const char *name = (const char *)(fh->f_handle + fh->handle_bytes);
+    if (!strcmp(name, ".")) {
+        return;
+    }
+
+    int dfd = open_by_handle_at(w->roots[i].mount_fd, fh, O_PATH | O_CLOEXEC);
+    if (dfd < 0) {
+        // deleted in the meantime, like temporary directories
+        return;
+    }
+    char link[32];
+    char path[PATH_MAX];
+    (void) snprintf(link, sizeof(link), "/proc/self/fd/%d", dfd);
+    ssize_t n = readlink(link, path, sizeof(path) - 1);
+    (void) close(dfd);
+    if (n <= 0) {
+        return;
+    }
+    path[n] = '\0';
+
+    // the filesystems may well have more than the roots on them
+    size_t j;
+    for (j = 0; j < w->nr_roots; j++) {
+        const struct watch_root *r = &w->roots[j];
+        if (!strncmp(path, r->real, r->real_len) && (r->real_len == 1 || path[r->real_len] == '/' || path[r->real_len] == '\0')) {
+            const char *dir = path + r->real_len + (r->real_len > 1 && path[r->real_len] == '/');
+            char *rel = join(dir, name);
+            if (m->mask & FAN_ONDIR) {
+                queue_tree(w, j, rel);
+                free(rel);
+            } else {
+                queue_path(w, j, rel);
+            }
+            return;
+        }
+    }
+}
+
+static void fanotify_read(struct watch *w)
+{
+    struct fanotify_event_metadata buf[EVENTS_BUF_SIZE / sizeof(struct fanotify_event_metadata)];
+    pid_t self = getpid();
+
+    for (;;) {
+        ssize_t n = read(w->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            // drained
+            break;
+        }
+
+        const struct fanotify_event_metadata *m;
+        for (m = buf; FAN_EVENT_OK(m, n); m = FAN_EVENT_NEXT(m, n)) {
+            // GCOVR_EXCL_START: kernel and headers out of sync
+            if (m->vers != FANOTIFY_METADATA_VERSION) {
+                errx(EX_SOFTWARE, _("unexpected fanotify event version %d"), m->vers);
+            }
+            // GCOVR_EXCL_STOP
+
+            if (m->mask & FAN_Q_OVERFLOW) {
+                w->overflowed = true;
+                note_pending(w);
+                continue;
+            }
+
+            // our own patching is of no interest
+            if (m->pid == self) {
+                continue;
+            }
+
+            fanotify_queue(w, m);
+        }
+    }
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+#if defined(HAVE_INOTIFY) && HAVE_INOTIFY
+#define DIR_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+// Watches the directory at rel under the root, and everything below it on
+// the same filesystem. Files already there are queued too if queue_files,
+// for directories moved into place whole.
+static void add_watches(struct watch *w, size_t root, const char *rel, bool queue_files)
+{
+    char *path = join(w->roots[root].real, rel);
+    int wd = inotify_add_watch(w->fd, path, DIR_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC && !w->warned_full) {
+            warnx(_("cannot watch every directory; consider raising fs.inotify.max_user_watches"));
+            w->warned_full = true;
+        }
+        free(path);
+        return;
+    }
+
+    // the same directory, renamed, keeps its watch descriptor
+    size_t cap = w->nr_dirs;
+    w->dirs = grow_array(w->dirs, &cap, (size_t)wd + 1, sizeof(*w->dirs));
+    w->nr_dirs = cap;
+    free(w->dirs[wd].rel);
+    w->dirs[wd].root = root;
+    w->dirs[wd].rel = join("", rel);
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    free(path);
+    DIR *dp = fd < 0 ? NULL : fdopendir(fd);
+    if (!dp) {
+        if (fd >= 0) {
+            (void) close(fd);
+        }
+        return;
+    }
+
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        struct stat sb;
+        if (fstatat(dirfd(dp), name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+            continue;
+        }
+
+        if (S_ISDIR(sb.st_mode) && sb.st_dev == w->roots[root].dev) {
+            char *sub = join(rel, name);
+            add_watches(w, root, sub, queue_files);
+            free(sub);
+        } else if (S_ISREG(sb.st_mode) && queue_files) {
+            queue_path(w, root, join(rel, name));
+        }
+    }
+
+    (void) closedir(dp);
+}
+
+static bool inotify_setup(struct watch *w)
+{
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) {
+        return false;
+    }
+
+    w->backend = BACKEND_INOTIFY;
+
+    size_t i;
+    for (i = 0; i < w->nr_roots; i++) {
+        add_watches(w, i, "", false);
+    }
+
+    return true;
+}
+
+static void inotify_read(struct watch *w)
+{
+    char buf[EVENTS_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t n = read(w->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            // drained
+            break;
+        }
+
+        const struct inotify_event *ev;
+        char *p;
+        for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *)p;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                w->overflowed = true;
+                note_pending(w);
+                continue;
+            }
+            if (ev->wd < 0 || (size_t)ev->wd >= w->nr_dirs || !w->dirs[ev->wd].rel) {
+                continue;
+            }
+
+            struct watched_dir *d = &w->dirs[ev->wd];
+            if (ev->mask & IN_IGNORED) {
+                // the directory is gone
+                free(d->rel);
+                d->rel = NULL;
+                continue;
+            }
+            if (!ev->len) {
+                continue;
+            }
+
+            size_t root = d->root;
+            char *rel = join(d->rel, ev->name);
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    add_watches(w, root, rel, true);
+                }
+                free(rel);
+            } else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                queue_path(w, root, rel);
+            } else {
+                free(rel);
+            }
+        }
+    }
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int path_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// goes through the files changed since the last batch
+static void flush(struct watch *w, struct sl_workqueue *wq)
+{
+    size_t i;
+    for (i = 0; i < w->nr_roots; i++) {
+        struct watch_root *r = &w->roots[i];
+        if (!r->nr_pending && !w->overflowed) {
+            continue;
+        }
+
+        // results are shared by inode, and the files may have changed since
+        // they were last looked at
+        struct sl_dedup *dd = sl_dedup_new(&global_cfg);
+
+        if (w->overflowed) {
+            warnx(_("%s: changes were missed, looking at everything"), r->path);
+            (void) process_dir(r->path, NULL, wq, dd);
+        } else {
+            // sorted, the files are grouped by directory, and each is
+            // looked at once however many times it was written
+            qsort(r->pending, r->nr_pending, sizeof(*r->pending), path_cmp);
+            size_t nr = 0;
+            size_t j;
+            for (j = 0; j < r->nr_pending; j++) {
+                if (nr && !strcmp(r->pending[nr - 1], r->pending[j])) {
+                    free(r->pending[j]);
+                    continue;
+                }
+                r->pending[nr++] = r->pending[j];
+            }
+            r->nr_pending = nr;
+
+            struct sl_filelist list = {
+                .paths = r->pending,
+                .nr = r->nr_pending,
+                .buf = NULL,
+            };
+            (void) process_dir(r->path, &list, wq, dd);
+        }
+
+        // the files in flight refer to the dedup table
+        if (wq) {
+            sl_workqueue_wait(wq);
+        }
+        sl_dedup_free(dd);
+
+        size_t j;
+        for (j = 0; j < r->nr_pending; j++) {
+            free(r->pending[j]);
+        }
+        r->nr_pending = 0;
+    }
+
+    w->overflowed = false;
+    w->nr_pending = 0;
+
+    // for whoever is following the output
+    (void) fflush(stdout);
+}
+
+int watch_roots(const char *const *roots, struct sl_workqueue *wq)
+{
+    struct watch w;
+    memset(&w, 0, sizeof(w));
+    w.fd = -1;
+
+    while (roots[w.nr_roots]) {
+        w.nr_roots++;
+    }
+    w.roots = calloc(w.nr_roots, sizeof(*w.roots));
+    // GCOVR_EXCL_START: OOM
+    if (!w.roots) {
+        err(EX_OSERR, _("cannot allocate watch list"));
+    }
+    // GCOVR_EXCL_STOP
+
+    int ret = 0;
+    size_t i;
+    for (i = 0; i < w.nr_roots; i++) {
+        struct watch_root *r = &w.roots[i];
+        struct stat sb;
+        r->path = roots[i];
+        r->mount_fd = -1;
+        r->real = realpath(roots[i], NULL);
+        if (!r->real || stat(r->real, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+            if (r->real) {
+                errno = ENOTDIR;
+            }
+            warn(_("cannot open %s"), roots[i]);
+            ret = EX_NOINPUT;
+            goto out;
+        }
+        r->real_len = strlen(r->real);
+        r->dev = sb.st_dev;
+    }
+
+    // fanotify scales with the number of mounts rather than directories,
+    // but needs privileges inotify doesn't
+    bool ok = false;
+    errno = ENOSYS;
+#if defined(HAVE_FANOTIFY) && HAVE_FANOTIFY
+    ok = fanotify_setup(&w);
+#endif
+#if defined(HAVE_INOTIFY) && HAVE_INOTIFY
+    ok = ok || inotify_setup(&w);
+#endif
+    if (!ok) {
+        warn(_("cannot watch for changes"));
+        ret = EX_OSERR;
+        goto out;
+    }
+
+    if (global_cfg.verbose && global_cfg.format == SL_FORMAT_TEXT) {
+        printf(
+            _("watching for changes with %s\n"),
+            w.backend == BACKEND_FANOTIFY ? "fanotify" : "inotify"
+        );
+        (void) fflush(stdout);
+    }
+
+    // no SA_RESTART, so that poll(2) gets interrupted
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    (void) sigemptyset(&sa.sa_mask);
+    (void) sigaction(SIGINT, &sa, NULL);
+    (void) sigaction(SIGTERM, &sa, NULL);
+
+    while (!g_stop) {
+        int timeout = -1;
+        if (w.nr_pending) {
+            uint64_t now = now_ns();
+            uint64_t quiet_ms = (now - w.last_ns) / 1000000;
+            uint64_t delay_ms = (now - w.first_ns) / 1000000;
+            if (w.nr_pending >= MAX_PENDING || quiet_ms >= QUIET_MS || delay_ms >= MAX_DELAY_MS) {
+                flush(&w, wq);
+                continue;
+            }
+
+            uint64_t left = QUIET_MS - quiet_ms;
+            if (MAX_DELAY_MS - delay_ms < left) {
+                left = MAX_DELAY_MS - delay_ms;
+            }
+            timeout = (int)left + 1;
+        }
+
+        struct pollfd pfd = { .fd = w.fd, .events = POLLIN, .revents = 0 };
+        int n = poll(&pfd, 1, timeout);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // GCOVR_EXCL_START: shouldn't happen with a single valid fd
+            warn(_("cannot watch for changes"));
+            ret = EX_OSERR;
+            break;
+            // GCOVR_EXCL_STOP
+        }
+        if (n == 0) {
+            continue;
+        }
+
+#if defined(HAVE_FANOTIFY) && HAVE_FANOTIFY
+        if (w.backend == BACKEND_FANOTIFY) {
+            fanotify_read(&w);
+        }
+#endif
+#if defined(HAVE_INOTIFY) && HAVE_INOTIFY
+        if (w.backend == BACKEND_INOTIFY) {
+            inotify_read(&w);
+        }
+#endif
+    }
+
+    // what's been written so far still gets a look
+    if (w.nr_pending) {
+        flush(&w, wq);
+    }
+
+out:
+    if (w.fd >= 0) {
+        (void) close(w.fd);
+    }
+    for (i = 0; i < w.nr_dirs; i++) {
+        free(w.dirs[i].rel);
+    }
+    free(w.dirs);
+    for (i = 0; i < w.nr_roots; i++) {
+        if (w.roots[i].mount_fd >= 0) {
+            (void) close(w.roots[i].mount_fd);
+        }
+        free(w.roots[i].real);
+        free(w.roots[i].pending);
+    }
+    free(w.roots);
+
+    return ret;
+}
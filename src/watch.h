@@ -0,0 +1,12 @@
+#ifndef _shengloong_watch_h
+#define _shengloong_watch_h
+
+#include "workqueue.h"
+
+// Keeps running until interrupted, going through the files written or moved
+// into place under the roots in batches, once things have been quiet for a
+// moment; only the filesystems the roots are on are watched. wq may be
+// NULL, in which case files are processed inline.
+int watch_roots(const char *const *roots, struct sl_workqueue *wq);
+
+#endif  // _shengloong_watch_h
@@ -0,0 +1,173 @@
+#include <err.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "buildconfig.gen.h"
+#include "gettext.h"
+#include "processing.h"
+#include "stats.h"
+#include "workqueue.h"
+
+#define _(x) gettext(x)
+
+// how many pending files per worker the walker may queue up before blocking;
+// every queued item holds an open fd, so keep this small
+#define QUEUE_DEPTH_PER_WORKER 4
+
+struct sl_work {
+    struct sl_file file;
+    int fd;
+    char name[NAME_MAX + 1];
+};
+
+struct sl_workqueue {
+    const struct sl_cfg *cfg;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t idle;
+
+    // ring buffer of pending work
+    struct sl_work *items;
+    size_t cap;
+    size_t head;
+    size_t len;
+    // items taken off the queue but not done yet
+    size_t nr_busy;
+    bool closing;
+
+    pthread_t *workers;
+    int nr_workers;
+};
+
+static void *worker_fn(void *arg)
+{
+    struct sl_workqueue *wq = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&wq->lock);
+        while (wq->len == 0 && !wq->closing) {
+            pthread_cond_wait(&wq->not_empty, &wq->lock);
+        }
+
+        if (wq->len == 0) {
+            // closing and fully drained
+            pthread_mutex_unlock(&wq->lock);
+            return NULL;
+        }
+
+        struct sl_work w = wq->items[wq->head];
+        wq->head = (wq->head + 1) % wq->cap;
+        wq->len--;
+        wq->nr_busy++;
+        pthread_cond_signal(&wq->not_full);
+        pthread_mutex_unlock(&wq->lock);
+
+        // fd is moved into process; errors are reported there, and we want
+        // to continue with the remaining files anyway
+        w.file.name = w.name;
+        (void) process(wq->cfg, &w.file, w.fd);
+        sl_dir_put(w.file.dir);
+        sl_stats_phase(SL_PHASE_NONE);
+
+        pthread_mutex_lock(&wq->lock);
+        wq->nr_busy--;
+        if (wq->len == 0 && wq->nr_busy == 0) {
+            pthread_cond_broadcast(&wq->idle);
+        }
+        pthread_mutex_unlock(&wq->lock);
+    }
+}
+
+struct sl_workqueue *sl_workqueue_new(const struct sl_cfg *cfg, int nr_workers)
+{
+    struct sl_workqueue *wq = calloc(1, sizeof(*wq));
+    // GCOVR_EXCL_START: OOM
+    if (!wq) {
+        err(EX_OSERR, _("cannot allocate work queue"));
+    }
+    // GCOVR_EXCL_STOP
+
+    wq->cfg = cfg;
+    wq->cap = (size_t)nr_workers * QUEUE_DEPTH_PER_WORKER;
+    wq->items = calloc(wq->cap, sizeof(*wq->items));
+    wq->workers = calloc((size_t)nr_workers, sizeof(*wq->workers));
+    // GCOVR_EXCL_START: OOM
+    if (!wq->items || !wq->workers) {
+        err(EX_OSERR, _("cannot allocate work queue"));
+    }
+    // GCOVR_EXCL_STOP
+
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->not_empty, NULL);
+    pthread_cond_init(&wq->not_full, NULL);
+    pthread_cond_init(&wq->idle, NULL);
+
+    for (wq->nr_workers = 0; wq->nr_workers < nr_workers; wq->nr_workers++) {
+        int ret = pthread_create(&wq->workers[wq->nr_workers], NULL, worker_fn, wq);
+        // GCOVR_EXCL_START: resource exhaustion
+        if (ret) {
+            errx(EX_OSERR, _("cannot create worker thread: %s"), strerror(ret));
+        }
+        // GCOVR_EXCL_STOP
+    }
+
+    return wq;
+}
+
+// takes ownership of fd and the file's results, and a new reference to its
+// dir
+void sl_workqueue_submit(struct sl_workqueue *wq, const struct sl_file *f, int fd)
+{
+    pthread_mutex_lock(&wq->lock);
+    while (wq->len == wq->cap) {
+        pthread_cond_wait(&wq->not_full, &wq->lock);
+    }
+
+    size_t tail = (wq->head + wq->len) % wq->cap;
+    wq->items[tail].file = *f;
+    wq->items[tail].file.dir = sl_dir_get(f->dir);
+    wq->items[tail].fd = fd;
+    // d_name is bounded by NAME_MAX
+    strcpy(wq->items[tail].name, f->name);
+    wq->len++;
+    pthread_cond_signal(&wq->not_empty);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+// waits for all submitted work to complete, keeping the workers around
+void sl_workqueue_wait(struct sl_workqueue *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    while (wq->len > 0 || wq->nr_busy > 0) {
+        pthread_cond_wait(&wq->idle, &wq->lock);
+    }
+    pthread_mutex_unlock(&wq->lock);
+}
+
+// waits for all submitted work to complete, then frees the queue
+void sl_workqueue_finish(struct sl_workqueue *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    wq->closing = true;
+    pthread_cond_broadcast(&wq->not_empty);
+    pthread_mutex_unlock(&wq->lock);
+
+    int i;
+    for (i = 0; i < wq->nr_workers; i++) {
+        pthread_join(wq->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&wq->idle);
+    pthread_cond_destroy(&wq->not_full);
+    pthread_cond_destroy(&wq->not_empty);
+    pthread_mutex_destroy(&wq->lock);
+    free(wq->workers);
+    free(wq->items);
+    free(wq);
+}
@@ -0,0 +1,14 @@
+#ifndef _shengloong_workqueue_h
+#define _shengloong_workqueue_h
+
+#include "cfg.h"
+#include "file.h"
+
+struct sl_workqueue;
+
+struct sl_workqueue *sl_workqueue_new(const struct sl_cfg *cfg, int nr_workers);
+void sl_workqueue_submit(struct sl_workqueue *wq, const struct sl_file *f, int fd);
+void sl_workqueue_wait(struct sl_workqueue *wq);
+void sl_workqueue_finish(struct sl_workqueue *wq);
+
+#endif  // _shengloong_workqueue_h
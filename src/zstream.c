@@ -0,0 +1,387 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "buildconfig.gen.h"
+#include "gettext.h"
+#include "stats.h"
+#include "zstream.h"
+
+#if defined(HAVE_ZLIB) && HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if defined(HAVE_LZMA) && HAVE_LZMA
+#include <lzma.h>
+#endif
+#if defined(HAVE_ZSTD) && HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define _(x) gettext(x)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// compressed input is read in pieces growing up to IN_SIZE, and at most
+// FILL_SIZE bytes are decompressed at a time, so that little more than the
+// header gets decompressed when that's all there is to look at
+#define IN_SIZE (64 * 1024)
+#define IN_SIZE_FIRST 4096
+#define FILL_SIZE (64 * 1024)
+
+// decompressed output is kept in a window this large; once full, only the
+// last WINDOW_KEEP bytes are kept, so that what's right before the current
+// position can still be read without starting over, e.g. the section names
+// right before the section headers at the end of the file
+#define WINDOW_SIZE (1024 * 1024)
+#define WINDOW_KEEP (WINDOW_SIZE / 4)
+
+struct sl_zstream {
+    enum sl_compression kind;
+    int fd;
+
+    // compressed input, read sequentially from the start of the file
+    uint8_t *in;
+    size_t in_pos;
+    size_t in_len;
+    size_t in_want;
+    uint64_t in_off;
+    bool in_eof;
+
+    union {
+        int unused;
+#if defined(HAVE_ZLIB) && HAVE_ZLIB
+        z_stream gz;
+#endif
+#if defined(HAVE_LZMA) && HAVE_LZMA
+        lzma_stream xz;
+#endif
+#if defined(HAVE_ZSTD) && HAVE_ZSTD
+        ZSTD_DStream *zstd;
+#endif
+    } u;
+    // whether everything given to the decoder so far forms complete
+    // streams, i.e. whether the input may end here
+    bool at_end;
+
+    // the last decompressed bytes, ending at pos in the decompressed file
+    uint8_t *win;
+    size_t win_len;
+    uint64_t pos;
+};
+
+enum sl_compression sl_compression_detect(const void *head, size_t len)
+{
+    const uint8_t *p = head;
+
+#if defined(HAVE_ZLIB) && HAVE_ZLIB
+    // ID1, ID2, and deflate as the compression method
+    if (len >= 3 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8) {
+        return SL_COMPRESSION_GZIP;
+    }
+#endif
+#if defined(HAVE_LZMA) && HAVE_LZMA
+    if (len >= 6 && !memcmp(p, "\xfd" "7zXZ\0", 6)) {
+        return SL_COMPRESSION_XZ;
+    }
+#endif
+#if defined(HAVE_ZSTD) && HAVE_ZSTD
+    if (len >= 4 && !memcmp(p, "\x28\xb5\x2f\xfd", 4)) {
+        return SL_COMPRESSION_ZSTD;
+    }
+#endif
+
+    (void) p;
+    (void) len;
+    return SL_COMPRESSION_NONE;
+}
+
+static void decoder_init(struct sl_zstream *z)
+{
+    bool ok = false;
+
+    switch (z->kind) {
+#if defined(HAVE_ZLIB) && HAVE_ZLIB
+    case SL_COMPRESSION_GZIP:
+        memset(&z->u.gz, 0, sizeof(z->u.gz));
+        // gzip wrapper only
+        ok = inflateInit2(&z->u.gz, 16 + MAX_WBITS) == Z_OK;
+        break;
+#endif
+#if defined(HAVE_LZMA) && HAVE_LZMA
+    case SL_COMPRESSION_XZ: {
+        lzma_stream init = LZMA_STREAM_INIT;
+        z->u.xz = init;
+        ok = lzma_stream_decoder(&z->u.xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+        break;
+    }
+#endif
+#if defined(HAVE_ZSTD) && HAVE_ZSTD
+    case SL_COMPRESSION_ZSTD:
+        z->u.zstd = ZSTD_createDStream();
+        ok = z->u.zstd != NULL;
+        break;
+#endif
+    default:
+        __builtin_unreachable();  // GCOVR_EXCL_LINE
+    }
+
+    // GCOVR_EXCL_START: OOM
+    if (!ok) {
+        errx(EX_OSERR, _("cannot set up decompression"));
+    }
+    // GCOVR_EXCL_STOP
+
+    z->at_end = false;
+}
+
+static void decoder_fini(struct sl_zstream *z)
+{
+    switch (z->kind) {
+#if defined(HAVE_ZLIB) && HAVE_ZLIB
+    case SL_COMPRESSION_GZIP:
+        (void) inflateEnd(&z->u.gz);
+        break;
+#endif
+#if defined(HAVE_LZMA) && HAVE_LZMA
+    case SL_COMPRESSION_XZ:
+        lzma_end(&z->u.xz);
+        break;
+#endif
+#if defined(HAVE_ZSTD) && HAVE_ZSTD
+    case SL_COMPRESSION_ZSTD:
+        (void) ZSTD_freeDStream(z->u.zstd);
+        break;
+#endif
+    default:
+        __builtin_unreachable();  // GCOVR_EXCL_LINE
+    }
+}
+
+// decompresses what it can of the input buffered so far into out, returning
+// false if the data is corrupt
+static bool decoder_step(struct sl_zstream *z, uint8_t *out, size_t avail, size_t *produced)
+{
+    const uint8_t *in = z->in + z->in_pos;
+    size_t in_avail = z->in_len - z->in_pos;
+
+    switch (z->kind) {
+#if defined(HAVE_ZLIB) && HAVE_ZLIB
+    case SL_COMPRESSION_GZIP: {
+        z_stream *s = &z->u.gz;
+        s->next_in = (Bytef *)in;
+        s->avail_in = (uInt)MIN(in_avail, UINT32_MAX);
+        s->next_out = out;
+        s->avail_out = (uInt)MIN(avail, UINT32_MAX);
+        int ret = inflate(s, Z_NO_FLUSH);
+        *produced = (size_t)(s->next_out - out);
+        z->in_pos += (size_t)(s->next_in - in);
+        if (ret == Z_STREAM_END) {
+            // more members may follow, as with concatenated .gz files
+            z->at_end = true;
+            return inflateReset(s) == Z_OK;
+        }
+        if (*produced || s->next_in != in) {
+            z->at_end = false;
+        }
+        return ret == Z_OK || ret == Z_BUF_ERROR;
+    }
+#endif
+#if defined(HAVE_LZMA) && HAVE_LZMA
+    case SL_COMPRESSION_XZ: {
+        lzma_stream *s = &z->u.xz;
+        s->next_in = in;
+        s->avail_in = in_avail;
+        s->next_out = out;
+        s->avail_out = avail;
+        // concatenated streams are only known to be complete when told
+        // there's no more input
+        lzma_ret ret = lzma_code(s, z->in_eof ? LZMA_FINISH : LZMA_RUN);
+        *produced = (size_t)(s->next_out - out);
+        z->in_pos += (size_t)(s->next_in - in);
+        if (ret == LZMA_STREAM_END) {
+            z->at_end = true;
+            return true;
+        }
+        return ret == LZMA_OK || ret == LZMA_BUF_ERROR;
+    }
+#endif
+#if defined(HAVE_ZSTD) && HAVE_ZSTD
+    case SL_COMPRESSION_ZSTD: {
+        ZSTD_inBuffer ib = { in, in_avail, 0 };
+        ZSTD_outBuffer ob = { out, avail, 0 };
+        size_t ret = ZSTD_decompressStream(z->u.zstd, &ob, &ib);
+        if (ZSTD_isError(ret)) {
+            return false;
+        }
+        *produced = ob.pos;
+        z->in_pos += ib.pos;
+        // 0 once a frame is completely decoded and flushed
+        z->at_end = ret == 0;
+        return true;
+    }
+#endif
+    default:
+        // only unused when no decompressor is built in
+        (void) in;
+        (void) in_avail;
+        (void) out;
+        (void) avail;
+        (void) produced;
+        __builtin_unreachable();  // GCOVR_EXCL_LINE
+    }
+}
+
+static bool read_in(struct sl_zstream *z)
+{
+    for (;;) {
+        ssize_t n = pread(z->fd, z->in, z->in_want, (off_t)z->in_off);
+        // GCOVR_EXCL_START: unlikely to happen except in cases like media error
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // GCOVR_EXCL_STOP
+
+        sl_stats_add(SL_STAT_BYTES_READ, (uint64_t)n);
+        z->in_want = MIN(z->in_want * 2, IN_SIZE);
+        z->in_pos = 0;
+        z->in_len = (size_t)n;
+        z->in_off += (uint64_t)n;
+        z->in_eof = n == 0;
+        return true;
+    }
+}
+
+// Decompresses at least one more byte into the window. Returns false with
+// errno set to ENODATA if there's none, as the stream ends or is cut short,
+// to EBADMSG if it's corrupt, or to whatever made reading the file fail.
+static bool fill(struct sl_zstream *z)
+{
+    if (z->win_len == WINDOW_SIZE) {
+        memmove(z->win, z->win + WINDOW_SIZE - WINDOW_KEEP, WINDOW_KEEP);
+        z->win_len = WINDOW_KEEP;
+    }
+
+    for (;;) {
+        if (z->in_pos == z->in_len && !z->in_eof && !read_in(z)) {
+            return false;  // GCOVR_EXCL_LINE: media error
+        }
+        bool no_input = z->in_pos == z->in_len;
+        if (no_input && z->in_eof && z->at_end) {
+            // read past the end
+            errno = ENODATA;
+            return false;
+        }
+
+        size_t in_pos = z->in_pos;
+        size_t produced = 0;
+        size_t avail = MIN(WINDOW_SIZE - z->win_len, FILL_SIZE);
+        if (!decoder_step(z, z->win + z->win_len, avail, &produced)) {
+            errno = EBADMSG;
+            return false;
+        }
+
+        if (produced) {
+            sl_stats_add(SL_STAT_BYTES_DECOMPRESSED, produced);
+            z->win_len += produced;
+            z->pos += produced;
+            return true;
+        }
+
+        if (z->in_pos == in_pos && (!no_input || z->in_eof) && !z->at_end) {
+            // cut short, or stuck on corrupt data
+            errno = z->in_eof ? ENODATA : EBADMSG;
+            return false;
+        }
+    }
+}
+
+// gets back to the beginning of the file
+static void rewind_stream(struct sl_zstream *z)
+{
+    decoder_fini(z);
+    decoder_init(z);
+    z->in_pos = 0;
+    z->in_len = 0;
+    z->in_off = 0;
+    z->in_want = IN_SIZE_FIRST;
+    z->in_eof = false;
+    z->win_len = 0;
+    z->pos = 0;
+}
+
+// Starts decompressing the file behind fd, with the given compression as
+// detected; moves fd.
+struct sl_zstream *sl_zstream_open(enum sl_compression c, int fd)
+{
+    struct sl_zstream *z = calloc(1, sizeof(*z));
+    // GCOVR_EXCL_START: OOM
+    if (!z) {
+        err(EX_OSERR, _("cannot allocate decompression buffers"));
+    }
+    // GCOVR_EXCL_STOP
+    z->in = malloc(IN_SIZE);
+    z->win = malloc(WINDOW_SIZE);
+    // GCOVR_EXCL_START: OOM
+    if (!z->in || !z->win) {
+        err(EX_OSERR, _("cannot allocate decompression buffers"));
+    }
+    // GCOVR_EXCL_STOP
+
+    z->kind = c;
+    z->fd = fd;
+    z->in_want = IN_SIZE_FIRST;
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    decoder_init(z);
+
+    return z;
+}
+
+void sl_zstream_close(struct sl_zstream *z)
+{
+    decoder_fini(z);
+    (void) close(z->fd);
+    free(z->in);
+    free(z->win);
+    free(z);
+}
+
+// Copies len bytes at off in the decompressed file to out, decompressing
+// only as far as needed. Returns false with errno set if they're not all
+// there, or cannot be read or decompressed, as for fill.
+bool sl_zstream_pread(struct sl_zstream *z, void *out, size_t len, uint64_t off)
+{
+    uint8_t *p = out;
+    while (len > 0) {
+        uint64_t start = z->pos - z->win_len;
+        if (off < start) {
+            rewind_stream(z);
+            continue;
+        }
+
+        if (off < z->pos) {
+            size_t n = (size_t)MIN((uint64_t)len, z->pos - off);
+            memcpy(p, z->win + (off - start), n);
+            p += n;
+            len -= n;
+            off += n;
+            continue;
+        }
+
+        if (off - z->pos >= WINDOW_SIZE) {
+            // skipping so far ahead that nothing in the window would be kept
+            z->win_len = 0;
+        }
+        if (!fill(z)) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef _shengloong_zstream_h
+#define _shengloong_zstream_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// compression formats of whole files; only those built in are ever detected
+enum sl_compression {
+    SL_COMPRESSION_NONE,
+    SL_COMPRESSION_GZIP,
+    SL_COMPRESSION_XZ,
+    SL_COMPRESSION_ZSTD,
+};
+
+// A compressed file, decompressed front to back only as far as it's read,
+// into a window of bounded size. Reads within the window or ahead of it are
+// cheap; reads behind it start decompressing over from the beginning.
+struct sl_zstream;
+
+enum sl_compression sl_compression_detect(const void *head, size_t len);
+struct sl_zstream *sl_zstream_open(enum sl_compression c, int fd);
+void sl_zstream_close(struct sl_zstream *z);
+bool sl_zstream_pread(struct sl_zstream *z, void *out, size_t len, uint64_t off);
+
+#endif  // _shengloong_zstream_h
@@ -26,4 +26,7 @@ info 'calling with no positional args -- should bail'
 info 'calling with unknown parameter -- should bail'
 "$sl_prog" --foo bar /dev > /dev/null 2>&1 && dief 'should fail'
 
+info 'calling with unknown output format -- should bail'
+"$sl_prog" -F xml /dev > /dev/null 2>&1 && dief 'should fail'
+
 info 'all passed!'
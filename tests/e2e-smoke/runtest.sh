@@ -25,12 +25,19 @@ sysroot_new="$mydir/sysroot-$new_symver"
 
 workdir_old="$(mktemp -d)"
 workdir_new="$(mktemp -d)"
+indexdir="$(mktemp -d)"
+dedupdir="$(mktemp -d)"
+combineddir="$(mktemp -d)"
+replacedir="$(mktemp -d)"
+compresseddir="$(mktemp -d)"
+watchdir="$(mktemp -d)"
+jsonldir="$(mktemp -d)"
 
 dbgf 'workdir_old = %s' "$workdir_old"
 dbgf 'workdir_new = %s' "$workdir_new"
 
 cleanup() {
-  dbgrun rm -rf "$workdir_old" "$workdir_new" || true
+  dbgrun rm -rf "$workdir_old" "$workdir_new" "$indexdir" "$dedupdir" "$combineddir" "$replacedir" "$compresseddir" "$watchdir" "$jsonldir" || true
 }
 
 trap cleanup EXIT
@@ -156,4 +163,171 @@ echo "$stdout" | grep 'lib64/ld-linux-loongarch-lp64d\.so\.1: usage of removed s
 
 echo
 
+info 'same findings with multiple workers'
+stdout_mt="$("$sl_prog" -j 4 -a "$workdir_new")"
+[[ $? -ne 0 ]] && dief 'shengloong -j 4 -a failed'
+[[ "$(echo "$stdout" | sort)" == "$(echo "$stdout_mt" | sort)" ]] || dief 'findings differ with multiple workers'
+
+echo
+
+info 'same findings, in the same order, without reading ahead'
+stdout_pf="$("$sl_prog" --prefetch=0 -a "$workdir_new")"
+[[ $? -ne 0 ]] && dief 'shengloong --prefetch=0 -a failed'
+[[ "$stdout" == "$stdout_pf" ]] || dief 'findings differ without reading ahead'
+
+echo
+
+info 'same findings when only reading the parts looked at'
+stdout_lm="$("$sl_prog" -l -a "$workdir_new")"
+[[ $? -ne 0 ]] && dief 'shengloong -l -a failed'
+[[ "$stdout" == "$stdout_lm" ]] || dief 'findings differ when only reading the parts looked at'
+
+echo
+
+info 'same findings with statistics printed'
+stdout_st="$("$sl_prog" --stats-json -a "$workdir_new" 2> /dev/null)"
+[[ $? -ne 0 ]] && dief 'shengloong --stats-json -a failed'
+[[ "$stdout" == "$stdout_st" ]] || dief 'findings differ with statistics printed'
+stats="$("$sl_prog" --stats-json -a "$workdir_new" 2>&1 > /dev/null)"
+[[ "$stats" == *'"files_processed":'[1-9]* ]] || dief 'no statistics printed'
+
+echo
+
+info 'same findings as JSON Lines, one record each'
+stdout_jsonl="$("$sl_prog" -F jsonl -j 4 -a "$workdir_new")"
+[[ $? -ne 0 ]] && dief 'shengloong -F jsonl -a failed'
+[[ "$(echo "$stdout" | grep -c 'usage of removed syscall')" -eq "$(echo "$stdout_jsonl" | grep -c '"kind":"removed_syscall"')" ]] \
+  || dief 'findings differ as JSON Lines'
+echo "$stdout_jsonl" | grep -qv '^{"path":' && dief 'not only records written'
+
+info 'paths that are not UTF-8 still as valid JSON, with their exact bytes'
+cp "$workdir_new/lib64/libc.so.6" "$jsonldir/libc-"$'\xff'".so.6" || dief 'cp failed'
+stdout_jsonl="$("$sl_prog" -F jsonl -a "$jsonldir")"
+[[ $? -ne 0 ]] && dief 'shengloong -F jsonl -a failed'
+echo "$stdout_jsonl" | grep -q '^{"path":"[^"]*/libc-\\ufffd\.so\.6","path_hex":"[0-9a-f]*6c6962632dff2e736f2e36",' \
+  || dief 'expected the path with U+FFFD in place of the bad byte, and as hex'
+
+echo
+
+info 'same findings when replayed from the index'
+"$sl_prog" -i "$indexdir" -a "$workdir_new" > /dev/null || dief 'shengloong -i -a failed'
+stdout_idx="$("$sl_prog" -i "$indexdir" -a "$workdir_new")"
+[[ $? -ne 0 ]] && dief 'shengloong -i -a failed'
+[[ "$stdout" == "$stdout_idx" ]] || dief 'findings differ when replayed from the index'
+
+echo
+
+info 'only the listed syscalls called out, even with the index'
+printf '# nr name\n80 fstat\n' > "$indexdir/removed-syscalls"
+stdout_rs="$("$sl_prog" -i "$indexdir" -R "$indexdir/removed-syscalls" -a "$workdir_new")"
+[[ $? -ne 0 ]] && dief 'shengloong -R -a failed'
+echo "$stdout_rs" | grep -q newfstatat && dief 'expected newfstatat not to be called out'
+printf '80\n' > "$indexdir/removed-syscalls"
+"$sl_prog" -R "$indexdir/removed-syscalls" -a "$workdir_new" && dief 'expected shengloong -R to fail on a bad list'
+
+echo
+
+info 'findings shown for every path of shared files'
+ln "$workdir_new/lib64/libc.so.6" "$dedupdir/libc-link.so.6" || dief 'ln failed'
+cp "$workdir_new/lib64/libc.so.6" "$dedupdir/libc-copy.so.6" || dief 'cp failed'
+stdout_dd="$("$sl_prog" -c -a "$workdir_new" "$dedupdir")"
+[[ $? -ne 0 ]] && dief 'shengloong -c -a failed'
+for f in lib64/libc.so.6 libc-link.so.6 libc-copy.so.6; do
+  echo "$stdout_dd" | grep "${f//./\\.}: usage of removed syscall \`newfstatat\` at \.text+0xb37f8$" || dief "expected to see $f being called out"
+done
+
+echo
+
+# SL_DECOMPRESSORS lists the file extensions of the compression formats
+# built in
+for ext in ${SL_DECOMPRESSORS-}; do
+  info "checking a $ext-compressed libc without unpacking it"
+  case "$ext" in
+  gz) gzip -c "$workdir_new/lib64/libc.so.6" > "$compresseddir/libc.so.6.$ext" ;;
+  xz) xz -c "$workdir_new/lib64/libc.so.6" > "$compresseddir/libc.so.6.$ext" ;;
+  zst) zstd -q -c "$workdir_new/lib64/libc.so.6" > "$compresseddir/libc.so.6.$ext" ;;
+  esac
+  [[ $? -ne 0 ]] && dief "compressing to $ext failed"
+  stdout_z="$("$sl_prog" -a "$compresseddir")"
+  [[ $? -ne 0 ]] && dief 'shengloong -a failed'
+  echo "$stdout_z" | grep "libc\.so\.6\.$ext: usage of removed syscall \`newfstatat\` at \.text+0xb37f8$" || dief 'expected to see .text+0xb37f8 being called out'
+
+  info "checking a $ext-compressed libc cut short, or corrupt"
+  mkdir -p "$compresseddir/bad" || dief 'mkdir failed'
+  head -c 200000 "$compresseddir/libc.so.6.$ext" > "$compresseddir/bad/cut.$ext" || dief 'head failed'
+  { head -c 200000 "$compresseddir/libc.so.6.$ext"; head -c 100000 /dev/zero; } > "$compresseddir/bad/corrupt.$ext" || dief 'head failed'
+  stderr_z="$("$sl_prog" -a "$compresseddir/bad" 2>&1 > /dev/null)" || dief 'should pass, as malformed files are skipped'
+  [[ -z "$stderr_z" ]] || dief 'malformed files are not worth a mention'
+done
+
+echo
+
+info 'only the listed files looked at'
+stdout_ff="$(printf '/lib64/ld-linux-loongarch-lp64d.so.1\0' | "$sl_prog" -a -T - "$workdir_new")"
+[[ $? -ne 0 ]] && dief 'shengloong -a -T failed'
+echo "$stdout_ff" | grep 'lib64/ld-linux-loongarch-lp64d\.so\.1: usage of removed syscall `newfstatat` at \.text+0x1bb64$' || dief 'expected to see .text+0x1bb64 being called out'
+echo "$stdout_ff" | grep 'libc\.so\.6' && dief 'expected libc.so.6 to be left alone'
+
+echo
+
+info 'files looked at as they get moved into place while watching'
+mkdir "$watchdir/root" || dief 'mkdir failed'
+"$sl_prog" -a -W "$watchdir/root" > "$watchdir/out" &
+watch_pid=$!
+sleep 1
+cp "$workdir_new/lib64/libc.so.6" "$watchdir/libc.tmp" || dief 'cp failed'
+mv "$watchdir/libc.tmp" "$watchdir/root/libc.so.6" || dief 'mv failed'
+for i in $(seq 50); do
+  grep -q 'root/libc\.so\.6: usage of removed syscall' "$watchdir/out" && break
+  sleep 0.2
+done
+kill -INT "$watch_pid"
+wait "$watch_pid" || dief 'shengloong -W failed'
+grep 'root/libc\.so\.6: usage of removed syscall `newfstatat` at \.text+0xb37f8$' "$watchdir/out" || dief 'expected to see .text+0xb37f8 being called out'
+
+info 'files moved into place long after they were written, while watching'
+"$sl_prog" -a -W "$watchdir/root" > "$watchdir/out" &
+watch_pid=$!
+sleep 1
+mkdir "$watchdir/image" || dief 'mkdir failed'
+cp "$workdir_new/lib64/libc.so.6" "$watchdir/image/libc.so.6" || dief 'cp failed'
+sleep 1.5
+mv "$watchdir/image/libc.so.6" "$watchdir/root/libc-moved.so.6" || dief 'mv failed'
+for i in $(seq 50); do
+  grep -q 'root/libc-moved\.so\.6: usage of removed syscall' "$watchdir/out" && break
+  sleep 0.2
+done
+kill -INT "$watch_pid"
+wait "$watch_pid" || dief 'shengloong -W failed'
+grep 'root/libc-moved\.so\.6: usage of removed syscall `newfstatat` at \.text+0xb37f8$' "$watchdir/out" || dief 'expected to see .text+0xb37f8 being called out'
+
+echo
+
+info 'checks and patching in a single pass'
+cp -r "$sysroot_old"/* "$combineddir" || dief 'cp failed'
+stdout_all="$("$sl_prog" -f "GLIBC_$old_symver" -t "GLIBC_$new_symver" -A "$combineddir")"
+[[ $? -ne 0 ]] && dief 'shengloong -A failed'
+echo "$stdout_all" | grep 'lib64/libc\.so\.6: usage of removed syscall `newfstatat` at \.text+0xb4c58$' || dief 'expected to see .text+0xb4c58 being called out'
+echo "$stdout_all" | grep 'lib64/libc\.so\.6: file uses obsolete object file ABI' || dief 'expected to see the object file ABI being called out'
+echo "$stdout_all" | grep '2 files were patched' || dief 'expected to see the patch summary'
+assert_sha256sum 55a4118c07340126be958cc9f5e24d5f1a7966590b6a2d0e315166c4e326ddc6 "$combineddir/lib64/ld-linux-loongarch-lp64d.so.1"
+assert_sha256sum baa94e1bdd823404cb6b4ba23c356c262f70f0288df3060c9fc4771c8c337e05 "$combineddir/lib64/libc.so.6"
+
+echo
+
+info 'patched copies replace the originals'
+cp -r "$sysroot_old"/* "$replacedir" || dief 'cp failed'
+chmod 4711 "$replacedir/lib64/libc.so.6" || dief 'chmod failed'
+ino_before="$(stat -c %i "$replacedir/lib64/libc.so.6")"
+# a hard link under another name must not keep ld.so from being fully patched
+ln "$replacedir/lib64/ld-linux-loongarch-lp64d.so.1" "$replacedir/ldso-link" || dief 'ln failed'
+"$sl_prog" -f "GLIBC_$old_symver" -t "GLIBC_$new_symver" -r "$replacedir" || dief 'shengloong -r failed'
+assert_sha256sum 55a4118c07340126be958cc9f5e24d5f1a7966590b6a2d0e315166c4e326ddc6 "$replacedir/lib64/ld-linux-loongarch-lp64d.so.1"
+assert_sha256sum baa94e1bdd823404cb6b4ba23c356c262f70f0288df3060c9fc4771c8c337e05 "$replacedir/lib64/libc.so.6"
+[[ "$(stat -c %i "$replacedir/lib64/libc.so.6")" != "$ino_before" ]] || dief 'expected libc.so.6 to be replaced'
+[[ "$(stat -c %a "$replacedir/lib64/libc.so.6")" == 4711 ]] || dief 'expected the mode of libc.so.6 to be kept'
+[[ -z "$(find "$replacedir" -name '.shengloong-*')" ]] || dief 'temporary files left behind'
+
+echo
+
 info 'all passed!'
@@ -37,9 +37,48 @@ echo "retcode = $?; passes on some systems while failing on others, that's fine"
 info 'dry-running on /sys for unreadable and special files'
 "$sl_prog" -p /sys && dief 'should fail due to unreadable files'
 
+info 'checking a process in /proc, whose empty-looking files must not be read'
+"$sl_prog" -o "/proc/$$/" > /dev/null || dief 'should pass'
+
 info "real-running on $workdir"
 "$sl_prog" "$workdir" || dief 'should pass'
 
+info "checking object file ABI in $workdir, archive members included"
+out="$("$sl_prog" -o "$workdir")" || dief 'should pass'
+grep -qF "$workdir/libm.a(s_matherr.o): file uses obsolete object file ABI" <<< "$out" \
+  || dief 'members of libm.a should be named'
+
+info "checking $workdir with rules leaving out some of the files"
+out="$("$sl_prog" -o --include libm.a --exclude '*.a' "$workdir")" || dief 'should pass'
+grep -qF "$workdir/libm.a(s_matherr.o): file uses obsolete object file ABI" <<< "$out" \
+  || dief 'libm.a should be included, as the first rule matching it says so'
+out="$("$sl_prog" -o --exclude '*.a' --include libm.a "$workdir")" || dief 'should pass'
+grep -qF "$workdir/libm.a(" <<< "$out" && dief 'libm.a should be excluded, as the first rule matching it says so'
+
+# enough files with findings that the order they're found in is unlikely to
+# be that of their inodes
+orderdir="$workdir/order"
+mkdir "$orderdir" || dief 'mkdir failed'
+for i in $(seq 16); do
+  cp "$workdir/libm.a" "$orderdir/libm-$i.a" || dief 'cp failed'
+done
+
+info "checking $orderdir with the files opened in the order they're on disk"
+# -o alone only needs the ELF headers, which are probed in batches if
+# io_uring is there; with -a too, the files are opened one by one
+for checks in -o -oa; do
+  for format in text jsonl; do
+    want="$("$sl_prog" $checks -F $format --io-order=walk "$orderdir")" || dief 'should pass'
+    for order in inode extent; do
+      for jobs in 1 4; do
+        out="$("$sl_prog" $checks -F $format -j $jobs --io-order=$order "$orderdir")" || dief 'should pass'
+        [[ "$out" == "$want" ]] \
+          || dief "files opened in $order order with $jobs jobs should still be reported in walk order ($checks, $format)"
+      done
+    done
+  done
+done
+
 info 'checksumming; nothing should change'
 assert_sha256sum e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855 "$workdir/empty.bin"
 assert_sha256sum 3f2edf04e53a79b41a55ebd118476c78187a08ea5367085075293dd39bc74093 "$workdir/libm.a"
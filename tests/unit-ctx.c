@@ -0,0 +1,137 @@
+// Checks that recorded changes are only written if every byte to change is
+// still what it was when the file was looked at.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "ctx.h"
+
+#define FILE_SIZE 64
+
+static struct sl_cfg cfg;
+static char path[] = "unit-ctx";
+
+// .dynstr-like contents, with two strings to change
+static const char contents[FILE_SIZE] = "\0libc.so.6\0GLIBC_2.35\0GLIBC_PRIVATE\0GLIBC_2.35";
+#define OFF1 11
+#define OFF2 37
+
+// Writes contents to a new unlinked file and records both changes, as they
+// would be when the file was scanned.
+static int setup(struct sl_elf_ctx *ctx, struct sl_elf64_scn *s, char *data)
+{
+    char tmpl[] = "/tmp/unit-ctx-XXXXXX";
+    int fd = mkstemp(tmpl);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    (void) unlink(tmpl);
+
+    if (pwrite(fd, contents, FILE_SIZE, 0) != FILE_SIZE) {
+        perror("pwrite");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->cfg = &cfg;
+    // no file to make the path from
+    ctx->path = path;
+
+    memcpy(data, contents, FILE_SIZE);
+    memset(s, 0, sizeof(*s));
+    s->name = ".dynstr";
+    s->data = (uint8_t *)data;
+    s->size = FILE_SIZE;
+
+    sl_elf_patch(ctx, s, data + OFF1, "GLIBC_2.36", 10);
+    sl_elf_patch(ctx, s, data + OFF2, "GLIBC_2.36", 10);
+
+    return fd;
+}
+
+static bool has_contents(int fd, const char *want)
+{
+    char got[FILE_SIZE];
+    return pread(fd, got, FILE_SIZE, 0) == FILE_SIZE && !memcmp(got, want, FILE_SIZE);
+}
+
+static void fini(struct sl_elf_ctx *ctx)
+{
+    free(ctx->patches);
+}
+
+int main(void)
+{
+    int failures = 0;
+    struct sl_elf_ctx ctx;
+    struct sl_elf64_scn s;
+    char data[FILE_SIZE];
+
+    // unchanged since looked at: both strings are changed
+    int fd = setup(&ctx, &s, data);
+    char want[FILE_SIZE];
+    memcpy(want, contents, FILE_SIZE);
+    memcpy(want + OFF1, "GLIBC_2.36", 10);
+    memcpy(want + OFF2, "GLIBC_2.36", 10);
+    int ret = sl_elf_apply_patches(&ctx, fd);
+    if (ret != 0 || !has_contents(fd, want)) {
+        printf("FAIL unchanged file: returned %d, or contents not patched\n", ret);
+        failures++;
+    }
+    (void) close(fd);
+    fini(&ctx);
+
+    // one byte of the second string changed in between: nothing is written,
+    // not even the first string, which is still as it was
+    fd = setup(&ctx, &s, data);
+    memcpy(want, contents, FILE_SIZE);
+    want[OFF2 + 9] = '6';
+    if (pwrite(fd, &want[OFF2 + 9], 1, OFF2 + 9) != 1) {
+        perror("pwrite");
+        return EXIT_FAILURE;
+    }
+
+    // the failure is reported on stderr
+    FILE *err_out = tmpfile();
+    int saved_stderr = dup(STDERR_FILENO);
+    if (!err_out || saved_stderr < 0) {
+        perror("tmpfile");
+        return EXIT_FAILURE;
+    }
+    fflush(stderr);
+    (void) dup2(fileno(err_out), STDERR_FILENO);
+    ret = sl_elf_apply_patches(&ctx, fd);
+    fflush(stderr);
+    (void) dup2(saved_stderr, STDERR_FILENO);
+    (void) close(saved_stderr);
+
+    char msg[256] = { 0 };
+    rewind(err_out);
+    (void) fread(msg, 1, sizeof(msg) - 1, err_out);
+    (void) fclose(err_out);
+
+    if (ret != EX_TEMPFAIL) {
+        printf("FAIL changed file: returned %d; want %d\n", ret, EX_TEMPFAIL);
+        failures++;
+    }
+    if (!has_contents(fd, want)) {
+        printf("FAIL changed file: written to anyway\n");
+        failures++;
+    }
+    if (!strstr(msg, "unit-ctx: changed while being looked at")) {
+        printf("FAIL changed file: not reported, got \"%s\"\n", msg);
+        failures++;
+    }
+    (void) close(fd);
+    fini(&ctx);
+
+    if (!failures) {
+        printf("ok\n");
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
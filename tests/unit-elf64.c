@@ -0,0 +1,344 @@
+// Checks the ELF reader against broken copies of a small, well-formed file,
+// both in memory and read through a reader.
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf64.h"
+
+// the ELF header, the section names, .text, then the section headers for
+// the null section, .shstrtab and .text
+#define SHSTRTAB_OFF 64
+#define TEXT_OFF 96
+#define TEXT_SIZE 16
+#define SHOFF 128
+#define SHNUM 3
+#define IMG_SIZE (SHOFF + SHNUM * sizeof(Elf64_Shdr))
+
+static const char shstrtab[] = "\0.shstrtab\0.text";
+
+static uint8_t img[IMG_SIZE] __attribute__((aligned(__alignof__(Elf64_Shdr))));
+
+static Elf64_Ehdr *ehdr(void)
+{
+    return (Elf64_Ehdr *)img;
+}
+
+static Elf64_Shdr *shdr(size_t idx)
+{
+    return (Elf64_Shdr *)(img + SHOFF) + idx;
+}
+
+static void build(void)
+{
+    memset(img, 0, sizeof(img));
+
+    Elf64_Ehdr *eh = ehdr();
+    memcpy(eh->e_ident, ELFMAG, SELFMAG);
+    eh->e_ident[EI_CLASS] = ELFCLASS64;
+    eh->e_ident[EI_DATA] = ELFDATA2LSB;
+    eh->e_ident[EI_VERSION] = EV_CURRENT;
+    eh->e_type = htole16(ET_DYN);
+    eh->e_version = htole32(EV_CURRENT);
+    eh->e_ehsize = htole16(sizeof(Elf64_Ehdr));
+    eh->e_shoff = htole64(SHOFF);
+    eh->e_shentsize = htole16(sizeof(Elf64_Shdr));
+    eh->e_shnum = htole16(SHNUM);
+    eh->e_shstrndx = htole16(1);
+
+    memcpy(img + SHSTRTAB_OFF, shstrtab, sizeof(shstrtab));
+    memset(img + TEXT_OFF, 0xcc, TEXT_SIZE);
+
+    shdr(1)->sh_name = htole32(1);
+    shdr(1)->sh_type = htole32(SHT_STRTAB);
+    shdr(1)->sh_offset = htole64(SHSTRTAB_OFF);
+    shdr(1)->sh_size = htole64(sizeof(shstrtab));
+
+    shdr(2)->sh_name = htole32(11);
+    shdr(2)->sh_type = htole32(SHT_PROGBITS);
+    shdr(2)->sh_offset = htole64(TEXT_OFF);
+    shdr(2)->sh_size = htole64(TEXT_SIZE);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void intact(size_t *size)
+{
+    (void) size;
+}
+
+static void cut_in_ehdr(size_t *size)
+{
+    *size = sizeof(Elf64_Ehdr) - 1;
+}
+
+static void not_elf64_lsb(size_t *size)
+{
+    (void) size;
+    ehdr()->e_ident[EI_DATA] = ELFDATA2MSB;
+}
+
+static void cut_in_shdrs(size_t *size)
+{
+    *size = SHOFF + 2 * sizeof(Elf64_Shdr) + 8;
+}
+
+static void cut_in_shdr0(size_t *size)
+{
+    *size = SHOFF + 8;
+}
+
+static void bad_shentsize(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shentsize = htole16(sizeof(Elf64_Shdr) / 2);
+}
+
+static void shoff_past_end(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shoff = htole64(IMG_SIZE);
+}
+
+static void shoff_wrapping(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shoff = htole64(UINT64_MAX - sizeof(Elf64_Shdr) + 2);
+}
+
+static void shnum_too_large(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shnum = htole16(SHNUM + 1);
+}
+
+static void shnum_in_shdr0(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shnum = htole16(0);
+    shdr(0)->sh_size = htole64(SHNUM);
+}
+
+static void shnum_in_shdr0_huge(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shnum = htole16(0);
+    shdr(0)->sh_size = htole64(UINT64_MAX);
+}
+
+static void shnum_in_shdr0_wrapping(size_t *size)
+{
+    (void) size;
+    // times the entry size, this wraps around to exactly the table size
+    ehdr()->e_shnum = htole16(0);
+    shdr(0)->sh_size = htole64(((uint64_t)1 << 58) + SHNUM);
+}
+
+static void xindex(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shstrndx = htole16(SHN_XINDEX);
+    shdr(0)->sh_link = htole32(1);
+}
+
+static void xindex_undef(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shstrndx = htole16(SHN_XINDEX);
+}
+
+static void xindex_out_of_range(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shstrndx = htole16(SHN_XINDEX);
+    shdr(0)->sh_link = htole32(SHNUM);
+}
+
+static void shstrndx_undef(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shstrndx = htole16(SHN_UNDEF);
+}
+
+static void shstrndx_out_of_range(size_t *size)
+{
+    (void) size;
+    ehdr()->e_shstrndx = htole16(SHNUM);
+}
+
+static void unterminated_name(size_t *size)
+{
+    (void) size;
+    img[SHSTRTAB_OFF + sizeof(shstrtab) - 1] = 'x';
+}
+
+static void name_out_of_range(size_t *size)
+{
+    (void) size;
+    shdr(2)->sh_name = htole32(sizeof(shstrtab));
+}
+
+static void shstrtab_past_end(size_t *size)
+{
+    (void) size;
+    shdr(1)->sh_size = htole64(IMG_SIZE);
+}
+
+static void scn_wrapping(size_t *size)
+{
+    (void) size;
+    shdr(2)->sh_offset = htole64(UINT64_MAX - TEXT_SIZE + 2);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static bool names_are(const struct sl_elf64 *e, const char *name1, const char *name2)
+{
+    struct sl_elf64_scn s1, s2;
+    if (!sl_elf64_scn(e, 1, &s1) || !sl_elf64_scn(e, 2, &s2)) {
+        return false;
+    }
+
+    if (!name1 != !s1.name || (name1 && strcmp(name1, s1.name))) {
+        return false;
+    }
+    return !name2 == !s2.name && (!name2 || !strcmp(name2, s2.name));
+}
+
+static bool check_intact(const struct sl_elf64 *e)
+{
+    struct sl_elf64_scn text;
+    uint8_t b;
+    return e->shnum == SHNUM
+        && names_are(e, ".shstrtab", ".text")
+        && !sl_elf64_scn(e, SHNUM, &text)
+        && sl_elf64_scn(e, 2, &text)
+        && text.offset == TEXT_OFF
+        && text.size == TEXT_SIZE
+        && sl_elf64_copy(e, &text, TEXT_SIZE - 1, &b, 1)
+        && b == 0xcc
+        && !sl_elf64_copy(e, &text, TEXT_SIZE, &b, 1)
+        && !sl_elf64_copy(e, &text, 1, &b, SIZE_MAX)
+        && !sl_elf64_ptr(&text, SIZE_MAX, 2);
+}
+
+static bool check_no_text_name(const struct sl_elf64 *e)
+{
+    return names_are(e, ".shstrtab", NULL);
+}
+
+static bool check_no_names(const struct sl_elf64 *e)
+{
+    return names_are(e, NULL, NULL);
+}
+
+static bool check_text_empty(const struct sl_elf64 *e)
+{
+    struct sl_elf64_scn text;
+    return sl_elf64_scn(e, 2, &text) && !text.size && !text.data && !strcmp(text.name, ".text");
+}
+
+struct example {
+    const char *what;
+    void (*break_it)(size_t *size);
+    enum sl_elf64_status want;
+    // only if the file can be looked at
+    bool (*check)(const struct sl_elf64 *e);
+};
+
+static const struct example examples[] = {
+    { "intact", intact, SL_ELF64_OK, check_intact },
+    { "cut short in the ELF header", cut_in_ehdr, SL_ELF64_BAD_HEADER, NULL },
+    { "not ELF64 little-endian", not_elf64_lsb, SL_ELF64_BAD_HEADER, NULL },
+    { "cut short in the section headers", cut_in_shdrs, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "cut short in section header 0", cut_in_shdr0, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "e_shentsize wrong", bad_shentsize, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "e_shoff past the end", shoff_past_end, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "e_shoff wrapping around", shoff_wrapping, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "e_shnum too large", shnum_too_large, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "e_shnum in section header 0", shnum_in_shdr0, SL_ELF64_OK, check_intact },
+    { "e_shnum in section header 0 too large", shnum_in_shdr0_huge, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "e_shnum in section header 0 wrapping around", shnum_in_shdr0_wrapping, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "SHN_XINDEX", xindex, SL_ELF64_OK, check_intact },
+    { "SHN_XINDEX with SHN_UNDEF in section header 0", xindex_undef, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "SHN_XINDEX out of range in section header 0", xindex_out_of_range, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "e_shstrndx SHN_UNDEF", shstrndx_undef, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "e_shstrndx out of range", shstrndx_out_of_range, SL_ELF64_NO_SHSTRNDX, NULL },
+    { "section name unterminated", unterminated_name, SL_ELF64_OK, check_no_text_name },
+    { "section name out of range", name_out_of_range, SL_ELF64_OK, check_no_text_name },
+    { "section names past the end", shstrtab_past_end, SL_ELF64_OK, check_no_names },
+    { "section wrapping around", scn_wrapping, SL_ELF64_OK, check_text_empty },
+};
+
+// a file of the given size, of which only avail bytes are there
+struct mem_file {
+    size_t avail;
+};
+
+static bool mem_read(void *arg, void *out, size_t len, uint64_t off)
+{
+    const struct mem_file *m = arg;
+    if (off > m->avail || len > m->avail - off) {
+        errno = ENODATA;
+        return false;
+    }
+
+    memcpy(out, img + off, len);
+    return true;
+}
+
+static int check(const char *how, const struct example *ex, struct sl_elf64 *e, enum sl_elf64_status got)
+{
+    int failures = 0;
+
+    if (got != ex->want) {
+        printf("FAIL %s %s: status %d; want %d\n", ex->what, how, got, ex->want);
+        failures++;
+    } else if (got == SL_ELF64_OK && ex->check && !ex->check(e)) {
+        printf("FAIL %s %s: sections not as expected\n", ex->what, how);
+        failures++;
+    }
+
+    sl_elf64_fini(e);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    size_t i;
+    for (i = 0; i < sizeof(examples) / sizeof(examples[0]); i++) {
+        const struct example *ex = &examples[i];
+        struct sl_elf64 e;
+
+        build();
+        size_t size = IMG_SIZE;
+        ex->break_it(&size);
+        failures += check("in memory", ex, &e, sl_elf64_init(&e, img, size));
+
+        struct mem_file m = { size };
+        failures += check("through a reader", ex, &e, sl_elf64_open_reader(&e, mem_read, &m, size));
+    }
+
+    // the data running out before the size said is not the same as the size
+    // being too small for the headers
+    build();
+    struct mem_file m = { SHOFF + sizeof(Elf64_Shdr) };
+    struct sl_elf64 e;
+    enum sl_elf64_status got = sl_elf64_open_reader(&e, mem_read, &m, IMG_SIZE);
+    if (got != SL_ELF64_MALFORMED) {
+        printf("FAIL reader running out: status %d; want %d\n", got, SL_ELF64_MALFORMED);
+        failures++;
+    }
+    sl_elf64_fini(&e);
+
+    if (!failures) {
+        printf("ok\n");
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
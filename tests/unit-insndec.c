@@ -0,0 +1,79 @@
+// Checks the instruction decoder on hand-assembled encodings of the kinds of
+// insns the scanners have to get right.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "insndec.h"
+
+#define R(n) (1u << (n))
+
+struct example {
+    const char *asm_;
+    uint32_t insn;
+    uint32_t written;
+    bool jumps;
+};
+
+static const struct example examples[] = {
+    { "addi.d $a7, $zero, 79", 0x02c13c0b, R(11), false },
+    { "lu12i.w $t0, 0xbb8d6", 0x15771acc, R(12), false },
+    { "ori $t0, $t0, 0x105", 0x0384158c, R(12), false },
+    { "or $a7, $a0, $zero", 0x0015008b, R(11), false },
+    { "ld.d $a7, $sp, 0", 0x28c0006b, R(11), false },
+    { "st.d $a7, $sp, 8", 0x29c0206b, 0, false },
+    { "ldptr.d $a7, $sp, 0", 0x2600006b, R(11), false },
+    { "stptr.d $a7, $sp, 0", 0x2700006b, 0, false },
+    { "ldx.d $a7, $sp, $t0", 0x380c306b, R(11), false },
+    { "stx.d $a7, $sp, $t0", 0x381c306b, 0, false },
+    { "preld 11, $a7, 0", 0x2ac0016b, 0, false },
+    { "fld.d $f11, $sp, 0", 0x2b80006b, 0, false },
+    { "amswap.w $a7, $t0, $sp", 0x3860306b, R(11), false },
+    { "sc.w $a7, $sp, 0", 0x2100006b, R(11), false },
+    { "dbar 11", 0x3872000b, 0, false },
+    { "syscall 11", 0x002b000b, 0, false },
+    { "rdtime.d $a0, $a1", 0x000068a4, R(4) | R(5), false },
+    { "fadd.d $f11, $f0, $f1", 0x0101040b, 0, false },
+    { "movfr2gr.d $a7, $f0", 0x0114b80b, R(11), false },
+    { "vadd.w $vr11, $vr0, $vr1", 0x700b040b, 0, false },
+    { "vpickve2gr.w $a7, $vr0, 1", 0x72efe40b, R(11), false },
+    { "beq $a0, $a7, 0", 0x5800008b, 0, false },
+    { "bnez $a7, 0", 0x44000160, 0, false },
+    { "b 0", 0x50000000, 0, true },
+    { "bl 0", 0x54000000, R(1), true },
+    { "jirl $ra, $t0, 0", 0x4c000181, R(1), true },
+    { "jr $ra", 0x4c000020, 0, true },
+    { "addi.w $zero, $zero, 0", 0x02800000, 0, false },
+    { "(reserved)", 0xffffffff, R(31), false },
+};
+
+int main(void)
+{
+    int failures = 0;
+
+    size_t i;
+    for (i = 0; i < sizeof(examples) / sizeof(examples[0]); i++) {
+        const struct example *e = &examples[i];
+        unsigned int flags = sl_insn_decode(e->insn);
+        uint32_t written = sl_insn_gprs_written(e->insn, flags);
+        bool jumps = !!(flags & SL_INSN_JUMPS);
+
+        if (written != e->written || jumps != e->jumps) {
+            printf(
+                "FAIL %s (%08x): writes %08x, jumps %d; want %08x, %d\n",
+                e->asm_,
+                e->insn,
+                written,
+                jumps,
+                e->written,
+                e->jumps
+            );
+            failures++;
+        }
+    }
+
+    if (!failures) {
+        printf("ok\n");
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
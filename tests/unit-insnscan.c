@@ -0,0 +1,123 @@
+// Checks every instruction scanning variant built in and supported by the
+// running CPU against a plain loop, on random words with planted matches.
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "insnscan.h"
+
+#define MAX_WORDS 300
+
+static uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+static size_t reference(const uint32_t *insns, size_t n, uint32_t mask, uint32_t match)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if ((le32toh(insns[i]) & mask) == match) {
+            return i;
+        }
+    }
+    return n;
+}
+
+struct pattern {
+    const char *name;
+    uint32_t mask;
+    uint32_t match;
+};
+
+static const struct pattern patterns[] = {
+    // syscall <code>
+    { "syscall", 0xffff7000, 0x002b0000 },
+    // lu12i.w <reg>, hi20 of the old ELF hash
+    { "lu12i.w", 0xffffffe0, 0x14000000 | ((0x0bb8d6 & 0xfffff) << 5) },
+};
+
+static uint32_t plant(const struct pattern *pat)
+{
+    return htole32(pat->match | (rng() & ~pat->mask));
+}
+
+int main(void)
+{
+    // one extra word to also test unaligned starts
+    static uint32_t buf[MAX_WORDS + 1];
+    int failures = 0;
+    int nr_impls = 0;
+
+    const struct sl_insnscan_impl *impl;
+    for (impl = sl_insnscan_impls; impl->name; impl++) {
+        if (!impl->supported()) {
+            printf("skip %s: not supported by this CPU\n", impl->name);
+            continue;
+        }
+        nr_impls++;
+
+        size_t p;
+        for (p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+            const struct pattern *pat = &patterns[p];
+            uint32_t mask = htole32(pat->mask);
+            uint32_t match = htole32(pat->match);
+
+            size_t n;
+            for (n = 0; n <= MAX_WORDS; n++) {
+                int round;
+                for (round = 0; round < 8; round++) {
+                    uint32_t *insns = buf + (round & 1);
+                    size_t i;
+                    for (i = 0; i < n; i++) {
+                        insns[i] = rng();
+                    }
+
+                    // none, one, or a few planted hits
+                    int hits = n ? round / 2 : 0;
+                    while (hits-- > 0) {
+                        insns[rng() % n] = plant(pat);
+                    }
+
+                    // keep scanning past each hit, like the callers do
+                    size_t pos = 0;
+                    for (;;) {
+                        size_t want = pos + reference(insns + pos, n - pos, pat->mask, pat->match);
+                        size_t got = pos + impl->find(insns + pos, n - pos, mask, match);
+                        if (got != want) {
+                            printf("FAIL %s %s: n=%zu from %zu: got %zu, want %zu\n", impl->name, pat->name, n, pos, got, want);
+                            failures++;
+                            break;
+                        }
+                        if (want == n) {
+                            break;
+                        }
+                        pos = want + 1;
+                    }
+                }
+            }
+        }
+
+        printf("ok %s\n", impl->name);
+    }
+
+    // and the dispatcher, which takes host order
+    buf[0] = rng();
+    buf[1] = plant(&patterns[0]);
+    if (sl_insn_find(buf, 2, patterns[0].mask, patterns[0].match) != reference(buf, 2, patterns[0].mask, patterns[0].match)) {
+        printf("FAIL sl_insn_find\n");
+        failures++;
+    }
+
+    if (nr_impls == 0) {
+        printf("FAIL no variant supported\n");
+        failures++;
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}